@@ -0,0 +1,347 @@
+/*      *** astdetect.cpp ***
+
+------------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+---------------------- NO WARRANTY ------------------
+THIS PROGRAM IS PROVIDED AS-IS WITH ABSOLUTELY NO WARRANTY
+OR GUARANTEE OF ANY KIND, EITHER EXPRESSED OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE
+FOR DAMAGES RESULTING FROM THE USE OR INABILITY TO USE THIS
+PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU OR
+THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH
+ANY OTHER PROGRAM).
+
+------------------------------------------------------------------------
+
+  apply a new set of detectors to the 4D-STEM data saved by
+  autostem (-4d file) without repeating the multislice calculation
+
+  the detectors are the same as in autostem (ADF, segmented ADF and
+  COM with COMx, COMy and in 2D COMi, COMd from postImage()) plus
+  the total intensity in the saved pattern (confocal needs the
+  wave function, not the intensity, so it cannot be done here)
+
+  each detector is applied to the pattern pixels with the same
+  limits as autostem (>= min and < max, atan2() for phi) so
+  an unbinned file (-4dbin 1) gives the same signals as autostem
+  (within single precision) - a binned file uses the center of
+  each binned pixel so the detector edges are only as good as the
+  binned pixel size
+
+  the file is memory mapped and only read once for all detectors
+  (positions in parallel) so it can be much bigger than memory
+
+  this file is formatted for a tab size of 4 characters
+
+  started 16-oct-2026
+  write the output files with autostem::writeImages() etc. as autostem
+     and astmerge 16-oct-2026
+*/
+
+#include <cstdio>  /* ANSI C libraries used */
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+
+#include <string>
+#include <iostream>  //  C++ stream IO
+#include <fstream>
+#include <iomanip>   //  to format the output
+#include <vector>
+
+using namespace std;
+
+#include "slicelib.hpp"   // misc. routines for multislice
+#include "floatTIFF.hpp"  // file I/O routines in TIFF format
+#include "newD.hpp"       //  for 2D and 3D arrays
+#include "cbed4d.hpp"     //  4D-STEM data file
+#include "autostem.hpp"   //  for COM images
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+int main()
+{
+    string version = "16-oct-2026";
+    string filein, fileoutpre, fileout, cmode;
+
+    int i, ix, iy, it, ik, jk, idetect, ndetect, nsig, npos, ip, nxout, nyout,
+        nThick, nkx, nky, nbin, ik2, jk2, l1d, NPARAM;
+
+    float ***pixr, **rmin, **rmax;
+    float akx, aky, kx, ky;
+
+    double almin0, almax0, phimin0, phimax0, k2, k2lim, w, dx, dy, pi;
+
+    vectord almin, almax, phiMin, phiMax, k2min, k2max;
+    vectorf kxp, kyp, kxp2, kyp2, param;
+    vectori collectorMode;
+    vector<vectori> detIndex;
+    vector<vectord> detWeight;
+
+    cbed4d c4d;
+    floatTIFF myFile;
+    autostem ast;
+    ofstream fp;
+
+    cout << "astdetect version dated " << version  << endl;
+    cout <<  "This program is provided AS-IS with ABSOLUTELY NO WARRANTY\n "
+            << " under the GNU general public license\n"  << endl;
+
+    cout << "Apply detectors to the 4D-STEM data of autostem\n"
+        << "(autostem -4d file -4dbin n -4dmax mrad)\n" << endl;
+
+    cout << "Name of 4D-STEM file:" << endl;
+    cin >> filein;
+    if( c4d.map( filein ) < 0 ) {
+        cout << "Cannot read 4D-STEM file " << filein << endl;
+        exit( EXIT_FAILURE );
+    }
+    nThick = c4d.nThick;
+    nxout  = c4d.nxout;
+    nyout  = c4d.nyout;
+    nkx    = c4d.nkx;
+    nky    = c4d.nky;
+    nbin   = c4d.nbin;
+    l1d    = ( 1 == nxout ) ? 1 : 0;
+    cout << nxout << " x " << nyout << " positions, " << nThick << " thicknesses, "
+        << nkx << " x " << nky << " pixel patterns (binned by " << nbin << ")" << endl;
+    cout << "max. angle in pattern = " << 1000.0*c4d.wavlen*0.5*nkx*c4d.dkx
+        << " x " << 1000.0*c4d.wavlen*0.5*nky*c4d.dky << " mrad" << endl;
+
+    cout << "Type name of file to get output of image (no extension):" << endl;
+    cin >> fileoutpre;
+
+    /*  same detector input as autostem except confocal */
+    pi = 4.0 * atan( 1.0 );
+    do {    cout << "Number of detector geometries (>=1):" << endl;
+            cin >> ndetect;
+    } while (ndetect <= 0);
+
+    for( idetect=0; idetect<ndetect; idetect++) {
+        cout << "Detector " << idetect + 1 << ", type: min max polar angles(mrad)" << endl;
+        cout << "followed by m, seg, com, t (ADF, segmented, com, total intensity)" << endl;
+        cout << "add phimin phimax (degrees) if segmented" << endl;
+        cin >> almin0 >> almax0 >> cmode;
+        if( almin0 > almax0 ) {
+            cout << "bad angles, exit..." << endl;
+            exit( EXIT_FAILURE );
+        }
+        phimin0 = phimax0 = 0.0;
+        if( (cmode.compare("m") == 0) || (cmode.compare("M") == 0) ) {
+            collectorMode.push_back( ADF );
+        } else if( (cmode.compare("t") == 0) || (cmode.compare("T") == 0) ) {
+            collectorMode.push_back( TOTAL );
+        } else if( (cmode.compare("seg") == 0) || (cmode.compare("SEG") == 0) ) {
+            collectorMode.push_back( ADF_SEG );
+            cin >> phimin0 >> phimax0;
+            //  remember atan2() goes from -pi(-180) to +pi(+180)
+            if( (phimin0 < -180) || (phimin0 > 180)
+                || (phimax0 < -180) || (phimax0 > 180) || (phimin0 > phimax0) ) {
+                cout << "phi must be between -180 and +180 deg., exit..." << endl;
+                exit( EXIT_FAILURE );
+            }
+        } else if( (cmode.compare("com") == 0) || (cmode.compare("COM") == 0) ) {
+            //  expand COM into x,y,i,d modes as in autostem
+            collectorMode.push_back( COMX );
+            collectorMode.push_back( COMY );
+            if( 0 == l1d ) {    //  can only calculate COMI,D in 2D
+                collectorMode.push_back( COMI );
+                collectorMode.push_back( COMD );
+            }
+        } else {
+            cout << "unrecognized collector mode = " << cmode << endl;
+            exit( EXIT_FAILURE );
+        }
+        while( almin.size() < collectorMode.size() ) {
+            almin.push_back( almin0 * 0.001 );  // convert to radians
+            almax.push_back( almax0 * 0.001 );
+            phiMin.push_back( phimin0 * (pi / 180.0) );
+            phiMax.push_back( phimax0 * (pi / 180.0) );
+        }
+    }  /* end for(idetect=.. */
+
+    ndetect = (int) almin.size();
+    cout << "found " << ndetect << " detectors" << endl;
+    if( nbin > 1 )
+        cout << "warning: patterns are binned by " << nbin
+            << " so the detector edges are approximate" << endl;
+
+    /*  spatial frequency of the center of each pattern pixel
+        - same float values as freqn() in autostem for nbin=1 */
+    akx = (float) ( nbin/c4d.dkx );     //  probe size in Ang.
+    aky = (float) ( nbin/c4d.dky );
+    ik2 = (nkx*nbin)/2;                 //  zero freq. on unbinned grid
+    jk2 = (nky*nbin)/2;
+    kxp.resize( nkx );
+    kxp2.resize( nkx );
+    kyp.resize( nky );
+    kyp2.resize( nky );
+    for( ik=0; ik<nkx; ik++) {
+        kxp[ik] = ( (float) ( ik*nbin + 0.5*(nbin-1) - ik2 ) ) / akx;
+        kxp2[ik] = kxp[ik] * kxp[ik];
+    }
+    for( jk=0; jk<nky; jk++) {
+        kyp[jk] = ( (float) ( jk*nbin + 0.5*(nbin-1) - jk2 ) ) / aky;
+        kyp2[jk] = kyp[jk] * kyp[jk];
+    }
+
+    /*  list the pixels inside each detector as in autostem::calculate() */
+    k2min.resize( ndetect );
+    k2max.resize( ndetect );
+    detIndex.resize( ndetect );
+    detWeight.resize( ndetect );
+    k2lim = 0.0;
+    for( idetect=0; idetect<ndetect; idetect++) {
+        k2max[idetect] = almax[idetect]/c4d.wavlen;
+        k2max[idetect] = k2max[idetect] * k2max[idetect];
+        k2min[idetect] = almin[idetect]/c4d.wavlen;
+        k2min[idetect] = k2min[idetect] * k2min[idetect];
+        if( (TOTAL != collectorMode[idetect]) && (k2max[idetect] > k2lim) )
+            k2lim = k2max[idetect];
+        for( ik=0; ik<nkx; ik++) {
+            for( jk=0; jk<nky; jk++) {
+                k2 = kxp2[ik] + kyp2[jk];
+                if( TOTAL == collectorMode[idetect] ) {
+                    w = 1.0;
+                } else if( (k2 < k2min[idetect]) || (k2 >= k2max[idetect]) ) {
+                    continue;
+                } else if( ADF == collectorMode[idetect] ) {
+                    w = 1.0;
+                } else if( ADF_SEG == collectorMode[idetect] ) {
+                    w = atan2( kyp[jk], kxp[ik] );
+                    if( (w < phiMin[idetect]) || (w >= phiMax[idetect]) ) continue;
+                    w = 1.0;
+                } else if( COMX == collectorMode[idetect] ) {
+                    w = kxp[ik];
+                } else if( COMY == collectorMode[idetect] ) {
+                    w = kyp[jk];
+                } else continue;    //  COMI,COMD done in postImage()
+                detIndex[idetect].push_back( jk + ik*nky );
+                detWeight[idetect].push_back( w );
+            }
+        }
+    }  /* end for(idetect...) */
+
+    kx = 0.5F*nkx*nbin/akx;
+    ky = 0.5F*nky*nbin/aky;
+    if( k2lim > ( (kx < ky) ? kx*kx : ky*ky ) )
+        cout << "warning: some detectors are bigger than the saved pattern" << endl;
+
+    /*  sum each detector at each position - read the file only once
+        in order with positions in parallel */
+    nsig = nThick * ndetect;
+    npos = nxout * nyout;
+    pixr = new3D<float>( nsig, nxout, nyout, "pixr" );
+    for( it=0; it<nThick; it++) {
+#pragma omp parallel for private(ix,iy,idetect,i,w)
+        for( ip=0; ip<npos; ip++) {
+            ix = ip / nyout;
+            iy = ip - ix*nyout;
+            const float *pat = c4d.pattern( it, ix, iy );
+            for( idetect=0; idetect<ndetect; idetect++) {
+                const vectori &idx = detIndex[idetect];
+                const vectord &wt = detWeight[idetect];
+                w = 0.0;
+                for( i=0; i<(int)idx.size(); i++)
+                    w += wt[i] * pat[ idx[i] ];
+                pixr[idetect + it*ndetect][ix][iy] = (float) w;
+            }
+        }
+    }  /* end for(it...) */
+
+    rmin  = new2D<float>( nThick, ndetect, "rmin" );
+    rmax  = new2D<float>( nThick, ndetect, "rmax" );
+
+    NPARAM = myFile.maxParam();
+    param.resize( NPARAM, 0.0F );
+    param[pMODE]  = mAUTOSTEM;  // save mode = autostem
+    param[pWAVEL] = (float) c4d.wavlen;
+
+    // ------------- start here for a full image output --------------
+    if( 0 == l1d ) {
+
+        ast.postImage( pixr, rmin, rmax, nxout, nyout, nThick, ndetect,
+            collectorMode, c4d.xi, c4d.xf, c4d.yi, c4d.yf );
+
+        dx = (c4d.xf-c4d.xi)/((double)(nxout-1));  // pixels size for image output
+        dy = (c4d.yf-c4d.yi)/((double)(nyout-1));
+
+        /*  directory file listing parameters for each image file */
+        fileout = fileoutpre + ".txt";
+        fp.open( fileout.c_str() );
+        if( fp.bad() ) {
+            cout << "Cannot open output file " << fileout << endl;
+            exit( 0 );
+        }
+        fp << "C" << endl;
+        fp << "C   output of astdetect version " << version << endl;
+        fp << "C   from 4D-STEM file " << filein << endl;
+        fp << "C" << endl;
+        fp << endl;
+
+        param[pIMAX]    = 0.0F;
+        param[pIMIN]    = 0.0F;
+        param[pDX]      = (float) dx;
+        param[pDY]      = (float) dy;
+        param[ pNXOUT ] = (float) nxout;  // size of output (in pixels)
+        param[ pNYOUT ] = (float) nyout;
+
+        for( i=0; i<NPARAM; i++) myFile.setParam( i, param[i] );
+        ast.writeImages( myFile, fp, fileoutpre, pixr, rmin, rmax, nxout, nyout,
+            nThick, ndetect, collectorMode, almin, almax, phiMin, phiMax,
+            c4d.thick, dx, dy );
+
+        fp.close();
+
+    /* ------------- start here for 1d line scan output ---------------- */
+
+    } else {
+
+        dx = (c4d.xf-c4d.xi)/((double)(nyout-1));
+        dy = (c4d.yf-c4d.yi)/((double)(nyout-1));
+
+        fileout = fileoutpre + ".dat";
+        cout << "output file= " << fileout << endl;
+
+        fp.open( fileout.c_str() );
+        if( fp.bad() ) {
+            cout << "Cannot open output file " << fileout << endl;
+            exit( 0 );
+        }
+
+        fp << "C" << endl;
+        fp << "C   output of astdetect version " << version << endl;
+        fp << "C   from 4D-STEM file " << filein << endl;
+        fp << "C" << endl;
+        ast.writeDetect1D( fp, ndetect, collectorMode, almin, almax, phiMin, phiMax );
+        ast.writeLine1D( fp, pixr, nyout, nThick, ndetect, c4d.xi, c4d.yi, dx, dy );
+        fp.close();
+
+    } /* end if( l1d...) */
+
+    c4d.unmap();
+    delete3D<float>( pixr, nsig, nxout );
+    delete2D<float>( rmin, nThick );
+    delete2D<float>( rmax, nThick );
+
+    return( EXIT_SUCCESS );
+
+}  // end main()
@@ -0,0 +1,315 @@
+/*      *** astmerge.cpp ***
+
+------------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+---------------------- NO WARRANTY ------------------
+THIS PROGRAM IS PROVIDED AS-IS WITH ABSOLUTELY NO WARRANTY
+OR GUARANTEE OF ANY KIND, EITHER EXPRESSED OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE
+FOR DAMAGES RESULTING FROM THE USE OR INABILITY TO USE THIS
+PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU OR
+THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH
+ANY OTHER PROGRAM).
+
+------------------------------------------------------------------------
+
+  combine the partial sums of several autostem processes (shards)
+  into the final image files
+
+  each shard is one autostem run with the same input and the
+  command line options:
+
+       -shard file   = save the partial sums in this file
+       -lines l0 l1  = only calculate scan lines l0 to l1-1
+                          (x index in 2D, position in 1D)
+       -configs c0 c1= only calculate phonon configurations c0 to c1-1
+       -seed n       = random number seed (use the same in all shards
+                          to get the same result as one process)
+
+  the shards can run anywhere (no scheduler needed) as long as their
+  files end up where astmerge can read them
+
+  the signal at each position is the average of all shards that
+  include it weighted by their number of configurations, so shards
+  of lines, configurations or both can be combined (the pos. aver.
+  CBED is the sum of all shards)
+
+  this file is formatted for a tab size of 4 characters
+
+  started 16-oct-2026
+  convolve with the source size of the shards (param[pSOURCE]) 16-oct-2026
+  write the output files with the same autostem::writeImages() etc.
+     as autostem 16-oct-2026
+*/
+
+#include <cstdio>  /* ANSI C libraries used */
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+
+#include <string>
+#include <iostream>  //  C++ stream IO
+#include <fstream>
+#include <iomanip>   //  to format the output
+#include <vector>
+
+using namespace std;
+
+#include "slicelib.hpp"   // misc. routines for multislice
+#include "floatTIFF.hpp"  // file I/O routines in TIFF format
+#include "newD.hpp"       //  for 2D and 3D arrays
+#include "astpartial.hpp" //  partial sums from each shard
+#include "autostem.hpp"   //  for COM images
+
+int main()
+{
+    string version = "16-oct-2026";
+    string fileoutpre, fileout, pacbedFile;
+
+    int ishard, nshard, i, ip, ix, iy, nsig, npos, nposl,
+        nThick, ndetect, nxout, nyout, nxprobe, nyprobe, l1d, NPARAM;
+
+    float ***pixr, **rmin, **rmax, **pacbedPix;
+
+    double w, wmin, wmax, dx, dy, dxp, dyp, totmin, totmax;
+
+    vector<string> filein;
+    vectord sum, wsum, pacbed;
+    vectorf param;
+    vectori collectorMode;
+
+    astpartial ps, ps0;
+    floatTIFF myFile;
+    autostem ast;
+    ofstream fp;
+
+    cout << "astmerge version dated " << version  << endl;
+    cout <<  "This program is provided AS-IS with ABSOLUTELY NO WARRANTY\n "
+            << " under the GNU general public license\n"  << endl;
+
+    cout << "Combine the partial sums of several autostem shards\n"
+        << "(autostem -shard file -lines l0 l1 -configs c0 c1)\n" << endl;
+
+    cout << "Type number of shard files:" << endl;
+    cin >> nshard;
+    if( nshard < 1 ) {
+        cout << "need at least one shard" << endl;
+        exit( EXIT_FAILURE );
+    }
+    filein.resize( nshard );
+    for( ishard=0; ishard<nshard; ishard++) {
+        cout << "shard " << ishard << " file name:" << endl;
+        cin >> filein[ishard];
+    }
+
+    cout << "Type name of file to get output of image (no extension):" << endl;
+    cin >> fileoutpre;
+
+    /*  read each shard and add its signals to the average
+        - everything must come from the same calculation */
+    nsig = npos = 0;
+    pixr = NULL;
+    totmin = 10.0;
+    totmax = -10.0;
+    for( ishard=0; ishard<nshard; ishard++) {
+
+        if( ps.read( filein[ishard] ) < 0 ) {
+            cout << "Cannot read shard file " << filein[ishard] << endl;
+            exit( EXIT_FAILURE );
+        }
+        if( (ps.nposDone > 0) || (ps.nconfig != ps.config1) ) {
+            cout << "shard " << filein[ishard] << " is not finished ("
+                << ps.nconfig - ps.config0 << " of " << ps.config1 - ps.config0
+                << " configurations), continue it with autostem -resume" << endl;
+            exit( EXIT_FAILURE );
+        }
+
+        if( 0 == ishard ) {
+            ps0 = ps;       //  keep header of first for reference
+            ps0.pix.clear();
+            ps0.pacbed.clear();
+            nsig = ps.nThick * ps.ndetect;
+            npos = ps.nxout * ps.nyout;
+            sum.resize( ((size_t)nsig) * ((size_t)npos), 0.0 );
+            wsum.resize( npos, 0.0 );
+            pacbed.resize( ps.pacbed.size(), 0.0 );
+        } else if( (ps.fingerprint != ps0.fingerprint) || (ps.nThick != ps0.nThick)
+            || (ps.ndetect != ps0.ndetect) || (ps.nxout != ps0.nxout)
+            || (ps.nyout != ps0.nyout) || (ps.l1d != ps0.l1d)
+            || (ps.pacbed.size() != pacbed.size()) ) {
+            cout << "shard " << filein[ishard] << " is from a different calculation than "
+                << filein[0] << endl;
+            exit( EXIT_FAILURE );
+        }
+        if( ps.seed != ps0.seed ) {
+            cout << "warning: shard " << filein[ishard] << " has a different random number seed"
+                << " (use -seed for the same result as one process)" << endl;
+        }
+
+        nposl = ( 0 == ps.l1d ) ? ps.nyout : 1;     //  positions in one line
+        w = (double) ( ps.config1 - ps.config0 );   //  weight = number of config.
+        if( (ps.line0 < 0) || (ps.line0*nposl + ps.npos > npos) ) {
+            cout << "bad range of lines in shard " << filein[ishard] << endl;
+            exit( EXIT_FAILURE );
+        }
+        for( ip=0; ip<ps.npos; ip++) {
+            ix = ps.line0*nposl + ip;
+            wsum[ix] += w;
+            for( i=0; i<nsig; i++)
+                sum[ ix + i*npos ] += w * ps.pix[ ip + i*ps.npos ];
+        }
+        for( ip=0; ip<(int)pacbed.size(); ip++) pacbed[ip] += ps.pacbed[ip];
+        if( ps.totmin < totmin ) totmin = ps.totmin;
+        if( ps.totmax > totmax ) totmax = ps.totmax;
+
+        cout << "shard " << filein[ishard] << ": lines " << ps.line0 << " to "
+            << ps.line1-1 << ", configurations " << ps.config0 << " to "
+            << ps.config1-1 << endl;
+
+    }  /*  end for(ishard... */
+
+    //  check that all positions were calculated
+    wmin = wmax = wsum[0];
+    for( ip=0; ip<npos; ip++) {
+        if( wsum[ip] < wmin ) wmin = wsum[ip];
+        if( wsum[ip] > wmax ) wmax = wsum[ip];
+    }
+    if( wmin <= 0.0 ) {
+        cout << "some scan positions are not in any shard" << endl;
+        exit( EXIT_FAILURE );
+    }
+    if( wmin != wmax ) {
+        cout << "warning: positions have " << wmin << " to " << wmax
+            << " configurations" << endl;
+    } else cout << "each position has " << wmin << " configurations" << endl;
+    cout << "total integrated intensity range is " << totmin
+        << " to " << totmax << endl;
+
+    //  same size and layout as in autostem
+    nThick  = ps0.nThick;
+    ndetect = ps0.ndetect;
+    nxout   = ps0.nxout;
+    nyout   = ps0.nyout;
+    nxprobe = ps0.nxprobe;
+    nyprobe = ps0.nyprobe;
+    l1d     = ps0.l1d;
+    collectorMode = ps0.mode;
+
+    pixr = new3D<float>( nsig, nxout, nyout, "pixr" );
+    for( ix=0; ix<nxout; ix++) for( iy=0; iy<nyout; iy++) {
+        ip = iy + ix*nyout;
+        for( i=0; i<nsig; i++)
+            pixr[i][ix][iy] = (float) ( sum[ ip + i*npos ] / wsum[ip] );
+    }
+    rmin  = new2D<float>( nThick, ndetect, "rmin" );
+    rmax  = new2D<float>( nThick, ndetect, "rmax" );
+
+    NPARAM = myFile.maxParam();
+    param = ps0.param;
+    param.resize( NPARAM, 0.0F );
+    param[pMODE] = mAUTOSTEM;  // save mode = autostem
+
+    // ------------- start here for a full image output --------------
+    if( 0 == l1d ) {
+
+        ast.postImage( pixr, rmin, rmax, nxout, nyout, nThick, ndetect,
+            collectorMode, ps0.xi, ps0.xf, ps0.yi, ps0.yf, param[pSOURCE] );
+
+        dx = (ps0.xf-ps0.xi)/((double)(nxout-1));  // pixels size for image output
+        dy = (ps0.yf-ps0.yi)/((double)(nyout-1));
+
+        /*  directory file listing parameters for each image file */
+        fileout = fileoutpre + ".txt";
+        fp.open( fileout.c_str() );
+        if( fp.bad() ) {
+            cout << "Cannot open output file " << fileout << endl;
+            exit( 0 );
+        }
+        fp << "C" << endl;
+        fp << "C   output of astmerge version " << version << endl;
+        fp << "C   from " << nshard << " autostem shards" << endl;
+        fp << "C" << endl;
+        fp << endl;
+
+        param[pIMAX]    = 0.0F;
+        param[pIMIN]    = 0.0F;
+        param[pDX]      = (float) dx;
+        param[pDY]      = (float) dy;
+        param[ pNXOUT ] = (float) nxout;  // size of output (in pixels)
+        param[ pNYOUT ] = (float) nyout;
+
+        for( i=0; i<NPARAM; i++) myFile.setParam( i, param[i] );
+        ast.writeImages( myFile, fp, fileoutpre, pixr, rmin, rmax, nxout, nyout,
+            nThick, ndetect, collectorMode, ps0.almin, ps0.almax,
+            ps0.phimin, ps0.phimax, ps0.thick, dx, dy );
+
+        fp.close();
+
+        /*   save pos. aver. CBED if the shards have it
+             - same as autostem */
+        if( (pacbed.size() > 0) && ((int)pacbed.size() == nxprobe*nyprobe) ) {
+            cout << "Type name of file for position averaged CBED:" << endl;
+            cin >> pacbedFile;
+            pacbedPix = new2D<float>( nxprobe, nyprobe, "pacbedPix" );
+            for( ix=0; ix<nxprobe; ix++) for( iy=0; iy<nyprobe; iy++)
+                pacbedPix[ix][iy] = (float) pacbed[iy + ix*nyprobe];
+            ast.invert2D( pacbedPix, nxprobe, nyprobe );  /*  put zero in middle */
+            dxp = param[pAX]*((double)nxprobe)/param[pNX];
+            dyp = param[pBY]*((double)nyprobe)/param[pNY];
+            dxp = 1.0/dxp;
+            dyp = 1.0/dyp;
+            ast.writePACBED( myFile, pacbedFile, pacbedPix, nxprobe, nyprobe, dxp, dyp );
+            delete2D<float>( pacbedPix, nxprobe );
+        }   /*  end if( pacbed.... */
+
+    /* ------------- start here for 1d line scan output ---------------- */
+
+    } else {
+
+        dx = (ps0.xf-ps0.xi)/((double)(nyout-1));
+        dy = (ps0.yf-ps0.yi)/((double)(nyout-1));
+
+        fileout = fileoutpre + ".dat";
+        cout << "output file= " << fileout << endl;
+
+        fp.open( fileout.c_str() );
+        if( fp.bad() ) {
+            cout << "Cannot open output file " << fileout << endl;
+            exit( 0 );
+        }
+
+        fp << "C" << endl;
+        fp << "C   output of astmerge version " << version << endl;
+        fp << "C   from " << nshard << " autostem shards" << endl;
+        fp << "C" << endl;
+        ast.writeDetect1D( fp, ndetect, collectorMode, ps0.almin, ps0.almax,
+            ps0.phimin, ps0.phimax );
+        ast.writeLine1D( fp, pixr, nyout, nThick, ndetect, ps0.xi, ps0.yi, dx, dy );
+
+        fp.close();
+
+    } /* end if( l1d...) */
+
+    delete3D<float>( pixr, nsig, nxout );
+    delete2D<float>( rmin, nThick );
+    delete2D<float>( rmax, nThick );
+
+    return( EXIT_SUCCESS );
+
+}  // end main()
@@ -0,0 +1,373 @@
+/*              *** astpartial.cpp ***
+
+------------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+---------------------- NO WARRANTY ------------------
+THIS PROGRAM IS PROVIDED AS-IS WITH ABSOLUTELY NO WARRANTY
+OR GUARANTEE OF ANY KIND, EITHER EXPRESSED OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE
+FOR DAMAGES RESULTING FROM THE USE OR INABILITY TO USE THIS
+PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU OR
+THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH
+ANY OTHER PROGRAM).
+------------------------------------------------------------------------
+
+   C++ class to hold the partial sums of an autostem calculation
+   (see astpartial.hpp)
+
+   file layout (native byte order):
+      char[8]  = "ASTPSUM1"
+      int32[20]= nThick, ndetect, nxout, nyout, nxprobe, nyprobe,
+                 nwobble, nconfig, nposDone, npacbed, npos, line0,
+                 line1, config0, config1, l1d, nparam, 3 x spare
+      uint64[3]= fingerprint, rngState, seed
+      int64    = nbeamt
+      double[8]= totmin, totmax, ctotmin, ctotmax, xi, xf, yi, yf
+      float    param[nparam]
+      double   thick[nThick]
+      double   almin[ndetect], almax[ndetect], phimin[ndetect], phimax[ndetect]
+      int32    mode[ndetect]
+      float    pix[nThick*ndetect*npos]
+      float    pacbed[npacbed]
+      float    pixc[nThick*ndetect*npos]  (only if nposDone>0)
+      double   pacbedc[npacbed]           (only if nposDone>0)
+
+The source code is formatted for a tab size of 4.
+
+   started 16-oct-2026
+   add scan line and configuration range and the parameters of the
+      whole calculation so shards can be merged 16-oct-2026
+   only remove() the old file before rename() on Windows and read()
+      the finished .tmp file if the old one is gone 16-oct-2026
+*/
+
+#include "astpartial.hpp"   // class definition + inline functions here
+
+#include <cstring>
+
+static const char ASTPSUM_MAGIC[] = "ASTPSUM1";
+
+//------------------ constructor --------------------------------
+astpartial::astpartial()
+{
+    clear();
+
+}  // end astpartial::astpartial()
+
+//------------------ destructor ---------------------------------
+astpartial::~astpartial()
+{
+}  // end astpartial::~astpartial()
+
+//------------------ clear() ---------------------------------
+void astpartial::clear()
+{
+    nThick = ndetect = nxout = nyout = nxprobe = nyprobe = l1d = 0;
+    npos = line0 = line1 = config0 = config1 = 0;
+    fingerprint = rngState = seed = 0;
+    nwobble = nconfig = nposDone = 0;
+    nbeamt = 0;
+    totmin = ctotmin = 10.0;
+    totmax = ctotmax = -10.0;
+    xi = xf = yi = yf = 0.0;
+    param.clear();
+    thick.clear();
+    almin.clear();
+    almax.clear();
+    phimin.clear();
+    phimax.clear();
+    mode.clear();
+    pix.clear();
+    pacbed.clear();
+    pixc.clear();
+    pacbedc.clear();
+
+}  // end astpartial::clear()
+
+//------------------ hash() ---------------------------------
+//
+//  64 bit FNV-1a hash - not cryptographic but good enough
+//  to tell if the input parameters have changed
+//
+void astpartial::hash( uint64_t &h, const void *data, size_t nbytes )
+{
+    size_t i;
+    const unsigned char *c = (const unsigned char*) data;
+
+    if( 0 == h ) h = UINT64_C(14695981039346656037);
+    for( i=0; i<nbytes; i++) {
+        h ^= (uint64_t) c[i];
+        h *= UINT64_C(1099511628211);
+    }
+
+}  // end astpartial::hash()
+
+//------------------ readv(), writev() ---------------------------------
+//  read/write n elements of a vector and return number of elements done
+template< class T >
+static size_t readv( FILE *fp, std::vector<T> &v, size_t n )
+{
+    v.resize( n );
+    if( n < 1 ) return( 0 );
+    return( fread( &v[0], sizeof(T), n, fp ) );
+}
+
+template< class T >
+static size_t writev( FILE *fp, const std::vector<T> &v )
+{
+    if( v.size() < 1 ) return( 0 );
+    return( fwrite( &v[0], sizeof(T), v.size(), fp ) );
+}
+
+//------------------ read() ---------------------------------
+//
+//  file = name of file to read
+//
+//  if file does not exist use file.tmp (from write() stopped just
+//     between remove() and rename() on Windows) if it is complete
+//
+//  return +1 for success, -1 if it cannot be opened and
+//     -2 if it is not a valid file
+//
+int astpartial::read( std::string file )
+{
+    int lerr;
+    FILE *fp;
+    char magic[8];
+    int32_t ih[20];
+    uint64_t uh[3];
+    int64_t nb;
+    double dh[8];
+    size_t n, n0, nsig, npac, nparam;
+    std::vector<int32_t> mode32;
+
+    lerr = -2;
+    fp = fopen( file.c_str(), "rb" );
+    if( NULL == fp ) {
+        file += ".tmp";
+        fp = fopen( file.c_str(), "rb" );
+        if( NULL == fp ) return( -1 );
+        lerr = -1;      //  not finished = no file
+    }
+
+    n = fread( magic, 1, 8, fp );
+    n += fread( ih, sizeof(int32_t), 20, fp );
+    n += fread( uh, sizeof(uint64_t), 3, fp );
+    n += fread( &nb, sizeof(int64_t), 1, fp );
+    n += fread( dh, sizeof(double), 8, fp );
+    if( (n != (8+20+3+1+8)) || (0 != strncmp( magic, ASTPSUM_MAGIC, 8 ))
+        || (ih[0] < 0) || (ih[1] < 0) || (ih[9] < 0) || (ih[10] < 0) || (ih[16] < 0) ) {
+        sbuff = "astpartial: " + file + " is not a valid partial sum file";
+        messagePS( sbuff, 1 );
+        fclose( fp );
+        return( lerr );
+    }
+
+    nThick  = ih[0];
+    ndetect = ih[1];
+    nxout   = ih[2];
+    nyout   = ih[3];
+    nxprobe = ih[4];
+    nyprobe = ih[5];
+    nwobble = ih[6];
+    nconfig = ih[7];
+    nposDone= ih[8];
+    npac    = (size_t) ih[9];
+    npos    = ih[10];
+    line0   = ih[11];
+    line1   = ih[12];
+    config0 = ih[13];
+    config1 = ih[14];
+    l1d     = ih[15];
+    nparam  = (size_t) ih[16];
+    fingerprint = uh[0];
+    rngState = uh[1];
+    seed = uh[2];
+    nbeamt = (long) nb;
+    totmin = dh[0];
+    totmax = dh[1];
+    ctotmin = dh[2];
+    ctotmax = dh[3];
+    xi = dh[4];
+    xf = dh[5];
+    yi = dh[6];
+    yf = dh[7];
+
+    nsig = ((size_t)nThick) * ((size_t)ndetect) * ((size_t)npos);
+    n = readv( fp, param, nparam );
+    n += readv( fp, thick, nThick );
+    n += readv( fp, almin, ndetect );
+    n += readv( fp, almax, ndetect );
+    n += readv( fp, phimin, ndetect );
+    n += readv( fp, phimax, ndetect );
+    n += readv( fp, mode32, ndetect );
+    mode.assign( mode32.begin(), mode32.end() );
+    n += readv( fp, pix, nsig );
+    n += readv( fp, pacbed, npac );
+    n0 = nparam + nThick + 5*ndetect + nsig + npac;
+    if( nposDone > 0 ) {
+        n += readv( fp, pixc, nsig );
+        n += readv( fp, pacbedc, npac );
+        n0 += nsig + npac;
+    } else {
+        pixc.clear();
+        pacbedc.clear();
+    }
+    fclose( fp );
+
+    if( n != n0 ) {
+        sbuff = "astpartial: " + file + " is too short";
+        messagePS( sbuff, 1 );
+        return( lerr );
+    }
+
+    return( +1 );
+
+}  // end astpartial::read()
+
+//------------------ write() ---------------------------------
+//
+//  file = name of file to write
+//
+//  write to a temporary file first and then rename it so
+//  the old file is still there if this program is stopped
+//  in the middle of writing
+//
+//  return +1 for success and <0 for failure
+//
+int astpartial::write( std::string file )
+{
+    FILE *fp;
+    int32_t ih[20];
+    uint64_t uh[3];
+    int64_t nb;
+    double dh[8];
+    size_t n, n0, nsig;
+    std::string tmpfile;
+    std::vector<int32_t> mode32;
+
+    nsig = ((size_t)nThick) * ((size_t)ndetect) * ((size_t)npos);
+    if( (pix.size() != nsig) || (thick.size() != (size_t)nThick)
+        || (almin.size() != (size_t)ndetect) || (almax.size() != (size_t)ndetect)
+        || (phimin.size() != (size_t)ndetect) || (phimax.size() != (size_t)ndetect)
+        || (mode.size() != (size_t)ndetect)
+        || ( (nposDone > 0) && ( (pixc.size() != nsig) || (pacbedc.size() != pacbed.size()) ) ) ) {
+        sbuff = "astpartial: bad size, cannot write " + file;
+        messagePS( sbuff, 1 );
+        return( -1 );
+    }
+
+    tmpfile = file + ".tmp";
+    fp = fopen( tmpfile.c_str(), "wb" );
+    if( NULL == fp ) {
+        sbuff = "astpartial: cannot open " + tmpfile;
+        messagePS( sbuff, 1 );
+        return( -2 );
+    }
+
+    ih[0] = nThick;
+    ih[1] = ndetect;
+    ih[2] = nxout;
+    ih[3] = nyout;
+    ih[4] = nxprobe;
+    ih[5] = nyprobe;
+    ih[6] = nwobble;
+    ih[7] = nconfig;
+    ih[8] = nposDone;
+    ih[9] = (int32_t) pacbed.size();
+    ih[10] = npos;
+    ih[11] = line0;
+    ih[12] = line1;
+    ih[13] = config0;
+    ih[14] = config1;
+    ih[15] = l1d;
+    ih[16] = (int32_t) param.size();
+    ih[17] = ih[18] = ih[19] = 0;
+    uh[0] = fingerprint;
+    uh[1] = rngState;
+    uh[2] = seed;
+    nb = (int64_t) nbeamt;
+    dh[0] = totmin;
+    dh[1] = totmax;
+    dh[2] = ctotmin;
+    dh[3] = ctotmax;
+    dh[4] = xi;
+    dh[5] = xf;
+    dh[6] = yi;
+    dh[7] = yf;
+    mode32.assign( mode.begin(), mode.end() );
+
+    n = fwrite( ASTPSUM_MAGIC, 1, 8, fp );
+    n += fwrite( ih, sizeof(int32_t), 20, fp );
+    n += fwrite( uh, sizeof(uint64_t), 3, fp );
+    n += fwrite( &nb, sizeof(int64_t), 1, fp );
+    n += fwrite( dh, sizeof(double), 8, fp );
+    n += writev( fp, param );
+    n += writev( fp, thick );
+    n += writev( fp, almin );
+    n += writev( fp, almax );
+    n += writev( fp, phimin );
+    n += writev( fp, phimax );
+    n += writev( fp, mode32 );
+    n += writev( fp, pix );
+    n += writev( fp, pacbed );
+    n0 = 8+20+3+1+8 + param.size() + nThick + 5*ndetect + nsig + pacbed.size();
+    if( nposDone > 0 ) {
+        n += writev( fp, pixc );
+        n += writev( fp, pacbedc );
+        n0 += nsig + pacbed.size();
+    }
+    if( 0 != fclose( fp ) ) n = 0;
+
+    if( n != n0 ) {
+        sbuff = "astpartial: error writing " + tmpfile;
+        messagePS( sbuff, 1 );
+        remove( tmpfile.c_str() );
+        return( -3 );
+    }
+
+    //  rename() replaces the old file in one step except on Windows
+#ifdef _WIN32
+    remove( file.c_str() );
+#endif
+    if( 0 != rename( tmpfile.c_str(), file.c_str() ) ) {
+        sbuff = "astpartial: cannot rename " + tmpfile + " to " + file;
+        messagePS( sbuff, 1 );
+        return( -4 );
+    }
+
+    return( +1 );
+
+}  // end astpartial::write()
+
+/*------------------------- messagePS() ----------------------*/
+/*
+    common message output
+    redirect all print message to here so this can be redirected
+        to a dialog box in a GUI or cmd line
+
+   level = level of seriousness
+            0 = simple status message
+        1 = significant warning
+        2 = possibly fatal error
+*/
+void astpartial::messagePS( std::string &smsg,  int level )
+{
+    messageSL( smsg.c_str(), level );  //  just call slicelib version for now
+}
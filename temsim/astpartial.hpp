@@ -0,0 +1,139 @@
+/*              *** astpartial.hpp ***
+
+------------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+---------------------- NO WARRANTY ------------------
+THIS PROGRAM IS PROVIDED AS-IS WITH ABSOLUTELY NO WARRANTY
+OR GUARANTEE OF ANY KIND, EITHER EXPRESSED OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE
+FOR DAMAGES RESULTING FROM THE USE OR INABILITY TO USE THIS
+PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU OR
+THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH
+ANY OTHER PROGRAM).
+------------------------------------------------------------------------
+
+   C++ class to hold the partial sums of an autostem calculation
+   (the detector signals summed over the phonon configurations
+   done so far) so it can be saved in a file and continued later
+   (checkpoint/resume) or combined with the partial sums of other
+   processes that calculated other scan lines or configurations
+   of the same image (shards, see astmerge.cpp)
+
+   the file is raw binary in the native byte order (not portable
+   between different types of computers) and holds:
+
+      a header with the array sizes, the range of scan lines and
+         configurations, the number of configurations done, the random
+         number state and a fingerprint of all of the input parameters
+         (to detect a mismatched resume or merge)
+      the parameters needed to write the final image files
+      pix[]      = signal of each probe position ip and signal i
+                      (detector + thickness) at pix[ip + i*npos] summed
+                      over the configurations done / (config1-config0)
+                      (i.e. the average when all are done)
+      pacbed[]   = partial position averaged CBED (may be empty)
+      the partial sums of one configuration that is not finished
+         yet (if any, a checkpoint within a configuration)
+
+The source code is formatted for a tab size of 4.
+
+----------------------------------------------------------
+The public member functions are:
+
+clear()    : set all sizes to zero
+read()     : read from a file
+write()    : write to a file (safely so a crash does not lose
+                the previous file)
+hash()     : add some data to a fingerprint
+
+----------------------------------------------------------
+
+   started 16-oct-2026
+   add scan line and configuration range and the parameters of the
+      whole calculation so shards can be merged 16-oct-2026
+*/
+
+#ifndef ASTPARTIAL_HPP   // only include this file if its not already
+
+#define ASTPARTIAL_HPP   // remember that this has been included
+
+#include <cstdio>
+#include <cstdint>
+#include <string>   // STD string class
+#include <vector>
+
+#include "slicelib.hpp"    // misc. routines for multislice
+
+//------------------------------------------------------------------
+class astpartial{
+
+public:
+
+    astpartial();         // constructor functions
+
+    ~astpartial();        //  destructor function
+
+    //  size of data (nxout,nyout = whole image, nxout=1 for a line scan)
+    int nThick, ndetect, nxout, nyout, nxprobe, nyprobe, l1d;
+
+    //  this part of the image = lines line0 to line1-1 (x index in 2D,
+    //     position in 1D) and configurations config0 to config1-1
+    //     - weight of pix[] in a merge = config1-config0
+    int npos, line0, line1, config0, config1;
+
+    uint64_t fingerprint;   //  of the input parameters (not line/config range)
+    int nwobble;            //  total number of configurations of whole image
+    int nconfig;            //  configurations config0 to nconfig-1 are in pix[]
+    uint64_t rngState;      //  random number state before config. # nconfig
+    uint64_t seed;          //  initial random number seed (information only)
+    long nbeamt;
+    double totmin, totmax;  //  range of total integrated intensity
+
+    //  parameters of the whole calculation (to write the output files)
+    double xi, xf, yi, yf;  //  scan range
+    vectorf param;          //  as in calculate() and floatTIFF
+    vectord thick, almin, almax, phimin, phimax;    //  ThickSave, detectors
+    vectori mode;           //  collectorMode
+
+    vectorf pix;            //  nThick*ndetect*npos signals
+    vectorf pacbed;         //  nxprobe*nyprobe sum (empty if not used)
+
+    //  configuration # nconfig if partly done (nposDone=0 if not)
+    int nposDone;           //  positions done (in order)
+    double ctotmin, ctotmax;
+    vectorf pixc;           //  signals of positions done (divided by config1-config0)
+    vectord pacbedc;        //  pos. aver. CBED of positions done
+
+    void clear();
+
+    //  return +1 for success and <0 for failure
+    int read( std::string file );
+    int write( std::string file );
+
+    //  add nbytes of data to fingerprint h (start with h=0)
+    static void hash( uint64_t &h, const void *data, size_t nbytes );
+
+private:
+
+    std::string sbuff;
+    void messagePS( std::string &smsg, int level = 0 );
+
+};  // end astpartial::
+
+#endif  // ASTPARTIAL_HPP
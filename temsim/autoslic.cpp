@@ -165,6 +165,27 @@ ANY OTHER PROGRAM).
      anti-aliasing  (remove vzaomtLUT) 30-apr-2024 to 20-may-2024 ejk
   add justPhi argument to trlayer() 25-may-2024 ejk
   fix error in spec coord. generation in cuda version 28-may-2024 ejk
+  add convErr,convMin to calculateCBED_TDS() to stop averaging phonon
+     configurations when the estimated relative standard error of the
+     CBED is small enough (configurations in groups of the number of
+     threads) 16-oct-2026
+  add memMB and memoryGroup() to do the phonon configurations of
+     calculatePartial() and calculateCBED_TDS() in groups that fit
+     in a memory budget 16-oct-2026
+  add snapFile, snapEvery to write snapshots of the running average of
+     calculateCBED_TDS() in the background 16-oct-2026
+  add trTol to find the potential of big slices in trlayer() by gridding
+     each atomic species with one FFT each (sfgrid) 16-oct-2026
+  keep the scattering factors on the grid in fet (made once) and make
+     the first call to featom() thread safe 16-oct-2026
+  sum only the atoms of one unit cell at its reciprocal lattice points
+     in trlayer() for a perfect crystal (ncellx, ncelly) 16-oct-2026
+  sum the potential in trlayer() with phasor rows in x and y for each
+     atom in cache sized blocks and one openMP region (sfgrid::direct())
+     16-oct-2026
+  find the slices with the same atoms in projection in calculate() (a
+     crystal repeated in z without thermal vibrations) and calculate
+     each distinct transmission function once 16-oct-2026
 
   ax,by,cz  = unit cell size in x,y()
   BW     = Antialiasing bandwidth limit factor
@@ -206,6 +227,10 @@ extern vector< vector<double> > fparams;  // scattering factor table
 #define USE_OPENMP      // define to use openMP 
 #endif
 
+#ifdef USE_OPENMP
+#include <omp.h>        // to get number of threads
+#endif
+
 //=============================================================
 //---------------  creator and destructor --------------
 
@@ -227,6 +252,16 @@ autoslic::autoslic()
         lcbed = 1;  // default to original CBED
         lanimate = 0;
 
+        convErr = 0.0;
+        convMin = 4;
+        nconfigDone = 0;
+        memMB = 0.0;
+        snapFile = "";
+        snapEvery = 0;
+        trTol = 0.0;
+        ncellx = ncelly = 1;
+        lsameEcho = 1;
+
         echo = 1;   // >0 to echo status 
 
         pi = (float) (4.0 * atan( 1.0 ));
@@ -446,21 +481,25 @@ int autoslic::calculate(cfpix &pix, cfpix &wave0, cfpix &depthpix,
         vectori &Znum, vectorf &x, vectorf &y, vectorf &z, vectorf &occ,
         cfpix &beams, vectori &hb, vectori &kb, int nbout, float ycross, int verbose )
 {
-    int i, ix, iy, iz, nx, ny, nz, iycross, istart, nbeams,
-        ib, na, islice, nzbeams, nzout;
+    int i, ix, iy, iz, nx, ny, nz, iycross, istart, nbeams=0,
+        ib, na, islice, nzbeams, nzout, nsl, ndist, nshare, nfull, key;
 
     float xmin,xmax, ymin, ymax, zmin, zmax;
     float scale, v0, wavlen, ax, by, tctx;
 
-    double sum, zslice, deltaz, phirms;
+    double sum, zslice, deltaz, phirms=0.0, cacheLim;
 
     string sbuf;   //  need local copy to run in parallel
 
     vectori Znum2, hbeam, kbeam;
+    vectori sliceRef;      // first slice with the same atoms (-1 if not used again)
+    vectord phiRef;        // phirms of each slice kept
 
     cfpix wave;            // complex probe wave functions
     cfpix trans;           // complex transmission functions
     cfpix depthpix0;       // temp depth pix to get size right
+    cfpix *ptrans;
+    slicecache tcache;     // distinct slices that are used again
 
     // ---- get setup parameters from param[]
     ax = param[ pAX ];
@@ -595,6 +634,58 @@ int autoslic::calculate(cfpix &pix, cfpix &wave0, cfpix &depthpix,
 
     scale = 1.0F / ( ((float)nx) * ((float)ny) );
 
+    /*  slices with the same atoms in projection (a crystal repeated in z)
+        have the same transmission function so find them (same slices
+        as the loop below) and only calculate each distinct one
+        - keep the ones that are used again in tcache */
+    if( 0 == lwobble ) {
+        vectori sliceStart, sliceNa, nuse;
+        istart = 0;
+        for( zslice=0.75*deltaz; (istart < natom) && ( zslice < (zmax+deltaz) ); zslice+=deltaz ) {
+            na = 0;
+            for(i=istart; i<natom; i++)
+            if( z[i] < zslice ) na++; else break;
+            sliceStart.push_back( istart );
+            sliceNa.push_back( na );
+            istart += na;
+        }
+        sameSlice( x, y, occ, Znum, sliceStart, sliceNa, sliceRef );
+        nsl = (int) sliceRef.size();
+        nuse.assign( nsl, 0 );
+        for( i=0; i<nsl; i++) if( sliceNa[i] > 0 ) nuse[ sliceRef[i] ] += 1;
+        ndist = nshare = nfull = 0;
+        for( i=0; i<nsl; i++) {
+            if( nuse[i] > 0 ) ndist++;
+            if( nuse[i] > 1 ) nshare++;
+            if( sliceNa[i] > 0 ) nfull++;
+        }
+        for( i=0; i<nsl; i++) if( nuse[ sliceRef[i] ] < 2 ) sliceRef[i] = -1;
+
+        if( nshare > 0 ) {
+            //  remaining memory budget after wave, trans, cprop etc.
+            //    (> 0 so the cache does not become unlimited)
+            cacheLim = 0.0;
+            if( memMB > 0.0 ) {
+                cacheLim = memMB - 6.0*2.0*sizeof(float)*((double)nx)*ny/(1024.0*1024.0);
+                if( cacheLim <= 0.0 ) cacheLim = 1.0e-6;
+            }
+            tcache.setup( nx, ny, cacheLim, "" );
+            phiRef.assign( nsl, 0.0 );
+        } else sliceRef.clear();
+
+        //  once for a series of calls (partial coherence and CBED clear
+        //    lsameEcho after the first - this may run in parallel)
+        if( (verbose > 0) || ((echo > 0) && (1 == lsameEcho)) ) {
+            if( ndist < nfull ) sbuf = toString( nfull ) + " slices with atoms but only "
+                + toString( ndist ) + " are different: calculate " + toString( nfull - ndist )
+                + " fewer transmission functions (" + toString( 100.0*(nfull-ndist)/nfull )
+                + "%) and keep " + toString( nshare ) + " of them ("
+                + toString( nshare*tcache.sliceMB() ) + " MBytes)";
+            else sbuf = "all " + toString( nfull ) + " slices are different";
+            messageAS( sbuf );
+        }
+    }
+
     zslice = 0.75*deltaz;  /*  start a little before top of unit cell */
     istart = 0;
     islice = 1;
@@ -608,13 +699,23 @@ int autoslic::calculate(cfpix &pix, cfpix &wave0, cfpix &depthpix,
         for(i=istart; i<natom; i++) 
         if( z[i] < zslice ) na++; else break;
 
-        /* calculate transmission function, skip if layer empty */
+        /* calculate transmission function, skip if layer empty
+            - or reuse it if an earlier slice had the same atoms */
         if( na > 0 ) {
-            trlayer( x, y, occ,
-                Znum, na, istart, ax, by, v0, trans,
-                nx, ny, kx2, ky2, &phirms, &nbeams, k2max, 0 );
+            key = ( islice <= (int) sliceRef.size() ) ? sliceRef[islice-1] : -1;
+            ptrans = ( key >= 0 ) ? tcache.get( key, trans ) : NULL;
+            if( NULL == ptrans ) {
+                trlayer( x, y, occ,
+                    Znum, na, istart, ax, by, v0, trans,
+                    nx, ny, kx2, ky2, &phirms, &nbeams, k2max, 0 );
+                ptrans = &trans;
+                if( key >= 0 ) {
+                    tcache.put( key, trans );
+                    phiRef[key] = phirms;
+                }
+            } else phirms = phiRef[key];
    
-            wave *= trans;    //  transmit
+            wave *= *ptrans;    //  transmit
         }
 
         /*  bandwidth limit */
@@ -1310,7 +1411,8 @@ int autoslic::calculatePartial(cfpix &pix, vectorf &param, int multiMode,
         float dfdelt, ransubs& rng )
 {
     int i, ix, iy, nx, ny, nwobble, np, iverbose,
-        nacx,nacy, iqx, iqy, iwobble, ndf, idf, n1, n2, nbout;
+        nacx,nacy, iqx, iqy, iwobble, ndf, idf, n1, n2, nbout,
+        ngroup, iw0, nw, ic;
 
     float wmin, wmax, xmin,xmax, ymin, ymax, zmin, zmax;
     float k2, k2max, scale, v0, wavlen, rx, ry,
@@ -1394,11 +1496,16 @@ int autoslic::calculatePartial(cfpix &pix, vectorf &param, int multiMode,
 
     initAS( param, Znum, natom );  //  init for calculate()
 
+    /*  calculate ngroup configurations at the same time - all at once
+        unless that does not fit in memMB */
+    ngroup = memoryGroup( nwobble, nx, ny, natom, 3, 1, 0 );
+    if( ngroup < 1 ) return( -2 );
+
     /*---- allocate some more arrays and initialize wavefunction ----*/
 
-    wave = new cfpix[ nwobble ];
-    temp = new cfpix[ nwobble ];
-    pixw = new cfpix[ nwobble ];
+    wave = new cfpix[ ngroup ];
+    temp = new cfpix[ ngroup ];
+    pixw = new cfpix[ ngroup ];
     if( (NULL == wave) || (NULL == temp) || (NULL == pixw) ) {
         sbuffer = "Cannot allocate wave,temp,pix array";
         messageAS( sbuffer, 2 );
@@ -1411,14 +1518,14 @@ int autoslic::calculatePartial(cfpix &pix, vectorf &param, int multiMode,
     pixw[0].resize( nx, ny );
     pixw[0].copyInit( wave[0] );
 
-    for( iwobble=1; iwobble<nwobble; iwobble++){
-        wave[iwobble].resize( nx, ny );
-        temp[iwobble].resize( nx, ny );
-        pixw[iwobble].resize( nx, ny );
+    for( ic=1; ic<ngroup; ic++){
+        wave[ic].resize( nx, ny );
+        temp[ic].resize( nx, ny );
+        pixw[ic].resize( nx, ny );
 
-        wave[iwobble].copyInit( wave[0] );
-        temp[iwobble].copyInit( wave[0] );
-        pixw[iwobble].copyInit( wave[0] );
+        wave[ic].copyInit( wave[0] );
+        temp[ic].copyInit( wave[0] );
+        pixw[ic].copyInit( wave[0] );
     }
  
     k2max = nx/(2.0F*ax);
@@ -1470,45 +1577,21 @@ int autoslic::calculatePartial(cfpix &pix, vectorf &param, int multiMode,
     k2maxo = k2maxo*k2maxo;
 
     // for Monte Carlo stuff
-    //  make nwobble set of coord serially so RNG works
-    vector< vector<float> > x2( nwobble, x);
-    vector< vector<float> > y2( nwobble, y);
-    vector< vector<float> > z2( nwobble, z);
-    vector< vector<float> > occ2( nwobble, occ);
-    vector< vector<int> > Znum2( nwobble, Znum);
-    vector< vector<float> > param2( nwobble, param );
-
-    /*  add random thermal displacements scaled by temperature
-            if requested 
-        remember that initial wobble is at 300K for each direction */
+    //  make ngroup set of coord serially so RNG works
+    vector< vector<float> > x2( ngroup, x);
+    vector< vector<float> > y2( ngroup, y);
+    vector< vector<float> > z2( ngroup, z);
+    vector< vector<float> > occ2( ngroup, occ);
+    vector< vector<int> > Znum2( ngroup, Znum);
+    vector< vector<float> > param2( ngroup, param );
 
     np = (int) param.size();
     scale = (float) sqrt(temperature/300.0) ;
 
-    for( iwobble=0; iwobble<nwobble; iwobble++)
-            for( i=0; i<np; i++) param2[iwobble][i] = param[i];
-
-    if( (lwobble == 1) ) {          //  add frozen phonon random displacements
-        for( iwobble=0; iwobble<nwobble; iwobble++) {
-            for( i=0; i<natom; i++) {
-                x2[iwobble][i] = x[i] + (float)(wobble[i]*rng.rangauss()*scale);
-                y2[iwobble][i] = y[i] + (float)(wobble[i]*rng.rangauss()*scale);
-                z2[iwobble][i] = z[i] + (float)(wobble[i]*rng.rangauss()*scale);
-                occ2[iwobble][i] = occ[i];
-                Znum2[iwobble][i] = Znum[i];
-            }
-        }
-    } else {                        //  just copy the original
-        for( i=0; i<natom; i++) {
-            x2[0][i] = x[i];
-            y2[0][i] = y[i];
-            z2[0][i] = z[i];
-            occ2[0][i] = occ[i];
-            Znum2[0][i] = Znum[i];
-        }
-    }
+    for( ic=0; ic<ngroup; ic++)
+            for( i=0; i<np; i++) param2[ic][i] = param[i];
 
-    vector< string > str( nwobble );    //  must have separate string for each thread
+    vector< string > str( ngroup );    //  must have separate string for each thread
 
     //  same constant for all threads so take outside of loop
     if( fabs( (double) sigmaf ) < 1.0 ) n1 = n2 = 0;
@@ -1519,115 +1602,152 @@ int autoslic::calculatePartial(cfpix &pix, vectorf &param, int multiMode,
 
     nillum = 0;
 
-    //---  make separate thread for each TDS configuration
-    //---  multithread-1
-#pragma omp parallel for private(iqx,iqy,qx,qy,qy2,q2,t,ix,iy,tr,ti,wr,wi,alx,aly,idf,xdf,pdf,sum,k2)
-    for( iwobble=0; iwobble<nwobble; iwobble++) {
-        if( (lwobble == 1) && ( echo > 0 ) ) {
-            str[iwobble] = "configuration # " + toString( iwobble+1 );
-           messageAS( str[iwobble] );
+    for( iw0=0; iw0<nwobble; iw0+=nw) {
+
+        nw = nwobble - iw0;
+        if( nw > ngroup ) nw = ngroup;
+
+        /*  add random thermal displacements scaled by temperature
+                if requested 
+            remember that initial wobble is at 300K for each direction */
+
+        if( (lwobble == 1) ) {          //  add frozen phonon random displacements
+            for( ic=0; ic<nw; ic++) {
+                for( i=0; i<natom; i++) {
+                    x2[ic][i] = x[i] + (float)(wobble[i]*rng.rangauss()*scale);
+                    y2[ic][i] = y[i] + (float)(wobble[i]*rng.rangauss()*scale);
+                    z2[ic][i] = z[i] + (float)(wobble[i]*rng.rangauss()*scale);
+                    occ2[ic][i] = occ[i];
+                    Znum2[ic][i] = Znum[i];
+                }
+            }
+        } else {                        //  just copy the original
+            for( i=0; i<natom; i++) {
+                x2[0][i] = x[i];
+                y2[0][i] = y[i];
+                z2[0][i] = z[i];
+                occ2[0][i] = occ[i];
+                Znum2[0][i] = Znum[i];
+            }
         }
-        pixw[iwobble] = 0.0F;
-        //  integrate over the illumination angles
-        for( iqy= -nacy; iqy<=nacy; iqy++) {
-            qy = iqy * ry;
-            qy2 = qy * qy;
+
+        //---  make separate thread for each TDS configuration
+        //---  multithread-1
+#pragma omp parallel for private(iqx,iqy,qx,qy,qy2,q2,t,ix,iy,tr,ti,wr,wi,alx,aly,idf,xdf,pdf,sum,k2,iwobble) if(nw>1)
+        for( ic=0; ic<nw; ic++) {
+            iwobble = iw0 + ic;
+            if( (lwobble == 1) && ( echo > 0 ) ) {
+                str[ic] = "configuration # " + toString( iwobble+1 );
+               messageAS( str[ic] );
+            }
+            pixw[ic] = 0.0F;
+            //  integrate over the illumination angles
+            for( iqy= -nacy; iqy<=nacy; iqy++) {
+                qy = iqy * ry;
+                qy2 = qy * qy;
         
-            for( iqx= -nacx; iqx<=nacx; iqx++) {
-                qx = iqx * rx;
-                q2 = qx*qx + qy2;
+                for( iqx= -nacx; iqx<=nacx; iqx++) {
+                    qx = iqx * rx;
+                    q2 = qx*qx + qy2;
         
-                if( (q2 <= q2max) && (q2 >= q2min) ) {
-                    if( 0 == iwobble) nillum += 1;
-                    for( ix=0; ix<nx; ix++) {
-                        for( iy=0; iy<ny; iy++) {
-                            t = 2.0*pi*( qx*xpos[ix] + qy*ypos[iy] );
-                            wave[iwobble].re(ix,iy) = (float) cos(t);  // real
-                            wave[iwobble].im(ix,iy) = (float) sin(t);  // imag
+                    if( (q2 <= q2max) && (q2 >= q2min) ) {
+                        if( 0 == iwobble) nillum += 1;
+                        for( ix=0; ix<nx; ix++) {
+                            for( iy=0; iy<ny; iy++) {
+                                t = 2.0*pi*( qx*xpos[ix] + qy*ypos[iy] );
+                                wave[ic].re(ix,iy) = (float) cos(t);  // real
+                                wave[ic].im(ix,iy) = (float) sin(t);  // imag
+                            }
                         }
-                    }
 
-                    //-----  transmit thru the specimen with this configuration
-                    iverbose = 0;   //  turn off echo in calculate()
-                    lstart = 1;     //  must start calculate() from this wave
-                    calculate( temp[iwobble], wave[iwobble], depthpix, param2[iwobble], 
-                        multiMode, natom, Znum2[iwobble],
-                        x2[iwobble], y2[iwobble], z2[iwobble],
-                        occ2[iwobble], beams, hbeam, kbeam, nbout,
-                        ycross, iverbose );
+                        //-----  transmit thru the specimen with this configuration
+                        iverbose = 0;   //  turn off echo in calculate()
+                        lstart = 1;     //  must start calculate() from this wave
+                        calculate( temp[ic], wave[ic], depthpix, param2[ic], 
+                            multiMode, natom, Znum2[ic],
+                            x2[ic], y2[ic], z2[ic],
+                            occ2[ic], beams, hbeam, kbeam, nbout,
+                            ycross, iverbose );
+                        if( 1 == nw ) lsameEcho = 0;    //  not in parallel with one config.
           
-                    wave[iwobble] = temp[iwobble];  //  copy back results (not efficient?)
+                        wave[ic] = temp[ic];  //  copy back results (not efficient?)
 
-                    sum = 0.0;
-                    for( ix=0; ix<nx; ix++) {
-                        for( iy=0; iy<ny; iy++)
-                            sum += wave[iwobble].re(ix,iy)*wave[iwobble].re(ix,iy)
-                                + wave[iwobble].im(ix,iy)*wave[iwobble].im(ix,iy);
-                    }
-                    sum = sum / ( ((float)nx) * ((float)ny) );
+                        sum = 0.0;
+                        for( ix=0; ix<nx; ix++) {
+                            for( iy=0; iy<ny; iy++)
+                                sum += wave[ic].re(ix,iy)*wave[ic].re(ix,iy)
+                                    + wave[ic].im(ix,iy)*wave[ic].im(ix,iy);
+                        }
+                        sum = sum / ( ((float)nx) * ((float)ny) );
 
-                    if( (0 == iwobble) && ( echo > 0 ) ) {
-                        str[iwobble]=  "Illum. angle = " + toString(1000.*qx*wavlen) +
-                            ", "+toString(1000.*qy*wavlen) +
-                            " mrad, integ. intensity= "+toString(sum);
-                        messageAS( str[iwobble] );
-                    }
+                        if( (0 == iwobble) && ( echo > 0 ) ) {
+                            str[ic]=  "Illum. angle = " + toString(1000.*qx*wavlen) +
+                                ", "+toString(1000.*qy*wavlen) +
+                                " mrad, integ. intensity= "+toString(sum);
+                            messageAS( str[ic] );
+                        }
             
-                    //-------- integrate over +/- 2.5 sigma of defocus ------------ 
-                    //   should convert to Gauss-Hermite quadrature sometime
-                    wave[iwobble].fft();
-                    if( iwobble == 0 ) sumdf = 0.0F;
+                        //-------- integrate over +/- 2.5 sigma of defocus ------------ 
+                        //   should convert to Gauss-Hermite quadrature sometime
+                        wave[ic].fft();
+                        if( iwobble == 0 ) sumdf = 0.0F;
 
-                    for( idf= n1; idf<=n2; idf++) {
-                        param2[iwobble][pDEFOCUS] = df = df0 + idf*dfdelt;
+                        for( idf= n1; idf<=n2; idf++) {
+                            param2[ic][pDEFOCUS] = df = df0 + idf*dfdelt;
             
-                        for( ix=0; ix<nx; ix++) {
-                            alx = wavlen * kx[ix];  // x component of angle alpha
-                            for( iy=0; iy<ny; iy++) {
-                                aly = wavlen * ky[iy];  // y component of angle alpha
-                                k2 = kx2[ix] + ky2[iy];
-                                if( k2 <= k2maxo ) {
-                                    chi0 = (2.0*pi/wavlen) * chi( param2[iwobble], 
-                                            alx, aly, multiMode );
-                                    tr = (float)  cos(chi0);
-                                    ti = (float) -sin(chi0);
-                                    wr = wave[iwobble].re(ix,iy);
-                                    wi = wave[iwobble].im(ix,iy);
-                                    temp[iwobble].re(ix,iy) = wr*tr - wi*ti;
-                                    temp[iwobble].im(ix,iy) = wr*ti + wi*tr;
-                                } else {
-                                    temp[iwobble].re(ix,iy) = 0.0F;  // real
-                                    temp[iwobble].im(ix,iy) = 0.0F;  // imag
-                                }
-                            }  /*  end for( iy=0... ) */
-                        }   /*  end for( ix=0... ) */
-
-                        temp[iwobble].ifft();
+                            for( ix=0; ix<nx; ix++) {
+                                alx = wavlen * kx[ix];  // x component of angle alpha
+                                for( iy=0; iy<ny; iy++) {
+                                    aly = wavlen * ky[iy];  // y component of angle alpha
+                                    k2 = kx2[ix] + ky2[iy];
+                                    if( k2 <= k2maxo ) {
+                                        chi0 = (2.0*pi/wavlen) * chi( param2[ic], 
+                                                alx, aly, multiMode );
+                                        tr = (float)  cos(chi0);
+                                        ti = (float) -sin(chi0);
+                                        wr = wave[ic].re(ix,iy);
+                                        wi = wave[ic].im(ix,iy);
+                                        temp[ic].re(ix,iy) = wr*tr - wi*ti;
+                                        temp[ic].im(ix,iy) = wr*ti + wi*tr;
+                                    } else {
+                                        temp[ic].re(ix,iy) = 0.0F;  // real
+                                        temp[ic].im(ix,iy) = 0.0F;  // imag
+                                    }
+                                }  /*  end for( iy=0... ) */
+                            }   /*  end for( ix=0... ) */
+
+                            temp[ic].ifft();
             
-                        if( (0==n1) && (0==n2) ) pdf = 1;
-                        else {
-                            xdf = (double) ( (df - df0) /sigmaf );
-                            pdf = (float) exp( -0.5 * xdf*xdf );
-                        }
-                        if( iwobble == 0 ) sumdf += pdf;
+                            if( (0==n1) && (0==n2) ) pdf = 1;
+                            else {
+                                xdf = (double) ( (df - df0) /sigmaf );
+                                pdf = (float) exp( -0.5 * xdf*xdf );
+                            }
+                            if( iwobble == 0 ) sumdf += pdf;
             
-                        for( ix=0; ix<nx; ix++) {
-                            for( iy=0; iy<ny; iy++) {
-                                wr = temp[iwobble].re(ix,iy);
-                                wi = temp[iwobble].im(ix,iy);
-                                pixw[iwobble].re(ix,iy) += pdf* ( wr*wr + wi*wi );
+                            for( ix=0; ix<nx; ix++) {
+                                for( iy=0; iy<ny; iy++) {
+                                    wr = temp[ic].re(ix,iy);
+                                    wi = temp[ic].im(ix,iy);
+                                    pixw[ic].re(ix,iy) += pdf* ( wr*wr + wi*wi );
+                                }
                             }
-                        }
             
-                    }/* end for(idf..) */
+                        }/* end for(idf..) */
 
-                    param2[iwobble][ pDEFOCUS ] = df0;  // return to original value
+                        param2[ic][ pDEFOCUS ] = df0;  // return to original value
 
-                }/* end if( q2...) */
+                    }/* end if( q2...) */
         
-            } /* end for( iqx..) */
-        } /* end for( iqy..) */
-    } /* end for( iwobble...) */
+                } /* end for( iqx..) */
+            } /* end for( iqy..) */
+        } /* end for( ic...) */
+        lsameEcho = 0;      //  only echo the distinct slices once
+
+        //  sum results from each thread in order
+        for( ic=0; ic<nw; ic++) pix += pixw[ic];
+
+    } /* end for( iw0...) */
 
     //----  put these in main calling program if neede
     //sprintf(stemp, "Total number of illumination angle = %ld",
@@ -1636,12 +1756,6 @@ int autoslic::calculatePartial(cfpix &pix, vectorf &param, int multiMode,
     //sprintf(stemp, "Total number of defocus values = %d", 2*ndf+1);
     //messageAS( stemp );
 
-    //  sum results from each thread
-    pix = pixw[0];
-    if( nwobble > 1 ) for( iwobble=1; iwobble<nwobble; iwobble++) {
-        pix += pixw[iwobble];
-    }
-
     // scale the whole sum
     scale = 1.0F / (sumdf *(float)(nillum*nwobble)); 
     for( ix=0; ix<nx; ix++)
@@ -1691,7 +1805,8 @@ int autoslic::calculateCBED_TDS(cfpix &pix, vectorf &param,
         vectorf &x, vectorf &y, vectorf &z, vectorf &occ, vectorf &wobble, ransubs& rng)
 {
     int i, ix, iy, nx, ny, nwobble, iverbose, ismoth,
-         iwobble, npixels, nbout;
+         iwobble, npixels, nbout, ngroup, iw0, nw, ic, lconv, lstop,
+         lsnap, nsnap;
 
     float wmin, wmax, xmin,xmax, ymin, ymax, zmin, zmax;
     float  scale, v0, wavlen, rx, ry, rx2,ry2,
@@ -1699,13 +1814,17 @@ int autoslic::calculateCBED_TDS(cfpix &pix, vectorf &param,
         aobj, temperature, k2maxo;
     float tr, ti, ds;
 
-    double pixel, sum;
+    double pixel, sum, econv;
 
     vectori hbeam, kbeam;
+    vectorf inten;      //  CBED of one configuration for cstat
+    vectorf snapPix, snapParam;     //  snapshot of the running average
 
     cfpix wave0;        // complex probe wave functions
     cfpix *temp;        // complex scratch wave function
 
+    convstat cstat;     //  convergence of phonon average
+
     cfpix depthpix, beams;  //  dummy argument needed for calculate()
 
     probe prb;
@@ -1766,9 +1885,25 @@ int autoslic::calculateCBED_TDS(cfpix &pix, vectorf &param,
 
     initAS( param, Znum, natom );  //  init for calculate()
 
+    /*  calculate ngroup configurations at the same time - all at once
+        unless this stops when the average has converged or writes
+        snapshots of it */
+    lconv = ( (convErr > 0.0) && (lwobble == 1) && (nwobble > 1) ) ? 1 : 0;
+    lsnap = ( (snapFile.length() > 0) && (snapEvery > 0) && (nwobble > 1) ) ? 1 : 0;
+    ngroup = nwobble;
+#ifdef USE_OPENMP
+    if( (1 == lconv) || (1 == lsnap) ) {
+        ngroup = omp_get_max_threads();
+        if( ngroup < 1 ) ngroup = 1;
+        if( ngroup > nwobble ) ngroup = nwobble;
+    }
+#endif
+    ngroup = memoryGroup( ngroup, nx, ny, natom, 1, 2, lconv );
+    if( ngroup < 1 ) return( -2 );
+
     //---- allocate some more arrays and initialize wavefunction ----
 
-    temp = new cfpix[ nwobble ];
+    temp = new cfpix[ ngroup ];
     if( (NULL == temp) ) {
         sbuffer = "Cannot allocate temp array in autoslic.calculateCBED_TDS()";
         messageAS( sbuffer, 2 );
@@ -1777,9 +1912,9 @@ int autoslic::calculateCBED_TDS(cfpix &pix, vectorf &param,
     wave0.resize( nx, ny );
     wave0.init();
 
-    for( iwobble=0; iwobble<nwobble; iwobble++){
-        temp[iwobble].resize( nx, ny );
-        temp[iwobble].copyInit( wave0 );
+    for( ic=0; ic<ngroup; ic++){
+        temp[ic].resize( nx, ny );
+        temp[ic].copyInit( wave0 );
     }
  
     k2maxo = aobj / wavlen;     //  max in obj. aperture
@@ -1805,29 +1940,15 @@ int autoslic::calculateCBED_TDS(cfpix &pix, vectorf &param,
     pix.copyInit( wave0 );
 
     // for Monte Carlo stuff
-    //  make nwobble set of coord serially so RNG works
-    vector< vector<float> > x2( nwobble, x);
-    vector< vector<float> > y2( nwobble, y);
-    vector< vector<float> > z2( nwobble, z);
-    vector< vector<float> > occ2( nwobble, occ);
-    vector< vector<int> > Znum2( nwobble, Znum);
-
-    /*  add random thermal displacements scaled by temperature
-            if requested 
-        remember that initial wobble is at 300K for each direction */
+    //  make ngroup set of coord serially so RNG works
+    vector< vector<float> > x2( ngroup, x);
+    vector< vector<float> > y2( ngroup, y);
+    vector< vector<float> > z2( ngroup, z);
+    vector< vector<float> > occ2( ngroup, occ);
+    vector< vector<int> > Znum2( ngroup, Znum);
 
     scale = (float) sqrt(temperature/300.0) ;
 
-    for( iwobble=0; iwobble<nwobble; iwobble++) {
-        for( i=0; i<natom; i++) {
-            x2[iwobble][i] = x[i] + (float)(wobble[i]*rng.rangauss()*scale);
-            y2[iwobble][i] = y[i] + (float)(wobble[i]*rng.rangauss()*scale);
-            z2[iwobble][i] = z[i] + (float)(wobble[i]*rng.rangauss()*scale);
-            occ2[iwobble][i] = occ[i];
-            Znum2[iwobble][i] = Znum[i];
-        }
-    }
-
     if( 0 == lcbed ) {      // normal elect. diffraction
         wave0 = (float) ( 1.0/sqrt( ( (double)(nx)*((double)ny) ) ) );
     }  else {               //  CBED
@@ -1839,50 +1960,146 @@ int autoslic::calculateCBED_TDS(cfpix &pix, vectorf &param,
         messageAS( sbuffer );
     }
 
-    vector< string > str( nwobble );    //  must have separate string for each thread
+    vector< string > str( ngroup );    //  must have separate string for each thread
+
+    pix = 0.0F;
+    nconfigDone = 0;
+    convHist.clear();
+    convFinal.clear();
+    lstop = 0;
+    if( 1 == lconv ) {
+        cstat.resize( 1, ((size_t)nx)*((size_t)ny) );
+        inten.resize( nx*ny );
+        sbuffer = "stop when the rel. std. error is below " + toString( convErr )
+            + " (after at least " + toString( convMin ) + " and at most "
+            + toString( nwobble ) + " configurations)";
+        messageAS( sbuffer );
+    }
+
+    nsnap = 0;
+    if( 1 == lsnap ) {
+        snapPix.resize( nx*ny );
+        snapParam = param;
+        snapParam[ pDX ] = rx;      //  for FFT space
+        snapParam[ pDY ] = ry;
+        snap.start();
+        sbuffer = "write a snapshot of the CBED to " + snapFile + " after every "
+            + toString( snapEvery ) + " configurations";
+        messageAS( sbuffer );
+    }
 
-    //---  make separate thread for each TDS configuration
-    //---  multithread-1
     iverbose = 0;       //  turn off echo in calculate()
     lstart = 1;         //  must start calculate() from this wave
-#pragma omp parallel for private(ix,iy,tr,ti,sum,ds)
-    for( iwobble=0; iwobble<nwobble; iwobble++) {
-        if( (lwobble == 1) ) {
-            str[iwobble] = "configuration # " + toString( iwobble+1 );
-            messageAS( str[iwobble] );
+    for( iw0=0; iw0<nwobble; iw0+=nw) {
+
+        nw = nwobble - iw0;
+        if( nw > ngroup ) nw = ngroup;
+
+        /*  add random thermal displacements scaled by temperature
+                if requested 
+            remember that initial wobble is at 300K for each direction */
+        for( ic=0; ic<nw; ic++) {
+            for( i=0; i<natom; i++) {
+                x2[ic][i] = x[i] + (float)(wobble[i]*rng.rangauss()*scale);
+                y2[ic][i] = y[i] + (float)(wobble[i]*rng.rangauss()*scale);
+                z2[ic][i] = z[i] + (float)(wobble[i]*rng.rangauss()*scale);
+                occ2[ic][i] = occ[i];
+                Znum2[ic][i] = Znum[i];
+            }
         }
+
+        //---  make separate thread for each TDS configuration
+        //---  multithread-1
+#pragma omp parallel for private(ix,iy,tr,ti,sum,ds,iwobble)
+        for( ic=0; ic<nw; ic++) {
+            iwobble = iw0 + ic;
+            if( (lwobble == 1) ) {
+                str[ic] = "configuration # " + toString( iwobble+1 );
+                messageAS( str[ic] );
+            }
         
-        //-----  transmit thru the specimen with this configuration
-        calculate( temp[iwobble], wave0, depthpix, param, 
-            multiMode, natom, Znum2[iwobble],
-            x2[iwobble], y2[iwobble], z2[iwobble]
-            ,occ2[iwobble], beams, hbeam, kbeam, nbout,
-            ycross, iverbose );
+            //-----  transmit thru the specimen with this configuration
+            calculate( temp[ic], wave0, depthpix, param, 
+                multiMode, natom, Znum2[ic],
+                x2[ic], y2[ic], z2[ic]
+                ,occ2[ic], beams, hbeam, kbeam, nbout,
+                ycross, iverbose );
 
             // convert to diffraction pattern intensity
-            temp[iwobble].fft(); 
+            temp[ic].fft(); 
             sum = 0.0;
             for( ix=0; ix<nx; ix++) for(iy=0; iy<ny; iy++) {
-                tr = temp[iwobble].re(ix,iy);
-                ti = temp[iwobble].im(ix,iy);
-                temp[iwobble].re(ix,iy) = ds = tr*tr + ti*ti;  // intensity in CBED
-                //temp[iwobble].im(ix,iy) = 0.0F;  // should not be needed
+                tr = temp[ic].re(ix,iy);
+                ti = temp[ic].im(ix,iy);
+                temp[ic].re(ix,iy) = ds = tr*tr + ti*ti;  // intensity in CBED
+                //temp[ic].im(ix,iy) = 0.0F;  // should not be needed
                 sum += ds;
             }
-            str[iwobble] = "# " + toString( iwobble+1 )+ " total intensity = " + toString( sum/(nx*ny) );
-            messageAS( str[iwobble] );
+            str[ic] = "# " + toString( iwobble+1 )+ " total intensity = " + toString( sum/(nx*ny) );
+            messageAS( str[ic] );
                    
-     } /* end for( iwobble...) */
+        } /* end for( ic...) */
+        lsameEcho = 0;      //  only echo the distinct slices once
+
+        /*  add intensity of each phonon config to the total in pix in
+            order and check convergence after each one (so the result does
+            not depend on the number of threads) */
+        for( ic=0; ic<nw; ic++) {
+            for( ix=0; ix<nx; ix++) for(iy=0; iy<ny; iy++)
+                pix.re(ix,iy) += temp[ic].re(ix,iy);
+            nconfigDone += 1;
+            if( 1 == lconv ) {
+                for( ix=0; ix<nx; ix++) for(iy=0; iy<ny; iy++)
+                    inten[iy + ix*ny] = temp[ic].re(ix,iy);
+                cstat.add( &inten[0] );
+                if( cstat.nconfig() >= 2 ) {
+                    econv = cstat.relErr( 0 );
+                    convHist.push_back( econv );
+                    sbuffer = "after " + toString( nconfigDone )
+                        + " configurations rel. std. error = " + toString( econv );
+                    messageAS( sbuffer );
+                    if( (nconfigDone >= convMin) && (econv <= convErr) ) {
+                        lstop = 1;
+                        break;
+                    }
+                }
+            }
+        }  /* end for( ic...) */
+        if( 1 == lstop ) break;
+
+        /*  snapshot of the average of the configurations done so far
+            (zero in the center like the final pix) */
+        if( (1 == lsnap) && (iw0+nw < nwobble) && (nconfigDone - nsnap >= snapEvery) ) {
+            nsnap = nconfigDone;
+            for( ix=0; ix<nx; ix++) for(iy=0; iy<ny; iy++)
+                snapPix[ ((iy+ny/2)%ny) + ((ix+nx/2)%nx)*ny ] =
+                    pix.re(ix,iy) / ((float)nconfigDone);
+            snapParam[ pNWOBBLE ] = (float) nconfigDone;
+            snap.add( snapFile, &snapPix[0], nx, ny, rx, ry, snapParam );
+            sbuffer = "snapshot after " + toString( nconfigDone ) + " configurations";
+            messageAS( sbuffer );
+        }
 
-    //  add intensity of each phonon config to the total in pix
-    pix = 0.0F;
-    for( ix=0; ix<nx; ix++) for(iy=0; iy<ny; iy++) {
-        for( iwobble=0; iwobble<nwobble; iwobble++) {
-            pix.re(ix,iy) += temp[iwobble].re(ix,iy);
+    } /* end for( iw0...) */
+
+    if( 1 == lsnap ) snap.stop();   //  wait for the last one to be written
+
+    if( 1 == lconv ) {
+        convFinal.push_back( cstat.relErr( 0 ) );
+        if( 1 == lstop ) {
+            sbuffer = "converged after " + toString( nconfigDone ) + " of "
+                + toString( nwobble ) + " configurations";
+            messageAS( sbuffer, 0 );
+        } else {
+            sbuffer = "warning: not converged after " + toString( nwobble )
+                + " configurations, rel. std. error = " + toString( convFinal[0] );
+            messageAS( sbuffer, 1 );
         }
-        pix.re(ix,iy) = pix.re(ix,iy) / ((float)nwobble);
     }
 
+    for( ix=0; ix<nx; ix++) for(iy=0; iy<ny; iy++)
+        pix.re(ix,iy) = pix.re(ix,iy) / ((float)nconfigDone);
+
     pix.invert2D();  // put zero in the center
     nillum = 1;
 
@@ -1916,6 +2133,8 @@ void autoslic::initAS( vectorf &param, vectori Znum, int natom )
     ctilty = param[ pYCTILT ];
     deltaz = param[ pDELTAZ ];          // slice thickness
     v0 = param[pENERGY];                // electron beam energy in keV
+
+    lsameEcho = 1;      //  echo the distinct slices in the next calculate()
     
     // -------- spatial frequency
     kx.resize( nx );
@@ -1960,6 +2179,18 @@ void autoslic::initAS( vectorf &param, vectori Znum, int natom )
     poten0.resize(nx, ny);
     poten0.init();
 
+    //  scattering factors of each atomic species on the half plane once
+    //    for all slices, configurations and threads in trlayer()
+    fet.init( Znum, natom, kx2, ky2, ny/2+1 );
+
+    if( trTol > 0.0 ) {
+        if( sfg.init( nx, ny, ax, by, trTol ) > 0 ) {
+            sbuffer = "grid the atomic potential of big slices with a Gaussian of half width "
+                + toString( sfg.width() ) + " pixels (accuracy " + toString( trTol ) + ")";
+            messageAS( sbuffer );
+        }
+    }
+
 #ifdef ASL_USE_CUDA
     initCuda();
 #endif
@@ -1984,6 +2215,77 @@ void autoslic::messageAS( std::string &smsg,  int level )
 
 }  // end autoslic::messageAS()
 
+//=============================================================
+/* -------------------  memoryGroup() -------------------
+   estimate the memory of a phonon average, echo the breakdown and
+   return how many configurations can be calculated at the same time
+   in memMB (if > 0)
+
+   nwobble    = max. number of configurations at the same time
+   nx, ny     = size of the wave functions in pixels
+   natom      = number of atoms
+   npixConfig = number of complex nx x ny images for each configuration
+                  (not including the two in calculate())
+   npixShared = number of complex nx x ny images shared by all
+   lconv      = 1 if the convergence statistics are kept
+
+   return the number of configurations (1 to nwobble) or -1 if
+   even one does not fit
+*/
+int autoslic::memoryGroup( int nwobble, int nx, int ny, int natom,
+        int npixConfig, int npixShared, int lconv )
+{
+    int ngroup;
+    double pixMB, perConfig, shared, total;
+
+    const double MB = 1.0/(1024.0*1024.0);
+
+    pixMB = 2.0*sizeof(float)*((double)nx)*((double)ny)*MB;
+
+    //  wave and trans in calculate(), rfpix and sums in trlayer() and
+    //     the displaced coordinates
+    perConfig = (npixConfig + 4)*pixMB + 6.0*sizeof(float)*natom*MB;
+
+    //  cprop, poten0, scattering factors and the convergence statistics
+    shared = (npixShared + 2)*pixMB + sizeof(double)*((double)fet.nZ())*nx*(ny/2+1)*MB;
+    if( 1 == lconv ) shared += (2.0*sizeof(double)+sizeof(float))*nx*((double)ny)*MB;
+
+    ngroup = nwobble;
+    if( (memMB > 0.0) && (shared + ngroup*perConfig > memMB) ) {
+        ngroup = (int) ( (memMB - shared)/perConfig );
+        if( ngroup < 1 ) {
+            sbuffer = "autoslic needs at least " + toString( shared + perConfig )
+                + " MBytes which does not fit in the memory budget of "
+                + toString( memMB ) + " MBytes";
+            messageAS( sbuffer, 2 );
+            return( -1 );
+        }
+    }
+    total = shared + ngroup*perConfig;
+
+    if( echo > 0 ) {
+        sbuffer = "memory plan (MBytes): shared " + toString( shared ) + ", "
+            + toString( ngroup ) + " configuration(s) x " + toString( perConfig )
+            + " = " + toString( total ) + " total";
+        if( memMB > 0.0 ) sbuffer += " (budget " + toString( memMB ) + ")";
+        messageAS( sbuffer );
+        if( ngroup < nwobble ) {
+            sbuffer = "calculate " + toString( ngroup ) 
+                + " phonon configurations at a time to fit the memory budget";
+            messageAS( sbuffer );
+        }
+    }
+    if( (memMB <= 0.0) && (physMemMB() > 0.0) && (total > physMemMB()) ) {
+        sbuffer = "warning: autoslic needs about " + toString( total )
+            + " MBytes which is more than the physical memory ("
+            + toString( physMemMB() ) + " MBytes)";
+        messageAS( sbuffer, 1 );
+    }
+
+    return( ngroup );
+
+}  // end autoslic::memoryGroup()
+
 //=============================================================
 /*--------------------- saveMagnitude() -----------------------*/
 /*
@@ -2089,6 +2391,8 @@ void autoslic::saveMagnitude(cfpix& w, int islice, vectorf& param)
        storing in the array but this is slow and not practical
 
     - keep argument list the same as the old version so the rest of the code is same
+
+    16-oct-2026 sum with a row of phasors in x and y for each atom (sfgrid::direct())
 */
 void autoslic::trlayer(  const vectorf &x, const vectorf &y, const vectorf &occ,
             const vectori &Znum, const int natom, const int istart,
@@ -2097,13 +2401,9 @@ void autoslic::trlayer(  const vectorf &x, const vectorf &y, const vectorf &occ,
             const vectorf &kx2, const vectorf &ky2,
             double *phirms, int *nbeams, const float k2max, const int justPhi  )
 {
-    int j, ix, iy, iatom, Z;
-    const int NZMIN = 1;   // min Z 
-    const int NZMAX = 103; // max Z 
+    int ix, iy, lgrid;
     float k2, scale, wavlen, mm0;
     double vz, sum;
-    double  sumr, sumi, w;
-    vectord fe(NZMAX + 1);  // scatt. factor
 
     rfpix poten(nx, ny);
 
@@ -2116,47 +2416,17 @@ void autoslic::trlayer(  const vectorf &x, const vectorf &y, const vectorf &occ,
     mm0 = (float)(1.0F + kev / 510.99906F);
     scale = ((float)(nx*ny))*wavlen * mm0 / (ax * by);   //  this scale gives (nx*ny)*sigma*V_z(kx,ky)
 
-    for (ix = 0; ix < nx; ix++)      //  sum in k-space
-        for (iy = 0; iy < ny/2+1; iy++) {      // only do half plane for real poten
-
-            poten.re(ix, iy) = 0.0F;    // fill in complex half plane of Fourier transform
-            poten.im(ix, iy) = 0.0F;    //   poten is real so only need half plane
-
-            k2 = kx2[ix] + ky2[iy];
-
-            if (k2 < k2max) {    // might use larger k2max here (no *2/3) ????
-
-                // init scatt. factor to <0 to indicate not yet valid for this kx,ky
-                //   - should always be > 0.0 for real values
-                for (j = 0; j < (NZMAX + 1); j++) fe[j] = -100.0;
-
-                sumr = sumi = 0.0;
-                for (iatom = istart; iatom < (istart + natom); iatom++) {
-
-                    Z = Znum[iatom];
-                    if ((Z < NZMIN) || (Z > NZMAX)) return;
-
-                    // save old values in a look-up-table for repeated Z 
-                    //  - don't repeat featom() calculation - speeds thing up a lot  
-                    if (fe[Z] < 0.0) {
-                        fe[Z] = featom( Z, k2 );  // save scattering factor for this Z and kx,ky
-                    }
-                    w = twopi * (kx[ix] * x[iatom] + ky[iy] * y[iatom] );
-
-                    //  remember: fftw uses the opposite sign convention, 
-                    //     but this still needs to be - to get atoms in right side (not mirrored); why?
-                    sumr += fe[Z] * cos(-w) * occ[iatom];
-                    sumi += fe[Z] * sin(-w) * occ[iatom];
-                    //sumr += fe[Z] * cos(w) * occ[iatom];
-                    //sumi += fe[Z] * sin(w) * occ[iatom];
-
-                }  //end for( iatom...)
-
-                poten.re(ix, iy) = scale * ((float)sumr);  // real part
-                poten.im(ix, iy) = scale * ((float)sumi);  // imag part
-
-            } // end if(k2< ...
-        }   // end for(iy...
+    //  sum only one unit cell of a perfect crystal or grid each
+    //    atomic species if that is faster (big slices)
+    lgrid = 0;
+    if( (0 == lwobble) && (ncellx*ncelly > 1) ) lgrid = sfg.lattice( x, y, occ, Znum,
+        istart, natom, ncellx, ncelly, ax, by, kx, ky, kx2, ky2, k2max, scale, fet, poten );
+    if( (0 == lgrid) && (trTol > 0.0) && sfg.isInit() ) lgrid = sfg.potential( x, y, occ, Znum,
+        istart, natom, kx, ky, kx2, ky2, k2max, scale, fet, poten );
+
+    //  sum over atoms with the phasors of each atom in x and y
+    if( 0 == lgrid ) if( sfg.direct( x, y, occ, Znum, istart, natom,
+        kx, ky, kx2, ky2, k2max, scale, fet, poten ) < natom ) return;
 
     poten.ifft();    //  go back to real space - remember there is /(nx*ny) in ifft()
 
@@ -140,6 +140,21 @@ ANY OTHER PROGRAM).
      anti-aliasing  (remove vzaomtLUT) 30-apr-2024 to 20-may-2024 ejk
   add justPhi argument to trlayer() 25-may-2024 ejk
   fix error in spec coord. generation in cuda version 28-may-2024 ejk
+  add convErr, convMin, nconfigDone, convHist, convFinal to stop the
+     phonon average in calculateCBED_TDS() when it has converged
+     16-oct-2026
+  add memMB and memoryGroup() to limit the phonon configurations
+     calculated at the same time to a memory budget 16-oct-2026
+  add snapFile, snapEvery to write snapshots of the running average
+     of calculateCBED_TDS() 16-oct-2026
+  add trTol to calculate the potential in trlayer() by gridding each
+     atomic species (sfgrid) 16-oct-2026
+  add fet to keep the scattering factors of each atomic species on the
+     grid for trlayer() 16-oct-2026
+  add ncellx, ncelly to sum only one unit cell of a perfect crystal in
+     trlayer() 16-oct-2026
+  use slicecache in calculate() to keep the transmission functions of
+     slices that are the same as a later slice (lsameEcho) 16-oct-2026
 
   ax,by,cz  = unit cell size in x,y
   BW     = Antialiasing bandwidth limit factor
@@ -174,6 +189,10 @@ using namespace std;
 #include "probe.hpp"        //  for CBED
 #include "floatTIFF.hpp"    // file I/O routines in TIFF format - for save saveMagnitude()
 #include "ransubs.hpp"      //  randon number generators
+#include "convstat.hpp"     //  convergence of phonon average
+#include "snapshot.hpp"     //  snapshots of the running average
+#include "sfgrid.hpp"       //  gridded potential for large slices
+#include "slicecache.hpp"   //  to store transmission functions
 
 //#define ASL_USE_CUDA    // define to use nvidia cuda
 
@@ -202,6 +221,42 @@ public:
 
     int nillum;   //  (output) number of illumination angles used
 
+    //  calculateCBED_TDS() stops adding phonon configurations when the
+    //    relative standard error of the CBED (convstat.hpp) is below
+    //    convErr after at least convMin configurations (nwobble is the
+    //    max.) - convErr <= 0 to always do all
+    double convErr;
+    int convMin;
+
+    //  (output) configurations averaged, rel. std. error after each
+    //    (from the 2nd) and at the end (empty if convErr <= 0)
+    int nconfigDone;
+    vectord convHist, convFinal;
+
+    //  memory budget in MBytes (<=0 for none) - calculatePartial() and
+    //    calculateCBED_TDS() do fewer phonon configurations at the same
+    //    time to fit (same result)
+    double memMB;
+
+    //  calculateCBED_TDS() writes a snapshot of the running average
+    //    (zero in the center, linear scale) to snapFile (empty for none)
+    //    after every snapEvery configurations in the background
+    //    (see snapshot.hpp)
+    std::string snapFile;
+    int snapEvery;
+
+    //  if trTol > 0 trlayer() finds the potential of a slice from the
+    //    structure factor of each atomic species by gridding and FFT
+    //    (see sfgrid.hpp) with this relative accuracy when that is faster
+    //    than the direct sum over the atoms - <=0 for the direct sum
+    double trTol;
+
+    //  number of unit cells that ReadXYZcoord() replicated in x,y - if
+    //    ncellx*ncelly > 1 and lwobble=0 trlayer() checks if each slice
+    //    is made of identical unit cells and then only sums the atoms of
+    //    one cell at its reciprocal lattice points (see sfgrid.hpp)
+    int ncellx, ncelly;
+
     //  add random aberration tuning pi/4 errors for 2nd through 5th order
     void abbError(vector<float>& p1, int np, int NPARAM,
         ransubs& rng, int echo, double scale = 1.0);
@@ -241,6 +296,7 @@ public:
 private:
 
         int NZMAX, echo;
+        int lsameEcho;         // echo the number of distinct slices (once)
         float BW, pi, k2max;
         double twopi, ABERR;
 
@@ -248,6 +304,8 @@ private:
 
         cfpix cprop;           // complex propagator in Fourier space
         rfpix poten0;          // r2c FFT for atomic potential
+        sfgrid sfg;            // gridded potential if trTol > 0
+        fetable fet;           // scattering factors on the grid (made once)
         
         void trlayer(const vectorf& x, const vectorf& y, const vectorf& occ,
             const vectori& Znum, const int natom, const int istart,
@@ -260,8 +318,13 @@ private:
 
         std::string sbuffer;
 
+        snapshot snap;      //  writes snapshots in the background
+
         void messageAS( std::string &smsg,  int level = 0 );  // common error message handler
 
+        int memoryGroup( int nwobble, int nx, int ny, int natom,
+            int npixConfig, int npixShared, int lconv );
+
 #ifdef ASL_USE_CUDA
         //  D prefix = on device, and H prefix = on Host
         float *Hcbed, *Dcbed, *Dphimin, *Dphimax;
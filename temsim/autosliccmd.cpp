@@ -143,6 +143,18 @@ ANY OTHER PROGRAM).
      anti-aliasing  (remove vzaomtLUT) 30-apr-2024 to 20-may-2024 ejk
   add warning for non-integer number of slices in a unit cell 1-jun-2024 ejk
   update to ransubs.getStatus() 20-jul-2024 ejk
+  add cmd line options -conv err and -convmin n to stop the phonon
+       average of CBED/diffraction with TDS when it has converged
+       (statistics in file _conv.txt) 16-oct-2026
+  add cmd line option -mem MB to limit the phonon configurations
+       calculated at the same time to a memory budget 16-oct-2026
+  add cmd line option -snap n file to write a snapshot of the running
+       average of CBED/diffraction with TDS every n configurations
+       16-oct-2026
+  add cmd line option -gridpot tol to grid the potential of big slices
+       16-oct-2026
+  pass ncellx, ncelly to autoslic to sum one unit cell of a perfect
+       crystal 16-oct-2026
 
   ax,by,cz  = unit cell size in x,y
   acmin  = minimum illumination angle
@@ -190,7 +202,7 @@ double walltimer;
 
 enum{ TRUE=1, FALSE=0};
 
-int main()
+int main( int argc, char *argv[ ] )
 {
     string filein, fileout, filestart, filebeam, filecross, cline, description;
   
@@ -215,6 +227,12 @@ int main()
     float wmin, wmax, xmin,xmax, ymin, ymax, zmin, zmax;
 
     double timer, deltaz, vz;
+    double convErr;     //  target rel. std. error of phonon average
+    int convMin;        //  min. number of configurations
+    double memMB;       //  memory budget in MBytes
+    int snapEvery;      //  configurations between snapshots
+    string snapFile;    //  snapshot file name
+    double trTol;       //  accuracy of gridded potential
     double sum, rx, ry, ry2;
 
     vector<int> nhist;
@@ -249,6 +267,53 @@ int main()
 #endif
     cout <<  " "  << endl;
 
+    //  options that start with -
+    //       -conv err     = stop adding configurations at this rel. std. error
+    //       -convmin n    = but do at least n configurations
+    //       -mem MB       = fit the phonon configurations into MB MBytes
+    //       -snap n file  = write the running average of the CBED to file
+    //                          after every n configurations
+    //       -gridpot tol  = grid the potential of big slices with this
+    //                          relative accuracy (instead of direct sum)
+    convErr = 0.0;
+    convMin = 4;
+    memMB = 0.0;
+    snapEvery = 0;
+    snapFile = "";
+    trTol = 0.0;
+    for( i=1; i<argc; i++) {
+        cline = argv[i];
+        if( ( cline == "-conv" ) && ( i+1 < argc ) ) {
+            convErr = atof( argv[++i] );
+        } else if( ( cline == "-convmin" ) && ( i+1 < argc ) ) {
+            convMin = atoi( argv[++i] );
+        } else if( ( cline == "-mem" ) && ( i+1 < argc ) ) {
+            memMB = atof( argv[++i] );
+        } else if( ( cline == "-snap" ) && ( i+2 < argc ) ) {
+            snapEvery = atoi( argv[++i] );
+            snapFile = argv[++i];
+        } else if( ( cline == "-gridpot" ) && ( i+1 < argc ) ) {
+            trTol = atof( argv[++i] );
+        }
+    }
+    if( convErr > 0.0 ) {
+        if( convMin < 2 ) convMin = 2;
+        cout << "stop the phonon average of CBED at a rel. std. error of " << convErr
+            << " (at least " << convMin << " configurations)" << endl;
+    }
+    if( memMB > 0.0 ) {
+        cout << "fit the calculation into a memory budget of " << memMB
+            << " MBytes" << endl;
+    } else memMB = 0.0;
+    if( (snapEvery > 0) && (snapFile.length() > 0) ) {
+        cout << "write a snapshot of the CBED to " << snapFile << " every "
+            << snapEvery << " configurations" << endl;
+    } else snapEvery = 0;
+    if( trTol > 0.0 ) {
+        cout << "grid the potential of big slices with a rel. accuracy of "
+            << trTol << endl;
+    } else trTol = 0.0;
+
     pi = (float) (4.0 * atan( 1.0 ));
     NPARAM = myFile.maxParam();
     param.resize( NPARAM );
@@ -544,6 +609,14 @@ int main()
     aslice.lstart = lstart;
     aslice.lwobble = lwobble;
     aslice.lanimate = lanimate;
+    aslice.convErr = convErr;
+    aslice.convMin = convMin;
+    aslice.memMB = memMB;
+    aslice.snapFile = snapFile;
+    aslice.snapEvery = snapEvery;
+    aslice.trTol = trTol;
+    aslice.ncellx = ncellx;
+    aslice.ncelly = ncelly;
 
     //   set calculation parameters (some already set above)
     param[ pAX ] = ax;          // supercell size
@@ -599,20 +672,48 @@ int main()
     } else if( (1 == lpartl) && (0 == lCBED) ) {
         cout << "calculate pix with partial coherence" << endl;
         nbout = 0;
-        aslice.calculatePartial( pix, param, multiMode, natom,
+        status = aslice.calculatePartial( pix, param, multiMode, natom,
                 Znum, x,y,z,occ,wobble, dfdelt, rngAS );
+        if( status < 0 ) exit( EXIT_FAILURE );
     } else if( (1 == lCBED) && (0 == ldiffract) ) {
         cout << "calculate CBED" << endl;
         nbout = 0;
         aslice.lcbed = 1;
-        aslice.calculateCBED_TDS( pix, param, multiMode, natom,
+        status = aslice.calculateCBED_TDS( pix, param, multiMode, natom,
                 Znum, x,y,z,occ,wobble, rngAS );
+        if( status < 0 ) exit( EXIT_FAILURE );
     }else if( (0 == lCBED) && (1 == ldiffract) ) {
         cout << "calcuate diffraction" << endl;
         nbout = 0;
         aslice.lcbed = 0;
-        aslice.calculateCBED_TDS( pix, param, multiMode, natom,
+        status = aslice.calculateCBED_TDS( pix, param, multiMode, natom,
                 Znum, x,y,z,occ,wobble, rngAS );
+        if( status < 0 ) exit( EXIT_FAILURE );
+    }
+
+    /*  convergence of the phonon average (if requested) */
+    if( ( (1 == lCBED) || (1 == ldiffract) ) && ( aslice.convFinal.size() > 0 ) ) {
+        nwobble = aslice.nconfigDone;
+        param[ pNWOBBLE ] = (float) nwobble;
+        cline = fileout;        //  remove extension (if any)
+        if( ( cline.rfind( '.' ) != string::npos ) && ( ( cline.rfind( '/' ) == string::npos )
+            || ( cline.rfind( '.' ) > cline.rfind( '/' ) ) ) )
+            cline = cline.substr( 0, cline.rfind( '.' ) );
+        cline += "_conv.txt";
+        fp.open( cline.c_str() );
+        if( fp.bad() ) {
+            cout << "Cannot open output file " << cline << endl;
+        } else {
+            fp << "C   convergence of phonon average, autoslic version " << version << endl;
+            fp << "C   target rel. std. error = " << convErr << ", used "
+                << nwobble << " configurations" << endl;
+            fp << "C   final rel. std. error = " << aslice.convFinal[0] << endl;
+            fp << "C   configurations, rel. std. error" << endl;
+            for( i=0; i<(int)aslice.convHist.size(); i++)
+                fp << setw(6) << i+2 << " " << setw(14) << aslice.convHist[i] << endl;
+            fp.close();
+            cout << "convergence statistics written to " << cline << endl;
+        }
     }
  
  
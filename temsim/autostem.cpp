@@ -183,6 +183,90 @@ ANY OTHER PROGRAM).
   fix some float/double type def in cuda portion to get rid of warnings
         8-jun-2024 ejk
   add openMP to inner loop in trlayer() to speed it up a little 21-jun-2024  ejk
+  add slice cache so each transmission function is calculated only once
+     per phonon configuration in 2D mode (not once per line) 16-oct-2026
+  add probeBatch() and use one list of probe positions for 1D and 2D
+     that is split into batches sized by memory and number of threads
+     (not by the scan line length) 16-oct-2026
+  calculate several phonon configurations at the same time (nested
+     openMP) each in its own astConfig work space and add them to pixr
+     in order so the result does not depend on the thread split 16-oct-2026
+  add checkpoint/resume: save the partial sums, random number state and
+     a fingerprint of the input to ckptFile every ckptMin minutes (between
+     batches or configurations) and continue from there if lresume=1
+     16-oct-2026
+  add line0,line1,config0,config1 and lshard to calculate only some of
+     the scan lines and configurations (one shard of a larger calculation
+     merged later) and move COM post processing into postImage()
+     16-oct-2026
+  calculate the aberrated aperture function once in calculate() and make
+     each probe in STEMsignals() by multiplying it by separable x and y
+     phase ramps (no chi(), cos(), sin() per pixel per probe) 16-oct-2026
+  use cfpix::mulWindow() for the transmission function of each probe
+     (no periodic wrap test per pixel) 16-oct-2026
+  find the pixels inside each detector once in calculate() (detIndex[],
+     detWeight[]) so STEMsignals() does not need k2, atan2() and the
+     detector limits at every pixel of every probe 16-oct-2026
+  add PRISM mode (lprism, prismF) to make the probes from the exit waves
+     of a few plane waves (the S-matrix) propagated once per
+     configuration 16-oct-2026
+  add cbedFile,cbedBin,cbedMax to save the binned diffraction pattern of
+     every position and thickness (4D-STEM) with a background writer
+     thread (class cbed4d) 16-oct-2026
+  add lnyquist to calculate only the coarsest scan that the objective
+     aperture band limit allows and Fourier interpolate the images to
+     nxout x nyout (fourierUpsample()) 16-oct-2026
+  add convErr,convMin to stop averaging phonon configurations when the
+     estimated relative standard error of every image is small enough
+     (class convstat) 16-oct-2026
+  add lperiodic,periodx,periody to calculate only one period of the scan
+     of a perfect crystal and tile it into the whole image 16-oct-2026
+  add winTol to start each probe in a small window (same pixel size) that
+     grows as the probe spreads with depth (setupWindows(), growWindow())
+     16-oct-2026
+  add condParam,condGroup,condWeight to propagate a series of probe
+     conditions (defocus, aberrations, beam tilt) through the same slices
+     with separate output groups (makeAperture()) 16-oct-2026
+  convolve the final images with the source size param[pSOURCE] in
+     postImage() (sourceSize()) instead of the Monte-Carlo source
+     position that does not converge 16-oct-2026
+  add npipe to calculate the transmission functions of the next slices
+     in one thread while the others propagate the probes (makeSlice())
+     16-oct-2026
+  add memMB and memoryPlan() to print the peak memory and reduce the
+     pipeline, slice cache, configurations and batch size to fit
+     16-oct-2026
+  add snapFile, snapEvery to write snapshots of the running average of
+     the images in the background (writeSnap()) 16-oct-2026
+  add trTol to find the potential of big slices in trlayer() by gridding
+     each atomic species with one FFT each (sfgrid) 16-oct-2026
+  keep the scattering factors on the grid in fet (made once) and make
+     the first call to featom() thread safe 16-oct-2026
+  sum only the atoms of one unit cell at its reciprocal lattice points
+     in trlayer() for a perfect crystal (ncellx, ncelly) 16-oct-2026
+  sum the potential in trlayer() with phasor rows in x and y for each
+     atom in cache sized blocks and one openMP region (sfgrid::direct())
+     16-oct-2026
+  find the slices with the same atoms in projection (a crystal repeated
+     in z without thermal vibrations) and calculate each distinct
+     transmission function once with the slice cache (sliceRef) 16-oct-2026
+  move the final output of autostemcmd.cpp into writeImages(),
+     writePACBED(), writeDetect1D() and writeLine1D() so astmerge
+     writes the same files 16-oct-2026
+  list TOTAL detectors (astdetect) in writeImages() and writeDetect1D()
+     16-oct-2026
+  find |probe|^2 in ADFsignals() in a float buffer of each thread
+     (astConfig::inten, threadScratch()) instead of a new vector per
+     probe and thickness 16-oct-2026
+  keep the signals of each probe condition in astConfig::cdet of each
+     thread instead of a new3D() per probe and thickness 16-oct-2026
+  do all configurations of one batch of positions before the next batch
+     with 4D-STEM output (and more than one configuration) so each pattern
+     is averaged in memory (cbedSum) and written once 16-oct-2026
+  keep windowed probes in real space between slices so the window edge
+     is checked after every propagation (also in slices without atoms)
+     and pad them into astConfig::wfull of each thread (padWindow())
+     for the signals 16-oct-2026
 
     this file is formatted for a TAB size of 4 characters 
 */
@@ -191,6 +275,7 @@ ANY OTHER PROGRAM).
 #include <ctime>  /* ANSI C libraries used */
 
 #include <sstream>      // string streams
+#include <iomanip>      // to format the output
 
 //
 //  to select cuda/GPU code include autostem_cuda.hpp
@@ -213,6 +298,13 @@ extern vector< vector<double> > fparams;  // scattering factor table
 #define USE_OPENMP      // define to use openMP 
 #endif
 
+#ifdef USE_OPENMP
+#include <omp.h>        // to get number of threads
+#define threadNum() ( omp_get_thread_num() )
+#else
+#define threadNum() ( 0 )
+#endif
+
 
 #define MANY_ABERR      //  define to include many aberrations 
 
@@ -233,6 +325,57 @@ autostem::autostem()
         lwobble = l1d = lxzimage = lpacbed = 0;
         doConfocal = xFALSE;
 
+        lcache = 0;
+        cacheMB = 0.0;
+        doCache = xFALSE;
+        nsliceDist = nsliceShare = 0;
+
+        batchMB = 0.0;
+        nprobeBatch = nbatches = 0;
+
+        nconfigPar = 0;
+        nconfigRun = nthreadAll = 1;
+        cfg = NULL;
+
+        ckptFile = "";
+        ckptMin = 10.0;
+        lresume = 0;
+
+        line0 = line1 = config0 = config1 = -1;
+        lshard = 0;
+
+        lprism = 0;
+        prismF = 1;
+
+        cbedFile = "";
+        cbedBin = 1;
+        cbedMax = 0.0;
+        ncbed = 0;
+
+        lnyquist = 0;
+
+        lperiodic = 0;
+        periodx = periody = 0.0;
+
+        winTol = 0.0;
+        npipe = 0;
+        memMB = 0.0;
+        snapFile = "";
+        snapEvery = 0;
+        trTol = 0.0;
+        ncellx = ncelly = 1;
+        batchLimMB = cacheLimMB = 0.0;
+        nconfigLim = npipeRun = 0;
+        nwin = 1;
+        win0 = 0;
+
+        ncond = 1;
+        ngroup = 1;
+
+        convErr = 0.0;
+        convMin = 4;
+        nconfigDone = 0;
+
         return;
 
 }   //  end autostem::autostem()
@@ -350,21 +493,24 @@ int autostem::calculate( vectorf &param, int multiMode, int natomin,
 {
     int ix, iy, i, idetect, iwobble, nwobble,
         nprobes, ip, it, nbeamp, nbeampo, ix2, iy2;
+    int npos, ib, nb, ic, iw0, nw, np, nlevels, iwStart;
+    int nlines, iLine0, iLine1, iwFirst, iwLast, nwRun, ncx, ncy, lconv, lstop;
+    int lsnap, nsnap, ipg, ipg1, nposGroup, lnewcfg, lcbedSum;
+    uint64_t fprint, rngRound, rngGroup;
+    time_t tckpt;
 
-    float prr, pri, temp, temperature;
+    float prr, pri, temperature;
 
-    double scale, sum, wx, w, ***detect,
+    double scale, sum, wx, w, ztop,
        tctx, tcty, dx, dy, ctiltx, ctilty, k2maxa, k2maxb, k2;
+    double kband, perx, pery, econv;
+    float ***pixc, ***pixs, **smin, **smax, source;
 
     //double sourcesize, sourceFWHM;  //  MC source size is not practical
 
-    vectord x, y, sums;
-
-    //  to calculate comi image
-    float axc, byc;
-    cfpix comxpix, comypix, comipix, comdpix;
-    vectorf kxc(nxout), kyc(nyout), kx2c(nxout), ky2c(nyout), xc(nxout), yc(nyout);
-    double k2c;
+    vectord posx, posy;     //  all probe positions
+    vectori posix, posiy;   //  where each position goes in pixr[][][]
+    vectorf cbedSum;        //  4D-STEM patterns of one batch (config. average)
 
     // ---- get setup parameters from param[]
     ax = param[ pAX ];
@@ -381,7 +527,7 @@ int autostem::calculate( vectorf &param, int multiMode, int natomin,
     temperature = param[ pTEMPER ];             // temperature
     nwobble = ToInt( param[ pNWOBBLE ] );       // number config. to average
     deltaz = param[ pDELTAZ ];                  // slice thickness
-    //sourceFWHM = param[ pSOURCE ];              // source size  - doesn't work so not really used
+    source = param[ pSOURCE ];          // source size FWHM (<0 for Lorentzian)
 
     nxprobe = ToInt( param[ pNXPRB ] );  // probe size in pixels
     nyprobe = ToInt( param[ pNYPRB ] );
@@ -401,7 +547,6 @@ int autostem::calculate( vectorf &param, int multiMode, int natomin,
     wavlen = wavelength( keV );
 
     //  this code now works more consistently for both 1D and 2D
-    nprobes = nyout;
     if( nxout < 1 ) {
         sbuffer = "nxout must be > 1 in autostem but it is "+toString(nxout);
         messageAST( sbuffer, 2 );
@@ -412,6 +557,161 @@ int autostem::calculate( vectorf &param, int multiMode, int natomin,
         messageAST( sbuffer, 2 );
         return( -2 );
     }
+    if( (0.0F != source) && (0 != l1d) ) {
+        sbuffer = "warning: the source size is not used in a 1D line scan";
+        messageAST( sbuffer, 1 );
+    }
+
+    /*  periodic scan: without phonons a position that is a whole period
+        away from another gives the same signals so only calculate the
+        first period of the scan and copy it to the rest of the image
+        - the recursive call may still use a Nyquist scan for one period */
+    if( (0 != lperiodic) && (0 == l1d) ) {
+        if( (0 != lshard) || (cbedFile.length() > 0) ) {
+            sbuffer = "autostem::calculate - cannot use a periodic scan with shards"
+                " or 4D-STEM output";
+            messageAST( sbuffer, 2 );
+            return( -12 );
+        }
+        ncx = periodPixels( periodx, xi, xf, nxout );
+        ncy = periodPixels( periody, yi, yf, nyout );
+        if( lwobble != 0 ) {
+            sbuffer = "warning: thermal vibrations break the periodicity,"
+                " calculate the whole scan";
+            messageAST( sbuffer, 1 );
+        } else if( (ncx < 1) || (ncy < 1) ) {
+            sbuffer = "warning: the period " + toString(periodx) + " x "
+                + toString(periody) + " Ang. is not a whole number of scan pixels,"
+                " calculate the whole scan";
+            messageAST( sbuffer, 1 );
+        } else if( (ncx < nxout) || (ncy < nyout) ) {
+            sbuffer = "periodic scan: calculate " + toString(ncx) + " x " + toString(ncy)
+                + " positions and copy them to " + toString(nxout) + " x " + toString(nyout);
+            messageAST( sbuffer, 0 );
+
+            pixc = new3D<float>( nThick*ndetect, ncx, ncy, "pixc" );
+            lperiodic = 0;
+            param[ pSOURCE ] = 0.0F;    //  only convolve the whole image
+            if( snapFile.length() > 0 ) {
+                sbuffer = "warning: no snapshots of a periodic scan";
+                messageAST( sbuffer, 1 );
+            }
+            sbuffer = snapFile;
+            snapFile = "";
+            i = calculate( param, multiMode, natomin, Znum, xa, ya, za, occ, wobble,
+                xi, (nxout > 1) ? xi + (xf-xi)*(ncx-1)/((double)(nxout-1)) : xf,
+                yi, (nyout > 1) ? yi + (yf-yi)*(ncy-1)/((double)(nyout-1)) : yf,
+                ncx, ncy, ThickSave, nThick, almin, almax, collectorMode, ndetect,
+                phiMin, phiMax, pixc, rmin, rmax, pacbedPix, rng );
+            lperiodic = 1;
+            param[ pSOURCE ] = source;
+            snapFile = sbuffer;
+            if( i > 0 ) {
+                for( idetect=0; idetect<nThick*ndetect; idetect++)
+                for( ix=0; ix<nxout; ix++)
+                for( iy=0; iy<nyout; iy++)
+                    pixr[idetect][ix][iy] = pixc[idetect][ix % ncx][iy % ncy];
+                postImage( pixr, rmin, rmax, nxout, nyout, nThick, ndetect,
+                    collectorMode, xi, xf, yi, yf, source );
+                //  same units as a full scan (exact if the scan is a whole
+                //     number of periods)
+                if( lpacbed == xTRUE ) {
+                    w = ((double)nxout*nyout)/((double)ncx*ncy);
+                    for( ix=0; ix<nxprobe; ix++)
+                    for( iy=0; iy<nyprobe; iy++)
+                        pacbedPix[ix][iy] *= (float) w;
+                }
+            }
+            delete3D<float>( pixc, nThick*ndetect, ncx );
+            return( i );
+        }
+    }  /* end if( lperiodic... ) */
+
+    /*  Nyquist limited scan: the STEM signal vs. position is band limited
+        to 2*apert2/wavlen (the autocorrelation of the objective aperture)
+        for every detector so calculate the coarsest grid that samples
+        this band and Fourier interpolate each image to nxout x nyout
+        - this assumes that the image is periodic with the scan size plus
+          one pixel (nxout*dx x nyout*dy) */
+    if( (0 != lnyquist) && (0 == l1d) ) {
+        if( (0 != lshard) || (cbedFile.length() > 0) ) {
+            sbuffer = "autostem::calculate - cannot use a Nyquist scan with shards"
+                " or 4D-STEM output";
+            messageAST( sbuffer, 2 );
+            return( -10 );
+        }
+        kband = 2.0*apert2/wavlen;
+        ncx = nxout;
+        ncy = nyout;
+        perx = pery = 0.0;
+        if( nxout > 1 ) {
+            perx = (xf-xi)*nxout/((double)(nxout-1));
+            ncx = 1 + (int) floor( 2.0*kband*perx );
+            if( ncx > nxout ) ncx = nxout;
+        }
+        if( nyout > 1 ) {
+            pery = (yf-yi)*nyout/((double)(nyout-1));
+            ncy = 1 + (int) floor( 2.0*kband*pery );
+            if( ncy > nyout ) ncy = nyout;
+        }
+        sbuffer = "Nyquist scan: band limit = 2*apert2/wavlen = " + toString(kband)
+            + " 1/Ang., max. scan pixel = " + toString( 0.5/kband ) + " Ang.";
+        messageAST( sbuffer, 0 );
+        if( (ncx < nxout) || (ncy < nyout) ) {
+            sbuffer = "calculate " + toString(ncx) + " x " + toString(ncy)
+                + " positions instead of " + toString(nxout) + " x " + toString(nyout)
+                + " (" + toString( ((double)nxout*nyout)/((double)ncx*ncy) ) + " times fewer)";
+            messageAST( sbuffer, 0 );
+            sbuffer = "assume the image is periodic with period " + toString(perx)
+                + " x " + toString(pery) + " Ang. (scan range + one pixel)";
+            messageAST( sbuffer, 0 );
+            /*  the image repeats with the supercell (and a unit cell of a
+                perfect crystal but not with phonon displacements) */
+            w = perx/ax;
+            sum = pery/by;
+            if( (lwobble == 0) && (w < 1.0) ) w = 1.0/w;
+            if( (lwobble == 0) && (sum < 1.0) ) sum = 1.0/sum;
+            if( (w < 0.999) || (fabs(w-floor(w+0.5)) > 1.0e-3*w)
+               || (sum < 0.999) || (fabs(sum-floor(sum+0.5)) > 1.0e-3*sum) ) {
+                sbuffer = "warning: the scan period is not a multiple of the supercell"
+                    " so the interpolated image may have errors";
+                messageAST( sbuffer, 1 );
+            }
+
+            //  same calculation on the coarse grid (same xi,yi and period)
+            pixc = new3D<float>( nThick*ndetect, ncx, ncy, "pixc" );
+            lnyquist = 0;
+            param[ pSOURCE ] = 0.0F;    //  only convolve the whole image
+            if( snapFile.length() > 0 ) {
+                sbuffer = "warning: no snapshots of a Nyquist scan";
+                messageAST( sbuffer, 1 );
+            }
+            sbuffer = snapFile;
+            snapFile = "";
+            i = calculate( param, multiMode, natomin, Znum, xa, ya, za, occ, wobble,
+                xi, xi + perx*(ncx-1)/((double)ncx), yi, yi + pery*(ncy-1)/((double)ncy),
+                ncx, ncy, ThickSave, nThick, almin, almax, collectorMode, ndetect,
+                phiMin, phiMax, pixc, rmin, rmax, pacbedPix, rng );
+            lnyquist = 1;
+            param[ pSOURCE ] = source;
+            snapFile = sbuffer;
+            if( i > 0 ) {
+                for( idetect=0; idetect<nThick*ndetect; idetect++)
+                    fourierUpsample( pixc[idetect], ncx, ncy, pixr[idetect], nxout, nyout );
+                postImage( pixr, rmin, rmax, nxout, nyout, nThick, ndetect,
+                    collectorMode, xi, xf, yi, yf, source );
+                //  same units as a full scan (sum over all positions)
+                if( lpacbed == xTRUE ) {
+                    w = ((double)nxout*nyout)/((double)ncx*ncy);
+                    for( ix=0; ix<nxprobe; ix++)
+                    for( iy=0; iy<nyprobe; iy++)
+                        pacbedPix[ix][iy] *= (float) w;
+                }
+            }
+            delete3D<float>( pixc, nThick*ndetect, ncx );
+            return( i );
+        }
+    }  /* end if( lnyquist... ) */
 
     if( deltaz < 0.1F ) { 
         sbuffer = "delta z is too small; it is "+toString(deltaz);
@@ -440,13 +740,6 @@ int autostem::calculate( vectorf &param, int multiMode, int natomin,
         }
         sortByZ( xa, ya, za, occ, Znum, natom );
     }
-    /* to add random offsets */
-    xa2.resize( natom );
-    ya2.resize( natom );
-    za2.resize( natom );
-    Znum2.resize( natom );
-    occ2.resize( natom );
-
     /*  check that requested probe size is not bigger 
         than transmission function size (or too small)
     */
@@ -462,6 +755,24 @@ int autostem::calculate( vectorf &param, int multiMode, int natomin,
         messageAST( sbuffer, 0 );
     }
 
+    /*  PRISM beams must be on the transmission function grid and the
+        interpolated probe window must be a whole number of pixels */
+    if( 0 != lprism ) {
+#ifdef AST_USE_CUDA
+        sbuffer = "autostem::calculate - PRISM mode not available in cuda version";
+        messageAST( sbuffer, 2 );
+        return( -8 );
+#endif
+        if( prismF < 1 ) prismF = 1;
+        if( (xTRUE == doConfocal) || ( (nx % nxprobe) != 0 ) || ( (ny % nyprobe) != 0 )
+            || ( (nxprobe % prismF) != 0 ) || ( (nyprobe % prismF) != 0 ) ) {
+            sbuffer = "autostem::calculate - PRISM mode needs nx,ny a multiple of the probe size,"
+                " the probe size a multiple of the interpolation factor and no confocal detector";
+            messageAST( sbuffer, 2 );
+            return( -8 );
+        }
+    }
+
     /*  calculate spatial frequencies for future use
         (one set for transmission function and one for probe
         wavefunction)
@@ -485,6 +796,12 @@ int autostem::calculate( vectorf &param, int multiMode, int natomin,
     freqn( kx, kx2, xp, nx, ax );
     freqn( ky, ky2, yp, ny, by );
 
+#ifndef AST_USE_CUATOMPOT
+    //  scattering factors of each atomic species on the half plane once
+    //    for all slices, configurations and threads in trlayer()
+    if( fet.init( Znum, natom, kx2, ky2, ny/2+1 ) < 0 ) return( -15 );
+#endif
+
     kxp.resize( nxprobe );
     kyp.resize( nyprobe );
     kxp2.resize( nxprobe );
@@ -557,6 +874,92 @@ int autostem::calculate( vectorf &param, int multiMode, int natomin,
         exit( EXIT_FAILURE );
     }
 
+#ifndef AST_USE_CUDA
+    /*  the aberrated aperture function is the same for every probe position
+        - calculate it once here and just shift it in STEMsignals() */
+    makeAperture( param, multiMode, 0.0, 0.0, aperr, aperi );
+
+    /*  probe condition series: the aperture function of each condition
+        (all aberrations) and the normalized weight of each in its group */
+    ncond = ngroup = 1;
+    if( condParam.size() > 0 ) {
+        ncond = (int) condParam.size();
+        ngroup = 0;
+        for( i=0; i<(int)condGroup.size(); i++) {
+            if( condGroup[i] < 0 ) ngroup = -1;
+            if( (ngroup >= 0) && (condGroup[i] >= ngroup) ) ngroup = condGroup[i] + 1;
+        }
+        if( ((int)condGroup.size() != ncond) || ((int)condWeight.size() != ncond)
+            || (ngroup < 1) || ( (ndetect % ngroup) != 0 ) || (0 != lprism)
+            || (xTRUE == doConfocal) || (cbedFile.length() > 0) ) {
+            sbuffer = "autostem::calculate - probe conditions need a group >= 0 and weight"
+                " for each, the detectors repeated for each group and no PRISM,"
+                " confocal detectors or 4D-STEM output";
+            messageAST( sbuffer, 2 );
+            return( -13 );
+        }
+        condW.assign( ncond, 0.0 );
+        vectord gsum( ngroup, 0.0 );
+        for( i=0; i<ncond; i++) gsum[ condGroup[i] ] += condWeight[i];
+        for( i=0; i<ncond; i++) {
+            if( gsum[ condGroup[i] ] <= 0.0 ) {
+                sbuffer = "autostem::calculate - the weights of probe condition group "
+                    + toString( condGroup[i] ) + " do not add up to > 0";
+                messageAST( sbuffer, 2 );
+                return( -13 );
+            }
+            condW[i] = condWeight[i] / gsum[ condGroup[i] ];
+        }
+        condAperr.resize( ncond );
+        condAperi.resize( ncond );
+        for( i=0; i<ncond; i++)
+            makeAperture( condParam[i], 1, condParam[i][pXBTILT], condParam[i][pYBTILT],
+                condAperr[i], condAperi[i] );
+        sbuffer = "calculate " + toString( ncond ) + " probe conditions for each position"
+            " in the same slices (" + toString( ngroup ) + " output groups)";
+        messageAST( sbuffer, 0 );
+    }
+
+    /*  PRISM beams = every prismF-th probe pixel (in x and y) inside the
+        objective aperture and the propagator for the whole specimen */
+    prismBx.clear();
+    prismBy.clear();
+    if( 0 != lprism ) {
+        ix2 = (int) ( nxprobe/2.0 + 0.5);   //  as in freqn()
+        iy2 = (int) ( nyprobe/2.0 + 0.5);
+        for( ix=0; ix<nxprobe; ix++) {
+            if( ( ( (ix > ix2) ? (ix-nxprobe) : ix ) % prismF ) != 0 ) continue;
+            for( iy=0; iy<nyprobe; iy++) {
+                if( ( ( (iy > iy2) ? (iy-nyprobe) : iy ) % prismF ) != 0 ) continue;
+                i = iy + ix*nyprobe;
+                if( (aperr[i] != 0.0) || (aperi[i] != 0.0) ) {
+                    prismBx.push_back( ix );
+                    prismBy.push_back( iy );
+                }
+            }
+        }
+        cpropS.resize( nx, ny );
+        scale = pi * deltaz;
+        for( ix=0; ix<nx; ix++) {
+            wx = ( kx2[ix]*wavlen - kx[ix]*tctx );
+            for( iy=0; iy<ny; iy++) {
+                if( (kx2[ix] + ky2[iy]) < k2maxp ) {
+                    w = scale * ( wx + ky2[iy]*wavlen - ky[iy]*tcty );
+                    cpropS.re(ix,iy) = (float)  cos(w);
+                    cpropS.im(ix,iy) = (float) -sin(w);
+                } else {
+                    cpropS.re(ix,iy) = 0.0F;
+                    cpropS.im(ix,iy) = 0.0F;
+                }
+            }
+        }
+        w = 8.0*((double)nx)*((double)ny)*prismBx.size()*(nThick+1)/(1024.0*1024.0);
+        sbuffer = "PRISM with " + toString( (int) prismBx.size() ) + " beams (interpolation factor "
+            + toString( prismF ) + ", S-matrix " + toString( w ) + " MBytes per configuration)";
+        messageAST( sbuffer, 0 );
+    }
+#endif
+
     /*  convert aperture dimensions */
 
     k2min.resize( ndetect );
@@ -580,48 +983,334 @@ int autostem::calculate( vectorf &param, int multiMode, int natomin,
         }
     }
 
+#ifndef AST_USE_CUDA
+    /*  list the pixels inside each detector in the same order as they
+        were summed before so the signals do not change
+        - changed detector limits to >= min and < max
+           so many concentric ADF detectors sum correctly 7-jul-2011 */
+    detIndex.resize( ndetect );
+    detWeight.resize( ndetect );
+    for( idetect=0; idetect<ndetect; idetect++) {
+        detIndex[idetect].clear();
+        detWeight[idetect].clear();
+        for( ix=0; ix<nxprobe; ix++) {
+            for( iy=0; iy<nyprobe; iy++) {
+                k2 = kxp2[ix] + kyp2[iy];
+                if( (k2 < k2min[idetect]) || (k2 >= k2max[idetect]) ) continue;
+                if( ADF == collectorMode[idetect] ) {
+                    w = 1.0;
+                } else if( ADF_SEG == collectorMode[idetect] ) {
+                    w = atan2( kyp[iy], kxp[ix] );
+                    if( (w < phiMin[idetect]) || (w >= phiMax[idetect]) ) continue;
+                    w = 1.0;
+                } else if( COMX == collectorMode[idetect] ) {
+                    w = kxp[ix];
+                } else if( COMY == collectorMode[idetect] ) {
+                    w = kyp[iy];
+                } else continue;    //  confocal done separately
+                detIndex[idetect].push_back( iy + ix*nyprobe );
+                detWeight[idetect].push_back( w );
+            }
+        }
+    }  /* end for(idetect...) */
+
+    /*  4D-STEM pattern = center (+/- cbedMax) of the probe grid binned by
+        cbedBin with zero freq. near the middle (like invert2D()) */
+    ncbed = 0;
+    cbedIndex.clear();
+    if( cbedFile.length() > 0 ) {
+        if( cbedBin < 1 ) cbedBin = 1;
+        dx = ax*((double)nxprobe)/nx;       //  probe size in Ang.
+        dy = by*((double)nyprobe)/ny;
+        ix2 = nxprobe/2;
+        iy2 = nyprobe/2;
+        if( cbedMax > 0.0 ) {       //  number of freq. to keep on each side
+            ix = (int) ceil( 0.001*cbedMax*dx/wavlen );
+            iy = (int) ceil( 0.001*cbedMax*dy/wavlen );
+            if( ix < ix2 ) ix2 = ix;
+            if( iy < iy2 ) iy2 = iy;
+        }
+        c4d.nkx = (2*ix2)/cbedBin;
+        c4d.nky = (2*iy2)/cbedBin;
+        if( c4d.nkx < 1 ) c4d.nkx = 1;
+        if( c4d.nky < 1 ) c4d.nky = 1;
+        ix2 = (c4d.nkx*cbedBin)/2;          //  offset of zero freq.
+        iy2 = (c4d.nky*cbedBin)/2;
+        ncbed = c4d.nkx * c4d.nky;
+        cbedIndex.resize( nxprobe*nyprobe );
+        for( ix=0; ix<nxprobe; ix++) {
+            i = ( ix > (int)( nxprobe/2.0 + 0.5) ) ? (ix-nxprobe) : ix;     //  as in freqn()
+            i += ix2;
+            for( iy=0; iy<nyprobe; iy++) {
+                it = ( iy > (int)( nyprobe/2.0 + 0.5) ) ? (iy-nyprobe) : iy;
+                it += iy2;
+                if( (i >= 0) && (i < c4d.nkx*cbedBin) && (it >= 0) && (it < c4d.nky*cbedBin) )
+                    cbedIndex[iy + ix*nyprobe] = (i/cbedBin)*c4d.nky + it/cbedBin;
+                else cbedIndex[iy + ix*nyprobe] = -1;
+            }
+        }
+        c4d.nbin = cbedBin;
+        c4d.dkx = cbedBin/dx;
+        c4d.dky = cbedBin/dy;
+        c4d.wavlen = wavlen;
+    }
+#endif
+
     /*  init the min/max record of total integrated intensity */
 
     totmin =  10.0;
     totmax = -10.0;
-    detect  = new3D<double>( nThick, ndetect, nprobes,
-        "detect" );
-    sums.resize( nprobes ); 
-
-    // allocate probe wave function and transmission function arrays
 
-#ifndef AST_USE_CUATOMPOT
-    //(should also not be defined when not using cuda)
-    //  do init only once here so it can be reused many times later in a thread safe manner
-    poten0.resize(nx, ny);    //  add 4-jun-2024 ejk
-    poten0.init();
+    /*  range of scan lines (x in 2D, position in 1D) and configurations
+        - all of them unless this is one shard of a larger calculation */
+    nlines = ( l1d == 0 ) ? nxout : nyout;
+    iLine0 = ( line0 < 0 ) ? 0 : line0;
+    iLine1 = ( (line1 < 0) || (line1 > nlines) ) ? nlines : line1;
+    iwFirst = ( config0 < 0 ) ? 0 : config0;
+    iwLast = ( (config1 < 0) || (config1 > nwobble) ) ? nwobble : config1;
+    if( (iLine0 >= iLine1) || (iwFirst >= iwLast) ) {
+        sbuffer = "autostem::calculate - empty range of lines or configurations";
+        messageAST( sbuffer, 2 );
+        return( -7 );
+    }
+    nwRun = iwLast - iwFirst;
+    if( (0 != lshard) && (ckptFile.length() < 1) ) {
+        sbuffer = "autostem::calculate - need a file for the partial sums of a shard";
+        messageAST( sbuffer, 2 );
+        return( -7 );
+    }
+    if( (cbedFile.length() > 0) && (ckptFile.length() > 0) ) {
+        sbuffer = "autostem::calculate - cannot save 4D-STEM data with checkpoints or shards";
+        messageAST( sbuffer, 2 );
+        return( -9 );
+    }
+#ifdef AST_USE_CUDA
+    if( cbedFile.length() > 0 ) {
+        sbuffer = "autostem::calculate - 4D-STEM output not available in cuda version";
+        messageAST( sbuffer, 2 );
+        return( -9 );
+    }
 #endif
 
-#ifndef AST_USE_CUDA
-    probe = new cfpix[ nprobes ];
-    if( NULL == probe ) {
-        sbuffer = "autostem::calculate - Cannot allocate probe array";
+    /*  stop early when the phonon average has converged
+        - the weight of each configuration is only known at the end
+          so not with partial sums in a file */
+    lconv = ( (convErr > 0.0) && (lwobble == 1) && (nwRun > 1) ) ? xTRUE : xFALSE;
+    if( (xTRUE == lconv) && ( (ckptFile.length() > 0) || (cbedFile.length() > 0) ) ) {
+        sbuffer = "autostem::calculate - cannot stop at convergence with checkpoints,"
+            " shards or 4D-STEM output";
         messageAST( sbuffer, 2 );
-        exit( EXIT_FAILURE );
+        return( -11 );
     }
-    ix = probe[0].resize(nxprobe, nyprobe );
-    if( ix < 0 ) {
-        sbuffer = "autostem::calculate - Cannot allocate probe array storage";
+    nconfigDone = nwRun;
+    convHist.clear();
+    convFinal.clear();
+
+    /*  list all probe positions and where they go in pixr[][][]
+        - a 2D image is listed line by line so nearby positions 
+          are in the same batch, 1D is one line from (xi,yi) to (xf,yf) */
+    if( l1d == 0 ) {
+        npos = (iLine1 - iLine0) * nyout;
+        if( nxout > 1 ) dx = (xf-xi)/((double)(nxout-1));
+        else dx = 1.0;
+        if( nyout > 1 ) dy = (yf-yi)/((double)(nyout-1));
+        else dy = 1.0;
+    } else {
+        npos = iLine1 - iLine0;
+        if( nyout > 1 ) dx = (xf-xi)/((double)(nyout-1));
+        else dx = 1.0;
+        if( nyout > 1 ) dy = (yf-yi)/((double)(nyout-1));
+        else dy = 1.0;
+    }
+    posx.resize( npos );
+    posy.resize( npos );
+    posix.resize( npos );
+    posiy.resize( npos );
+    for( ip=0; ip<npos; ip++) {
+        if( l1d == 0 ) {
+            posix[ip] = ix = iLine0 + ip / nyout;
+            posiy[ip] = iy = ip % nyout;
+        } else {
+            posix[ip] = 0;
+            posiy[ip] = ix = iy = iLine0 + ip;
+        }
+        posx[ip] = xi + dx * ((double) ix);
+            //  + sourcesize * rng.rangauss();  - does not converge well
+        posy[ip] = yi + dy * ((double) iy);
+            //  + sourcesize * rng.rangauss();  - does not converge well
+        posx[ip] = periodic( posx[ip], ax );   /* put back in supercell */
+        posy[ip] = periodic( posy[ip], by );   /* if necessary */
+    }
+
+    /*  number of probes to propagate at the same time
+        and number of configurations to calculate at the same time */
+#ifdef AST_USE_CUDA
+    if( condParam.size() > 0 ) {
+        sbuffer = "autostem::calculate - probe conditions not available in cuda version";
         messageAST( sbuffer, 2 );
-        exit( EXIT_FAILURE );
+        return( -13 );
     }
-    probe[0].init();
-    if( nprobes > 1 ) for( ip=1; ip<nprobes; ip++){
-        ix = probe[ip].resize(nxprobe, nyprobe );
-        if( ix < 0 ) {
-            sbuffer = "autostem::calculate - Cannot allocate probe array storage";
-            messageAST( sbuffer, 2 );
-            exit( EXIT_FAILURE );    //  should do something better here ??
+#endif
+
+    /*  slices with the same atoms in projection (a crystal repeated in z)
+        have the same transmission function so find them to only
+        calculate each distinct one (same slices as STEMsignals())
+        - keep them in the slice cache (below) */
+    sliceRef.clear();
+    nsliceDist = nsliceShare = 0;
+#ifndef AST_USE_CUDA
+    if( (0 == lwobble) && (0 == lprism) ) {
+        int na, istart, nsl;
+        vectori sliceStart, sliceNa, nuse;
+        ztop = ( za[natom-1] > cz ) ? za[natom-1] : cz;
+        istart = 0;
+        for( w=0.75*deltaz; (w < (ztop+0.25*deltaz)) || (istart<natom); w+=deltaz ) {
+            na = 0;
+            for(i=istart; i<natom; i++)
+                if( za[i] < w ) na++; else break;
+            sliceStart.push_back( istart );
+            sliceNa.push_back( na );
+            istart += na;
         }
-        probe[ip].copyInit( probe[0] );
+        sameSlice( xa, ya, occ, Znum, sliceStart, sliceNa, sliceRef );
+        nsl = (int) sliceRef.size();
+        nuse.assign( nsl, 0 );
+        for( i=0; i<nsl; i++) if( sliceNa[i] > 0 ) nuse[ sliceRef[i] ] += 1;
+        for( i=ix=0; i<nsl; i++) {
+            if( nuse[i] > 0 ) nsliceDist++;
+            if( nuse[i] > 1 ) nsliceShare++;
+            if( sliceNa[i] > 0 ) ix++;
+        }
+        if( nsliceDist < ix ) {
+            sbuffer = toString( ix ) + " slices with atoms but only " + toString( nsliceDist )
+                + " are different: calculate " + toString( ix - nsliceDist )
+                + " fewer transmission functions per configuration ("
+                + toString( 100.0*(ix-nsliceDist)/ix ) + "%)";
+        } else {
+            sbuffer = "all " + toString( ix ) + " slices are different";
+            sliceRef.clear();
+            nsliceDist = nsliceShare = 0;
+        }
+        messageAST( sbuffer, 0 );
     }
+#endif
 
-#elif defined(AST_USE_CUDA)
+    if( memoryPlan( npos, nThick, ndetect, nwRun, nxout, nyout, za ) < 0 ) return( -14 );
+    nprobes = probeBatch( npos, nThick, ndetect, nwRun );
+
+    /*  fingerprint of everything that changes the result so a checkpoint
+        is only used for the same calculation (not the thread/batch split)
+        - same for all shards of one calculation so they can be merged */
+    iwStart = iwFirst;
+    if( ckptFile.length() > 0 ) {
+        fprint = 0;
+        astpartial::hash( fprint, &param[0], param.size()*sizeof(float) );
+        astpartial::hash( fprint, &multiMode, sizeof(int) );
+        astpartial::hash( fprint, &natom, sizeof(int) );
+        astpartial::hash( fprint, &Znum[0], natom*sizeof(int) );
+        astpartial::hash( fprint, &xa[0], natom*sizeof(float) );
+        astpartial::hash( fprint, &ya[0], natom*sizeof(float) );
+        astpartial::hash( fprint, &za[0], natom*sizeof(float) );
+        astpartial::hash( fprint, &occ[0], natom*sizeof(float) );
+        astpartial::hash( fprint, &wobble[0], natom*sizeof(float) );
+        astpartial::hash( fprint, &xi, sizeof(double) );
+        astpartial::hash( fprint, &xf, sizeof(double) );
+        astpartial::hash( fprint, &yi, sizeof(double) );
+        astpartial::hash( fprint, &yf, sizeof(double) );
+        astpartial::hash( fprint, &nxout, sizeof(int) );
+        astpartial::hash( fprint, &nyout, sizeof(int) );
+        astpartial::hash( fprint, &ThickSave[0], nThick*sizeof(double) );
+        astpartial::hash( fprint, &almin[0], ndetect*sizeof(double) );
+        astpartial::hash( fprint, &almax[0], ndetect*sizeof(double) );
+        astpartial::hash( fprint, &collectorMode[0], ndetect*sizeof(int) );
+        astpartial::hash( fprint, &phiMin[0], ndetect*sizeof(double) );
+        astpartial::hash( fprint, &phiMax[0], ndetect*sizeof(double) );
+        astpartial::hash( fprint, &lwobble, sizeof(int) );
+        astpartial::hash( fprint, &l1d, sizeof(int) );
+        astpartial::hash( fprint, &lpacbed, sizeof(int) );
+        if( 0 != lprism ) astpartial::hash( fprint, &prismF, sizeof(int) );
+        astpartial::hash( fprint, &winTol, sizeof(double) );
+        astpartial::hash( fprint, &trTol, sizeof(double) );
+        astpartial::hash( fprint, &ncellx, sizeof(int) );
+        astpartial::hash( fprint, &ncelly, sizeof(int) );
+        for( i=0; i<(int)condParam.size(); i++) {
+            astpartial::hash( fprint, &condParam[i][0], condParam[i].size()*sizeof(float) );
+            astpartial::hash( fprint, &condGroup[i], sizeof(int) );
+            astpartial::hash( fprint, &condWeight[i], sizeof(double) );
+        }
+
+        ckpt.clear();
+        if( 0 != lresume ) {
+            i = ckpt.read( ckptFile );
+            if( -1 == i ) {
+                sbuffer = "cannot open checkpoint file " + ckptFile
+                    + ", start from the beginning";
+                messageAST( sbuffer, 0 );
+                ckpt.clear();
+            } else if( (i < 0) || (ckpt.fingerprint != fprint)
+                || (ckpt.nThick != nThick) || (ckpt.ndetect != ndetect)
+                || (ckpt.npos != npos) || (ckpt.nwobble != nwobble)
+                || (ckpt.line0 != iLine0) || (ckpt.line1 != iLine1)
+                || (ckpt.config0 != iwFirst) || (ckpt.config1 != iwLast)
+                || (ckpt.nconfig < iwFirst) || (ckpt.nconfig > iwLast)
+                || (ckpt.nposDone >= npos)
+                || ( (lpacbed == xTRUE) && (l1d == 0) &&
+                      ( (ckpt.nxprobe != nxprobe) || (ckpt.nyprobe != nyprobe) ) ) ) {
+                sbuffer = "checkpoint file " + ckptFile
+                    + " does not match this calculation, cannot resume";
+                messageAST( sbuffer, 2 );
+                return( -6 );
+            } else {
+                iwStart = ckpt.nconfig;
+                sbuffer = "resume from checkpoint file " + ckptFile + " after "
+                    + toString( ckpt.nconfig - iwFirst ) + " configurations";
+                if( ckpt.nposDone > 0 ) sbuffer += " and " + toString( ckpt.nposDone )
+                    + " positions";
+                messageAST( sbuffer, 0 );
+            }
+        }
+        ckpt.fingerprint = fprint;
+        ckpt.nThick = nThick;
+        ckpt.ndetect = ndetect;
+        ckpt.nxout = ( l1d == 0 ) ? nxout : 1;
+        ckpt.nyout = nyout;
+        ckpt.nxprobe = nxprobe;
+        ckpt.nyprobe = nyprobe;
+        ckpt.nwobble = nwobble;
+        ckpt.l1d = l1d;
+        ckpt.npos = npos;
+        ckpt.line0 = iLine0;
+        ckpt.line1 = iLine1;
+        ckpt.config0 = iwFirst;
+        ckpt.config1 = iwLast;
+        ckpt.seed = rng.getInitSeed();
+        ckpt.xi = xi;
+        ckpt.xf = xf;
+        ckpt.yi = yi;
+        ckpt.yf = yf;
+        ckpt.param = param;
+        ckpt.thick.assign( ThickSave.begin(), ThickSave.begin()+nThick );
+        ckpt.almin.assign( almin.begin(), almin.begin()+ndetect );
+        ckpt.almax.assign( almax.begin(), almax.begin()+ndetect );
+        ckpt.phimin.assign( phiMin.begin(), phiMin.begin()+ndetect );
+        ckpt.phimax.assign( phiMax.begin(), phiMax.begin()+ndetect );
+        ckpt.mode.assign( collectorMode.begin(), collectorMode.begin()+ndetect );
+    }
+
+#ifndef AST_USE_CUATOMPOT
+    //(should also not be defined when not using cuda)
+    //  do init only once here so it can be reused many times later in a thread safe manner
+    poten0.resize(nx, ny);    //  add 4-jun-2024 ejk
+    poten0.init();
+    if( trTol > 0.0 ) {
+        if( sfg.init( nx, ny, ax, by, trTol ) < 0 ) return( -15 );
+        sbuffer = "grid the atomic potential of big slices with a Gaussian of half width "
+            + toString( sfg.width() ) + " pixels (accuracy " + toString( trTol ) + ")";
+        messageAST( sbuffer, 0 );
+    }
+#endif
+
+#ifdef AST_USE_CUDA
 
     // ------- cuda setup -------------------
 
@@ -807,320 +1496,626 @@ int autostem::calculate( vectorf &param, int multiMode, int natomin,
 
 #endif
 
-    trans.resize( nx, ny );
-    trans.init();
+    /*  work space for each configuration calculated at the same time
+        - make FFTW plans here (not thread safe) and copy them later */
+    cfg = new astConfig[ nconfigRun ];
+    for( ic=0; ic<nconfigRun; ic++) {
+        astConfig &cf = cfg[ic];
+        cf.xa2.resize( natom );     /* to add random offsets */
+        cf.ya2.resize( natom );
+        cf.za2.resize( natom );
+        cf.Znum2.resize( natom );
+        cf.occ2.resize( natom );
+        cf.nslice = 0;
+        cf.nbeamt = 0;
+        cf.trans.resize( nx, ny );
+        if( 0 == ic ) cf.trans.init();
+        else cf.trans.copyInit( cfg[0].trans );
+        cf.detect = new3D<double>( nThick, ndetect, nprobes, "detect" );
+        cf.sums.resize( nprobes );
+        cf.x.resize( nprobes );
+        cf.y.resize( nprobes );
+        cf.pixc.resize( npos*nThick*ndetect );
+        if( lpacbed == xTRUE ) cf.pacbedc.resize( nxprobe*nyprobe );
+        cf.ipos0 = 0;
+        cf.probe = NULL;
+        cf.smat = NULL;
+        cf.ring = NULL;
+        cf.cdet = NULL;
+        cf.ncdet = 0;
+        cf.wfull = NULL;
+        cf.nwfull = 0;
+        cf.lsmat = xFALSE;
+#ifndef AST_USE_CUDA
+        cf.probe = new cfpix[ nprobes*ncond ];     //  all conditions of each position
+        if( NULL == cf.probe ) {
+            sbuffer = "autostem::calculate - Cannot allocate probe array";
+            messageAST( sbuffer, 2 );
+            exit( EXIT_FAILURE );
+        }
+        for( ip=0; ip<nprobes*ncond; ip++){
+            ix = cf.probe[ip].resize(nxprobe, nyprobe );
+            if( ix < 0 ) {
+                sbuffer = "autostem::calculate - Cannot allocate probe array storage";
+                messageAST( sbuffer, 2 );
+                exit( EXIT_FAILURE );    //  should do something better here ??
+            }
+            if( (0 == ic) && (0 == ip) ) cf.probe[0].init();
+            else cf.probe[ip].copyInit( cfg[0].probe[0] );
+        }
+        //  ring of slices calculated ahead for the pipeline
+        if( (npipeRun > 0) && (0 == lprism) ) {
+            cf.ring = new cfpix[ npipeRun+1 ];
+            for( i=0; i<=npipeRun; i++) {
+                cf.ring[i].resize( nx, ny );
+                cf.ring[i].copyInit( cfg[0].trans );
+            }
+        }
+#endif
+    }  /* end for( ic... */
+    if( NULL != cfg[0].ring ) {
+        sbuffer = "pipeline: calculate up to " + toString( npipeRun )
+            + " slices ahead of the probes in one thread";
+        messageAST( sbuffer, 0 );
+    }
+
+    /*  4D-STEM output file - written while calculating */
+    if( cbedFile.length() > 0 ) {
+        c4d.nThick = nThick;
+        c4d.nxout = ( l1d == 0 ) ? nxout : 1;
+        c4d.nyout = nyout;
+        c4d.thick.assign( ThickSave.begin(), ThickSave.begin()+nThick );
+        c4d.xi = xi;
+        c4d.xf = xf;
+        c4d.yi = yi;
+        c4d.yf = yf;
+        if( c4d.open( cbedFile ) < 0 ) {
+            freeConfigs( nThick, ndetect );
+            return( -9 );
+        }
+        for( ic=0; ic<nconfigRun; ic++) cfg[ic].cbed.resize( nThick*nprobes*ncbed );
+        sbuffer = "save " + toString( c4d.nkx ) + " x " + toString( c4d.nky )
+            + " pixel diffraction patterns in " + cbedFile;
+        messageAST( sbuffer, 0 );
+    }
+
+#ifndef AST_USE_CUDA
+    setupWindows();
+#endif
+
+    /*  setup the slice cache - only useful if the same slices
+        are used for more than one batch (one STEMsignals() per batch)
+        or the same slice is used more than once in the specimen
+        (then each distinct slice only has one place in the cache) */
+    doCache = xFALSE;
+#ifndef AST_USE_CUDA
+    if( ( (0 != lcache) && (nbatches > 1) && (0 == lprism) ) || (nsliceShare > 0) ) {
+        doCache = xTRUE;
+        if( (0 == lcache) || (nbatches < 2) ) {
+            //  only keep the slices that are used again (-1 = do not keep)
+            vectori nuse( sliceRef.size(), 0 );
+            for( i=0; i<(int)sliceRef.size(); i++) nuse[ sliceRef[i] ] += 1;
+            for( i=0; i<(int)sliceRef.size(); i++)
+                if( nuse[ sliceRef[i] ] < 2 ) sliceRef[i] = -1;
+        }
+        for( ic=0; ic<nconfigRun; ic++) {
+            sbuffer = cacheFile;
+            if( (nconfigRun > 1) && (cacheFile.length() > 0) )
+                sbuffer += "_" + toString( ic );
+            if( cfg[ic].tcache.setup( nx, ny, cacheLimMB/nconfigRun, sbuffer ) < 0 )
+                doCache = xFALSE;
+        }
+        ztop = za[0];
+        for( i=0; i<natom; i++) if( za[i] > ztop ) ztop = za[i];
+        if( ztop < cz ) ztop = cz;
+        //  max number of slices (+1 in case thermal vibrations add one)
+        ix = (int) ( (ztop + 0.25*deltaz)/deltaz ) + 1;
+        if( nsliceShare > 0 ) ix = ( (0 != lcache) && (nbatches > 1) ) ? nsliceDist : nsliceShare;
+        w = nconfigRun * ix * cfg[0].tcache.sliceMB();
+        if( (cacheLimMB > 0.0) && (w > cacheLimMB) ) {
+            sum = w - cacheLimMB;
+            w = cacheLimMB;
+        } else sum = 0.0;
+        sbuffer = "slice cache ceiling = " + toString( w ) + " MBytes in memory";
+        if( sum > 0.0 ) {
+            if( cacheFile.length() > 0 ) sbuffer += " + " + toString( sum )
+                 + " MBytes in scratch file " + cacheFile;
+            else sbuffer += " (remaining slices will be recalculated)";
+        }
+        sbuffer += ", " + toString( ix ) + " slices of "
+            + toString( cfg[0].tcache.sliceMB() ) + " MBytes";
+        if( nconfigRun > 1 ) sbuffer += " for each of " + toString( nconfigRun )
+            + " configurations";
+        messageAST( sbuffer, 0 );
+    }
+#endif
 
     if( lpacbed == xTRUE ) {
         for( ix=0; ix<nxprobe; ix++) for( iy=0; iy<nyprobe; iy++)
                 pacbedPix[ix][iy] = 0;
     }
 
-/* ------------- start here for a full image output -------------- */
+/* ------------- start here for a full image or line scan -------------- */
 /*
-  do one whole line at once NOT the whole image (which may be huge)
+  do one batch of positions at once NOT the whole image (which may be huge)
 */
     if( l1d == 0 ) {
-       sbuffer = "output file size in pixels is " + toString(nxout) +" x " 
+       sbuffer = "output file size in pixels is " + toString(nxout) +" x "
                + toString(nyout);
        messageAST( sbuffer, 0 );
-       if( nprobes != nyout ) {
-           sbuffer = "Error, nprobes= "+ toString(nprobes)+" must be the same as nyout= "
-               +toString(nyout)+", in image mode.";
-           messageAST( sbuffer, 2 );
-           exit( 0 );
+    } else {
+       if( lpacbed == xTRUE ) {
+          sbuffer = "warning: cannot do pos. aver. CBED in 1d";
+          messageAST( sbuffer, 0 );
        }
-       /* double up first index to mimic a 4D array */
-       for( i=0; i<(nThick*ndetect); i++) {
-           for( ix=0; ix<nxout; ix++)
-           for( iy=0; iy<nyout; iy++)
-            pixr[i][ix][iy] = 0.0F;
+       if( nxout > 1 ) {
+               sbuffer="nxout must be 1 in 1D mode but is "+toString(nxout);
+               messageAST( sbuffer, 0 );
        }
+    }
 
-       /*  iterate the multislice algorithm proper for each
-           position of the focused probe */
+    /* double up first index to mimic a 4D array */
+    for( ip=0; ip<npos; ip++) {
+        for( i=0; i<(nThick*ndetect); i++)
+            pixr[i][posix[ip]][posiy[ip]] = 0.0F;
+    }
 
-       if( nxout > 1 ) dx = (xf-xi)/((double)(nxout-1));
-       else dx = 1.0;
-       if( nyout > 1 ) dy = (yf-yi)/((double)(nyout-1));
-       else dy = 1.0;
-       x.resize( nprobes );
-       y.resize( nprobes );
+    /*  skip the random numbers of the configurations before this shard
+        so they are the same as in one big calculation (with the same seed) */
+    if( lwobble == 1 ) {
+        for( iw0=0; iw0<iwFirst; iw0++)
+            for( i=0; i<3*natom; i++) rng.rangauss();
+    }
+
+    /*  restore the partial sums from a checkpoint (continue the same
+           random number sequence) - the configuration that was partly
+           done is finished by itself before the rest */
+    if( (iwStart > iwFirst) || (ckpt.nposDone > 0) ) {
+        for( ip=0; ip<npos; ip++) {
+            for( i=0; i<(nThick*ndetect); i++)
+                pixr[i][posix[ip]][posiy[ip]] = ckpt.pix[ ip + i*npos ];
+        }
+        if( (lpacbed == xTRUE) && (l1d == 0) && ((int)ckpt.pacbed.size() == nxprobe*nyprobe) ) {
+            for( ix=0; ix<nxprobe; ix++) for( iy=0; iy<nyprobe; iy++)
+                pacbedPix[ix][iy] = ckpt.pacbed[iy + ix*nyprobe];
+        }
+        totmin = ckpt.totmin;
+        totmax = ckpt.totmax;
+        nbeamt = ckpt.nbeamt;
+        rng.resetSeed( ckpt.rngState );
+        if( ckpt.nposDone > 0 ) {
+            cfg[0].ipos0 = ckpt.nposDone;
+            cfg[0].pixc = ckpt.pixc;
+            if( (lpacbed == xTRUE) && (l1d == 0) ) cfg[0].pacbedc = ckpt.pacbedc;
+            cfg[0].totmin = ckpt.ctotmin;
+            cfg[0].totmax = ckpt.ctotmax;
+        }
+    }
+    tckpt = time( NULL );
+
+    /*  snapshots of the running average (written by another thread) */
+    lsnap = xFALSE;
+    nsnap = 0;
+    pixs = NULL;
+    smin = smax = NULL;
+    if( (snapFile.length() > 0) && (snapEvery > 0) ) {
+        if( (0 != l1d) || (0 != lshard) ) {
+            sbuffer = "warning: no snapshots of a 1D line scan or shard";
+            messageAST( sbuffer, 1 );
+        } else {
+            lsnap = xTRUE;
+            pixs = new3D<float>( nThick*ndetect, nxout, nyout, "pixs" );
+            smin = new2D<float>( nThick, ndetect, "smin" );
+            smax = new2D<float>( nThick, ndetect, "smax" );
+            snap.start();
+            sbuffer = "write a snapshot of the images to " + snapFile + "*.tif after every "
+                + toString( snapEvery ) + ( (nwRun > 1) ? " configurations" : " scan lines" );
+            messageAST( sbuffer, 0 );
+        }
+    }
+
+    lstop = xFALSE;
+    if( xTRUE == lconv ) {
+        cstat.resize( nThick*ndetect, npos );
+        sbuffer = "stop when the rel. std. error of all images is below "
+            + toString( convErr ) + " (after at least " + toString( convMin )
+            + " and at most " + toString( nwRun ) + " configurations)";
+        messageAST( sbuffer, 0 );
+    }
+
+    /*  calculate nconfigRun configurations at the same time
+        and add them to pixr[][][] in order */
+#ifdef USE_OPENMP
+    nlevels = omp_get_max_active_levels();
+    if( nconfigRun > 1 ) omp_set_max_active_levels( 2 );
+#endif
+
+    /*  with 4D-STEM output and several configurations do all of the
+        configurations of one batch of positions (group) before the next
+        so each pattern is averaged in memory and written to the file once
+        - the configurations are made again (same random numbers) for each
+          group unless they are all in cfg[] at the same time */
+    nposGroup = npos;
+    lcbedSum = ( (ncbed > 0) && (nwRun > 1) ) ? xTRUE : xFALSE;
+    if( xTRUE == lcbedSum ) {
+        nposGroup = nprobes;
+        cbedSum.resize( ((size_t)nThick)*nprobes*ncbed );
+    }
+    rngGroup = rng.getState();
+
+    for( ipg=0; ipg<npos; ipg+=nposGroup )
+    for( iw0=iwStart; iw0<iwLast; iw0+=nw) {
+
+        ipg1 = std::min( ipg+nposGroup, npos );
+        lnewcfg = ( (0 == ipg) || (nwRun > nconfigRun) ) ? xTRUE : xFALSE;
+        if( (xTRUE == lcbedSum) && (iw0 == iwStart) ) {
+            cbedSum.assign( cbedSum.size(), 0.0F );
+            if( (ipg > 0) && (xTRUE == lnewcfg) ) rng.resetSeed( rngGroup );
+        }
+
+        nw = iwLast - iw0;
+        if( nw > nconfigRun ) nw = nconfigRun;
+        if( cfg[0].ipos0 > 0 ) nw = 1;     //  finish a resumed config. by itself
+        np = nthreadAll / nw;       //  threads for each configuration
+        if( np < 1 ) np = 1;
 
         /*  add random thermal displacements 
                scaled by temperature if requested 
             remember that initial wobble is at 300K for
-               each direction */
-
-        for( iwobble=0; iwobble<nwobble; iwobble++) {
+               each direction
+            - do all of these in order (not in parallel) so the random
+               numbers do not depend on how many configurations run at once */
+        rngRound = rng.getState();
+        for( ic=0; (ic<nw) && (xTRUE == lnewcfg); ic++) {
+            astConfig &cf = cfg[ic];
+            iwobble = iw0 + ic;
             if( lwobble == 1 ){
                 scale = (float) sqrt(temperature/300.0) ;
                 for( i=0; i<natom; i++) {
-                    xa2[i] = xa[i] + 
+                    cf.xa2[i] = xa[i] + 
                         (float)(wobble[i]*rng.rangauss()*scale);
-                    ya2[i] = ya[i] + 
+                    cf.ya2[i] = ya[i] + 
                         (float)(wobble[i]*rng.rangauss()*scale);
-                    za2[i] = za[i] + 
+                    cf.za2[i] = za[i] + 
                             (float)(wobble[i]*rng.rangauss()*scale);
-                    occ2[i] = occ[i];
-                    Znum2[i] = Znum[i];
+                    cf.occ2[i] = occ[i];
+                    cf.Znum2[i] = Znum[i];
                 }
-                sortByZ( xa2, ya2, za2, occ2, Znum2, natom );
+                sortByZ( cf.xa2, cf.ya2, cf.za2, cf.occ2, cf.Znum2, natom );
                 sbuffer = "configuration # " + toString( iwobble+1 );
                 messageAST( sbuffer, 0 );
                 sbuffer = "The new range of z is "
-                    + toString(za2[0]) + " to " + toString( za2[natom-1] );
+                    + toString(cf.za2[0]) + " to " + toString( cf.za2[natom-1] );
                 messageAST( sbuffer, 0 );
             } else for( i=0; i<natom; i++) {
-                xa2[i] = xa[i];
-                ya2[i] = ya[i];
-                za2[i] = za[i];
-                occ2[i] = occ[i];
-                Znum2[i] = Znum[i];
+                cf.xa2[i] = xa[i];
+                cf.ya2[i] = ya[i];
+                cf.za2[i] = za[i];
+                cf.occ2[i] = occ[i];
+                cf.Znum2[i] = Znum[i];
             }
-            zmin = za2[0];  /* reset zmin/max after wobble */
-            zmax = za2[natom-1];
-    
-            for( ix=0; ix<nxout; ix++) {
-    
-                for( iy=0; iy<nyout; iy++) {
-                    x[iy] = xi + dx * ((double) ix);
-                        //  + sourcesize * rng.rangauss();  - does not converge well
-                    y[iy] = yi + dy * ((double) iy);
-                        //  + sourcesize * rng.rangauss();  - does not converge well
-                    x[iy] = periodic( x[iy], ax );   /* put back in supercell */
-                    y[iy] = periodic( y[iy], by );   /* if necessary */
+            cf.zmin = cf.za2[0];  /* reset zmin/max after wobble */
+            cf.zmax = cf.za2[natom-1];
+        }
+
+        /*  iterate the multislice algorithm proper for each
+            batch of positions of the focused probe
+            - each configuration uses np threads for its probes */
+#pragma omp parallel for num_threads(nw) schedule(static,1) if(nw>1) private(ib,nb,ip,ix2,iy2,it,idetect,prr,pri)
+        for( ic=0; ic<nw; ic++) {
+            astConfig &cf = cfg[ic];
+            std::string smsg;       //  local so configurations can run in parallel
+
+#ifdef USE_OPENMP
+            omp_set_num_threads( np );
+#endif
+            if( xTRUE == lnewcfg ) {
+                if( xTRUE == doCache ) cf.tcache.clear();  //  new slices for this config.
+                cf.lsmat = xFALSE;                          //  new S-matrix for PRISM
+            }
+            if( 0 == cf.ipos0 ) {
+                cf.totmin =  10.0;
+                cf.totmax = -10.0;
+                for( ip=0; ip<(int)cf.pacbedc.size(); ip++) cf.pacbedc[ip] = 0.0;
+            }
+
+            for( ib=std::max( cf.ipos0, ipg ); ib<ipg1; ib+=nprobes) {
+
+                nb = ipg1 - ib;
+                if( nb > nprobes ) nb = nprobes;
+                for( ip=0; ip<nb; ip++) {
+                    cf.x[ip] = posx[ib+ip];
+                    cf.y[ip] = posy[ib+ip];
                 }
 
-                sbuffer =  "calculate line " + toString(ix);  //  new 3-jun-2015 ejk
-                messageAST( sbuffer, 0 );
+                if( (l1d == 0) || (nbatches > 1) ) {
+                    smsg =  "calculate positions " + toString(ib) + " to "
+                        + toString(ib+nb-1) + " of " + toString(npos);
+                    if( nw > 1 ) smsg += " in configuration # " + toString( iw0+ic+1 );
+                    messageAST( smsg, 0 );
+                }
+
+#ifndef AST_USE_CUDA
+                if( 0 != lprism ) PRISMsignals( cf, cf.x, cf.y, nb, cf.detect, ndetect,
+                    ThickSave, nThick, cf.sums );
+                else STEMsignals( cf, cf.x, cf.y, nb, cf.detect, ndetect,
+                    ThickSave, nThick, cf.sums, collectorMode );
+#else
+                STEMsignals( cf, cf.x, cf.y, nb, param, multiMode, cf.detect, ndetect, 
+                    ThickSave, nThick, cf.sums, collectorMode, phiMin, phiMax );
+#endif
 
-                STEMsignals( x, y, nyout, param, multiMode, detect, ndetect, 
-                    ThickSave, nThick, sums, collectorMode, phiMin, phiMax );
-                for( iy=0; iy<nyout; iy++) {
-                    if( sums[iy] < totmin ) totmin = sums[iy];
-                    if( sums[iy] > totmax ) totmax = sums[iy];
+                /*  queue the 4D-STEM patterns (written in the background)
+                    - averaged over the configurations below if more than one */
+                if( (ncbed > 0) && (xTRUE != lcbedSum) ) {
+                    for( it=0; it<nThick; it++)
+                    for( ip=0; ip<nb; ip++)
+                        c4d.put( it, posix[ib+ip], posiy[ib+ip],
+                            &cf.cbed[ (ip + it*nprobes)*ncbed ], 1.0F );
+                }
+                for( ip=0; ip<nb; ip++) {
+                    if( cf.sums[ip] < cf.totmin ) cf.totmin = cf.sums[ip];
+                    if( cf.sums[ip] > cf.totmax ) cf.totmax = cf.sums[ip];
                     for( it=0; it<nThick; it++){
                         for( idetect=0; idetect<ndetect; idetect++)
-                        pixr[idetect + it*ndetect][ix][iy] += (float)
-                            (detect[it][idetect][iy]/((double)nwobble));
+                        //  nwobble should be small so its prob. safe to sum into single prec. var.
+                        cf.pixc[ ib+ip + (idetect + it*ndetect)*npos ] = (float)
+                            (cf.detect[it][idetect][ip]/((double)nwRun));
                     }
-                    if( sums[iy] < 0.9) {
-                        sbuffer = "Warning integrated intensity too small, = "
-                           + toString(sums[iy])+" at "+toString(x[iy])+", "+toString(y[iy]);
-                        messageAST( sbuffer, 0 );
+                    if( cf.sums[ip] < 0.9) {
+                        smsg = "Warning integrated intensity too small, = "
+                           + toString(cf.sums[ip])+" at "+toString(cf.x[ip])+", "+toString(cf.y[ip]);
+                        messageAST( smsg, 0 );
                     }
-                    if( sums[iy] > 1.1) {
-                        sbuffer =  "Warning integrated intensity too large, = "
-                           + toString(sums[iy])+" at "+toString(x[iy])+", "+toString(y[iy]);
-                        messageAST( sbuffer, 0 );
+                    if( cf.sums[ip] > 1.1) {
+                        smsg =  "Warning integrated intensity too large, = "
+                           + toString(cf.sums[ip])+" at "+toString(cf.x[ip])+", "+toString(cf.y[ip]);
+                        messageAST( smsg, 0 );
                     }
                 }
 
                 /*   sum position averaged CBED if requested 
-                     - assume probe still left from stemsignal()  */
+                     - assume probe still left from stemsignal()
+                     - each thread does its own pixels (for all probes in
+                       order) so the sum does not depend on the threads */
 #ifndef AST_USE_CUDA
-                if( lpacbed == xTRUE ) {
-                    for( iy=0; iy<nyout; iy++) {
-                        for( ix2=0; ix2<nxprobe; ix2++)
-                        for( iy2=0; iy2<nyprobe; iy2++) {
-                            prr = probe[iy].re(ix2,iy2);
-                            pri = probe[iy].im(ix2,iy2);
-                            pacbedPix[ix2][iy2] += (prr*prr + pri*pri);
-                       }
+                if( (lpacbed == xTRUE) && (l1d == 0) ) {
+#pragma omp parallel for private(iy2,ip,prr,pri)
+                    for( ix2=0; ix2<nxprobe; ix2++) {
+                        for( ip=0; ip<nb; ip++) {
+                            for( iy2=0; iy2<nyprobe; iy2++) {
+                                prr = cf.probe[ip].re(ix2,iy2);
+                                pri = cf.probe[ip].im(ix2,iy2);
+                                cf.pacbedc[iy2 + ix2*nyprobe] += (prr*prr + pri*pri);
+                            }
+                        }
                     }
                 }   /*  end if( lpacbed.... */
 #elif defined(AST_USE_CUDA)
-                if( lpacbed == xTRUE ) {
-                   for( iy=0; iy<nyout; iy++) {
+                if( (lpacbed == xTRUE) && (l1d == 0) ) {
+                   for( ip=0; ip<nb; ip++) {
                         //--- copy to device ---------
-                    cudaMemcpy( Hprobe, &Dprobe[iy*nx*ny], nxprobe*nyprobe*sizeof(cufftComplex),
+                    cudaMemcpy( Hprobe, &Dprobe[ip*nx*ny], nxprobe*nyprobe*sizeof(cufftComplex),
                     cudaMemcpyDeviceToHost );
                     checkCudaErr( "cannot copy probe device to host");
                         for( ix2=0; ix2<nxprobe; ix2++)
                         for( iy2=0; iy2<nyprobe; iy2++) {
-                            prr = Hprobe[iy2 + ix2*nyprobe].x;   //  probe[iy].re(ix2,iy2);
-                            pri = Hprobe[iy2 + ix2*nyprobe].y;   //  probe[iy].im(ix2,iy2);
-                            pacbedPix[ix2][iy2] += (prr*prr + pri*pri);
+                            prr = Hprobe[iy2 + ix2*nyprobe].x;   //  probe[ip].re(ix2,iy2);
+                            pri = Hprobe[iy2 + ix2*nyprobe].y;   //  probe[ip].im(ix2,iy2);
+                            cf.pacbedc[iy2 + ix2*nyprobe] += (prr*prr + pri*pri);
                        }
                     }
                  }   /*  end if( lpacbed.... */
 
 #endif            
-            } /* end for(ix...) */
-    
-        } /* end for(iwobble... ) */
-
-        //------ calculate COMI from COMX,COMY pix - assume next in detect list
-        //   added   12-jul-2022 ejk
-        //    need whole image for COMX, COMY before COMI, COMD
-        for (idetect = 0; idetect < ndetect; idetect++) {
-            if (COMX == collectorMode[idetect]) {
-                sbuffer = "calculate COM pix ";
-                messageAST(sbuffer, 0);
-                comxpix.resize(nxout, nyout);
-                comxpix.init(1);
-                comypix.resize(nxout, nyout);
-                comypix.copyInit(comxpix);
-                comipix.resize(nxout, nyout);
-                comipix.copyInit(comxpix);
-                comdpix.resize(nxout, nyout);
-                comdpix.copyInit(comxpix);
-                axc = (float) ( (xf - xi) * (double(nxout+1) / double(nxout)) );
-                byc = (float) ( (yf - yi) * (double(nyout+1) / double(nyout)));
-                freqn(kxc, kx2c, xc, nxout, axc);
-                freqn(kyc, ky2c, yc, nyout, byc);
-                for (it = 0; it < nThick; it++) {
-                    for (ix = 0; ix < nxout; ix++) for (iy = 0; iy < nyout; iy++) {
-                        comxpix.re(ix, iy) = pixr[idetect + it * ndetect][ix][iy];
-                        comxpix.im(ix, iy) = 0.0F;
-                        comypix.re(ix, iy) = pixr[idetect + 1 + it * ndetect][ix][iy];
-                        comypix.im(ix, iy) = 0.0F;
-                    }
-                    comxpix.fft();
-                    comypix.fft();
-                    //  remember there is (2*pi*i) in denominator which swaps re,im
-                    for (ix = 0; ix < nxout; ix++) for (iy = 0; iy < nyout; iy++) {
-                        k2c = 2.0*pi*(kx2c[ix] + ky2c[iy]);
-                        if (fabs(k2c) > 1.0e-10) {
-                            comipix.re(ix, iy) = (float)
-                                (( kxc[ix] * comxpix.im(ix, iy) + kyc[iy] * comypix.im(ix, iy) ) / k2c);
-                            comipix.im(ix, iy) = (float)
-                                (-( kxc[ix] * comxpix.re(ix, iy) + kyc[iy] * comypix.re(ix, iy) ) /k2c);
-                        } else {
-                            comipix.re(ix, iy) = 0.0f;
-                            comipix.im(ix, iy) = 0.0f;
-                        }
-                        comdpix.re(ix, iy) = (float)
-                            (-2.0 * pi * (kxc[ix] * comxpix.im(ix, iy) + kyc[iy] * comypix.im(ix, iy)));
-                        comdpix.im(ix, iy) = (float)
-                            (2.0 * pi * (kxc[ix] * comxpix.re(ix, iy) + kyc[iy] * comypix.re(ix, iy)));
-                    }
-                    comipix.ifft();
-                    comdpix.ifft();
-                    //  why are these real ?
-                    for (ix = 0; ix < nxout; ix++) for (iy = 0; iy < nyout; iy++) {
-                        pixr[idetect + 2 + it * ndetect][ix][iy] = comipix.re(ix, iy);
-                        pixr[idetect + 3 + it * ndetect][ix][iy] = comdpix.re(ix, iy);
+
+                /*  snapshot of the whole scan lines done so far
+                    (with only one configuration so nw=1) */
+                if( (xTRUE == lsnap) && (1 == nwRun) && (ib+nb < npos)
+                    && ( (ib+nb)/nyout - nsnap >= snapEvery ) ) {
+                    nsnap = (ib+nb)/nyout;
+                    for( ip=0; ip<npos; ip++) {
+                        for( it=0; it<(nThick*ndetect); it++)
+                            pixs[it][posix[ip]][posiy[ip]] =
+                                ( ip < ib+nb ) ? cf.pixc[ ip + it*npos ] : 0.0F;
                     }
-                } //  end for ( it=....
-             } // end if( CONFOCAL
-        }  // end for( idetect...  COMI mode
-
-        /*  find range to output data files  */
-        for( it=0; it<nThick; it++)
-        for( i=0; i<ndetect; i++) {
-            rmin[it][i] = rmax[it][i] = pixr[i+it*ndetect][0][0];
-            for( ix=0; ix<nxout; ix++)
-            for( iy=0; iy<nyout; iy++) {
-                temp = pixr[i+it*ndetect][ix][iy];
-                if( temp < rmin[it][i] )rmin[it][i] = (float) temp;
-                if( temp > rmax[it][i] )rmax[it][i] = (float) temp;
-            }
-        }
-        if( lpacbed == xTRUE ) {
-            invert2D( pacbedPix, nxprobe, nyprobe );  /*  put zero in middle */
-         }
+                    writeSnap( pixs, smin, smax, nxout, nyout, nThick, ndetect,
+                        collectorMode, xi, xf, yi, yf, source, param, 1 );
+                    smsg = "snapshot after " + toString( nsnap ) + " scan lines";
+                    messageAST( smsg, 0 );
+                }
 
-    /* ------------- start here for 1d line scan ---------------- */
+                /*  checkpoint in the middle of a configuration
+                    - only if this is the only one running */
+                if( (ckptFile.length() > 0) && (1 == nw) && (ib+nb < npos)
+                    && ( difftime( time(NULL), tckpt ) >= 60.0*ckptMin ) ) {
+                    ckpt.nconfig = iw0;
+                    ckpt.rngState = rngRound;
+                    ckpt.nposDone = ib+nb;
+                    ckpt.ctotmin = cf.totmin;
+                    ckpt.ctotmax = cf.totmax;
+                    ckpt.pixc = cf.pixc;
+                    ckpt.pacbedc = cf.pacbedc;
+                    if( (lpacbed != xTRUE) || (l1d != 0) ) ckpt.pacbedc.clear();
+                    writeCkpt( pixr, pacbedPix, posix, posiy );
+                    ckpt.pixc.clear();
+                    ckpt.pacbedc.clear();
+                    tckpt = time( NULL );
+                }
+            } /* end for(ib...) */
 
-    } else { // the only other posibility is; if ( l1d == 1 ) {
+            cf.ipos0 = 0;
 
-       if( lpacbed == xTRUE ) {
-          sbuffer = "warning: cannot do pos. aver. CBED in 1d";
-          messageAST( sbuffer, 0 );
-       }
-       if( nxout > 1 ) {
-               sbuffer="nxout must be 1 in 1D mode but is "+toString(nxout);
-               messageAST( sbuffer, 0 );
-       }
-       if( nyout > 1 ) dx = (xf-xi)/((double)(nyout-1));
-       else dx = 1.0;
-       if( nyout > 1 ) dy = (yf-yi)/((double)(nyout-1));
-       else dy = 1.0;
-       x.resize( nprobes );
-       y.resize( nprobes );
-       for( ip=0; ip<nyout; ip++) {
-            for( it=0; it<nThick; it++)
-            for( idetect=0; idetect<ndetect; idetect++)
-                    pixr[idetect+it*ndetect][0][ip] = 0.0F;
-       }
+        } /* end for(ic...) */
 
-       /*  add random thermal displacements scaled by temperature
-            if requested 
-        remember that initial wobble is at 300K for each direction */
-
-       for( iwobble=0; iwobble<nwobble; iwobble++) {
-    
-            if( lwobble == 1 ){
-                scale = (float) sqrt(temperature/300.0) ;
-                for( i=0; i<natom; i++) {
-                    xa2[i] = xa[i] + 
-                        (float)(wobble[i]*rng.rangauss()*scale);
-                    ya2[i] = ya[i] + 
-                        (float)(wobble[i]*rng.rangauss()*scale);
-                    za2[i] = za[i] + 
-                        (float)(wobble[i]*rng.rangauss()*scale);
-                    occ2[i] = occ[i];
-                    Znum2[i] = Znum[i];
+        /*  add configurations in order so the result is the same
+            for any number of configurations at once */
+        for( ic=0; ic<nw; ic++) {
+            astConfig &cf = cfg[ic];
+            for( ip=ipg; ip<ipg1; ip++) {
+                ix = posix[ip];
+                iy = posiy[ip];
+                for( i=0; i<(nThick*ndetect); i++)
+                    pixr[i][ix][iy] += cf.pixc[ ip + i*npos ];
+            }
+            if( xTRUE == lcbedSum ) {
+                prr = (float) (1.0/nwRun);
+                for( it=0; it<nThick; it++)
+                for( ip=0; ip<(ipg1-ipg); ip++) {
+                    i = (ip + it*nprobes)*ncbed;
+                    for( ix2=0; ix2<ncbed; ix2++)
+                        cbedSum[ i+ix2 ] += prr * cf.cbed[ i+ix2 ];
                 }
-                sbuffer = "configuration # " + toString( iwobble+1 );
-                messageAST( sbuffer, 0 );
-                sortByZ( xa2, ya2, za2, occ2, Znum2, natom );
-                sbuffer = "The new range of z is "
-                    + toString(za2[0]) + " to " + toString( za2[natom-1] );
-                messageAST( sbuffer, 0 );
-            } else for( i=0; i<natom; i++) {
-                xa2[i] = xa[i];
-                ya2[i] = ya[i];
-                za2[i] = za[i];
-                occ2[i] = occ[i];
-                Znum2[i] = Znum[i];
             }
-            zmin = za2[0];      /* reset zmin/max after wobble */
-            zmax = za2[natom-1];
-            for( ip=0; ip<nyout; ip++) {
-                x[ip] = xi + dx * ((double)ip);
-                            //  + sourcesize * rng.rangauss();  - does not converge well
-                y[ip] = yi + dy * ((double)ip);
-                            //  + sourcesize * rng.rangauss();  - does not converge well
-                x[ip] = periodic( x[ip], ax );   // put back in supercell
-                y[ip] = periodic( y[ip], by );   // if necessary
+            if( (lpacbed == xTRUE) && (l1d == 0) ) {
+                for( ix2=0; ix2<nxprobe; ix2++)
+                for( iy2=0; iy2<nyprobe; iy2++)
+                    pacbedPix[ix2][iy2] += (float) cf.pacbedc[iy2 + ix2*nyprobe];
             }
-         
-            STEMsignals( x, y, nprobes, param, multiMode, detect, ndetect, 
-                ThickSave, nThick, sums, collectorMode, phiMin, phiMax );
-            for( ip=0; ip<nprobes; ip++) {
-                if( sums[ip] < totmin ) totmin = sums[ip];
-                if( sums[ip] > totmax ) totmax = sums[ip];
-                for( it=0; it<nThick; it++){
-                for( idetect=0; idetect<ndetect; idetect++)
-                   //  nwobble should be small so its prob. safe to sum into single prec. var.
-                   pixr[idetect+it*ndetect][0][ip] += 
-                        (float) ( detect[it][idetect][ip]/((double)nwobble) );
-                }
-                if( sums[ip] < 0.9) {
-                    sbuffer = "Warning integrated intensity too small, = "
-                           + toString(sums[ip])+" at "+toString(x[ip])+", "+toString(y[ip]);
-                    messageAST( sbuffer, 0 );
-                }
-                if( sums[ip] > 1.1) {
-                    sbuffer =  "Warning integrated intensity too large, = "
-                           + toString(sums[ip])+" at "+toString(x[ip])+", "+toString(y[ip]);
+            if( cf.totmin < totmin ) totmin = cf.totmin;
+            if( cf.totmax > totmax ) totmax = cf.totmax;
+            nbeamt = cf.nbeamt;
+
+            /*  check convergence after each configuration in order so the
+                result does not depend on how many run at once (the rest
+                of this group is not used) */
+            if( xTRUE == lconv ) {
+                cstat.add( &cf.pixc[0], (double) nwRun );
+                if( cstat.nconfig() >= 2 ) {
+                    econv = cstat.maxRelErr();
+                    convHist.push_back( econv );
+                    sbuffer = "after " + toString( cstat.nconfig() )
+                        + " configurations max. rel. std. error = " + toString( econv );
                     messageAST( sbuffer, 0 );
+                    if( (cstat.nconfig() >= convMin) && (econv <= convErr) ) {
+                        lstop = xTRUE;
+                        break;
+                    }
                 }
             }
+        }
+        if( xTRUE == lstop ) break;
+
+        /*  snapshot of the average of the configurations done so far */
+        i = iw0 + nw - iwFirst;
+        if( (xTRUE == lsnap) && (nwRun > 1) && (iw0+nw < iwLast)
+            && (nposGroup >= npos) && ( i - nsnap >= snapEvery ) ) {
+            nsnap = i;
+            w = ((double) nwRun)/((double) i);
+            for( ip=0; ip<npos; ip++) {
+                ix = posix[ip];
+                iy = posiy[ip];
+                for( it=0; it<(nThick*ndetect); it++)
+                    pixs[it][ix][iy] = (float) ( w * pixr[it][ix][iy] );
+            }
+            writeSnap( pixs, smin, smax, nxout, nyout, nThick, ndetect,
+                collectorMode, xi, xf, yi, yf, source, param, i );
+            sbuffer = "snapshot after " + toString( i ) + " configurations";
+            messageAST( sbuffer, 0 );
+        }
+
+        /*  checkpoint at the end of a group of configurations
+            (always after the last so a resume just writes the output) */
+        if( (ckptFile.length() > 0) && ( (iw0+nw >= iwLast) ||
+            ( difftime( time(NULL), tckpt ) >= 60.0*ckptMin ) ) ) {
+            ckpt.nconfig = iw0 + nw;
+            ckpt.rngState = rng.getState();
+            ckpt.nposDone = 0;
+            writeCkpt( pixr, pacbedPix, posix, posiy );
+            tckpt = time( NULL );
+        }
+
+        /*  queue the 4D-STEM patterns of this group after its last configuration */
+        if( (xTRUE == lcbedSum) && (iw0+nw >= iwLast) ) {
+            for( it=0; it<nThick; it++)
+            for( ip=0; ip<(ipg1-ipg); ip++)
+                c4d.put( it, posix[ipg+ip], posiy[ipg+ip],
+                    &cbedSum[ (ip + it*nprobes)*ncbed ], 1.0F );
+        }
+
+    } /* end for(iw0... ) */
+
+#ifdef USE_OPENMP
+    omp_set_max_active_levels( nlevels );
+    omp_set_num_threads( nthreadAll );
+#endif
+
+    if( xTRUE == doCache ) {
+        w = sum = 0.0;
+        for( ic=0; ic<nconfigRun; ic++) {
+            w += cfg[ic].tcache.memMB();
+            sum += cfg[ic].tcache.diskMB();
+            cfg[ic].tcache.clear();
+        }
+        sbuffer = "slice cache used " + toString( w ) + " MBytes in memory and "
+            + toString( sum ) + " MBytes on disk";
+        messageAST( sbuffer, 0 );
+    }
+
+    /*  average of the configurations used (each was added with
+        weight 1/nwRun) */
+    if( xTRUE == lconv ) {
+        nconfigDone = cstat.nconfig();
+        for( i=0; i<(nThick*ndetect); i++)
+            convFinal.push_back( cstat.relErr( i ) );
+        if( xTRUE == lstop ) {
+            sbuffer = "converged after " + toString( nconfigDone ) + " of "
+                + toString( nwRun ) + " configurations";
+            messageAST( sbuffer, 0 );
+            w = ((double) nwRun)/((double) nconfigDone);
+            for( ip=0; ip<npos; ip++) {
+                for( i=0; i<(nThick*ndetect); i++)
+                    pixr[i][posix[ip]][posiy[ip]] *= (float) w;
+            }
+            if( (lpacbed == xTRUE) && (l1d == 0) ) {
+                for( ix2=0; ix2<nxprobe; ix2++)
+                for( iy2=0; iy2<nyprobe; iy2++)
+                    pacbedPix[ix2][iy2] *= (float) w;
+            }
+        } else {
+            sbuffer = "warning: not converged after " + toString( nwRun )
+                + " configurations, max. rel. std. error = " + toString( cstat.maxRelErr() );
+            messageAST( sbuffer, 1 );
+        }
+        cstat.resize( 0, 0 );
+    }
 
-       }  /* end for(iwobble... */
+    if( xTRUE == lsnap ) {
+        snap.stop();        //  wait for the last one to be written
+        sbuffer = toString( snap.nwritten ) + " snapshot files written";
+        messageAST( sbuffer, 0 );
+        delete3D<float>( pixs, nThick*ndetect, nxout );
+        delete2D<float>( smin, nThick );
+        delete2D<float>( smax, nThick );
+    }
+
+    if( c4d.isOpen() ) {
+        if( c4d.close() < 0 ) {
+            freeConfigs( nThick, ndetect );
+            return( -9 );
+        }
+        sbuffer = "4D-STEM data written to " + cbedFile;
+        messageAST( sbuffer, 0 );
+    }
+
+    //  the image is finished when the shards are merged
+    if( (l1d == 0) && (0 == lshard) ) {
+
+        //  source size, COMI,COMD images and range of each image
+        postImage( pixr, rmin, rmax, nxout, nyout, nThick, ndetect,
+            collectorMode, xi, xf, yi, yf, source );
+
+        if( lpacbed == xTRUE ) {
+            invert2D( pacbedPix, nxprobe, nyprobe );  /*  put zero in middle */
+         }
 
     } /* end if( l1d.. ) */
 
     //----------- end:  free scratch arrays and exit --------------------
 
-    delete3D<double>( detect, nThick, ndetect );
+    freeConfigs( nThick, ndetect );
 
-#ifndef AST_USE_CUDA
-    delete [] probe;
-#elif defined(AST_USE_CUDA)
+#ifdef AST_USE_CUDA
     cufftDestroy( cuplanP );
     cufftDestroy( cuplanT );
     cufftDestroy( cuplanTc2r );
@@ -1249,6 +2244,7 @@ void autostem::CountBeams( vectorf &param, int &nbeamp, int &nbeampo, float &res
 */
 void autostem::messageAST( std::string &smsg,  int level )
 {
+#pragma omp critical (messageAST)
         messageSL( smsg.c_str(), level );  //  just call slicelib version for now
 
 }  // end autostem::messageAST()
@@ -1271,6 +2267,670 @@ double autostem::periodic( double pos, double size )
     return( x );
 }
 
+/*------------------------ postImage() ---------------------*/
+/*
+    finish the images after all configurations are summed
+    (also used to merge the partial sums of several processes)
+
+    convolve with the source size (if not zero), calculate COMI,COMD
+    from COMX,COMY (assume next in detect list) and find the range
+    of each image
+
+    pixr[][][]  = images indexed as [idetect + it*ndetect][ix][iy]
+    rmin, rmax  = get range of each image indexed as [it][idetect]
+    nxout,nyout = image size in pixels
+    nThick      = number of thicknesses
+    ndetect     = number of detectors
+    collectorMode = type of each detector
+    xi,xf,yi,yf = scan range
+    source      = source size FWHM in Ang. (param[pSOURCE], see sourceSize())
+*/
+void autostem::postImage( float ***pixr, float **rmin, float **rmax,
+        int nxout, int nyout, int nThick, int ndetect,
+        vectori &collectorMode, double xi, double xf, double yi, double yf,
+        double source )
+{
+    int i, ix, iy, it, idetect;
+    float temp;
+
+    //  to calculate comi image
+    float axc, byc;
+    cfpix comxpix, comypix, comipix, comdpix;
+    vectorf kxc(nxout), kyc(nyout), kx2c(nxout), ky2c(nyout), xc(nxout), yc(nyout);
+    double k2c, dxs, dys;
+
+    //------ finite source size (before COMI,COMD which are linear in COMX,COMY)
+    if( 0.0 != source ) {
+        dxs = ( nxout > 1 ) ? (xf-xi)/((double)(nxout-1)) : 0.0;
+        dys = ( nyout > 1 ) ? (yf-yi)/((double)(nyout-1)) : dxs;
+        if( dxs <= 0.0 ) dxs = dys;
+        if( dys > 0.0 ) {
+            sbuffer = "convolve images with source size " + toString( fabs(source) )
+                + " Ang. FWHM (" + ( (source > 0.0) ? "Gaussian" : "Lorentzian" ) + ")";
+            messageAST( sbuffer, 0 );
+            sourceSize( pixr, nThick*ndetect, nxout, nyout, dxs, dys, source );
+        }
+    }
+
+    //------ calculate COMI from COMX,COMY pix - assume next in detect list
+    //   added   12-jul-2022 ejk
+    //    need whole image for COMX, COMY before COMI, COMD
+    for (idetect = 0; idetect < ndetect; idetect++) {
+        if (COMX == collectorMode[idetect]) {
+            sbuffer = "calculate COM pix ";
+            messageAST(sbuffer, 0);
+            comxpix.resize(nxout, nyout);
+            comxpix.init(1);
+            comypix.resize(nxout, nyout);
+            comypix.copyInit(comxpix);
+            comipix.resize(nxout, nyout);
+            comipix.copyInit(comxpix);
+            comdpix.resize(nxout, nyout);
+            comdpix.copyInit(comxpix);
+            axc = (float) ( (xf - xi) * (double(nxout+1) / double(nxout)) );
+            byc = (float) ( (yf - yi) * (double(nyout+1) / double(nyout)));
+            freqn(kxc, kx2c, xc, nxout, axc);
+            freqn(kyc, ky2c, yc, nyout, byc);
+            for (it = 0; it < nThick; it++) {
+                for (ix = 0; ix < nxout; ix++) for (iy = 0; iy < nyout; iy++) {
+                    comxpix.re(ix, iy) = pixr[idetect + it * ndetect][ix][iy];
+                    comxpix.im(ix, iy) = 0.0F;
+                    comypix.re(ix, iy) = pixr[idetect + 1 + it * ndetect][ix][iy];
+                    comypix.im(ix, iy) = 0.0F;
+                }
+                comxpix.fft();
+                comypix.fft();
+                //  remember there is (2*pi*i) in denominator which swaps re,im
+                for (ix = 0; ix < nxout; ix++) for (iy = 0; iy < nyout; iy++) {
+                    k2c = 2.0*pi*(kx2c[ix] + ky2c[iy]);
+                    if (fabs(k2c) > 1.0e-10) {
+                        comipix.re(ix, iy) = (float)
+                            (( kxc[ix] * comxpix.im(ix, iy) + kyc[iy] * comypix.im(ix, iy) ) / k2c);
+                        comipix.im(ix, iy) = (float)
+                            (-( kxc[ix] * comxpix.re(ix, iy) + kyc[iy] * comypix.re(ix, iy) ) /k2c);
+                    } else {
+                        comipix.re(ix, iy) = 0.0f;
+                        comipix.im(ix, iy) = 0.0f;
+                    }
+                    comdpix.re(ix, iy) = (float)
+                        (-2.0 * pi * (kxc[ix] * comxpix.im(ix, iy) + kyc[iy] * comypix.im(ix, iy)));
+                    comdpix.im(ix, iy) = (float)
+                        (2.0 * pi * (kxc[ix] * comxpix.re(ix, iy) + kyc[iy] * comypix.re(ix, iy)));
+                }
+                comipix.ifft();
+                comdpix.ifft();
+                //  why are these real ?
+                for (ix = 0; ix < nxout; ix++) for (iy = 0; iy < nyout; iy++) {
+                    pixr[idetect + 2 + it * ndetect][ix][iy] = comipix.re(ix, iy);
+                    pixr[idetect + 3 + it * ndetect][ix][iy] = comdpix.re(ix, iy);
+                }
+            } //  end for ( it=....
+         } // end if( CONFOCAL
+    }  // end for( idetect...  COMI mode
+
+    /*  find range to output data files  */
+    for( it=0; it<nThick; it++)
+    for( i=0; i<ndetect; i++) {
+        rmin[it][i] = rmax[it][i] = pixr[i+it*ndetect][0][0];
+        for( ix=0; ix<nxout; ix++)
+        for( iy=0; iy<nyout; iy++) {
+            temp = pixr[i+it*ndetect][ix][iy];
+            if( temp < rmin[it][i] )rmin[it][i] = (float) temp;
+            if( temp > rmax[it][i] )rmax[it][i] = (float) temp;
+        }
+    }
+
+}  // end autostem::postImage()
+
+/*------------------------ sourceSize() ---------------------*/
+/*
+    convolve images with the intensity distribution of a finite source
+    (partial spatial coherence) - the Monte-Carlo average over the probe
+    position does not converge well but the incoherent sum over the
+    source is just a convolution of the finished (point source) image
+
+    pixr[i][ix][iy] = images i=0 to nimg-1 of nxout x nyout pixels
+                         (input and output)
+    dx, dy          = scan pixel size in Ang.
+    source          = FWHM of the source in Ang. at the specimen
+                      > 0 for a Gaussian = exp(-r^2/(2*s^2)), s = FWHM/2.3548
+                      < 0 for a Lorentzian = 1/(r^2+g^2)^(3/2), whose
+                        Fourier transform is exp(-2*pi*g*k), g = FWHM/1.5328
+
+    the scan is usually not periodic so mirror each image into
+    2*nxout x 2*nyout pixels (even extension) before the FFT so the
+    edges are not mixed with the opposite side of the image
+*/
+void autostem::sourceSize( float ***pixr, int nimg, int nxout, int nyout,
+        double dx, double dy, double source )
+{
+    int i, ix, iy, jx, jy, n2x, n2y;
+    double s, k, h;
+    cfpix cpix;
+    vectord hk;
+
+    if( (0.0 == source) || (nimg < 1) ) return;
+
+    n2x = 2*nxout;
+    n2y = 2*nyout;
+    vectorf kxs(n2x), kys(n2y), kx2s(n2x), ky2s(n2y), xs(n2x), ys(n2y);
+    freqn( kxs, kx2s, xs, n2x, n2x*dx );
+    freqn( kys, ky2s, ys, n2y, n2y*dy );
+
+    //  Fourier transform of source intensity (real and even, =1 at k=0)
+    hk.resize( n2x*n2y );
+    if( source > 0.0 ) s = source/2.354820045;
+        else s = -source/( 2.0*sqrt( pow( 2.0, 2.0/3.0 ) - 1.0 ) );
+    for( ix=0; ix<n2x; ix++) for( iy=0; iy<n2y; iy++) {
+        k = kx2s[ix] + ky2s[iy];
+        if( source > 0.0 ) h = exp( -2.0*pi*pi*s*s*k );
+            else h = exp( -2.0*pi*s*sqrt(k) );
+        hk[iy + ix*n2y] = h;
+    }
+
+    cpix.resize( n2x, n2y );
+    cpix.init( 1 );
+    for( i=0; i<nimg; i++) {
+        for( ix=0; ix<n2x; ix++) {
+            jx = ( ix < nxout ) ? ix : n2x-1-ix;
+            for( iy=0; iy<n2y; iy++) {
+                jy = ( iy < nyout ) ? iy : n2y-1-iy;
+                cpix.re(ix,iy) = pixr[i][jx][jy];
+                cpix.im(ix,iy) = 0.0F;
+            }
+        }
+        cpix.fft();
+        for( ix=0; ix<n2x; ix++) for( iy=0; iy<n2y; iy++) {
+            h = hk[iy + ix*n2y];
+            cpix.re(ix,iy) = (float) ( h * cpix.re(ix,iy) );
+            cpix.im(ix,iy) = (float) ( h * cpix.im(ix,iy) );
+        }
+        cpix.ifft();
+        for( ix=0; ix<nxout; ix++) for( iy=0; iy<nyout; iy++)
+            pixr[i][ix][iy] = cpix.re(ix,iy);
+    }  /* end for( i... */
+
+}  // end autostem::sourceSize()
+
+/*------------------------ fourierUpsample() ---------------------*/
+/*
+    Fourier interpolate a periodic band limited image to a finer grid
+    (zero pad its Fourier transform) with the same origin and period
+
+    pc[ix][iy]  = input image of ncx x ncy pixels
+    pf[ix][iy]  = output image of nxf x nyf pixels (nxf >= ncx, nyf >= ncy)
+
+    the Nyquist frequency of an even size input is split evenly
+    between + and - frequencies so the output stays real
+*/
+void autostem::fourierUpsample( float **pc, int ncx, int ncy, float **pf, int nxf, int nyf )
+{
+    int ix, iy, jx, jy, i, j, nfx, nfy;
+    int fx[2], fy[2];
+    float wx[2], wy[2], scale;
+    cfpix cpix, fpix;
+
+    cpix.resize( ncx, ncy );
+    cpix.init( 1 );
+    fpix.resize( nxf, nyf );
+    fpix.init( 1 );
+
+    for( ix=0; ix<ncx; ix++) for( iy=0; iy<ncy; iy++) {
+        cpix.re(ix,iy) = pc[ix][iy];
+        cpix.im(ix,iy) = 0.0F;
+    }
+    cpix.fft();
+
+    //  fft() is not normalized and ifft() divides by nxf*nyf
+    scale = (float) ( ((double)nxf*nyf)/((double)ncx*ncy) );
+    fpix = 0.0F;
+    for( ix=0; ix<ncx; ix++) {
+        nfx = 1;
+        wx[0] = wx[1] = 1.0F;
+        if( ncx == nxf ) fx[0] = ix;
+        else if( 2*ix < ncx ) fx[0] = ix;
+        else if( 2*ix > ncx ) fx[0] = ix - ncx + nxf;
+        else {                          //  Nyquist freq.
+            nfx = 2;
+            fx[0] = ix;
+            fx[1] = nxf - ix;
+            wx[0] = wx[1] = 0.5F;
+        }
+        for( iy=0; iy<ncy; iy++) {
+            nfy = 1;
+            wy[0] = wy[1] = 1.0F;
+            if( ncy == nyf ) fy[0] = iy;
+            else if( 2*iy < ncy ) fy[0] = iy;
+            else if( 2*iy > ncy ) fy[0] = iy - ncy + nyf;
+            else {
+                nfy = 2;
+                fy[0] = iy;
+                fy[1] = nyf - iy;
+                wy[0] = wy[1] = 0.5F;
+            }
+            for( i=0; i<nfx; i++) for( j=0; j<nfy; j++) {
+                jx = fx[i];
+                jy = fy[j];
+                fpix.re(jx,jy) += scale * wx[i] * wy[j] * cpix.re(ix,iy);
+                fpix.im(jx,jy) += scale * wx[i] * wy[j] * cpix.im(ix,iy);
+            }
+        }  /* end for(iy...) */
+    }  /* end for(ix...) */
+    fpix.ifft();
+
+    for( ix=0; ix<nxf; ix++) for( iy=0; iy<nyf; iy++)
+        pf[ix][iy] = fpix.re(ix,iy);
+
+}  // end autostem::fourierUpsample()
+
+/*------------------------ periodPixels() ---------------------*/
+/*
+    number of scan pixels in one period of a periodic image
+
+    period  = period of the image in Ang.
+    xi, xf  = scan range (first and last pixel)
+    nout    = number of pixels in the scan
+
+    return nout if the scan is not longer than one period (or the
+    period is not used) and 0 if the period is not a whole number of
+    scan pixels
+*/
+int autostem::periodPixels( double period, double xi, double xf, int nout )
+{
+    int m;
+    double r;
+
+    if( (nout < 2) || (period <= 0.0) || (xf <= xi) ) return( nout );
+    r = period*(nout-1)/(xf-xi);
+    m = (int) floor( r + 0.5 );
+    if( (m < 1) || (fabs( r - m ) > 1.0e-3*r) ) return( 0 );
+    if( m > nout ) m = nout;
+    return( m );
+
+}  // end autostem::periodPixels()
+
+/*------------------------ writeCkpt() ---------------------*/
+/*
+    write the partial sums to the checkpoint file ckptFile
+
+    the caller sets nconfig, rngState, nposDone and the partial
+    configuration (pixc, pacbedc, ctotmin/max) in ckpt
+
+    pixr      = partial sums (in pixr[i][posix[ip]][posiy[ip]])
+    pacbedPix = partial pos. aver. CBED
+    posix, posiy = where each probe position goes in pixr
+
+    return +1 for success and <0 for failure
+*/
+int autostem::writeCkpt( float ***pixr, float **pacbedPix, vectori &posix, vectori &posiy )
+{
+    int i, ip, ix, iy, npos, nsig, status;
+
+    npos = (int) posix.size();
+    nsig = ckpt.nThick * ckpt.ndetect;
+    ckpt.pix.resize( ((size_t)npos) * ((size_t)nsig) );
+    for( ip=0; ip<npos; ip++) {
+        for( i=0; i<nsig; i++)
+            ckpt.pix[ ip + i*npos ] = pixr[i][posix[ip]][posiy[ip]];
+    }
+    if( (lpacbed == xTRUE) && (l1d == 0) ) {
+        ckpt.pacbed.resize( nxprobe*nyprobe );
+        for( ix=0; ix<nxprobe; ix++) for( iy=0; iy<nyprobe; iy++)
+            ckpt.pacbed[iy + ix*nyprobe] = pacbedPix[ix][iy];
+    } else ckpt.pacbed.clear();
+    ckpt.totmin = totmin;
+    ckpt.totmax = totmax;
+    ckpt.nbeamt = nbeamt;
+
+    status = ckpt.write( ckptFile );
+    if( status > 0 ) {
+        sbuffer = "checkpoint after " + toString( ckpt.nconfig ) + " configurations";
+        if( ckpt.nposDone > 0 ) sbuffer += " and " + toString( ckpt.nposDone ) + " positions";
+        sbuffer += " saved in " + ckptFile;
+        messageAST( sbuffer, 0 );
+    }
+    ckpt.pix.clear();
+    ckpt.pacbed.clear();
+
+    return( status );
+
+}  // end autostem::writeCkpt()
+
+/*------------------------ probeBatch() ---------------------*/
+/*
+    find the number of probes to propagate at the same time
+    (i.e. in one call to STEMsignals())
+
+    each transmission function is reused for all probes in a batch
+    so use as many as fit in the memory budget batchMB, but split
+    the positions into batches of nearly equal size that are a
+    multiple of the number of threads so no core sits idle
+    (independent of the length of a scan line)
+
+    if there are fewer positions than threads then also calculate
+    several phonon configurations at the same time (each with
+    its own batch of probes and share of the threads)
+
+    npos    = total number of probe positions
+    nThick  = number of thickness levels
+    ndetect = number of detectors
+    nwobble = number of phonon configurations
+    lecho   = print the batches if not 0
+
+    the budget and number of configurations may be limited by
+    memoryPlan() (batchLimMB, nconfigLim)
+
+    return the number of probes in a batch
+        (also set nprobeBatch, nbatches, nconfigRun and nthreadAll)
+*/
+int autostem::probeBatch( int npos, int nThick, int ndetect, int nwobble, int lecho )
+{
+    int nthreads, nmax, nb;
+    double mb, perProbe;
+
+    nthreadAll = 1;
+#ifdef USE_OPENMP
+    nthreadAll = omp_get_max_threads();
+#endif
+    if( nthreadAll < 1 ) nthreadAll = 1;
+
+    //  number of configurations at the same time
+    nconfigRun = nconfigPar;
+    if( nconfigRun <= 0 ) {
+        if( npos >= nthreadAll ) nconfigRun = 1;
+        else nconfigRun = ( nthreadAll + npos - 1 )/npos;
+    }
+    if( nconfigRun > nwobble ) nconfigRun = nwobble;
+    if( nconfigRun > nthreadAll ) nconfigRun = nthreadAll;
+    if( (nconfigLim > 0) && (nconfigRun > nconfigLim) ) nconfigRun = nconfigLim;
+#ifdef AST_USE_CUDA
+    nconfigRun = 1;     //  only one GPU
+#endif
+    if( nconfigRun < 1 ) nconfigRun = 1;
+    nthreads = nthreadAll / nconfigRun;     //  for each configuration
+    if( nthreads < 1 ) nthreads = 1;
+
+    //  probe wave function (of each condition) + detector signals + offsets
+    //     for each position
+    perProbe = ( 2.0*sizeof(float)*((double)nxprobe)*((double)nyprobe)*ncond
+        + sizeof(double)*( nThick*ndetect + 5.0 ) ) / (1024.0*1024.0);
+
+    mb = batchLimMB;
+    if( mb <= 0.0 ) {
+        mb = 0.25 * physMemMB();
+        if( mb <= 0.0 ) mb = 1024.0;    //  guess if unknown
+    }
+    mb = mb / nconfigRun;
+    if( mb/perProbe >= (double) npos ) nmax = npos;
+    else nmax = (int) ( mb/perProbe );
+    if( nmax < 1 ) {
+        if( 0 != lecho ) {
+            sbuffer = "probe memory budget of " + toString( mb ) + " MBytes is too small"
+                + " for one probe, use one anyway";
+            messageAST( sbuffer, 1 );
+        }
+        nmax = 1;
+    }
+
+    if( npos <= nmax ) nb = npos;
+    else {
+        nbatches = (npos + nmax - 1)/nmax;
+        nb = (npos + nbatches - 1)/nbatches;     //  balance batch sizes
+        if( nb > nthreads ) {
+            nb = ( (nb + nthreads - 1)/nthreads ) * nthreads;
+            if( nb > nmax ) nb = (nmax/nthreads) * nthreads;
+        }
+    }
+    nbatches = (npos + nb - 1)/nb;
+    nprobeBatch = nb;
+
+    if( (nbatches > 1) && (0 != lecho) ) {
+        sbuffer = "propagate " + toString( nb ) + " probes at a time in "
+            + toString( nbatches ) + " batches (" + toString( nthreads ) + " threads, "
+            + toString( nb*perProbe ) + " MBytes)";
+        messageAST( sbuffer, 0 );
+    }
+    if( (nconfigRun > 1) && (0 != lecho) ) {
+        sbuffer = "calculate " + toString( nconfigRun ) + " phonon configurations"
+            + " at the same time with " + toString( nthreads ) + " threads each";
+        messageAST( sbuffer, 0 );
+    }
+
+    return( nb );
+
+}  // end autostem::probeBatch()
+
+/*------------------------ writeSnap() ---------------------*/
+/*
+    queue a snapshot of the running average of the 2D images to be
+    written in the background (see snapshot.hpp)
+
+    pix[][][]  = running average of each image [idetect + it*ndetect]
+                   (scratch - changed by postImage())
+    rmin, rmax = scratch for the range of each image
+    nxout, nyout, nThick, ndetect, collectorMode, xi, xf, yi, yf, source
+               = as in postImage()
+    param[]    = image parameters to write with each file
+    ndone      = number of configurations in the average
+*/
+void autostem::writeSnap( float ***pix, float **rmin, float **rmax,
+        int nxout, int nyout, int nThick, int ndetect, vectori &collectorMode,
+        double xi, double xf, double yi, double yf, double source,
+        vectorf &param, int ndone )
+{
+    int ix, iy, it, idetect, i;
+    double dx, dy;
+    vectorf p( param ), img( ((size_t)nxout)*nyout );
+
+    //  same source size and COM images as the final images
+    postImage( pix, rmin, rmax, nxout, nyout, nThick, ndetect,
+        collectorMode, xi, xf, yi, yf, source );
+
+    dx = ( nxout > 1 ) ? (xf-xi)/((double)(nxout-1)) : 0.0;
+    dy = ( nyout > 1 ) ? (yf-yi)/((double)(nyout-1)) : 0.0;
+    p[ pNWOBBLE ] = (float) ndone;
+
+    for( it=0; it<nThick; it++)
+    for( idetect=0; idetect<ndetect; idetect++) {
+        i = idetect + it*ndetect;
+        for( ix=0; ix<nxout; ix++) for( iy=0; iy<nyout; iy++)
+            img[ iy + ix*nyout ] = pix[i][ix][iy];
+        snap.add( snapFile + toString( idetect ) + "_" + toString( it ) + ".tif",
+            &img[0], nxout, nyout, dx, dy, p );
+    }
+
+}  // end autostem::writeSnap()
+
+/*------------------------ memoryPlan() ---------------------*/
+/*
+    estimate the peak memory of this calculation before anything big
+    is allocated, print the breakdown and fit it into memMB (if > 0)
+    by reducing (in this order)
+        1. the pipeline (no slices calculated ahead)
+        2. the slice cache in memory (the rest goes to the scratch file
+              or is recalculated) down to what is left after one probe
+              per thread in each configuration
+        3. the number of phonon configurations at the same time
+        4. the number of probes in a batch (down to one)
+    and refuse to start if it still does not fit
+
+    npos, nThick, ndetect, nwobble = as in probeBatch()
+    nxout, nyout = size of output images
+    za[]         = z coord. of the atoms (number of slices)
+
+    set batchLimMB, cacheLimMB, nconfigLim, npipeRun and
+    return +1 for success and <0 if it does not fit
+*/
+int autostem::memoryPlan( int npos, int nThick, int ndetect, int nwobble,
+        int nxout, int nyout, vectorf &za )
+{
+    int i, nb, nslice, nthreads, ncfgMin, ncfg0;
+    double mMB, npix, images, setup, perConfig, ring, cacheCfg, perProbe, sumProbe,
+        total, avail, sliceMB, ztop;
+    std::string s;
+
+    const double MB = 1.0/(1024.0*1024.0);
+
+    batchLimMB = batchMB;
+    cacheLimMB = cacheMB;
+    nconfigLim = 0;
+    npipeRun = ( npipe > 0 ) ? npipe : 0;
+    if( 0 != lprism ) npipeRun = 0;
+
+    npix = ((double)nxprobe)*((double)nyprobe);
+    sliceMB = 2.0*sizeof(float)*((double)nx)*((double)ny)*MB;
+
+    //  output images, partial sums (checkpoint) and convergence statistics
+    images = sizeof(float)*((double)nThick)*ndetect*((double)nxout)*nyout*MB;
+    if( ckptFile.length() > 0 )
+        images += 2.0*sizeof(float)*((double)npos)*nThick*ndetect*MB;
+    if( (convErr > 0.0) && (lwobble == 1) && (nwobble > 1) )
+        images += 2.0*sizeof(double)*((double)npos)*nThick*ndetect*MB;
+    if( (snapFile.length() > 0) && (snapEvery > 0) )
+        images += 2.0*sizeof(float)*((double)nThick)*ndetect*((double)nxout)*nyout*MB;
+
+    //  propagator, aperture function(s), detector pixel lists,
+    //     scattering factors and scratch of each thread (threadScratch())
+    nthreads = 1;
+#ifdef USE_OPENMP
+    nthreads = omp_get_max_threads();
+#endif
+    setup = ( 2.0*sizeof(float) + 2.0*sizeof(double)*(1 + ((ncond > 1) ? ncond : 0)) )*npix*MB;
+    setup += sizeof(float)*((double)nthreads)*npix*MB;
+    setup += sizeof(double)*((double)fet.nZ())*nx*(ny/2+1)*MB;
+    for( i=0; i<(int)detIndex.size(); i++)
+        setup += (sizeof(int)+sizeof(double))*((double)detIndex[i].size())*MB;
+
+    //  each configuration: atoms, transmission function, trlayer()
+    //     scratch, signals of all positions, pos. aver. CBED, PRISM
+    perConfig = ( 5.0*sizeof(float)*natom + sliceMB/MB
+        + 2.0*sizeof(float)*((double)nx)*(ny/2+1) + 2.0*sizeof(double)*((double)nx)*(ny/2+1)
+        + 4.0*sizeof(double)*32.0*(nx+ny)
+        + sizeof(float)*((double)npos)*nThick*ndetect ) * MB;
+    if( lpacbed == xTRUE ) perConfig += sizeof(double)*npix*MB;
+    if( 0 != lprism ) perConfig += sliceMB*prismBx.size()*(nThick+1);
+    if( winTol > 0.0 ) perConfig += 2.0*sizeof(float)*((double)nthreads)*npix*MB;
+
+    //  each probe: wave function(s), signals and 4D-STEM pattern
+    perProbe = ( 2.0*sizeof(float)*npix*ncond
+        + sizeof(double)*( nThick*ndetect + 5.0 )
+        + sizeof(float)*((double)nThick)*ncbed ) * MB;
+
+    //  each probe: average of the configurations of its 4D-STEM patterns
+    sumProbe = ( nwobble > 1 ) ? sizeof(float)*((double)nThick)*ncbed*MB : 0.0;
+
+    //  slice cache of each configuration (if all slices are kept)
+    cacheCfg = 0.0;
+    nslice = 0;
+    if( (0 != lcache) && (0 == lprism) ) {
+        ztop = cz;
+        for( i=0; i<natom; i++) if( za[i] > ztop ) ztop = za[i];
+        nslice = (int) ( (ztop + 0.25*deltaz)/deltaz ) + 1;
+        if( nsliceShare > 0 ) nslice = nsliceDist;
+        cacheCfg = nslice*sliceMB;
+    }
+    if( cacheCfg < nsliceShare*sliceMB ) cacheCfg = nsliceShare*sliceMB;
+
+    for( i=0; i<5; i++ ) {
+        nb = probeBatch( npos, nThick, ndetect, nwobble, 0 );
+        //  all slices are only used with several batches
+        mMB = ( (0 != lcache) && (nbatches > 1) ) ? cacheCfg : nsliceShare*sliceMB;
+        if( cacheLimMB > 0.0 ) mMB = std::min( cacheCfg, cacheLimMB/nconfigRun );
+        ring = ( npipeRun > 0 ) ? (npipeRun+1)*sliceMB : 0.0;
+        total = images + setup + nb*sumProbe + nconfigRun*( perConfig + ring + mMB + nb*perProbe );
+        if( (memMB <= 0.0) || (total <= memMB) ) break;
+
+        nthreads = std::max( 1, nthreadAll/nconfigRun );
+        ncfgMin = std::min( nthreads, npos );
+        avail = memMB - images - setup;
+        if( 0 == i ) {
+            npipeRun = 0;       //  1. no pipeline
+        } else if( 1 == i ) {   //  2. slice cache
+            mMB = avail/nconfigRun - perConfig - ncfgMin*perProbe;
+            if( mMB < cacheCfg ) {
+                if( mMB < sliceMB ) mMB = 0.0;
+                //  > 0 so the cache does not become unlimited
+                cacheLimMB = std::max( nconfigRun*mMB, 1.0e-6 );
+            }
+        } else if( 2 == i ) {   //  3. fewer configurations
+            ncfg0 = nconfigRun;
+            while( nconfigRun > 1 ) {
+                mMB = ( cacheLimMB > 0.0 ) ? std::min( cacheCfg, cacheLimMB/nconfigRun ) : cacheCfg;
+                if( nconfigRun*( perConfig + mMB + perProbe ) <= avail ) break;
+                nconfigRun -= 1;
+            }
+            if( nconfigRun < ncfg0 ) nconfigLim = nconfigRun;
+        } else if( 3 == i ) {   //  4. fewer probes in a batch (budget of all configurations)
+            mMB = ( cacheLimMB > 0.0 ) ? std::min( cacheCfg, cacheLimMB/nconfigRun ) : cacheCfg;
+            batchLimMB = avail - nconfigRun*( perConfig + mMB );
+            if( batchLimMB < nconfigRun*perProbe ) batchLimMB = 1.0e-6;
+        }
+    }  /* end for( i... */
+
+    sbuffer = "memory plan (MBytes): images " + toString( images )
+        + ", probe setup " + toString( setup );
+    if( sumProbe > 0.0 ) sbuffer += ", 4D-STEM average " + toString( nb*sumProbe );
+    sbuffer += ", " + toString( nconfigRun ) + " configuration(s) x ("
+        + toString( perConfig ) + " fixed";
+    if( ring > 0.0 ) sbuffer += " + " + toString( ring ) + " pipeline";
+    if( mMB > 0.0 ) sbuffer += " + " + toString( mMB ) + " slice cache";
+    sbuffer += " + " + toString( nb ) + " probes x " + toString( perProbe )
+        + ") = " + toString( total ) + " total";
+    if( memMB > 0.0 ) sbuffer += " (budget " + toString( memMB ) + ")";
+    messageAST( sbuffer, 0 );
+
+    if( (memMB > 0.0) && (total > memMB) ) {
+        sbuffer = "autostem::calculate - the calculation needs at least "
+            + toString( total ) + " MBytes which does not fit in the memory budget of "
+            + toString( memMB ) + " MBytes";
+        messageAST( sbuffer, 2 );
+        return( -1 );
+    }
+    if( (memMB <= 0.0) && (physMemMB() > 0.0) && (total > physMemMB()) ) {
+        sbuffer = "warning: the calculation needs about " + toString( total )
+            + " MBytes which is more than the physical memory ("
+            + toString( physMemMB() ) + " MBytes)";
+        messageAST( sbuffer, 1 );
+    }
+    if( (memMB > 0.0) && ( (npipeRun < npipe) || (cacheLimMB != cacheMB) 
+            || (nconfigLim > 0) || (batchLimMB != batchMB) ) ) {
+        sbuffer = "reduced to fit the memory budget:";
+        if( npipeRun < npipe ) sbuffer += " no pipeline,";
+        if( cacheLimMB != cacheMB ) sbuffer += " slice cache " + toString( cacheLimMB )
+            + " MBytes in memory,";
+        if( nconfigLim > 0 ) sbuffer += " " + toString( nconfigLim ) + " configuration(s) at once,";
+        if( batchLimMB != batchMB ) sbuffer += " " + toString( nb ) + " probes per batch";
+        messageAST( sbuffer, 0 );
+    }
+
+    return( +1 );
+
+}  // end autostem::memoryPlan()
+
+/*------------------------ freeConfigs() ---------------------*/
+/*
+  free the work space of each configuration (cfg[] from calculate())
+
+  nThick, ndetect = number of thickness levels and detectors
+*/
+void autostem::freeConfigs( int nThick, int ndetect )
+{
+    int ic;
+
+    if( NULL == cfg ) return;
+    for( ic=0; ic<nconfigRun; ic++) {
+        delete3D<double>( cfg[ic].detect, nThick, ndetect );
+        if( NULL != cfg[ic].probe ) delete [] cfg[ic].probe;
+        if( NULL != cfg[ic].smat ) delete [] cfg[ic].smat;
+        if( NULL != cfg[ic].ring ) delete [] cfg[ic].ring;
+        if( NULL != cfg[ic].cdet ) delete3D<double>( cfg[ic].cdet, cfg[ic].ncdet, ndetect/ngroup );
+        if( NULL != cfg[ic].wfull ) delete [] cfg[ic].wfull;
+    }
+    delete [] cfg;
+    cfg = NULL;
+
+}  // end autostem::freeConfigs()
+
 /*------------------------ STEMsignals() ---------------------*/
 /*
 
@@ -1294,16 +2954,19 @@ double autostem::periodic( double pos, double size )
      add multipole aberrations 9-may-2011 ejk
      change to cfpix for probe and trans 10-nov-2012 ejk
 
+  cf          = work space for this phonon configuration
   x[],y[]     = real positions of the incident probe
   npos        = int number of positions
-  param[]     = parameters of probe
-  multiMode   = flag to add multipole aberrations
+  param[]     = parameters of probe (cuda version only)
+  multiMode   = flag to add multipole aberrations (cuda version only)
   detect[][][]= real array to get signal into each detector
             for each probe position and thickness
   ndetect     = number of detector geometries
   ThickSave[] = thicknesses at which to save data (other than the last)
   nThick      = number of thickness levels (including the last)
   sum         = real total integrated intensity
+  collectorMode[] = detector type (ADF or confocal)
+  phiMin[],phiMax[] = azimuthal range of each detector (cuda version only)
   
   the assumed global variables are:
   
@@ -1339,28 +3002,41 @@ double autostem::periodic( double pos, double size )
 
 */
 #ifndef AST_USE_CUDA
-void autostem::STEMsignals( vectord &x, vectord &y, int npos, vectorf &p,
-         int multiMode, double ***detect, int ndetect,
-         vectord &ThickSave, int nThick, vectord &sum, vectori &collectorMode,
-         vectord &phiMin, vectord &phiMax )
+void autostem::STEMsignals( astConfig &cf, vectord &x, vectord &y, int npos,
+         double ***detect, int ndetect,
+         vectord &ThickSave, int nThick, vectord &sum, vectori &collectorMode )
 {
-    int ix, iy, ixt, iyt, idetect,  ixmid, iymid;
-    int istart, na, ip, i, it;
-
-    long nxl, nyl;
+    int ix, iy, idetect,  ixmid, iymid;
+    int istart, na, ip, i, it, nprb;
+    int nsl, nring, nprod, ndone;
 
-    float scale, prr, pri, tr, ti;
+    float prr, pri;
 
     double  chi0, chi1, k2maxa, k2maxb,
-        w, k2, phi, phirms, alx, aly;
+        w, k2, phi;
     double sum0, sum1, delta, zslice, totalz;
 
     vectori ixoff, iyoff;
     vectord xoff, yoff;
+    vectori wlev;           //  window level of each probe
+    vectori wreal;          //  1 if the probe is in real space (windowed)
+
+    cfpix *ptrans;         //  trans or a slice from the cache
+    vectori sliceStart, sliceNa;    //  first atom and number of atoms in each slice
+    std::vector< cfpix* > pring;    //  slices in the pipeline ring
     
     /* extra for confocal */
     float hr, hi;
     double chi2C, chi3C, k2maxaC, k2maxbC, r2, rx2;
+
+    /*  work space of this configuration
+        - other configurations may be running at the same time */
+    vectorf &za2 = cf.za2;
+    float &zmax = cf.zmax;
+    int &nslice = cf.nslice;
+    cfpix &trans = cf.trans;
+    cfpix *probe = cf.probe;
+    std::string sbuffer;
     cfpix cpix;            // temp complex image for confocal 
 
     /* ------ make sure x,y are ok ------ */
@@ -1404,47 +3080,74 @@ void autostem::STEMsignals( vectord &x, vectord &y, int npos, vectorf &p,
     k2maxbC = apert2C /wavlen;
     k2maxbC = k2maxbC * k2maxbC;
 
-    ixoff.resize( npos );
-    iyoff.resize( npos );
-    xoff.resize( npos );
-    yoff.resize( npos );
+    threadScratch( cf, ndetect );
+
+    /*  probe ip + ic*npos is position ip with probe condition ic */
+    nprb = npos * ncond;
+    ixoff.resize( nprb );
+    iyoff.resize( nprb );
+    xoff.resize( nprb );
+    yoff.resize( nprb );
+    wlev.resize( nprb );
+    wreal.assign( nprb, 0 );
 
     /* ------- calculate all of the probe wave functions at once ------
         to reuse the transmission functions which takes a long
-        time to calculate*/
+        time to calculate
+        - shift the aberrated aperture function aperr,aperi (from calculate())
+          with a phase ramp exp(2*pi*i*(xoff*kx+yoff*ky)) which is
+          a product of a 1D x part and a 1D y part
+        - with depth-adaptive windows start in the window of level win0
+          (every 2^win0-th pixel of the aperture function) */
 
 /*  paralleling this loop has little effect */
-#pragma omp parallel for private(ix,iy,sum0,k2,w,chi0,scale,tr,ti,alx,aly) 
-    for( ip=0; ip<npos; ip++) {
-        ixoff[ip] = (int) floor( x[ip]*((double)nx) / ax ) - ixmid;
-        xoff[ip]  = x[ip] - ax*((double)ixoff[ip])/((double)nx);
+#pragma omp parallel for private(ix,iy,i,w) 
+    for( ip=0; ip<nprb; ip++) {
+        double rr, ri, ar, ai;
+        int nsx, nsy;
+        const double xpos = x[ ip % npos ], ypos = y[ ip % npos ];
+        const vectord &apr = ( ncond > 1 ) ? condAperr[ ip/npos ] : aperr;
+        const vectord &api = ( ncond > 1 ) ? condAperi[ ip/npos ] : aperi;
+
+        wlev[ip] = ( nwin > 1 ) ? win0 : 0;
+        const vectori &mx = wmapx[ wlev[ip] ], &my = wmapy[ wlev[ip] ];
+        nsx = nxprobe >> wlev[ip];
+        nsy = nyprobe >> wlev[ip];
+        if( (probe[ip].nx() != nsx) || (probe[ip].ny() != nsy) ) {
+            probe[ip].resize( nsx, nsy );
+            probe[ip].copyInit( wprop[ wlev[ip] ] );
+        }
+        vectord rampxr( nsx ), rampxi( nsx ), rampyr( nsy ), rampyi( nsy );
 
-        iyoff[ip] = (int) floor( y[ip]*((double)ny) / by ) - iymid;
-        yoff[ip]  = y[ip] - by*((double)iyoff[ip])/((double)ny);
+        ixoff[ip] = (int) floor( xpos*((double)nx) / ax ) - ixmid + (nxprobe-nsx)/2;
+        xoff[ip]  = xpos - ax*((double)ixoff[ip])/((double)nx);
+
+        iyoff[ip] = (int) floor( ypos*((double)ny) / by ) - iymid + (nyprobe-nsy)/2;
+        yoff[ip]  = ypos - by*((double)iyoff[ip])/((double)ny);
+
+        for( ix=0; ix<nsx; ix++) {
+            w = 2.*pi* xoff[ip]*kxp[mx[ix]];
+            rampxr[ix] = cos( w );
+            rampxi[ix] = sin( w );
+        }
+        for( iy=0; iy<nsy; iy++) {
+            w = 2.*pi* yoff[ip]*kyp[my[iy]];
+            rampyr[iy] = cos( w );
+            rampyi[iy] = sin( w );
+        }
 
-        sum0 = 0.0;
-        for( ix=0; ix<nxprobe; ix++) {
-            alx = wavlen * kxp[ix];  /* x component of angle alpha */
-            for( iy=0; iy<nyprobe; iy++) {
-                aly = wavlen * kyp[iy];  /* y component of angle alpha */
-                k2 = kxp2[ix] + kyp2[iy];
-                if( (k2 >= k2maxa) && (k2 <= k2maxb) ) {
-                    w = 2.*pi* ( xoff[ip]*kxp[ix] + yoff[ip]*kyp[iy] );
-                    chi0 = (2.0*pi/wavlen) * chi( p, alx, aly, multiMode );
-                    chi0= - chi0 + w;
-                    probe[ip].re(ix,iy) = tr = (float) cos( chi0 );
-                    probe[ip].im(ix,iy) = ti = (float) sin( chi0 );
-                    sum0 += (double) (tr*tr + ti*ti);
-                } else {
-                    probe[ip].re(ix,iy) = 0.0F;
-                    probe[ip].im(ix,iy) = 0.0F;
-                }
+        for( ix=0; ix<nsx; ix++) {
+            for( iy=0; iy<nsy; iy++) {
+                i = my[iy] + mx[ix]*nyprobe;
+                rr = rampxr[ix]*rampyr[iy] - rampxi[ix]*rampyi[iy];  //  x ramp * y ramp
+                ri = rampxr[ix]*rampyi[iy] + rampxi[ix]*rampyr[iy];
+                ar = apr[i] * wnorm[ wlev[ip] ];
+                ai = api[i] * wnorm[ wlev[ip] ];
+                probe[ip].re(ix,iy) = (float) ( ar*rr - ai*ri );
+                probe[ip].im(ix,iy) = (float) ( ar*ri + ai*rr );
             }
         }  /* end for( ix... */
 
-        scale = (float) ( 1.0/sqrt(sum0) );  
-        probe[ip] *= scale;
-
     }  /* end for( ip...) */
 
     /* -------- transmit thru nslice layers ------------------------
@@ -1452,11 +3155,6 @@ void autostem::STEMsignals( vectord &x, vectord &y, int npos, vectorf &p,
             of the array bounds
     */          
 
-    nxl = (long) nx;
-    nyl = (long) ny;
-    
-    scale = 1.0F / ( ((float)nx) * ((float)ny) );
-
     zslice = 0.75*deltaz;  /*  start a little before top of unit cell */
     istart = 0;
     nslice = 0;
@@ -1468,6 +3166,24 @@ void autostem::STEMsignals( vectord &x, vectord &y, int npos, vectorf &p,
         sbuffer= "specimen range is 0 to "+ toString(totalz) + " Ang.";
         messageAST( sbuffer, 0 );
     }
+
+    /*  atoms in each slice (same as the loop below) so the pipeline
+        can calculate slices ahead of the probes */
+    nring = nprod = ndone = 0;
+    if( (npipeRun > 0) && (NULL != cf.ring) ) {
+        for( w=zslice; (w < (totalz+0.25*deltaz)) || (istart<natom); w+=deltaz ) {
+            na = 0;
+            for(i=istart; i<natom; i++)
+                if( za2[i] < w ) na++; else break;
+            sliceStart.push_back( istart );
+            sliceNa.push_back( na );
+            istart += na;
+        }
+        istart = 0;
+        nring = npipeRun + 1;
+        pring.assign( nring, &trans );
+    }
+    nsl = (int) sliceNa.size();
     
     /* range of unit cell */
     while(  (zslice < (totalz+0.25*deltaz)) || (istart<natom) ) {
@@ -1485,40 +3201,74 @@ void autostem::STEMsignals( vectord &x, vectord &y, int npos, vectorf &p,
            //messageAST( ss.str(), 0 );
        }
 
-       /* calculate transmission function and bandwidth limit */
-       if( na > 0 ) trlayer( xa2, ya2, occ2,
-            Znum2, na, istart, (float)ax, (float)by, (float)keV,
-            trans, nxl, nyl, &phirms, &nbeamt, (float) k2maxp );
-
-       /*----- one multislice trans/prop cycle for all probes ---- */
-#pragma omp parallel for private(ix,iy,ixt,iyt,prr,pri)
-       for( ip=0; ip<npos; ip++) {
-           /* apply transmission function if there are atoms in this slice */
-           if( na > 0 ) {
+       /* calculate transmission function and bandwidth limit
+            - or reuse it if this config. has been here before
+            - or take it from the pipeline ring (may be calculated already) */
+       ptrans = &trans;
+       if( nring > 0 ) {
+            for( ; (nprod <= nslice) && (nprod < nsl); nprod++)
+                pring[ nprod % nring ] = makeSlice( cf, nprod, sliceStart[nprod],
+                    sliceNa[nprod], cf.ring[ nprod % nring ] );
+            if( nslice < nsl ) ptrans = pring[ nslice % nring ];
+       } else if( na > 0 ) ptrans = makeSlice( cf, nslice, istart, na, trans );
+
+       /*----- one multislice trans/prop cycle for all probes ----
+            - in pipeline mode one thread first calculates the next
+              slices (unless the probes are done) and then helps with
+              the probes */
+       ndone = 0;
+#pragma omp parallel
+       {
+       if( nring > 0 ) {
+#pragma omp single nowait
+            {
+                int nd;
+                while( (nprod < nsl) && (nprod <= nslice+npipeRun) ) {
+#pragma omp atomic read
+                    nd = ndone;
+                    if( nd >= nprb ) break;
+                    pring[ nprod % nring ] = makeSlice( cf, nprod, sliceStart[nprod],
+                        sliceNa[nprod], cf.ring[ nprod % nring ] );
+                    nprod++;
+                }
+            }
+       }
+#pragma omp for schedule(dynamic)
+       for( ip=0; ip<nprb; ip++) {
+           /* apply transmission function if there are atoms in this slice
+                - a windowed probe is already in real space */
+           if( 0 != wreal[ip] ) {
+                if( na > 0 ) probe[ip].mulWindow( *ptrans, ixoff[ip], iyoff[ip] );
+                probe[ip].fft();
+           } else if( na > 0 ) {
                 probe[ip].ifft();
-                for( ix=0; ix<nxprobe; ix++) {
-                    ixt = ix + ixoff[ip];
-                    if( ixt >= nx ) ixt = ixt - nx;
-                    else if( ixt < 0 ) ixt = ixt + nx;
-                    for( iy=0; iy<nyprobe; iy++) {
-                        iyt = iy + iyoff[ip];
-                        if( iyt >= ny ) iyt = iyt - ny;
-                        else if( iyt < 0 ) iyt = iyt + ny;
-                        prr = probe[ip].re(ix,iy);
-                        pri = probe[ip].im(ix,iy);
-                        probe[ip].re(ix,iy) =  prr*trans.re(ixt,iyt)
-                                              - pri*trans.im(ixt,iyt);  // real
-                        probe[ip].im(ix,iy) =  prr*trans.im(ixt,iyt)
-                                              + pri*trans.re(ixt,iyt);  // imag
-                    } /* end for(iy...) */
-                }  /* end for(ix...) */
+                probe[ip].mulWindow( *ptrans, ixoff[ip], iyoff[ip] );
                 probe[ip].fft();
            }
     
             /*  multiplied by the propagator function */
-            probe[ip] *= cprop;
+            if( 0 == wlev[ip] ) probe[ip] *= cprop;
+            else probe[ip] *= wprop[ wlev[ip] ];
+
+            /*  double the window if the probe has spread to its edge
+                - after every propagation so keep it in real space */
+            wreal[ip] = 0;
+            if( wlev[ip] > 0 ) {
+                probe[ip].ifft();
+                if( edgeFraction( probe[ip] ) > winTol ) {
+                    growWindow( probe[ip], wlev[ip], wlev[ip]-1, ixoff[ip], iyoff[ip] );
+                    wlev[ip] -= 1;
+                }
+                wreal[ip] = 1;
+            }
+
+            if( nring > 0 ) {
+#pragma omp atomic
+                ndone++;
+            }
 
         }  /* end  for( ip=... */
+       }  /* end omp parallel */
 
         /*  if this is a good thickness level then save the ADF or confocal signals
            - remember that the last level may be off by one layer with
@@ -1535,49 +3285,35 @@ void autostem::STEMsignals( vectord &x, vectord &y, int npos, vectorf &p,
             }
     
             /*  loop over all probes again */
-#pragma omp parallel for private(ix,iy,idetect,prr,pri,delta,k2,cpix,phi,chi0,hr,hi,sum0,sum1,rx2,r2)
+#pragma omp parallel for private(ix,iy,i,idetect,prr,pri,delta,k2,cpix,phi,chi0,hr,hi,sum0,sum1,rx2,r2)
             for( ip=0; ip<npos; ip++) {
+                float *inten = &cf.inten[ ((size_t)threadNum())*nxprobe*nyprobe ];
 
-                /*  zero sum count */
-                sum[ip] = 0.0;
-                for(ix=0; ix<ndetect; ix++) detect[it][ix][ip] = 0.0;
-   
-                /*  sum intensity incident on the ADF detector
+                /*  sum intensity incident on the ADF/COM detectors
                         and calculate total integrated intensity
-                    - changed detector limits to >= min and < max
-                       so many concentric ADF detectors sum correctly
-                       7-jul-2011
-                */
-                for( ix=0; ix<nxprobe; ix++) {
-                    for( iy=0; iy<nyprobe; iy++) {
-
-                        prr = probe[ip].re(ix,iy);
-                        pri = probe[ip].im(ix,iy);
-                        delta = prr*prr + pri*pri;
-                        sum[ip] += delta;
-
-                        k2 = kxp2[ix] + kyp2[iy];
-                        phi = atan2( kyp[iy], kxp[ix] );  //  for ADF_SEG detector
-
-                        for( idetect=0; idetect<ndetect; idetect++) {
-                            if( ADF == collectorMode[idetect] ) {
-                                if( (k2 >= k2min[idetect] ) &&
-                                (k2 < k2max[idetect] ) )
-                                detect[it][idetect][ip] += delta;
-                            } else if( ADF_SEG == collectorMode[idetect] ) {
-                                if( (k2 >= k2min[idetect] ) && (k2 < k2max[idetect] )
-                                    && (phi >= phiMin[idetect]) && (phi< phiMax[idetect]) )
-                                detect[it][idetect][ip] += delta;
-                            } else if (COMX == collectorMode[idetect]) {
-                                if ((k2 >= k2min[idetect]) && (k2 < k2max[idetect]))
-                                    detect[it][idetect][ip] += kxp[ix] * delta;
-                            } else if (COMY == collectorMode[idetect]) {
-                                if ((k2 >= k2min[idetect]) && (k2 < k2max[idetect]))
-                                    detect[it][idetect][ip] += kyp[iy] * delta;
-                            }
-                        }
-                    } /* end for(iy..) */
-                }  /* end for(ix...) */
+                    - on the whole probe grid if in a smaller window
+                    - weighted sum of the conditions in each group */
+                if( ncond > 1 ) {
+                    int ic, nd0 = ndetect/ngroup, ith = threadNum();
+                    double s;
+                    for( idetect=0; idetect<ndetect; idetect++) detect[it][idetect][ip] = 0.0;
+                    sum[ip] = 0.0;
+                    for( ic=0; ic<ncond; ic++) {
+                        s = ADFsignals( probe[ip + ic*npos], cf.cdet, ith, 0, nd0, inten );
+                        sum[ip] += condW[ic] * s / ngroup;
+                        for( idetect=0; idetect<nd0; idetect++)
+                            detect[it][idetect + condGroup[ic]*nd0][ip] +=
+                                condW[ic] * cf.cdet[ith][idetect][0];
+                    }
+                } else if( 0 != wreal[ip] ) {
+                    cfpix &wfull = cf.wfull[ threadNum() ];
+                    padWindow( probe[ip], wlev[ip], wfull );
+                    wfull.fft();
+                    sum[ip] = ADFsignals( wfull, detect, it, ip, ndetect, inten,
+                        cf.cbed.empty() ? NULL : &cf.cbed[ (ip + it*cf.sums.size())*ncbed ] );
+                } else
+                sum[ip] = ADFsignals( probe[ip], detect, it, ip, ndetect, inten,
+                    cf.cbed.empty() ? NULL : &cf.cbed[ (ip + it*cf.sums.size())*ncbed ] );
 
                 /*  transform back if confocal needed 
                     - use copy of probe so original can continue in use  */
@@ -1660,10 +3396,640 @@ void autostem::STEMsignals( vectord &x, vectord &y, int npos, vectorf &p,
 
     }  /* end while( istart...) */
 
+    /*  leave the whole probes for pos. aver. CBED and the next batch */
+    if( nwin > 1 ) {
+#pragma omp parallel for
+        for( ip=0; ip<nprb; ip++) {
+            if( 0 != wreal[ip] ) {
+                if( wlev[ip] > 0 ) growWindow( probe[ip], wlev[ip], 0, ixoff[ip], iyoff[ip] );
+                probe[ip].fft();
+            }
+        }
+    }
+
     return;
 
 }// end autostem::STEMsignals() - openMP version
 
+/*------------------------ threadScratch() ---------------------*/
+/*
+  size the scratch of each thread of one configuration (only the first
+  time so it is allocated once and reused for every probe)
+
+  cf      = configuration (its threads are omp_get_max_threads())
+  ndetect = number of detectors (ndetect/ngroup for each probe condition)
+
+  wfull[] is only used with depth-adaptive windows (nwin>1)
+*/
+void autostem::threadScratch( astConfig &cf, int ndetect )
+{
+    int i;
+    size_t nthr = 1, npix = ((size_t)nxprobe)*nyprobe;
+
+#ifdef USE_OPENMP
+    nthr = omp_get_max_threads();
+#endif
+    if( cf.inten.size() < nthr*npix ) cf.inten.resize( nthr*npix );
+
+    if( (ncond > 1) && (cf.ncdet < (int)nthr) ) {
+        if( NULL != cf.cdet ) delete3D<double>( cf.cdet, cf.ncdet, ndetect/ngroup );
+        cf.ncdet = (int) nthr;
+        cf.cdet = new3D<double>( cf.ncdet, ndetect/ngroup, 1, "cdet" );
+    }
+
+    if( (nwin > 1) && (cf.nwfull < (int)nthr) ) {
+        if( NULL != cf.wfull ) delete [] cf.wfull;
+        cf.nwfull = (int) nthr;
+        cf.wfull = new cfpix[ nthr ];
+        for( i=0; i<cf.nwfull; i++) {
+            cf.wfull[i].resize( nxprobe, nyprobe );
+            cf.wfull[i].copyInit( wprop[0] );
+        }
+    }
+
+}  // end autostem::threadScratch()
+
+/*------------------------ ADFsignals() ---------------------*/
+/*
+  sum the intensity of one probe on each ADF, ADF_SEG, COMX and COMY
+  detector with the pixel lists detIndex[], detWeight[] from calculate()
+  (confocal signals are set to zero here and added later)
+
+  wave   = probe wave function in Fourier space (nxprobe x nyprobe)
+  detect[it][idetect][ip] = detector signals (output)
+  it, ip = thickness level and probe index
+  inten  = scratch for |probe|^2 (nxprobe*nyprobe, one for each thread)
+  cbed   = binned 4D-STEM pattern (ncbed pixels, output) or NULL
+
+  return the total integrated intensity
+*/
+double autostem::ADFsignals( cfpix &wave, double ***detect, int it, int ip, int ndetect,
+    float *inten, float *cbed )
+{
+    int ix, iy, i, idetect, npix = nxprobe*nyprobe;
+    float prr, pri;
+    double delta, sum;
+
+    /*  find intensity once in one pass that can be vectorized
+        and then the total integrated intensity */
+    for( ix=0; ix<nxprobe; ix++) {
+        float *prow = &inten[ ix*nyprobe ];
+        for( iy=0; iy<nyprobe; iy++) {
+            prr = wave.re(ix,iy);
+            pri = wave.im(ix,iy);
+            prow[iy] = prr*prr + pri*pri;
+        } /* end for(iy..) */
+    }  /* end for(ix...) */
+    sum = 0.0;
+    for( i=0; i<npix; i++) sum += inten[i];
+
+    for( idetect=0; idetect<ndetect; idetect++) {
+        const vectori &idx = detIndex[idetect];
+        const vectord &wt = detWeight[idetect];
+        delta = 0.0;
+        for( i=0; i<(int)idx.size(); i++)
+            delta += wt[i] * inten[ idx[i] ];
+        detect[it][idetect][ip] = delta;
+    }
+
+    if( NULL != cbed ) {
+        for( i=0; i<ncbed; i++) cbed[i] = 0.0F;
+        for( i=0; i<npix; i++)
+            if( cbedIndex[i] >= 0 ) cbed[ cbedIndex[i] ] += inten[i];
+    }
+
+    return( sum );
+
+}  // end autostem::ADFsignals()
+
+/*------------------------ makeSlice() ---------------------*/
+/*
+  transmission function of one slice (bandwidth limited) from the slice
+  cache or trlayer() - may be called by one thread while others
+  propagate probes (pipeline) so only use this configuration
+
+  cf        = configuration with the displaced atoms and slice cache
+  islice    = slice index (kept in the cache as sliceRef[islice] if
+                some slices are the same)
+  istart,na = first atom and number of atoms in this slice
+  buf       = nx x ny work space (plans from cf.trans)
+
+  return a pointer to the transmission function (buf or in the cache)
+*/
+cfpix* autostem::makeSlice( astConfig &cf, int islice, int istart, int na, cfpix &buf )
+{
+    int key, lkeep;
+    cfpix *pt = NULL;
+    double phirms;
+
+    if( na < 1 ) return( &buf );
+
+    //  slices with the same atoms share one place in the cache
+    key = ( islice < (int) sliceRef.size() ) ? sliceRef[islice] : islice;
+    lkeep = ( (xTRUE == doCache) && (key >= 0) ) ? xTRUE : xFALSE;
+
+    if( xTRUE == lkeep ) pt = cf.tcache.get( key, buf );
+    if( NULL == pt ) {
+        trlayer( cf.xa2, cf.ya2, cf.occ2,
+            cf.Znum2, na, istart, (float)ax, (float)by, (float)keV,
+            buf, (long) nx, (long) ny, &phirms, &cf.nbeamt, (float) k2maxp );
+        pt = &buf;
+        if( xTRUE == lkeep ) cf.tcache.put( key, buf );
+    }
+
+    return( pt );
+
+}  // end autostem::makeSlice()
+
+/*------------------------ makeAperture() ---------------------*/
+/*
+  aberrated aperture function exp(-i*chi) of one probe condition on the
+  probe grid normalized to unit integrated intensity
+
+  p           = parameters with the aberrations (see chi())
+  multiMode   = use all aberrations if not 0 (else just df, Cs3, Cs5)
+  tiltx,tilty = beam tilt in radians (aperture centered on the tilt)
+  ar, ai      = real and imag. part at [iy + ix*nyprobe] (output)
+*/
+void autostem::makeAperture( vectorf &p, int multiMode, double tiltx, double tilty,
+            vectord &ar, vectord &ai )
+{
+    int ix, iy, i;
+    double k2maxa, k2maxb, alx, aly, k2, w, sum, scale;
+
+    k2maxa = apert1 /wavlen;
+    k2maxa = k2maxa *k2maxa;
+    k2maxb = apert2 /wavlen;
+    k2maxb = k2maxb * k2maxb;
+
+    ar.resize( nxprobe*nyprobe );
+    ai.resize( nxprobe*nyprobe );
+    sum = 0.0;
+    for( ix=0; ix<nxprobe; ix++) {
+        alx = wavlen * kxp[ix] - tiltx;  /* x component of angle alpha */
+        for( iy=0; iy<nyprobe; iy++) {
+            aly = wavlen * kyp[iy] - tilty;  /* y component of angle alpha */
+            k2 = kxp2[ix] + kyp2[iy];
+            if( (0.0 != tiltx) || (0.0 != tilty) ) k2 = (alx*alx + aly*aly)/(wavlen*wavlen);
+            i = iy + ix*nyprobe;
+            if( (k2 >= k2maxa) && (k2 <= k2maxb) ) {
+                w = - (2.0*pi/wavlen) * chi( p, alx, aly, multiMode );
+                ar[i] = cos( w );
+                ai[i] = sin( w );
+                sum += ar[i]*ar[i] + ai[i]*ai[i];
+            } else {
+                ar[i] = 0.0;
+                ai[i] = 0.0;
+            }
+        }
+    }  /* end for( ix... */
+    scale = 1.0/sqrt( sum );
+    for( i=0; i<nxprobe*nyprobe; i++) {
+        ar[i] *= scale;
+        ai[i] *= scale;
+    }
+
+}  // end autostem::makeAperture()
+
+/*------------------------ setupWindows() ---------------------*/
+/*
+  setup the depth-adaptive probe windows (if winTol > 0): level l is
+  nxprobe>>l x nyprobe>>l pixels with the same pixel size as the whole
+  probe so its Fourier space pixels are every 2^l-th pixel of the whole
+  probe (the propagator and aperture function are sampled there)
+
+  the start level win0 is the smallest window where less than winTol of
+  the intensity of the probe at the entrance surface is near the edge
+
+  must be called after cprop, aperr, aperi and the probes in cfg[0]
+  are made in calculate()
+*/
+void autostem::setupWindows()
+{
+    int l, ix, iy, i, nsx, nsy, nbeam;
+    double sum, w, x0, y0, ar, ai;
+    cfpix wave;
+
+    //  level 0 = whole probe (also used without windows)
+    nwin = 1;
+    win0 = 0;
+    wmapx[0].resize( nxprobe );
+    for( ix=0; ix<nxprobe; ix++) wmapx[0][ix] = ix;
+    wmapy[0].resize( nyprobe );
+    for( iy=0; iy<nyprobe; iy++) wmapy[0][iy] = iy;
+    wnorm[0] = 1.0;
+
+    if( winTol <= 0.0 ) return;
+    if( (0 != lprism) || (xTRUE == doConfocal) || (ncond > 1) ) {
+        sbuffer = "warning: depth-adaptive probe windows are not used with PRISM,"
+            " confocal detectors or probe conditions";
+        messageAST( sbuffer, 1 );
+        return;
+    }
+
+    wprop[0].resize( nxprobe, nyprobe );
+    wprop[0].copyInit( cfg[0].probe[0] );
+    wprop[0] = cprop;
+
+    //  windows must be an even number of pixels and not too small
+    //    (at least 100 pixels in the aperture as in calculate())
+    for( l=1; l<NWINMAX; l++) {
+        if( ( (nxprobe % (2<<l)) != 0 ) || ( (nyprobe % (2<<l)) != 0 )
+            || ( (nxprobe>>l) < 32 ) || ( (nyprobe>>l) < 32 ) ) break;
+        nsx = nxprobe >> l;
+        nsy = nyprobe >> l;
+        wmapx[l].resize( nsx );     //  same spatial frequency as freqn()
+        for( ix=0; ix<nsx; ix++)
+            wmapx[l][ix] = ( ix <= nsx/2 ) ? (ix<<l) : nxprobe - ((nsx-ix)<<l);
+        wmapy[l].resize( nsy );
+        for( iy=0; iy<nsy; iy++)
+            wmapy[l][iy] = ( iy <= nsy/2 ) ? (iy<<l) : nyprobe - ((nsy-iy)<<l);
+
+        sum = 0.0;
+        nbeam = 0;
+        for( ix=0; ix<nsx; ix++)
+        for( iy=0; iy<nsy; iy++) {
+            i = wmapy[l][iy] + wmapx[l][ix]*nyprobe;
+            w = aperr[i]*aperr[i] + aperi[i]*aperi[i];
+            sum += w;
+            if( w > 0.0 ) nbeam++;
+        }
+        if( nbeam < 100 ) break;
+        wnorm[l] = 1.0/sqrt( sum );
+
+        wprop[l].resize( nsx, nsy );
+        wprop[l].init( );           //  FFTW plans (also overwrites data)
+        for( ix=0; ix<nsx; ix++)
+        for( iy=0; iy<nsy; iy++) {
+            wprop[l].re(ix,iy) = cprop.re( wmapx[l][ix], wmapy[l][iy] );
+            wprop[l].im(ix,iy) = cprop.im( wmapx[l][ix], wmapy[l][iy] );
+        }
+        nwin = l + 1;
+    }
+
+    /*  smallest window that holds the probe (in the middle of it) */
+    for( l=nwin-1; l>0; l--) {
+        nsx = nxprobe >> l;
+        nsy = nyprobe >> l;
+        wave.resize( nsx, nsy );
+        wave.copyInit( wprop[l] );
+        x0 = ax*(nsx/2)/((double)nx);
+        y0 = by*(nsy/2)/((double)ny);
+        for( ix=0; ix<nsx; ix++)
+        for( iy=0; iy<nsy; iy++) {
+            i = wmapy[l][iy] + wmapx[l][ix]*nyprobe;
+            ar = aperr[i] * wnorm[l];
+            ai = aperi[i] * wnorm[l];
+            w = 2.0*pi*( x0*kxp[ wmapx[l][ix] ] + y0*kyp[ wmapy[l][iy] ] );
+            wave.re(ix,iy) = (float) ( ar*cos(w) - ai*sin(w) );
+            wave.im(ix,iy) = (float) ( ar*sin(w) + ai*cos(w) );
+        }
+        wave.ifft();
+        if( edgeFraction( wave ) <= winTol ) {
+            win0 = l;
+            break;
+        }
+    }
+
+    if( win0 > 0 ) {
+        sbuffer = "start each probe in a " + toString( nxprobe>>win0 ) + " x "
+            + toString( nyprobe>>win0 ) + " pixel window and double it when more than "
+            + toString( winTol ) + " of the intensity is near its edge";
+        messageAST( sbuffer, 0 );
+    } else {
+        sbuffer = "the probe does not fit in a smaller window, use "
+            + toString( nxprobe ) + " x " + toString( nyprobe ) + " pixels";
+        messageAST( sbuffer, 0 );
+        nwin = 1;
+    }
+
+}  // end autostem::setupWindows()
+
+/*------------------------ edgeFraction() ---------------------*/
+/*
+  fraction of the intensity of a wave function (in real space) in the
+  outer 1/8 of the window on each side
+*/
+double autostem::edgeFraction( cfpix &wave )
+{
+    int ix, iy, nsx, nsy, bx, by;
+    float prr, pri;
+    double delta, sum, sume;
+
+    nsx = wave.nx();
+    nsy = wave.ny();
+    bx = nsx/8;
+    if( bx < 1 ) bx = 1;
+    by = nsy/8;
+    if( by < 1 ) by = 1;
+
+    sum = sume = 0.0;
+    for( ix=0; ix<nsx; ix++) {
+        for( iy=0; iy<nsy; iy++) {
+            prr = wave.re(ix,iy);
+            pri = wave.im(ix,iy);
+            delta = prr*prr + pri*pri;
+            sum += delta;
+            if( (ix < bx) || (ix >= nsx-bx) || (iy < by) || (iy >= nsy-by) )
+                sume += delta;
+        }
+    }
+
+    return( ( sum > 0.0 ) ? sume/sum : 0.0 );
+
+}  // end autostem::edgeFraction()
+
+/*------------------------ growWindow() ---------------------*/
+/*
+  put a wave function (in real space) in the middle of a bigger window
+  with the same pixel size and zero elsewhere
+
+  wave        = wave function in the window of level lev (input)
+                   and level lnew < lev (output)
+  ixoff,iyoff = position of the window in the transmission function
+                   (updated)
+
+  scaled so the integrated intensity in Fourier space stays the same
+*/
+void autostem::growWindow( cfpix &wave, int lev, int lnew, int &ixoff, int &iyoff )
+{
+    int ix, iy, nsx, nsy, nbx, nby, dx, dy;
+    float scale;
+    vectorf wr, wi;
+
+    nsx = nxprobe >> lev;
+    nsy = nyprobe >> lev;
+    nbx = nxprobe >> lnew;
+    nby = nyprobe >> lnew;
+    dx = nbx/2 - nsx/2;
+    dy = nby/2 - nsy/2;
+    scale = 1.0F / ( (float) (1 << (lev-lnew)) );   //  sqrt( nsx*nsy/(nbx*nby) )
+
+    wr.resize( nsx*nsy );
+    wi.resize( nsx*nsy );
+    for( ix=0; ix<nsx; ix++)
+    for( iy=0; iy<nsy; iy++) {
+        wr[iy + ix*nsy] = wave.re(ix,iy);
+        wi[iy + ix*nsy] = wave.im(ix,iy);
+    }
+
+    wave.resize( nbx, nby );
+    wave.copyInit( wprop[lnew] );
+    wave = 0.0F;
+    for( ix=0; ix<nsx; ix++)
+    for( iy=0; iy<nsy; iy++) {
+        wave.re(ix+dx,iy+dy) = scale * wr[iy + ix*nsy];
+        wave.im(ix+dx,iy+dy) = scale * wi[iy + ix*nsy];
+    }
+
+    ixoff -= dx;
+    iyoff -= dy;
+
+}  // end autostem::growWindow()
+
+/*------------------------ padWindow() ---------------------*/
+/*
+  put a windowed probe in the middle of the whole probe grid (the same
+  as growWindow() to level 0 but into an existing array)
+
+  wave = windowed probe in real space at level lev (not changed)
+  full = whole probe (nxprobe x nyprobe, real space, output)
+*/
+void autostem::padWindow( cfpix &wave, int lev, cfpix &full )
+{
+    int ix, iy, nsx, nsy, dx, dy;
+    float scale;
+
+    nsx = nxprobe >> lev;
+    nsy = nyprobe >> lev;
+    dx = nxprobe/2 - nsx/2;
+    dy = nyprobe/2 - nsy/2;
+    scale = 1.0F / ( (float) (1 << lev) );
+
+    full = 0.0F;
+    for( ix=0; ix<nsx; ix++)
+    for( iy=0; iy<nsy; iy++) {
+        full.re(ix+dx,iy+dy) = scale * wave.re(ix,iy);
+        full.im(ix+dx,iy+dy) = scale * wave.im(ix,iy);
+    }
+
+}  // end autostem::padWindow()
+
+/*------------------------ PRISMsmatrix() ---------------------*/
+/*
+  PRISM step 1: propagate a plane wave exp(-2*pi*i*k.r) for each beam
+  prismBx[],prismBy[] (from calculate()) through the whole specimen
+  (the current configuration in cf) and save the exit waves in real
+  space at each thickness ThickSave[it] in cf.smat[ib + it*nbeam]
+
+  all beams go through each slice together so each transmission function
+  is calculated only once per configuration (no slice cache needed)
+
+  see:
+  C. Ophus, "A fast image simulation algorithm for scanning transmission
+     electron microscopy", Adv. Struct. Chem. Imag. 3 (2017) p.13
+*/
+void autostem::PRISMsmatrix( astConfig &cf, vectord &ThickSave, int nThick )
+{
+    int i, ib, it, na, istart, nbeam, ixb, iyb;
+    long nxl, nyl;
+    double phirms, zslice, totalz;
+    cfpix *beam;
+
+    /*  work space of this configuration */
+    vectorf &xa2 = cf.xa2, &ya2 = cf.ya2, &za2 = cf.za2, &occ2 = cf.occ2;
+    vectori &Znum2 = cf.Znum2;
+    cfpix &trans = cf.trans;
+
+    nxl = (long) nx;
+    nyl = (long) ny;
+    nbeam = (int) prismBx.size();
+
+    /*  exit waves are saved for all configurations of this cf */
+    if( NULL == cf.smat ) {
+        cf.smat = new cfpix[ nbeam*nThick ];
+        for( i=0; i<nbeam*nThick; i++) {
+            if( cf.smat[i].resize( nx, ny ) < 0 ) {
+                sbuffer = "autostem::PRISMsmatrix - Cannot allocate S-matrix storage";
+                messageAST( sbuffer, 2 );
+                exit( EXIT_FAILURE );
+            }
+            cf.smat[i].copyInit( trans );
+        }
+    }
+
+    /*  start with a plane wave = one pixel in Fourier space
+        - remember there is 1/(nx*ny) in ifft() */
+    beam = new cfpix[ nbeam ];
+    for( ib=0; ib<nbeam; ib++) {
+        if( beam[ib].resize( nx, ny ) < 0 ) {
+            sbuffer = "autostem::PRISMsmatrix - Cannot allocate plane wave storage";
+            messageAST( sbuffer, 2 );
+            exit( EXIT_FAILURE );
+        }
+        beam[ib].copyInit( trans );
+        beam[ib] = 0.0F;
+        ixb = prismBx[ib];      //  same spatial freq. on the whole specimen grid
+        if( ixb > (int) ( nxprobe/2.0 + 0.5) ) ixb = nx + (ixb-nxprobe)*(nx/nxprobe);
+        else ixb = ixb*(nx/nxprobe);
+        iyb = prismBy[ib];
+        if( iyb > (int) ( nyprobe/2.0 + 0.5) ) iyb = ny + (iyb-nyprobe)*(ny/nyprobe);
+        else iyb = iyb*(ny/nyprobe);
+        beam[ib].re(ixb,iyb) = ((float)nx) * ((float)ny);
+    }
+
+    zslice = 0.75*deltaz;  /*  start a little before top of unit cell */
+    istart = 0;
+    cf.nslice = 0;
+
+    if( cf.zmax > cz ) totalz = cf.zmax;
+        else totalz = cz;
+
+    while(  (zslice < (totalz+0.25*deltaz)) || (istart<natom) ) {
+
+        /* find range of atoms for current slice */
+        na = 0;
+        for(i=istart; i<natom; i++)
+            if( za2[i] < zslice ) na++; else break;
+
+        if( na > 0 ) trlayer( xa2, ya2, occ2, Znum2, na, istart,
+            (float)ax, (float)by, (float)keV, trans, nxl, nyl,
+            &phirms, &cf.nbeamt, (float) k2maxp );
+
+        /*----- one multislice trans/prop cycle for all beams ---- */
+#pragma omp parallel for
+        for( ib=0; ib<nbeam; ib++) {
+            if( na > 0 ) {
+                beam[ib].ifft();
+                beam[ib] *= trans;
+                beam[ib].fft();
+            }
+            beam[ib] *= cpropS;
+        }
+
+        /*  save the exit waves at each thickness level */
+        for( it=0; it<nThick; it++ )
+        if( fabs(ThickSave[it]-zslice)<fabs(0.5*deltaz)) {
+#pragma omp parallel for
+            for( ib=0; ib<nbeam; ib++) {
+                cf.smat[ib + it*nbeam] = beam[ib];
+                cf.smat[ib + it*nbeam].ifft();
+            }
+        }
+
+        cf.nslice++;
+        zslice += deltaz;
+        istart += na;
+
+    }  /* end while( istart...) */
+
+    delete [] beam;
+
+    return;
+
+}  // end autostem::PRISMsmatrix()
+
+/*------------------------ PRISMsignals() ---------------------*/
+/*
+  PRISM step 2: same as STEMsignals() but make the exit wave of each
+  probe position from the S-matrix of this configuration (calculate
+  it first if needed)
+
+  the probe = sum of the S-matrix beams times the aberrated aperture
+  function and a phase shift to the probe position in a window of
+  nxprobe/prismF x nyprobe/prismF pixels around the probe - the rest
+  of the probe array is zero - then FFT to get the diffraction pattern
+  on the same grid as STEMsignals() so the detectors are the same
+
+  x[],y[]  = probe positions
+  npos     = number of probe positions
+  detect[it][idetect][ip] = detector signals (output)
+  sum[ip]  = total integrated intensity (output)
+  the probe wave function at the last thickness is left in cf.probe[]
+*/
+void autostem::PRISMsignals( astConfig &cf, vectord &x, vectord &y, int npos,
+    double ***detect, int ndetect, vectord &ThickSave, int nThick, vectord &sum )
+{
+    int ip, nbeam, nxw, nyw, ixw0, iyw0;
+    double scale;
+    cfpix *probe = cf.probe;
+
+    if( xTRUE != cf.lsmat ) {
+        PRISMsmatrix( cf, ThickSave, nThick );
+        cf.lsmat = xTRUE;
+    }
+
+    nbeam = (int) prismBx.size();
+    nxw = nxprobe/prismF;           //  window around the probe
+    nyw = nyprobe/prismF;
+    ixw0 = nxprobe/2 - nxw/2;
+    iyw0 = nyprobe/2 - nyw/2;
+
+    /*  aperr,aperi are normalized on all nxprobe*nyprobe pixels
+        but only every prismF-th is used here */
+    scale = ((double)(prismF*prismF)) / ( ((double)nxprobe)*((double)nyprobe) );
+
+    threadScratch( cf, ndetect );
+
+#pragma omp parallel for
+    for( ip=0; ip<npos; ip++) {
+        int ix, iy, ixt, ixoff, iyoff, ib, i, it;
+        float *inten = &cf.inten[ ((size_t)threadNum())*nxprobe*nyprobe ];
+        double w, cr, ci, sr, si;
+        vectord accr( nxw*nyw ), acci( nxw*nyw );
+        vectori ixtab( nxw ), iytab( nyw );
+
+        /*  same window position as STEMsignals() - with periodic wrap */
+        ixoff = (int) floor( x[ip]*((double)nx) / ax ) - nxprobe/2;
+        iyoff = (int) floor( y[ip]*((double)ny) / by ) - nyprobe/2;
+        for( ix=0; ix<nxw; ix++) {
+            ixtab[ix] = ( ix + ixw0 + ixoff ) % nx;
+            if( ixtab[ix] < 0 ) ixtab[ix] += nx;
+        }
+        for( iy=0; iy<nyw; iy++) {
+            iytab[iy] = ( iy + iyw0 + iyoff ) % ny;
+            if( iytab[iy] < 0 ) iytab[iy] += ny;
+        }
+
+        for( it=0; it<nThick; it++) {
+            for( i=0; i<nxw*nyw; i++) accr[i] = acci[i] = 0.0;
+
+            for( ib=0; ib<nbeam; ib++) {
+                cfpix &s = cf.smat[ib + it*nbeam];
+                i = prismBy[ib] + prismBx[ib]*nyprobe;
+                w = 2.0*pi*( x[ip]*kxp[prismBx[ib]] + y[ip]*kyp[prismBy[ib]] );
+                cr = scale * ( aperr[i]*cos(w) - aperi[i]*sin(w) );
+                ci = scale * ( aperr[i]*sin(w) + aperi[i]*cos(w) );
+                for( ix=0; ix<nxw; ix++) {
+                    ixt = ixtab[ix];
+                    for( iy=0; iy<nyw; iy++) {
+                        sr = s.re(ixt,iytab[iy]);
+                        si = s.im(ixt,iytab[iy]);
+                        accr[iy + ix*nyw] += cr*sr - ci*si;
+                        acci[iy + ix*nyw] += cr*si + ci*sr;
+                    }
+                }
+            }  /* end for(ib...) */
+
+            probe[ip] = 0.0F;
+            for( ix=0; ix<nxw; ix++)
+            for( iy=0; iy<nyw; iy++) {
+                probe[ip].re(ix+ixw0,iy+iyw0) = (float) accr[iy + ix*nyw];
+                probe[ip].im(ix+ixw0,iy+iyw0) = (float) acci[iy + ix*nyw];
+            }
+            probe[ip].fft();
+
+            sum[ip] = ADFsignals( probe[ip], detect, it, ip, ndetect, inten,
+                cf.cbed.empty() ? NULL : &cf.cbed[ (ip + it*cf.sums.size())*ncbed ] );
+
+        }  /* end for(it...) */
+
+    }  /* end for(ip...) */
+
+    return;
+
+}  // end autostem::PRISMsignals()
+
 #elif defined(AST_USE_CUDA)
 
 //-------  checkCudaErr() -------------
@@ -1678,7 +4044,7 @@ int autostem::checkCudaErr( const char msg[] )
     return +1;
 }
 
-void autostem::STEMsignals( vectord &x, vectord &y, int npos, vectorf &p,
+void autostem::STEMsignals( astConfig &cf, vectord &x, vectord &y, int npos, vectorf &p,
          int multiMode, double ***detect, int ndetect,
          vectord &ThickSave, int nThick, vectord &sum, vectori &collectorMode,
          vectord &phiMin, vectord &phiMax )
@@ -1700,6 +4066,13 @@ void autostem::STEMsignals( vectord &x, vectord &y, int npos, vectorf &p,
     /* extra for confocal */
     float hr, hi;
     double chi2C, chi3C, k2maxaC, k2maxbC, r2, rx2;
+
+    /*  work space of this configuration */
+    vectorf &xa2 = cf.xa2, &ya2 = cf.ya2, &za2 = cf.za2, &occ2 = cf.occ2;
+    vectori &Znum2 = cf.Znum2;
+    float &zmax = cf.zmax;
+    int &nslice = cf.nslice;
+    cfpix &trans = cf.trans;
  
     /* ------ make sure x,y are ok ------ */
 
@@ -2153,6 +4526,7 @@ void autostem::STEMsignals( vectord &x, vectord &y, int npos, vectorf &p,
        storing in the array but this is slow and not practical
        
     21-jun-2024 add openMP to inner loop to speed it up a little ejk
+    16-oct-2026 sum with a row of phasors in x and y for each atom (sfgrid::direct())
 
     - keep argument list the same as the old version so the rest of the code is same
 */
@@ -2162,14 +4536,9 @@ void autostem::trlayer(const vectorf& x, const vectorf& y, const vectorf& occ,
         cfpix& trans, const long nx, const long ny,
         double* phirms, long* nbeams, const float k2max, const int justPhi)
 {
-    int j, ix, iy, iatom, Z;
-    const int NZMIN = 1;   // min Z 
-    const int NZMAX = 103; // max Z 
+    int ix, iy, lgrid;
     float k2, scale, wavlen, mm0;
     double vz, sum;
-    double  sumr, sumi, w;
-    static vectord fe(NZMAX + 1);  // scatt. factor
-    vector< vectord> fexy( nx, fe);    //  to parallel in ix
 
     rfpix poten(nx, ny);
 
@@ -2182,48 +4551,17 @@ void autostem::trlayer(const vectorf& x, const vectorf& y, const vectorf& occ,
     mm0 = (float)(1.0F + kev / 510.99906F);
     scale = ((float)(nx * ny)) * wavlen * mm0 / (ax * by);   //  this scale gives (nx*ny)*sigma*V_z(kx,ky)
 
-    for (iy = 0; iy < ny / 2 + 1; iy++)      //  sum in k-space
-#pragma omp parallel for private(k2,j,sumr,sumi,iatom,Z,w)
-        for (ix = 0; ix < nx; ix++) {      // only do half plane for real poten
-
-            poten.re(ix, iy) = 0.0F;    // fill in complex half plane of Fourier transform
-            poten.im(ix, iy) = 0.0F;    //   poten is real so only need half plane
-
-            k2 = kx2[ix] + ky2[iy];
-
-            if (k2 < k2max) {    // might use larger k2max here (no *2/3) ????
-
-                // init scatt. factor to <0 to indicate not yet valid for this kx,ky
-                //   - should always be > 0.0 for real values
-                for (j = 0; j < (NZMAX + 1); j++) fexy[ix][j] = -100.0;
-
-                sumr = sumi = 0.0;
-                for (iatom = istart; iatom < (istart + natom); iatom++) {
-
-                    Z = Znum[iatom];
-                    if ((Z < NZMIN) || (Z > NZMAX)) break;
+    //  sum only one unit cell of a perfect crystal or grid each
+    //    atomic species if that is faster (big slices)
+    lgrid = 0;
+    if( (0 == lwobble) && (ncellx*ncelly > 1) ) lgrid = sfg.lattice( x, y, occ, Znum,
+        istart, natom, ncellx, ncelly, ax, by, kx, ky, kx2, ky2, k2max, scale, fet, poten );
+    if( (0 == lgrid) && (trTol > 0.0) && sfg.isInit() ) lgrid = sfg.potential( x, y, occ, Znum,
+        istart, natom, kx, ky, kx2, ky2, k2max, scale, fet, poten );
 
-                    // save old values in a look-up-table for repeated Z 
-                    //  - don't repeat featom() calculation - speeds thing up a lot  
-                    if (fexy[ix][Z] < 0.0) {
-                        fexy[ix][Z] = featom(Z, k2);  // save scattering factor for this Z and kx,ky
-                    }
-                    w = twopi * (kx[ix] * x[iatom] + ky[iy] * y[iatom]);
-
-                    //  remember: fftw uses the opposite sign convention, 
-                    //     but this still needs to be - to get atoms in right side (not mirrored); why?
-                    sumr += fexy[ix][Z] * cos(-w) * occ[iatom];
-                    sumi += fexy[ix][Z] * sin(-w) * occ[iatom];
-                    //sumr += fe[Z] * cos(w) * occ[iatom];
-                    //sumi += fe[Z] * sin(w) * occ[iatom];
-
-                }  //end for( iatom...)
-
-                poten.re(ix, iy) = scale * ((float)sumr);  // real part
-                poten.im(ix, iy) = scale * ((float)sumi);  // imag part
-
-            } // end if(k2< ...
-        }   // end for(iy...
+    //  sum over atoms with the phasors of each atom in x and y
+    if( 0 == lgrid ) sfg.direct( x, y, occ, Znum, istart, natom,
+        kx, ky, kx2, ky2, k2max, scale, fet, poten );
 
     poten.ifft();    //  go back to real space - remember there is /(nx*ny) in ifft()
 
@@ -2297,3 +4635,207 @@ void autostem::invert2D( float** pix, long nxx, long nyy )
 
 #undef SWAP
 };  // end autostem::invert2D()
+
+/*------------------------ writeImages() ---------------------*/
+/*
+    write each 2D image as a TIFF file and list it in a text file
+
+    myFile     = floatTIFF with the parameters already set
+                   (resized and the detector parameters changed here)
+    fp         = open text file to list the image files in
+    fileoutpre = file name prefix, images are fileoutpre<i>_<it>.tif
+    pixr[][][] = images [idetect + it*ndetect] of size nxout x nyout
+    rmin, rmax = range of each image [it][idetect]
+    nThick, ndetect = number of thicknesses and detectors
+    collectorMode, almin, almax, phiMin, phiMax = detector parameters
+    ThickSave  = thickness of each image (in Ang.)
+    dx, dy     = pixel size of the images (in Ang.)
+*/
+void autostem::writeImages( floatTIFF &myFile, ofstream &fp, string fileoutpre,
+        float ***pixr, float **rmin, float **rmax, int nxout, int nyout,
+        int nThick, int ndetect, vectori &collectorMode,
+        vectord &almin, vectord &almax, vectord &phiMin, vectord &phiMax,
+        vectord &ThickSave, double dx, double dy )
+{
+    int i, it, ix, iy;
+    float aimin, aimax;
+    string fileout;
+
+    myFile.setnpix( 1 );
+    myFile.resize( nxout, nyout );
+    aimin = aimax = 0.0F;
+
+    for( it=0; it<nThick; it++)
+    for( i=0; i<ndetect; i++) {
+        fileout = fileoutpre + toString(i) + "_" + toString(it) + ".tif";
+        cout << fileout << ", " << DETECTNAME[collectorMode[i]] << ": output pix range : " 
+            << rmin[it][i] << " to " << rmax[it][i] << endl;
+        myFile.setParam( pRMAX, rmax[it][i] );
+        myFile.setParam( pRMIN, rmin[it][i] );
+        myFile.setParam(pMINDET, 0 );
+        myFile.setParam(pMAXDET, 0 );
+        myFile.setParam(pPMINDET, 0 );
+        myFile.setParam(pPMAXDET, 0 );
+        myFile.setParam(pCMINDET, 0 );
+        myFile.setParam(pCMAXDET, 0 );
+        if((ADF == collectorMode[i]) || (COMX == collectorMode[i]) || (COMY == collectorMode[i]) ) {
+            myFile.setParam( pMINDET, (float) ( almin[i] ) );
+            myFile.setParam( pMAXDET, (float) ( almax[i] ) );
+        } else if( CONFOCAL  == collectorMode[i] ) {
+            myFile.setParam(pCMINDET, (float) almin[i] );
+            myFile.setParam(pCMAXDET, (float) almax[i] );
+        } else if( ADF_SEG == collectorMode[i] ) {
+            myFile.setParam( pMINDET, (float) ( almin[i] ) );
+            myFile.setParam( pMAXDET, (float) ( almax[i] ) );
+            myFile.setParam( pPMINDET, (float) ( phiMin[i] ) );
+            myFile.setParam( pPMAXDET, (float) ( phiMax[i] ) );
+        }
+        for( ix=0; ix<nxout; ix++) for( iy=0; iy<nyout; iy++)  
+            myFile( ix, iy ) = pixr[i+it*ndetect][ix][iy];
+        if( myFile.write( fileout.c_str(), rmin[it][i], rmax[it][i], aimin, aimax,
+            (float) dx, (float) dy ) != 1 ) {
+                cout << "Cannot write output file " << fileout << endl;
+        }
+
+        if( (ADF == collectorMode[i]) || (COMX == collectorMode[i]) || 
+                (COMY == collectorMode[i]) || (COMI == collectorMode[i]) || (COMD == collectorMode[i]) )
+            fp << "file: " << fileout << ", " << DETECTNAME[collectorMode[i]]
+                << ", detector= " << almin[i]*1000.0 << " to " << almax[i]*1000.0 << " mrad, "
+                << "thicknes= " << ThickSave[it] << " A, range= " << rmin[it][i] 
+                << " to " << rmax[it][i] << endl;
+        else if( CONFOCAL == collectorMode[i] )
+            fp <<"file: " << fileout << ", " << DETECTNAME[collectorMode[i]]
+                << ", detector= " << almin[i] << " to " << almax[i] << " Angst., "
+                << "thicknes= " << ThickSave[it] << " A, range= " << rmin[it][i]
+                << " to " << rmax[it][i] << endl;
+        else if( ADF_SEG == collectorMode[i]  )
+            fp << "file: " << fileout << ", " << DETECTNAME[collectorMode[i]]
+                << ", detector= " << almin[i]*1000.0 << " to " << almax[i]*1000.0 << " mrad, "
+                << "thicknes= " << ThickSave[it] << " A, range= " << rmin[it][i] 
+                << " to " << rmax[it][i] << endl;
+        else if( TOTAL == collectorMode[i]  )
+            fp << "file: " << fileout << ", " << DETECTNAME[collectorMode[i]]
+                << ", thicknes= " << ThickSave[it] << " A, range= " << rmin[it][i] 
+                << " to " << rmax[it][i] << endl;
+    }  /*  end for(i=... */
+
+}  // end autostem::writeImages()
+
+/*------------------------ writePACBED() ---------------------*/
+/*
+    write the center of the position averaged CBED without the
+    anti-aliasing zeros as a TIFF file
+
+    myFile     = floatTIFF with the parameters already set
+    fileout    = name of the output file
+    pacbedPix[][] = pos. aver. CBED of size nxprobe x nyprobe
+                    with zero frequency in the middle (see invert2D())
+    dxp, dyp   = pixel size (in 1/Ang.)
+*/
+void autostem::writePACBED( floatTIFF &myFile, string fileout, float **pacbedPix,
+        int nxprobe, int nyprobe, double dxp, double dyp )
+{
+    int ixo, iyo, ix2, iy2, nx1, nx2, ny1, ny2, nxout2, nyout2;
+    float aimin, aimax, scalef, rmin0, rmax0;
+
+    myFile.setnpix( 1 );
+    nx1 =    nxprobe / 6;
+    nx2 = (5*nxprobe) / 6;  /*  cut out center portion without anti-aliasing zeros */
+    ny1 =    nyprobe / 6;
+    ny2 = (5*nyprobe) / 6;
+    nxout2 = nx2 - nx1 + 1;
+    nyout2 = ny2 - ny1 + 1;
+    if( (nxout2<1) || (nyout2<1) ) {
+            nx1 = ny1 = 0;
+            nx2 = nxout2 = nxprobe;
+            ny2 = nyout2 = nyprobe;
+    }
+    myFile.resize( nxout2, nyout2 );
+    aimin = aimax = 0.0F;
+    scalef = (float) (1.0/(nxout2*nyout2) );
+    ixo = 0;
+    for( ix2=nx1; ix2<=nx2; ix2++) {
+        iyo = 0;
+        for( iy2=ny1; iy2<=ny2; iy2++) {
+            myFile(ixo,iyo++) = scalef * pacbedPix[ix2][iy2];
+        }  ixo++;
+    }
+    rmin0 = myFile.min(0);
+    rmax0 = myFile.max(0);
+    myFile.setParam( pRMAX, rmax0 );
+    myFile.setParam( pRMIN, rmin0 );
+    myFile.setParam( pDX, (float) dxp);
+    myFile.setParam( pDY, (float) dyp );
+    cout << "pos. averg. CBED (unaliased) size " << nxout2 << " x " << nyout2 << " pixels\n"
+        << " and range (arb. units): " << rmin0 << " to " << rmax0 << endl;
+    if( myFile.write( fileout.c_str(), rmin0, rmax0, aimin, aimax,
+        (float) dxp, (float) dyp ) != 1 ) {
+        cout << "Cannot write output file " << fileout << endl;
+    }
+
+}  // end autostem::writePACBED()
+
+/*------------------------ writeDetect1D() ---------------------*/
+/*
+    write the detector parameters as comment lines in a 1D output file
+
+    fp         = open text file
+    ndetect, collectorMode, almin, almax, phiMin, phiMax = detectors
+*/
+void autostem::writeDetect1D( ofstream &fp, int ndetect, vectori &collectorMode,
+        vectord &almin, vectord &almax, vectord &phiMin, vectord &phiMax )
+{
+    int idetect;
+
+    for(  idetect=0; idetect<ndetect; idetect++) {
+        if( (ADF == collectorMode[idetect]) || (COMX == collectorMode[idetect]) ||
+            (COMY == collectorMode[idetect]) )
+            fp << "C Detector " << idetect << ", " << DETECTNAME[collectorMode[idetect]]
+                << ", Almin= " << almin[idetect]*1000.0
+               << " mrad, Almax= " << almax[idetect]*1000.0 << " mrad" << endl;
+        else if( CONFOCAL == collectorMode[idetect] )
+            fp << "C Detector " <<idetect << ", " << DETECTNAME[collectorMode[idetect]]
+                << ", cmin= " << almin[idetect] 
+                << " Angst, cmax= " << almax[idetect] << " Angst." << endl;
+        else if( ADF_SEG == collectorMode[idetect] )
+            fp << "C Detector " << idetect << ", " << DETECTNAME[collectorMode[idetect]]
+                << ", Almin= " << almin[idetect]*1000.0
+                << " mrad, Almax= " << almax[idetect]*1000.0  << " mrad, " 
+                << "phimin= " << phiMin[idetect]*180.0/pi << ", phimax= " 
+                << phiMax[idetect]*180.0/pi  << " deg." << endl;
+        else if( TOTAL == collectorMode[idetect] )
+            fp << "C Detector " << idetect << ", " << DETECTNAME[collectorMode[idetect]]
+                << endl;
+    }
+
+}  // end autostem::writeDetect1D()
+
+/*------------------------ writeLine1D() ---------------------*/
+/*
+    write the signals of a 1D line scan as columns of x, y, signal(s)
+
+    fp         = open text file
+    pixr[][][] = signals [idetect + it*ndetect][0][ip]
+                   (only the last thickness is written)
+    nyout      = number of positions
+    xi, yi     = start of the line scan (in Ang.)
+    dx, dy     = step along the line scan (in Ang.)
+*/
+void autostem::writeLine1D( ofstream &fp, float ***pixr, int nyout, int nThick,
+        int ndetect, double xi, double yi, double dx, double dy )
+{
+    int i, ip;
+
+    fp << "C     x      y     signal" << endl;
+
+    //  remember there is only one thickness for 1D mode
+    for( ip=0; ip<nyout; ip++) {
+        /* recalculate mean x,y without source size wobble */
+        fp << setw(14) << xi + dx * ((double)ip) << " "
+            << setw(14) << yi + dy * ((double)ip);
+        for(i=0; i<ndetect; i++)
+            fp << " " << setw(14) << pixr[i+(nThick-1)*ndetect][0][ip];
+        fp <<  endl;
+    }
+
+}  // end autostem::writeLine1D()
@@ -175,6 +175,58 @@ ANY OTHER PROGRAM).
      anti-aliasing  (remove vzaomtLUT) 4-jun-2024 ejk
   fix some float/double type def in cuda portion to get rid of warnings
         8-jun-2024 ejk
+  add slice cache to reuse transmission functions for each line in 2D mode
+        16-oct-2026
+  add probeBatch() to split the probe positions into batches set by a memory
+     budget and the number of threads (not the scan size) 16-oct-2026
+  move the work space of one phonon configuration into astConfig so
+     several configurations can be calculated at the same time 16-oct-2026
+  add checkpoint/resume of the partial sums (ckptFile, ckptMin, lresume)
+        16-oct-2026
+  add line0,line1,config0,config1,lshard to calculate one shard of a larger
+     calculation and make postImage() and invert2D() public for merging
+        16-oct-2026
+  add aperr,aperi to calculate the aberrated aperture function only once
+        16-oct-2026
+  add detIndex,detWeight for detector pixel lists 16-oct-2026
+  add PRISM mode (lprism, prismF, PRISMsmatrix(), PRISMsignals()) and
+     ADFsignals() 16-oct-2026
+  add cbedFile, cbedBin, cbedMax to save the 4D-STEM data 16-oct-2026
+  add lnyquist and fourierUpsample() for a Nyquist limited scan 16-oct-2026
+  add convErr, convMin, nconfigDone, convHist, convFinal to stop the
+     phonon average when it has converged 16-oct-2026
+  add lperiodic, periodx, periody and periodPixels() to calculate only one
+     period of the scan of a perfect crystal 16-oct-2026
+  add winTol, setupWindows(), edgeFraction(), growWindow() to start each
+     probe in a smaller window that grows with depth 16-oct-2026
+  add condParam, condGroup, condWeight and makeAperture() for a series of
+     probe conditions calculated in the same slices 16-oct-2026
+  add sourceSize() to convolve the images with the source size (pSOURCE)
+     and add source arg. to postImage() 16-oct-2026
+  add npipe, astConfig::ring and makeSlice() to calculate the next slices
+     while the probes go through the current one 16-oct-2026
+  add memMB and memoryPlan() to estimate the peak memory and fit the
+     calculation into a budget 16-oct-2026
+  add snapFile, snapEvery and writeSnap() to write snapshots of the
+     running average during the calculation 16-oct-2026
+  add fet to keep the scattering factors of each atomic species on the
+     grid for trlayer() 16-oct-2026
+  add ncellx, ncelly to sum only one unit cell of a perfect crystal in
+     trlayer() 16-oct-2026
+  add trTol to calculate the potential in trlayer() by gridding each
+     atomic species (sfgrid) 16-oct-2026
+  add sliceRef, nsliceDist, nsliceShare to calculate each distinct slice
+     of a crystal repeated in z only once 16-oct-2026
+  add freeConfigs() to also free cfg[] when the 4D-STEM file fails
+     16-oct-2026
+  add writeImages(), writePACBED(), writeDetect1D() and writeLine1D()
+     for the final output of autostem and astmerge 16-oct-2026
+  add astConfig::inten and threadScratch() so ADFsignals() uses a float
+     buffer of each thread instead of allocating one per call 16-oct-2026
+  add astConfig::cdet, ncdet for the probe condition signals of each
+     thread 16-oct-2026
+  add astConfig::wfull, nwfull and padWindow() for the signals of a
+     windowed probe 16-oct-2026
 
   this file is formatted for a TAB size of 8 characters 
   
@@ -191,6 +243,7 @@ ANY OTHER PROGRAM).
 
 #include <string>   // STD string class
 #include <vector>
+#include <fstream>  // STD file IO streams
 
 using namespace std;
 
@@ -199,6 +252,13 @@ using namespace std;
 #include "slicelib.hpp"    // misc. routines for multislice 
 #include "newD.hpp"        //  for 2D and 3D arrays
 #include "ransubs.hpp"     // random number generators
+#include "slicecache.hpp"  // to store transmission functions
+#include "astpartial.hpp"  // partial sums for checkpoint/resume
+#include "cbed4d.hpp"      // 4D-STEM output file
+#include "convstat.hpp"    // convergence of phonon average
+#include "snapshot.hpp"    // snapshots of the running average
+#include "sfgrid.hpp"      // gridded potential for large slices
+#include "floatTIFF.hpp"   // file I/O routines in TIFF format
 
 //#define AST_USE_CUDA    // define to use nvidia cuda
 
@@ -228,9 +288,138 @@ public:
     //   things that don't fit in param[]
     int lwobble, l1d, lxzimage, lpacbed, lverbose;
 
+    //  slice cache to calculate each transmission function once per
+    //    phonon configuration instead of once per batch of probes
+    //    cacheMB = max. memory in MBytes (<=0 for no limit)
+    //    cacheFile = scratch file for slices that do not fit (empty for none)
+    int lcache;
+    double cacheMB;
+    std::string cacheFile;
+
+    //  memory budget in MBytes for the probes propagated at the same time
+    //    (<=0 for automatic = 1/4 of physical memory)
+    double batchMB;
+
+    //  number of phonon configurations to calculate at the same time
+    //    (<=0 for automatic = enough to keep all threads busy)
+    int nconfigPar;
+
+    //  hard memory budget in MBytes for the whole calculation (<=0 for
+    //    none) - the pipeline, slice cache (to the scratch file), phonon
+    //    configurations at the same time and probes per batch are reduced
+    //    (in that order) until the estimated peak memory fits
+    double memMB;
+
+    //  checkpoint the partial sums to ckptFile (empty for none) at most every
+    //    ckptMin minutes (0 for every batch) and continue from it if lresume=1
+    //    - within a configuration only if one configuration runs at a time
+    std::string ckptFile;
+    double ckptMin;
+    int lresume;
+
+    //  only calculate scan lines line0 to line1-1 (x index in 2D, position
+    //    in 1D) and configurations config0 to config1-1 (<0 for all)
+    //    if lshard=1 the partial sums are left in ckptFile for astmerge
+    //    (not finished with postImage())
+    int line0, line1, config0, config1, lshard;
+
+    //  use the PRISM algorithm if lprism=1: propagate a plane wave for every
+    //    prismF-th beam (in x and y) inside the objective aperture through
+    //    the whole specimen once per configuration (the S-matrix) and make
+    //    the probe at each position from a window of nxprobe/prismF x
+    //    nyprobe/prismF pixels of it (prismF=1 is most accurate, larger is
+    //    faster) - not for confocal detectors, nx,ny must be a multiple of
+    //    nxprobe,nyprobe and nxprobe,nyprobe a multiple of prismF
+    int lprism, prismF;
+
+    //  save the diffraction pattern of every position and thickness in
+    //    cbedFile (empty for none, see cbed4d.hpp) binned by cbedBin x cbedBin
+    //    pixels and cropped to +/- cbedMax (in mrad, <=0 for all of it)
+    //    - not with checkpoints or shards
+    std::string cbedFile;
+    int cbedBin;
+    double cbedMax;
+
+    //  if lnyquist=1 only calculate the coarsest 2D scan that samples the
+    //    band limit of the objective aperture (2*apert2/wavlen) and Fourier
+    //    interpolate each image to nxout x nyout (assumes the image is
+    //    periodic with the scan size plus one pixel) - not with shards or
+    //    4D-STEM output
+    int lnyquist;
+
+    //  if lperiodic=1 the image of a perfect crystal (lwobble=0) repeats
+    //    with periodx x periody (in Ang., usually the unit cell) so only
+    //    calculate the positions of the first period of the 2D scan and
+    //    copy them to the rest of it (each period must be a whole number
+    //    of scan pixels) - not with shards or 4D-STEM output
+    int lperiodic;
+    double periodx, periody;
+
+    //  if winTol > 0 start each probe in a window of nxprobe/2^l x
+    //    nyprobe/2^l pixels (same pixel size, the smallest that holds the
+    //    probe at the entrance surface) and double it when more than winTol
+    //    of its intensity is near the edge of the window (in the outer 1/8
+    //    on each side) - not with confocal detectors or PRISM
+    double winTol;
+
+    //  probe condition series: if condParam is not empty every position is
+    //    calculated with each probe condition ic (condParam[ic] = param[]
+    //    with its own defocus, aberrations and beam tilt pXBTILT,pYBTILT)
+    //    in the same slices - condition ic adds condWeight[ic] (normalized
+    //    in each group) of its signals to group condGroup[ic] = 0,1,2...
+    //    whose detector idetect is idetect + group*ndetect/ngroup (the
+    //    caller repeats the detectors for each group) - pos. aver. CBED is
+    //    for condition 0 - not with confocal detectors, PRISM or 4D-STEM
+    std::vector< vectorf > condParam;
+    vectori condGroup;
+    vectord condWeight;
+
+    //  pipeline: one thread calculates the transmission functions of up
+    //    to npipe slices ahead (in a ring of npipe+1 slices of each
+    //    configuration) while the other threads transmit and propagate
+    //    the probes through the current slice - 0 to calculate each
+    //    slice with all threads before the probes (not used by PRISM)
+    int npipe;
+
+    //  stop adding phonon configurations when the relative standard error
+    //    of every image (convstat.hpp) is below convErr after at least
+    //    convMin configurations (nwobble is the max.) - convErr <= 0 to
+    //    always do all - not with checkpoints, shards or 4D-STEM output
+    double convErr;
+    int convMin;
+
+    //  write a snapshot of the running average of the 2D images to
+    //    snapFile + idetect + "_" + it + ".tif" (empty for none) after every
+    //    snapEvery configurations (or scan lines if there is only one
+    //    configuration) in the background (see snapshot.hpp) so partial
+    //    results can be looked at during a long run - not with 1D line
+    //    scans, shards, periodic or Nyquist scans
+    std::string snapFile;
+    int snapEvery;
+
+    //  if trTol > 0 trlayer() finds the potential of a slice from the
+    //    structure factor of each atomic species by gridding and FFT
+    //    (see sfgrid.hpp) with this relative accuracy when that is faster
+    //    than the direct sum over the atoms (big slices) - <=0 for the
+    //    direct sum always (not used by the CUDA version)
+    double trTol;
+
+    //  number of unit cells that ReadXYZcoord() replicated in x,y - if
+    //    ncellx*ncelly > 1 and lwobble=0 trlayer() checks if each slice
+    //    is made of identical unit cells and then only sums the atoms of
+    //    one cell at its reciprocal lattice points (see sfgrid.hpp)
+    int ncellx, ncelly;
+
+    //  (output) configurations averaged, max. rel. std. error after each
+    //    (from the 2nd) and the final rel. std. error of each image
+    //    [idetect + it*ndetect] (empty if convErr <= 0)
+    int nconfigDone;
+    vectord convHist, convFinal;
+
     //  misc info that may be used in calling program
     long nbeamt;
     double totmin, totmax, xmin, ymin, xmax, ymax;
+    int nprobeBatch, nbatches;   //  probes per batch and number of batches
 
     void CountBeams( vectorf &param, int &nbeamp, int &nbeampo, float &res, float &almax );
 
@@ -247,6 +436,35 @@ public:
         float ***pixr, float  **rmin, float **rmax,
         float **pacbedPix, ransubs& rng );
 
+    //  source size convolution (source = param[pSOURCE]), COMI,COMD
+    //     images from COMX,COMY and range of each image
+    void postImage( float ***pixr, float **rmin, float **rmax,
+        int nxout, int nyout, int nThick, int ndetect,
+        vectori &collectorMode, double xi, double xf, double yi, double yf,
+        double source=0.0 );
+
+    //  convolve nimg images with the source intensity: FWHM = source Ang.
+    //     Gaussian if source > 0 and Lorentzian if source < 0
+    void sourceSize( float ***pixr, int nimg, int nxout, int nyout,
+        double dx, double dy, double source );
+
+    void invert2D( float** pix, long nx, long ny );    /*   for CBED pix */
+
+    //  final output shared by autostem and astmerge: 2D images as
+    //     prefix<idetect>_<it>.tif (listed in fp), the center of the pos.
+    //     aver. CBED, and the detectors and signals of a 1D line scan
+    void writeImages( floatTIFF &myFile, ofstream &fp, string fileoutpre,
+        float ***pixr, float **rmin, float **rmax, int nxout, int nyout,
+        int nThick, int ndetect, vectori &collectorMode,
+        vectord &almin, vectord &almax, vectord &phiMin, vectord &phiMax,
+        vectord &ThickSave, double dx, double dy );
+    void writePACBED( floatTIFF &myFile, string fileout, float **pacbedPix,
+        int nxprobe, int nyprobe, double dxp, double dyp );
+    void writeDetect1D( ofstream &fp, int ndetect, vectori &collectorMode,
+        vectord &almin, vectord &almax, vectord &phiMin, vectord &phiMax );
+    void writeLine1D( ofstream &fp, float ***pixr, int nyout, int nThick,
+        int ndetect, double xi, double yi, double dx, double dy );
+
     //  transmission layer 
     void trlayer( const vectorf &x, const vectorf &y, const vectorf &occ,
         const vectori &Znum, const int natom, const int istart,
@@ -256,7 +474,7 @@ public:
 
 private:
 
-        int nx, ny, nxprobe, nyprobe, nslice;
+        int nx, ny, nxprobe, nyprobe;
         int natom;
 
         //  TRUE and FALSE seemed to be predefined in the GUI so change name slightly
@@ -270,8 +488,49 @@ private:
 
         void messageAST( std::string &smsg, int level = 0 );  // common error message handler
 
-        // complex probes and transmission functions
-        cfpix trans;
+        //  work space for one phonon configuration
+        //    (several may be calculated at the same time)
+        class astConfig {
+        public:
+            vectorf xa2, ya2, za2, occ2;    //  displaced atoms
+            vectori Znum2;
+            float zmin, zmax;
+            int nslice;
+            long nbeamt;
+            double totmin, totmax;
+            cfpix trans;            //  transmission function
+            slicecache tcache;      //  all transmission functions
+            cfpix *probe;           //  probes in one batch
+            double ***detect;       //  signals of one batch
+            vectord x, y, sums;
+            vectorf pixc;           //  signals of all positions
+            vectord pacbedc;        //  pos. aver. CBED
+            int ipos0;              //  first position (>0 if resumed)
+            cfpix *smat;            //  PRISM S-matrix (nThick*nbeam exit waves)
+            int lsmat;              //  xTRUE if smat is for this configuration
+            vectorf cbed;           //  4D-STEM patterns of one batch
+            cfpix *ring;            //  slices calculated ahead (npipe+1, or NULL)
+            vectorf inten;          //  |probe|^2 of each thread for ADFsignals()
+            double ***cdet;         //  signals of one probe condition of each thread
+            int ncdet;              //      [ithread][idetect][0] (NULL, 0 if not used)
+            cfpix *wfull;           //  whole probe grid of each thread for the
+            int nwfull;             //      signals of a windowed probe (NULL, 0 if not used)
+        };
+        astConfig *cfg;
+        int nconfigRun, nthreadAll; //  config. at the same time, total threads
+
+        int doCache;
+
+        //  first slice with the same atoms in projection as each slice
+        //     (empty if none are the same), the number of distinct
+        //     slices and the number used more than once (no wobble)
+        vectori sliceRef;
+        int nsliceDist, nsliceShare;
+
+        astpartial ckpt;            //  checkpoint of partial sums
+        convstat cstat;             //  running mean, variance of images
+        int writeCkpt( float ***pixr, float **pacbedPix, vectori &posix, vectori &posiy );
+
 #ifdef AST_USE_CUDA
         //  D prefix = on device, and H prefix = on Host
         float *Hcbed, *Dcbed, *Dkxp, *Dkyp, *Dkyp2, *Dkxp2, *Dphimin, *Dphimax;
@@ -284,11 +543,8 @@ private:
         cufftHandle cuplanP, cuplanT, cuplanTc2r;
         int checkCudaErr( const char msg[] );
         cfpix probe0;
-#else
-        cfpix *probe;
 #endif
 
-        float zmin, zmax;
         float ax, by, cz;                   //  specimen dimensions
         double k2maxp, Cs3,Cs5, df,apert1, apert2, pi, keV, twopi;
         double k2maxt;  //  really only used for cuda version
@@ -297,19 +553,84 @@ private:
 
         vectorf kx, ky, kx2, ky2, kxp, kyp, kxp2, kyp2;
         vectorf xp, yp;
-        vectorf xa2, ya2, za2, occ2;
-        vectori Znum2;
         vectord k2max, k2min;
+        vectord aperr, aperi;   //  aberrated aperture function (all probes)
+
+        //  pixels (iy + ix*nyprobe) inside each ADF, ADF_SEG, COMX, COMY detector
+        //     and their weight (1, kx or ky) - made once in calculate()
+        std::vector< vectori > detIndex;
+        std::vector< vectord > detWeight;
+
+        //  4D-STEM output: pattern pixel of each probe pixel (<0 if not used)
+        cbed4d c4d;
+        vectori cbedIndex;
+        int ncbed;              //  pixels in one pattern
+
+        //  snapshots of the running average
+        snapshot snap;
+        void writeSnap( float ***pix, float **rmin, float **rmax,
+            int nxout, int nyout, int nThick, int ndetect, vectori &collectorMode,
+            double xi, double xf, double yi, double yf, double source,
+            vectorf &param, int ndone );
 
         cfpix cprop;           // complex propagator in Fourier space
+
+        //  depth-adaptive probe window: level l is nxprobe>>l x nyprobe>>l
+        //    pixels (l=0 is the whole probe) with its propagator (and FFTW
+        //    plans), the pixel of the whole probe at each of its pixels and
+        //    the normalization of the aperture function
+        enum{ NWINMAX=8 };
+        int nwin, win0;         //  number of levels, start level
+        cfpix wprop[ NWINMAX ];
+        vectori wmapx[ NWINMAX ], wmapy[ NWINMAX ];
+        double wnorm[ NWINMAX ];
+
+        //  probe conditions (ncond=1 if not used), number of output groups,
+        //    normalized weight and aberrated aperture of each condition
+        int ncond, ngroup;
+        vectord condW;
+        std::vector< vectord > condAperr, condAperi;
+
+        cfpix cpropS;          // propagator of the whole specimen for PRISM
+        vectori prismBx, prismBy;   //  PRISM beams (index in kxp[],kyp[])
         rfpix poten0;          // r2c FFT for atomic potential
+        sfgrid sfg;            // gridded potential if trTol > 0
+        fetable fet;           // scattering factors on the grid (made once)
 
         double periodic( double pos, double size );
-        void STEMsignals( vectord &x, vectord &y, int npos, vectorf &p,
+        void fourierUpsample( float **pc, int ncx, int ncy, float **pf, int nxf, int nyf );
+        int periodPixels( double period, double xi, double xf, int nout );
+        void setupWindows();
+        cfpix* makeSlice( astConfig &cf, int islice, int istart, int na, cfpix &buf );
+        void makeAperture( vectorf &p, int multiMode, double tiltx, double tilty,
+            vectord &ar, vectord &ai );
+        double edgeFraction( cfpix &wave );
+        void growWindow( cfpix &wave, int lev, int lnew, int &ixoff, int &iyoff );
+        void padWindow( cfpix &wave, int lev, cfpix &full );
+        int probeBatch( int npos, int nThick, int ndetect, int nwobble, int lecho=1 );
+
+        //  limits used for this calculation (set by memoryPlan())
+        double batchLimMB, cacheLimMB;
+        int nconfigLim, npipeRun;
+        int memoryPlan( int npos, int nThick, int ndetect, int nwobble,
+            int nxout, int nyout, vectorf &za );
+        void freeConfigs( int nThick, int ndetect );
+#ifdef AST_USE_CUDA
+        void STEMsignals( astConfig &cf, vectord &x, vectord &y, int npos, vectorf &p,
             int multiMode, double ***detect, int ndetect,
             vectord &ThickSave, int nThick, vectord &sum, vectori &collectorMode,
             vectord &phiMin, vectord &phiMax );
-        void invert2D( float** pix, long nx, long ny );    /*   for CBED pix */
+#else
+        void STEMsignals( astConfig &cf, vectord &x, vectord &y, int npos,
+            double ***detect, int ndetect,
+            vectord &ThickSave, int nThick, vectord &sum, vectori &collectorMode );
+#endif
+        double ADFsignals( cfpix &wave, double ***detect, int it, int ip, int ndetect,
+            float *inten, float *cbed = NULL );
+        void threadScratch( astConfig &cf, int ndetect );
+        void PRISMsmatrix( astConfig &cf, vectord &ThickSave, int nThick );
+        void PRISMsignals( astConfig &cf, vectord &x, vectord &y, int npos,
+            double ***detect, int ndetect, vectord &ThickSave, int nThick, vectord &sum );
 
         /* extra for confocal mode */
         int doConfocal;
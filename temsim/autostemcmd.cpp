@@ -150,6 +150,45 @@ ANY OTHER PROGRAM).
   remove some old code commented out 6-jun-2024 ejk
   fix pacbed detect to work right in ubuntu source 19-jun-2024 ejk
   update to ransubs.getStatus() 20-jul-2024 ejk
+  add cmd line options -cache MB and -scratch file for slice cache
+       16-oct-2026
+  add cmd line option -batch MB for memory used by probes 16-oct-2026
+  add cmd line option -nconfig n for phonon configurations calculated
+       at the same time 16-oct-2026
+  add cmd line options -ckpt file, -ckptmin m and -resume to save the
+       partial sums and continue an interrupted calculation 16-oct-2026
+  add cmd line options -shard file, -lines l0 l1, -configs c0 c1 and
+       -seed n to calculate part of an image in several processes
+       (combine with astmerge) 16-oct-2026
+  add cmd line option -prism f to use the PRISM algorithm with
+       interpolation factor f 16-oct-2026
+  add cmd line options -4d file, -4dbin n and -4dmax mrad to save the
+       diffraction pattern of every position (4D-STEM) 16-oct-2026
+  add cmd line option -nyquist to calculate a coarse scan and Fourier
+       interpolate the images 16-oct-2026
+  add cmd line options -conv err and -convmin n to stop the phonon
+       average when it has converged (statistics in file _conv.txt)
+       16-oct-2026
+  add cmd line options -periodic and -period px py to calculate only one
+       period of the scan of a perfect crystal 16-oct-2026
+  add cmd line option -window tol to start each probe in a small window
+       that grows with depth 16-oct-2026
+  add cmd line option -probes file to calculate a series of probe conditions
+       (defocus, aberrations, beam tilt) in the same slices 16-oct-2026
+  add cmd line options -source fwhm and -lsource fwhm to convolve the 2D
+       images with a Gaussian or Lorentzian source size 16-oct-2026
+  add cmd line option -pipeline n to calculate up to n slices ahead of the
+       probes in one thread 16-oct-2026
+  add cmd line option -mem MB to fit the calculation into a memory budget
+       16-oct-2026
+  add cmd line option -snap n prefix to write snapshots of the running
+       average of the images during the calculation 16-oct-2026
+  add cmd line option -gridpot tol to grid the potential of big slices
+       16-oct-2026
+  pass ncellx, ncelly to autostem to sum one unit cell of a perfect
+       crystal 16-oct-2026
+  write the final images, pos. aver. CBED and line scan with
+       autostem::writeImages() etc. (same as astmerge) 16-oct-2026
 
 */
 
@@ -163,6 +202,7 @@ ANY OTHER PROGRAM).
 #include <iostream>  //  C++ stream IO
 #include <fstream>
 #include <iomanip>   //  to format the output
+#include <sstream>   //  to read the probe condition file
 #include <vector>
 
 using namespace std;
@@ -199,12 +239,12 @@ int main( int argc, char *argv[ ] )
     const string version = "8-aug-2024 (ejk)";
 
     int ix, iy, i, idetect, nxout, nyout,
-        ncellx, ncelly, ncellz, nwobble, ndetect, ip, nThick, it,
+        ncellx, ncelly, ncellz, nwobble, ndetect, nThick, it,
         done, status, multiMode;
     int nx, ny, nxprobe, nyprobe, nslice, natom, numslice;
 
     int l1d=0, lwobble=0, lxzimage=0, labErr=0, NPARAM, np, echo;
-    int lpacbed, ixo,iyo, ix2,iy2, nx1,nx2, ny1,ny2, nxout2,nyout2;
+    int lpacbed, lcache, nconfigPar, lresume;
     int doConfocal, doSegment;  // for confocal, segmented detector mode
 
     int nbeamp, nbeampo;
@@ -212,7 +252,7 @@ int main( int argc, char *argv[ ] )
 
     float ***pixr, temp, pmin, pmax, aimin, aimax;
     float wmin, wmax, xmin,xmax, ymin, ymax, temperature;
-    float rmin0, rmax0, scalef, res, thetamax;
+    float res, thetamax;
     float ax, by, cz, cz0;                    //  specimen dimensions
     float dfa2C, dfa2phiC, dfa3C, dfa3phiC;   // astigmatism parameters
     float  **rmin, **rmax;
@@ -226,6 +266,32 @@ int main( int argc, char *argv[ ] )
 
     double xi,xf, yi,yf, dx, dy, totmin, totmax,
        ctiltx, ctilty, timer, sourceFWHM,  vz;
+    double cacheMB;     //  memory limit for slice cache
+    double batchMB;     //  memory budget for probes propagated together
+    string cacheFile;   //  scratch file for slice cache
+    double ckptMin;     //  minutes between checkpoints
+    string ckptFile;    //  checkpoint file for partial sums
+    string shardFile;   //  partial sums of one shard
+    int line0, line1, config0, config1;     //  range of one shard
+    unsigned long long seed;    //  random number seed (0 for time)
+    int lprism, prismF;         //  PRISM mode and interpolation factor
+    string cbedFile;            //  4D-STEM output file
+    int cbedBin;                //  4D-STEM binning
+    double cbedMax;             //  4D-STEM max angle in mrad
+    int lnyquist;               //  coarse scan + Fourier interpolation
+    int lperiodic;              //  only calculate one period of the scan
+    double periodx, periody;    //  period of the image in Ang. (<=0 for unit cell)
+    double winTol;              //  edge intensity to grow the probe window
+    double convErr;             //  target rel. std. error of phonon average
+    int convMin;                //  min. number of configurations
+    int npipe;                  //  slices calculated ahead of the probes
+    double memMB;               //  memory budget (MBytes) of whole calc.
+    int snapEvery;              //  configurations (or lines) between snapshots
+    string snapFile;            //  prefix of snapshot files
+    double trTol;               //  accuracy of gridded potential
+    string probeFile;           //  file with a series of probe conditions
+    vector<string> condDesc;    //  line of probe condition file of each
+    int ngroup, nd0;            //  output groups, detectors of each group
 
     double wavlen, Cs3,Cs5, df,apert1, apert2, pi, keV;
     double deltaz;
@@ -237,7 +303,7 @@ int main( int argc, char *argv[ ] )
     vectorf xa, ya, za, occ, wobble;
 
     //  almin/max = detector polar angles, thetaMin/Max= detector azimuthal angles
-    vectord ThickSave, almin, almax, x, y, phiMin, phiMax;
+    vectord ThickSave, almin, almax, phiMin, phiMax;
     double almin0, almax0, phimin0, phimax0;
 
     ofstream fp;
@@ -265,10 +331,142 @@ int main( int argc, char *argv[ ] )
     cout << "\n";
 
     //    get option to save position averaged CBED pattern
+    //    and other options that start with -
+    //       -cache MB     = cache slices (MB max memory, 0 for no limit)
+    //       -scratch file = put slices that do not fit in memory in this file
+    //       -batch MB     = memory for probes propagated at the same time
+    //       -nconfig n    = phonon configurations calculated at the same time
+    //       -ckpt file    = save partial sums in this file (checkpoint)
+    //       -ckptmin m    = minutes between checkpoints (0 for every batch)
+    //       -resume       = continue from the checkpoint file
+    //       -shard file   = only save partial sums in this file (for astmerge)
+    //       -lines l0 l1  = only calculate scan lines l0 to l1-1 (x index in 2D)
+    //       -configs c0 c1= only calculate phonon configurations c0 to c1-1
+    //       -seed n       = random number seed (same in all shards)
+    //       -prism f      = PRISM algorithm with interpolation factor f
+    //       -4d file      = save diffraction pattern of every position
+    //       -4dbin n      = bin 4D-STEM patterns by n x n pixels
+    //       -4dmax mrad   = crop 4D-STEM patterns to +/- mrad
+    //       -nyquist      = only calculate the scan needed for the aperture
+    //                          band limit and Fourier interpolate the image
+    //       -periodic     = perfect crystal, only calculate one unit cell
+    //                          of the scan and copy it
+    //       -period px py = same with a period of px,py in Ang.
+    //       -window tol   = start each probe in a small window and double
+    //                          it when tol of the intensity is near its edge
+    //       -conv err     = stop adding configurations at this rel. std. error
+    //       -convmin n    = but do at least n configurations
+    //       -probes file  = calculate each probe condition (one per line =
+    //                          group weight [name value]...) in the same slices
+    //       -source fwhm  = convolve 2D images with a Gaussian source (Ang.)
+    //       -lsource fwhm = same with a Lorentzian source
+    //       -pipeline n   = calculate up to n slices ahead in one thread
+    //                          while the others propagate the probes
+    //       -mem MB       = fit the whole calculation into MB MBytes
+    //       -snap n prefix = write the running average of the 2D images to
+    //                          prefix*.tif after every n configurations
+    //                          (or n scan lines with one configuration)
+    //       -gridpot tol  = grid the potential of big slices with this
+    //                          relative accuracy (instead of direct sum)
     lpacbed = FALSE;
-    if( argc >= 2 ) {
-        pacbedFile =  argv[1]; 
-        if( pacbedFile.length() > 3) {  // Ubuntu sometimes puts CR here so ignore 
+    lcache = FALSE;
+    cacheMB = 0.0;
+    cacheFile = "";
+    batchMB = 0.0;
+    nconfigPar = 0;
+    ckptFile = "";
+    ckptMin = 10.0;
+    lresume = FALSE;
+    shardFile = "";
+    line0 = line1 = config0 = config1 = -1;
+    seed = 0;
+    lprism = FALSE;
+    prismF = 1;
+    cbedFile = "";
+    cbedBin = 1;
+    cbedMax = 0.0;
+    lnyquist = FALSE;
+    lperiodic = FALSE;
+    periodx = periody = 0.0;
+    winTol = 0.0;
+    convErr = 0.0;
+    convMin = 4;
+    probeFile = "";
+    sourceFWHM = 0.0;
+    npipe = 0;
+    memMB = 0.0;
+    snapEvery = 0;
+    snapFile = "";
+    trTol = 0.0;
+    for( i=1; i<argc; i++) {
+        cline = argv[i];
+        if( ( cline == "-cache" ) && ( i+1 < argc ) ) {
+            cacheMB = atof( argv[++i] );
+            lcache = TRUE;
+        } else if( ( cline == "-scratch" ) && ( i+1 < argc ) ) {
+            cacheFile = argv[++i];
+            lcache = TRUE;
+        } else if( ( cline == "-batch" ) && ( i+1 < argc ) ) {
+            batchMB = atof( argv[++i] );
+        } else if( ( cline == "-nconfig" ) && ( i+1 < argc ) ) {
+            nconfigPar = atoi( argv[++i] );
+        } else if( ( cline == "-ckpt" ) && ( i+1 < argc ) ) {
+            ckptFile = argv[++i];
+        } else if( ( cline == "-ckptmin" ) && ( i+1 < argc ) ) {
+            ckptMin = atof( argv[++i] );
+        } else if( cline == "-resume" ) {
+            lresume = TRUE;
+        } else if( ( cline == "-shard" ) && ( i+1 < argc ) ) {
+            shardFile = argv[++i];
+        } else if( ( cline == "-lines" ) && ( i+2 < argc ) ) {
+            line0 = atoi( argv[++i] );
+            line1 = atoi( argv[++i] );
+        } else if( ( cline == "-configs" ) && ( i+2 < argc ) ) {
+            config0 = atoi( argv[++i] );
+            config1 = atoi( argv[++i] );
+        } else if( ( cline == "-seed" ) && ( i+1 < argc ) ) {
+            seed = strtoull( argv[++i], NULL, 10 );
+        } else if( ( cline == "-prism" ) && ( i+1 < argc ) ) {
+            prismF = atoi( argv[++i] );
+            lprism = TRUE;
+        } else if( ( cline == "-4d" ) && ( i+1 < argc ) ) {
+            cbedFile = argv[++i];
+        } else if( ( cline == "-4dbin" ) && ( i+1 < argc ) ) {
+            cbedBin = atoi( argv[++i] );
+        } else if( ( cline == "-4dmax" ) && ( i+1 < argc ) ) {
+            cbedMax = atof( argv[++i] );
+        } else if( cline == "-nyquist" ) {
+            lnyquist = TRUE;
+        } else if( cline == "-periodic" ) {
+            lperiodic = TRUE;
+        } else if( ( cline == "-period" ) && ( i+2 < argc ) ) {
+            periodx = atof( argv[++i] );
+            periody = atof( argv[++i] );
+            lperiodic = TRUE;
+        } else if( ( cline == "-window" ) && ( i+1 < argc ) ) {
+            winTol = atof( argv[++i] );
+        } else if( ( cline == "-conv" ) && ( i+1 < argc ) ) {
+            convErr = atof( argv[++i] );
+        } else if( ( cline == "-convmin" ) && ( i+1 < argc ) ) {
+            convMin = atoi( argv[++i] );
+        } else if( ( cline == "-probes" ) && ( i+1 < argc ) ) {
+            probeFile = argv[++i];
+        } else if( ( cline == "-source" ) && ( i+1 < argc ) ) {
+            sourceFWHM = fabs( atof( argv[++i] ) );
+        } else if( ( cline == "-lsource" ) && ( i+1 < argc ) ) {
+            sourceFWHM = - fabs( atof( argv[++i] ) );  //  < 0 for Lorentzian
+        } else if( ( cline == "-pipeline" ) && ( i+1 < argc ) ) {
+            npipe = atoi( argv[++i] );
+        } else if( ( cline == "-mem" ) && ( i+1 < argc ) ) {
+            memMB = atof( argv[++i] );
+        } else if( ( cline == "-snap" ) && ( i+2 < argc ) ) {
+            snapEvery = atoi( argv[++i] );
+            snapFile = argv[++i];
+        } else if( ( cline == "-gridpot" ) && ( i+1 < argc ) ) {
+            trTol = atof( argv[++i] );
+        } else if( ( FALSE == lpacbed ) && ( cline.length() > 3 )
+            && ( cline[0] != '-' ) ) {  // Ubuntu sometimes puts CR here so ignore
+            pacbedFile =  cline;
             cout << "calculate 2D position averaged CBED pattern (arb. units) in file "
                 << pacbedFile << endl;
             lpacbed = TRUE;
@@ -276,6 +474,89 @@ int main( int argc, char *argv[ ] )
     }
     if( FALSE == lpacbed )
         cout << "To calculate 2D pos. aver. CBED, include a file name on command line." << endl;
+    if( TRUE == lcache ) {
+        cout << "cache transmission functions between batches of probes";
+        if( cacheMB > 0.0 ) cout << " (max " << cacheMB << " MBytes)";
+        if( cacheFile.length() > 0 ) cout << " with scratch file " << cacheFile;
+        cout << endl;
+    }
+    if( shardFile.length() > 0 ) {
+        cout << "calculate one shard: lines " << line0 << " to " << line1
+            << ", configurations " << config0 << " to " << config1
+            << " (<0 for all), save partial sums in " << shardFile << endl;
+        if( (ckptFile.length() > 0) && (ckptFile != shardFile) )
+            cout << "checkpoint file " << ckptFile << " replaced by shard file" << endl;
+        ckptFile = shardFile;
+    } else if( (line0 >= 0) || (line1 >= 0) || (config0 >= 0) || (config1 >= 0) ) {
+        cout << "-lines and -configs need a shard file (-shard file)" << endl;
+        exit( EXIT_FAILURE );
+    }
+    if( TRUE == lprism ) {
+        if( prismF < 1 ) prismF = 1;
+        cout << "use PRISM algorithm with interpolation factor " << prismF << endl;
+    }
+    if( cbedFile.length() > 0 ) {
+        if( cbedBin < 1 ) cbedBin = 1;
+        cout << "save the diffraction pattern of every position in " << cbedFile
+            << " binned by " << cbedBin;
+        if( cbedMax > 0.0 ) cout << " up to " << cbedMax << " mrad";
+        cout << endl;
+    }
+    if( TRUE == lnyquist ) {
+        cout << "calculate the coarsest scan allowed by the objective aperture"
+            << " and Fourier interpolate the image" << endl;
+    }
+    if( TRUE == lperiodic ) {
+        cout << "calculate only one period of the scan and copy it";
+        if( (periodx > 0.0) && (periody > 0.0) )
+            cout << " (period " << periodx << " x " << periody << " Ang.)";
+        cout << endl;
+    }
+    if( winTol > 0.0 ) {
+        cout << "start each probe in a small window and grow it when more than "
+            << winTol << " of the intensity is near the edge" << endl;
+    }
+    if( convErr > 0.0 ) {
+        if( convMin < 2 ) convMin = 2;
+        cout << "stop the phonon average at a rel. std. error of " << convErr
+            << " (at least " << convMin << " configurations)" << endl;
+    }
+    if( probeFile.length() > 0 ) {
+        cout << "calculate the probe conditions in file " << probeFile
+            << " in the same slices" << endl;
+    }
+    if( 0.0 != sourceFWHM ) {
+        cout << "convolve the images with a " << ( (sourceFWHM > 0.0) ? "Gaussian" : "Lorentzian" )
+            << " source size of " << fabs( sourceFWHM ) << " Ang. (FWHM)" << endl;
+    }
+    if( npipe > 0 ) {
+        cout << "calculate up to " << npipe << " slices ahead of the probes in"
+            << " one thread (pipeline)" << endl;
+    } else npipe = 0;
+    if( memMB > 0.0 ) {
+        cout << "fit the calculation into a memory budget of " << memMB
+            << " MBytes" << endl;
+    } else memMB = 0.0;
+    if( (snapEvery > 0) && (snapFile.length() > 0) ) {
+        cout << "write snapshots of the images to " << snapFile << "*.tif every "
+            << snapEvery << " configurations (or scan lines)" << endl;
+    } else snapEvery = 0;
+    if( trTol > 0.0 ) {
+        cout << "grid the potential of big slices with a rel. accuracy of "
+            << trTol << endl;
+    } else trTol = 0.0;
+    if( seed > 0 ) {
+        rngAST = ransubs( (uint64_t) seed );
+        cout << "random number seed = " << seed << endl;
+    }
+    if( ckptFile.length() > 0 ) {
+        cout << "save partial sums in checkpoint file " << ckptFile
+            << " every " << ckptMin << " minutes" << endl;
+        if( TRUE == lresume ) cout << "and continue from it if possible" << endl;
+    } else if( TRUE == lresume ) {
+        cout << "-resume needs a checkpoint file (-ckpt file)" << endl;
+        exit( EXIT_FAILURE );
+    }
 
 /*  get simulation options */
 
@@ -517,9 +798,9 @@ int main( int argc, char *argv[ ] )
         if( nwobble < 1 ) nwobble = 1;
         //  source size doesn't work here - requires too many MC samples
         //  but leave part here so I don't forget 30-jan-2019 ejk
+        //  (now a convolution of the final image, see -source)
         //cout << "Type source size (FWHM in Ang.):" << endl;
         //cin >> sourceFWHM;
-        sourceFWHM = 0.0;
 
         int iseed0 = rngAST.getStatus();
         if (iseed0 < 0) {
@@ -528,7 +809,6 @@ int main( int argc, char *argv[ ] )
     } else {
         temperature = 0.0F;
         nwobble = 1;
-        sourceFWHM = 0.0;
     }
 
     timer = cputim();   /* get initial CPU time */
@@ -568,6 +848,14 @@ int main( int argc, char *argv[ ] )
     }
 
     cout << natom <<" atomic coordinates read in" << endl;
+
+    //  a perfect crystal repeats with the unit cell that was replicated
+    if( (TRUE == lperiodic) && ( (periodx <= 0.0) || (periody <= 0.0) ) ) {
+        periodx = ax / ncellx;
+        periody = by / ncelly;
+        cout << "the image repeats with the unit cell " << periodx
+            << " x " << periody << " Ang." << endl;
+    }
     cout << description << endl;
 
     cout << "Lattice constant a,b,c = " << ax << ", " << by << ", " << cz << endl;
@@ -673,6 +961,67 @@ int main( int argc, char *argv[ ] )
         cout << "add random pi/4 aberration tuning errors" << endl;
     }
 
+    /*  read the probe condition series - each line is the output group
+        (0,1,2...), a weight and the changes from the probe above as
+        name value pairs: df (Ang.), tx ty (beam tilt in mrad), abb (random
+        aberration errors as abb scale * pi/4) or C32a etc. (mm)
+        - lines that do not start with two numbers are comments
+        - repeat the detectors for each group */
+    ngroup = 1;
+    nd0 = ndetect;
+    if( probeFile.length() > 0 ) {
+        ifstream fcond( probeFile.c_str() );
+        if( !fcond ) {
+            cout << "Cannot open probe condition file " << probeFile << endl;
+            exit( EXIT_FAILURE );
+        }
+        ngroup = 0;
+        while( getline( fcond, cline ) ) {
+            istringstream ssc( cline );
+            string name;
+            double w, v;
+            int g;
+            if( !( ssc >> g >> w ) ) continue;
+            vectorf pc = param;
+            while( ssc >> name >> v ) {
+                if( name == "df" ) pc[pDEFOCUS] = (float) v;
+                else if( name == "tx" ) pc[pXBTILT] = (float) ( v * 0.001 );
+                else if( name == "ty" ) pc[pYBTILT] = (float) ( v * 0.001 );
+                else if( name == "abb" ) ast.abbError( pc, 22, NPARAM, rngAST, 0, v );
+                else if( readCnm( name, pc, v ) < 0 ) {
+                    cout << "unrecognized probe condition " << name << ", exit..." << endl;
+                    exit( EXIT_FAILURE );
+                }
+            }
+            if( (g < 0) || (w < 0.0) ) {
+                cout << "bad probe condition group or weight: " << cline << endl;
+                exit( EXIT_FAILURE );
+            }
+            ast.condParam.push_back( pc );
+            ast.condGroup.push_back( g );
+            ast.condWeight.push_back( w );
+            condDesc.push_back( cline );
+            if( g >= ngroup ) ngroup = g + 1;
+        }
+        fcond.close();
+        if( ast.condParam.size() < 1 ) {
+            cout << "no probe conditions in " << probeFile << ", exit..." << endl;
+            exit( EXIT_FAILURE );
+        }
+        for( i=1; i<ngroup; i++)
+        for( idetect=0; idetect<nd0; idetect++) {
+            collectorMode.push_back( collectorMode[idetect] );
+            almin.push_back( almin[idetect] );
+            almax.push_back( almax[idetect] );
+            phiMin.push_back( phiMin[idetect] );
+            phiMax.push_back( phiMax[idetect] );
+        }
+        ndetect = nd0 * ngroup;
+        cout << ast.condParam.size() << " probe conditions in " << ngroup
+            << " groups, detectors " << nd0 << "*g to " << nd0 << "*g+"
+            << nd0-1 << " are group g" << endl;
+    }
+
     ast.CountBeams( param, nbeamp, nbeampo, res, thetamax );
 
     //  transmission function sampling
@@ -712,6 +1061,38 @@ int main( int argc, char *argv[ ] )
     ast.lpacbed = lpacbed;
     ast.lwobble = lwobble;
     ast.lxzimage = lxzimage;
+    ast.lcache = lcache;
+    ast.cacheMB = cacheMB;
+    ast.cacheFile = cacheFile;
+    ast.batchMB = batchMB;
+    ast.nconfigPar = nconfigPar;
+    ast.ckptFile = ckptFile;
+    ast.ckptMin = ckptMin;
+    ast.lresume = lresume;
+    ast.line0 = line0;
+    ast.line1 = line1;
+    ast.config0 = config0;
+    ast.config1 = config1;
+    ast.lshard = ( shardFile.length() > 0 ) ? 1 : 0;
+    ast.lprism = lprism;
+    ast.prismF = prismF;
+    ast.cbedFile = cbedFile;
+    ast.cbedBin = cbedBin;
+    ast.cbedMax = cbedMax;
+    ast.lnyquist = lnyquist;
+    ast.lperiodic = lperiodic;
+    ast.periodx = periodx;
+    ast.periody = periody;
+    ast.winTol = winTol;
+    ast.npipe = npipe;
+    ast.memMB = memMB;
+    ast.snapFile = snapFile;
+    ast.snapEvery = snapEvery;
+    ast.trTol = trTol;
+    ast.ncellx = ncellx;
+    ast.ncelly = ncelly;
+    ast.convErr = convErr;
+    ast.convMin = convMin;
     //????? ast.lverbose = 1;
     ast.lverbose = 0;
    
@@ -726,7 +1107,7 @@ int main( int argc, char *argv[ ] )
     param[ pTEMPER ] = temperature;     // temperature
     param[ pNWOBBLE ] = (float) nwobble;    //  number config. to average
     param[ pDELTAZ ] = (float) deltaz;      // slice thickness
-    param[ pSOURCE ] = (float) sourceFWHM;  // source size  -- should get rid of this ??? doesn't work
+    param[ pSOURCE ] = (float) sourceFWHM;  // source size (<0 for Lorentzian) - convolve final image
 
     param[ pNXPRB ] = (float) nxprobe;      // probe size in pixels
     param[ pNYPRB ] = (float) nyprobe;
@@ -737,13 +1118,46 @@ int main( int argc, char *argv[ ] )
     pixr = new3D<float>( ndetect*nThick, nxout, nyout, "pixr" );
 
    //  do the autostem calculation
-   ast.calculate( param, multiMode, natom, 
+   i = ast.calculate( param, multiMode, natom, 
         Znum, xa,ya,za, occ, wobble,
         xi,xf,yi,yf, nxout, nyout,
         ThickSave, nThick,
         almin, almax, collectorMode, ndetect,
         phiMin, phiMax,
         pixr, rmin, rmax, pacbedPix, rngAST );
+    if( i < 0 ) {
+        cout << "autostem calculation failed, status = " << i << endl;
+        exit( EXIT_FAILURE );
+    }
+    if( shardFile.length() > 0 ) {
+        cout << "partial sums saved in " << shardFile
+            << " (combine all shards with astmerge)" << endl;
+        return( EXIT_SUCCESS );
+    }
+
+    /*  convergence of the phonon average (if requested) */
+    if( ast.convFinal.size() > 0 ) {
+        nwobble = ast.nconfigDone;
+        fileout = fileoutpre + "_conv.txt";
+        fp.open( fileout.c_str() );
+        if( fp.bad() ) {
+            cout << "Cannot open output file " << fileout << endl;
+        } else {
+            fp << "C   convergence of phonon average, autostem version " << version << endl;
+            fp << "C   target rel. std. error = " << convErr << ", used "
+                << nwobble << " configurations" << endl;
+            fp << "C   final rel. std. error of each image (detector, thickness):" << endl;
+            for( it=0; it<nThick; it++)
+            for( i=0; i<ndetect; i++)
+                fp << "C   " << setw(4) << i << setw(4) << it << " "
+                    << DETECTNAME[collectorMode[i]] << " " << ast.convFinal[i + it*ndetect] << endl;
+            fp << "C   configurations, max. rel. std. error of all images" << endl;
+            for( i=0; i<(int)ast.convHist.size(); i++)
+                fp << setw(6) << i+2 << " " << setw(14) << ast.convHist[i] << endl;
+            fp.close();
+            cout << "convergence statistics written to " << fileout << endl;
+        }
+    }
 
     nslice = (int) ((zmax-zmin)/deltaz + 0.5);   // may be off by 1 or 2 with wobble
     nbeamt = ast.nbeamt;   //  ??? get beam count - should do this better
@@ -806,11 +1220,19 @@ int main( int argc, char *argv[ ] )
        fp << "C with a resolution (in Angstroms) = " << res  << endl;
        if( lwobble == 1 ) {
           fp << "C Number of thermal configurations = " << nwobble << endl;
-          fp << "C Source size = " << sourceFWHM << " Ang. (FWHM)" << endl;
+       }
+       if( 0.0 != sourceFWHM ) {
+          fp << "C Source size = " << fabs(sourceFWHM) << " Ang. (FWHM), "
+              << ( (sourceFWHM > 0.0) ? "Gaussian" : "Lorentzian" ) << endl;
        }
        if( TRUE == labErr ) {
           fp << "C  add pi/4 aberr. tuning errors" << endl;
 	   }
+       for( i=0; i<(int)condDesc.size(); i++)
+           fp << "C Probe condition " << i << " (group, weight, changes): " << condDesc[i] << endl;
+       if( ngroup > 1 )
+           fp << "C Detectors " << nd0 << "*g to " << nd0 << "*g+" << nd0-1
+               << " are probe condition group g" << endl;
        fp << endl;
 
         /*  store params plus min and max */
@@ -838,103 +1260,19 @@ int main( int argc, char *argv[ ] )
         param[pTEMPER] = temperature;
 
         for( i=0; i<NPARAM; i++) myFile.setParam( i, param[i] );
-        myFile.setnpix( 1 );
-        myFile.resize( nxout, nyout );
-        aimin = aimax = 0.0F;
-
-        for( it=0; it<nThick; it++)
-        for( i=0; i<ndetect; i++) {
-            //sprintf( fileout, "%s%03d%03d.tif", fileoutpre, i, it );   // plain C
-            fileout = fileoutpre + toString(i) + "_" + toString(it) + ".tif";
-            cout << fileout << ", " << DETECTNAME[collectorMode[i]] << ": output pix range : " 
-                << rmin[it][i] << " to " << rmax[it][i] << endl;
-            myFile.setParam( pRMAX, rmax[it][i] );
-            myFile.setParam( pRMIN, rmin[it][i] );
-            myFile.setParam(pMINDET, 0 );
-            myFile.setParam(pMAXDET, 0 );
-            myFile.setParam(pPMINDET, 0 );
-            myFile.setParam(pPMAXDET, 0 );
-            myFile.setParam(pCMINDET, 0 );
-            myFile.setParam(pCMAXDET, 0 );
-            if((ADF == collectorMode[i]) || (COMX == collectorMode[i]) || (COMY == collectorMode[i]) ) {
-                myFile.setParam( pMINDET, (float) ( almin[i] ) );
-                myFile.setParam( pMAXDET, (float) ( almax[i] ) );
-            } else if( CONFOCAL  == collectorMode[i] ) {
-                myFile.setParam(pCMINDET, (float) almin[i] );
-                myFile.setParam(pCMAXDET, (float) almax[i] );
-            } else if( ADF_SEG == collectorMode[i] ) {
-                myFile.setParam( pMINDET, (float) ( almin[i] ) );
-                myFile.setParam( pMAXDET, (float) ( almax[i] ) );
-                myFile.setParam( pPMINDET, (float) ( phiMin[i] ) );
-                myFile.setParam( pPMAXDET, (float) ( phiMax[i] ) );
-            }
-            for( ix=0; ix<nxout; ix++) for( iy=0; iy<nyout; iy++)  
-                myFile( ix, iy ) = pixr[i+it*ndetect][ix][iy];
-            if( myFile.write( fileout.c_str(), rmin[it][i], rmax[it][i], aimin, aimax,
-                (float) dx, (float) dy ) != 1 ) {
-                    cout << "Cannot write output file " << fileout << endl;
-            }
-
-            if( (ADF == collectorMode[i]) || (COMX == collectorMode[i]) || 
-                    (COMY == collectorMode[i]) || (COMI == collectorMode[i]) || (COMD == collectorMode[i]) )
-                fp << "file: " << fileout << ", " << DETECTNAME[collectorMode[i]]
-                    << ", detector= " << almin[i]*1000.0 << " to " << almax[i]*1000.0 << " mrad, "
-                    << "thicknes= " << ThickSave[it] << " A, range= " << rmin[it][i] 
-                    << " to " << rmax[it][i] << endl;
-            else if( CONFOCAL == collectorMode[i] )
-                fp <<"file: " << fileout << ", " << DETECTNAME[collectorMode[i]]
-                    << ", detector= " << almin[i] << " to " << almax[i] << " Angst., "
-                    << "thicknes= " << ThickSave[it] << " A, range= " << rmin[it][i]
-                    << " to " << rmax[it][i] << endl;
-            else if( ADF_SEG == collectorMode[i]  )
-                fp << "file: " << fileout << ", " << DETECTNAME[collectorMode[i]]
-                    << ", detector= " << almin[i]*1000.0 << " to " << almax[i]*1000.0 << " mrad, "
-                    << "thicknes= " << ThickSave[it] << " A, range= " << rmin[it][i] 
-                    << " to " << rmax[it][i] << endl;
-        }  /*  end for(i=... */
+        ast.writeImages( myFile, fp, fileoutpre, pixr, rmin, rmax, nxout, nyout,
+            nThick, ndetect, collectorMode, almin, almax, phiMin, phiMax,
+            ThickSave, dx, dy );
 
         fp.close();
 
         /*   save pos. aver. CBED if needed */
         if( lpacbed == TRUE ) {
-            myFile.setnpix( 1 );
-            nx1 =    nxprobe / 6;
-            nx2 = (5*nxprobe) / 6;  /*  cut out center portion without anti-aliasing zeros */
-            ny1 =    nyprobe / 6;
-            ny2 = (5*nyprobe) / 6;
-            nxout2 = nx2 - nx1 + 1;
-            nyout2 = ny2 - ny1 + 1;
-            if( (nxout2<1) || (nyout2<1) ) {
-                    nx1 = ny1 = 0;
-                    nx2 = nxout2 = nxprobe;
-                    ny2 = nyout2 = nyprobe;
-            }
-            myFile.resize( nxout2, nyout2 );
-            aimin = aimax = 0.0F;
-            scalef = (float) (1.0/(nxout2*nyout2) );
-            ixo = 0;
-            for( ix2=nx1; ix2<=nx2; ix2++) {
-                iyo = 0;
-                for( iy2=ny1; iy2<=ny2; iy2++) {
-                    myFile(ixo,iyo++) = scalef * pacbedPix[ix2][iy2];
-                }  ixo++;
-            }
-            rmin0 = myFile.min(0);
-            rmax0 = myFile.max(0);
             dxp = ax*((double)nxprobe)/nx;
             dyp = by*((double)nyprobe)/ny;
             dxp = 1.0/dxp;
             dyp = 1.0/dyp;
-            myFile.setParam( pRMAX, rmax0 );
-            myFile.setParam( pRMIN, rmin0 );
-            myFile.setParam( pDX, (float) dxp);
-            myFile.setParam( pDY, (float) dyp );
-            cout << "pos. averg. CBED (unaliased) size " << nxout2 << " x " << nyout2 << " pixels\n"
-                << " and range (arb. units): " << rmin0 << " to " << rmax0 << endl;
-            if( myFile.write( pacbedFile.c_str(), rmin0, rmax0, aimin, aimax,
-                (float) dxp, (float) dyp ) != 1 ) {
-                cout << "Cannot write output file " << pacbedFile << endl;
-            }
+            ast.writePACBED( myFile, pacbedFile, pacbedPix, nxprobe, nyprobe, dxp, dyp );
         }   /*  end if( lpacbed.... */
 
     /* ------------- start here for 1d line scan output ---------------- */
@@ -943,13 +1281,6 @@ int main( int argc, char *argv[ ] )
 
        dx = (xf-xi)/((double)(nyout-1));
        dy = (yf-yi)/((double)(nyout-1));
-       x.resize( nyout );
-       y.resize( nyout );
-       for( ip=0; ip<nyout; ip++) {
-           /* recalculate mean x,y without source size wobble */
-           x[ip] = xi + dx * ((double)ip);
-           y[ip] = yi + dy * ((double)ip);
-       }
 
        /* ------ first output text data ---------------- */
        fileout = fileoutpre + ".dat";
@@ -976,23 +1307,7 @@ int main( int argc, char *argv[ ] )
        }
        fp << "C Crystal tilt x,y= " << ctiltx << ", " << ctilty << endl;
 
-       for(  idetect=0; idetect<ndetect; idetect++) {
-            if( (ADF == collectorMode[idetect]) || (COMX == collectorMode[idetect]) ||
-                (COMY == collectorMode[idetect]) )
-                fp << "C Detector " << idetect << ", " << DETECTNAME[collectorMode[idetect]]
-                    << ", Almin= " << almin[idetect]*1000.0
-                   << " mrad, Almax= " << almax[idetect]*1000.0 << " mrad" << endl;
-            else if( CONFOCAL == collectorMode[idetect] )
-                fp << "C Detector " <<idetect << ", " << DETECTNAME[collectorMode[idetect]]
-                    << ", cmin= " << almin[idetect] 
-                    << " Angst, cmax= " << almax[idetect] << " Angst." << endl;
-            else if( ADF_SEG == collectorMode[idetect] )
-                fp << "C Detector " << idetect << ", " << DETECTNAME[collectorMode[idetect]]
-                    << ", Almin= " << almin[idetect]*1000.0
-                    << " mrad, Almax= " << almax[idetect]*1000.0  << " mrad, " 
-                    << "phimin= " << phiMin[idetect]*180.0/pi << ", phimax= " 
-                    << phiMax[idetect]*180.0/pi  << " deg." << endl;
-       }
+       ast.writeDetect1D( fp, ndetect, collectorMode, almin, almax, phiMin, phiMax );
 
        fp << "C ax= " << ax << " A, by= " << by << " A, cz= " << cz << " A" << endl;
        fp << "C Number of symmetrical anti-aliasing "
@@ -1005,18 +1320,12 @@ int main( int argc, char *argv[ ] )
        if( TRUE == labErr ) {
           fp << "C  add pi/4 aberr. tuning errors" << endl;
 	   }
-       fp << "C     x      y     signal" << endl;
-
-       //  remember there is only one thickness for 1D mode
-       for( ip=0; ip<nyout; ip++) {
-           /* recalculate mean x,y without source size wobble */
-           x[ip] = xi + dx * ((double)ip);
-           y[ip] = yi + dy * ((double)ip);
-           fp << setw(14) << x[ip] << " " << setw(14) << y[ip];
-           for(i=0; i<ndetect; i++)
-               fp << " " << setw(14) << pixr[i+(nThick-1)*ndetect][0][ip];
-           fp <<  endl;
-       }
+       for( i=0; i<(int)condDesc.size(); i++)
+           fp << "C Probe condition " << i << " (group, weight, changes): " << condDesc[i] << endl;
+       if( ngroup > 1 )
+           fp << "C Detectors " << nd0 << "*g to " << nd0 << "*g+" << nd0-1
+               << " are probe condition group g" << endl;
+       ast.writeLine1D( fp, pixr, nyout, nThick, ndetect, xi, yi, dx, dy );
 
        fp.close();
 
@@ -0,0 +1,384 @@
+/*              *** cbed4d.cpp ***
+
+------------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+---------------------- NO WARRANTY ------------------
+THIS PROGRAM IS PROVIDED AS-IS WITH ABSOLUTELY NO WARRANTY
+OR GUARANTEE OF ANY KIND, EITHER EXPRESSED OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE
+FOR DAMAGES RESULTING FROM THE USE OR INABILITY TO USE THIS
+PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU OR
+THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH
+ANY OTHER PROGRAM).
+------------------------------------------------------------------------
+
+   C++ class to save the diffraction pattern of every probe position
+   and thickness of an autostem calculation (see cbed4d.hpp)
+
+The source code is formatted for a tab size of 4.
+
+   started 16-oct-2026
+   add scan range to header and map() to read the file 16-oct-2026
+   replace add() with put() so each pattern is written once without
+      reading it back 16-oct-2026
+*/
+
+#include "cbed4d.hpp"   // class definition + inline functions here
+
+#include <cstring>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>   //  to memory map the file in map()
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static const char AST4D_MAGIC[] = "AST4DCB1";
+
+//  64 bit file position (the file may be bigger than 2 GBytes)
+#if defined(_WIN32)
+#define fseek64( fp, off ) _fseeki64( fp, off, SEEK_SET )
+#else
+#define fseek64( fp, off ) fseeko( fp, (off_t) (off), SEEK_SET )
+#endif
+
+//------------------ constructor --------------------------------
+cbed4d::cbed4d()
+{
+    nThick = nxout = nyout = nkx = nky = 0;
+    nbin = 1;
+    dkx = dky = wavlen = 0.0;
+    xi = xf = yi = yf = 0.0;
+    queueMB = 256.0;
+    fp = NULL;
+    headerBytes = 0;
+    status = +1;
+    queueBytes = 0.0;
+    done = 0;
+    mdata = NULL;
+    mbase = NULL;
+    mbytes = 0;
+
+}  // end cbed4d::cbed4d()
+
+//------------------ destructor ---------------------------------
+cbed4d::~cbed4d()
+{
+    if( NULL != fp ) close();
+    unmap();
+
+}  // end cbed4d::~cbed4d()
+
+//------------------ open() ---------------------------------
+//
+//  file = name of file to create (replaced if it exists)
+//
+//  write the header and make the data part all zero and
+//  start the writer thread
+//
+//  return +1 for success and <0 for failure
+//
+int cbed4d::open( std::string file )
+{
+    int32_t ih[8];
+    double dh[8];
+    int64_t nbytes, n;
+    char zero = 0;
+
+    if( NULL != fp ) close();
+
+    if( (nThick < 1) || (nxout < 1) || (nyout < 1) || (nkx < 1) || (nky < 1)
+        || ((int)thick.size() < nThick) ) {
+        sbuff = "cbed4d: bad size, cannot open " + file;
+        messageCB( sbuff, 2 );
+        return( -1 );
+    }
+
+    fileName = file;
+    fp = fopen( file.c_str(), "w+b" );
+    if( NULL == fp ) {
+        sbuff = "cbed4d: cannot open " + file;
+        messageCB( sbuff, 2 );
+        return( -2 );
+    }
+
+    //  round header up to a page so the data can be memory mapped
+    headerBytes = 8 + 8*sizeof(int32_t) + 8*sizeof(double) + nThick*sizeof(double);
+    headerBytes = ( (headerBytes + 4095)/4096 ) * 4096;
+
+    ih[0] = nThick;
+    ih[1] = nxout;
+    ih[2] = nyout;
+    ih[3] = nkx;
+    ih[4] = nky;
+    ih[5] = nbin;
+    ih[6] = (int32_t) headerBytes;
+    ih[7] = 0;
+    dh[0] = dkx;
+    dh[1] = dky;
+    dh[2] = wavlen;
+    dh[3] = xi;
+    dh[4] = xf;
+    dh[5] = yi;
+    dh[6] = yf;
+    dh[7] = 0.0;
+
+    n = fwrite( AST4D_MAGIC, 1, 8, fp );
+    n += fwrite( ih, sizeof(int32_t), 8, fp );
+    n += fwrite( dh, sizeof(double), 8, fp );
+    n += fwrite( &thick[0], sizeof(double), nThick, fp );
+
+    //  make the whole file (zeros) - holes in the file on most systems
+    nbytes = headerBytes + ((int64_t)sizeof(float)) * nThick
+        * ((int64_t)nxout) * ((int64_t)nyout) * ((int64_t)nkx) * ((int64_t)nky);
+    if( 0 == fseek64( fp, nbytes-1 ) ) n += fwrite( &zero, 1, 1, fp );
+    if( (n != (8+8+8+nThick+1)) || (0 != fflush( fp )) ) {
+        sbuff = "cbed4d: cannot write " + file;
+        messageCB( sbuff, 2 );
+        fclose( fp );
+        fp = NULL;
+        return( -3 );
+    }
+
+    status = +1;
+    queueBytes = 0.0;
+    done = 0;
+    writer = std::thread( &cbed4d::run, this );
+
+    return( +1 );
+
+}  // end cbed4d::open()
+
+//------------------ put() ---------------------------------
+//
+//  it     = thickness index
+//  ix,iy  = position index in the image (ix=0 for 1D)
+//  pat[]  = nkx*nky pattern (zero freq. at the center)
+//  weight = multiply pat[] by this before writing to the file
+//
+//  each pattern should be written once (it replaces what is there)
+//
+void cbed4d::put( int it, int ix, int iy, const float *pat, float weight )
+{
+    int i, npix;
+    chunk c;
+
+    if( NULL == fp ) return;
+
+    npix = nkx*nky;
+    c.offset = headerBytes + ((int64_t)sizeof(float)) * npix
+        * ( ( ((int64_t)it)*nxout + ix )*nyout + iy );
+    c.data.resize( npix );
+    for( i=0; i<npix; i++) c.data[i] = weight * pat[i];
+
+    //  wait if too much is waiting to be written
+    std::unique_lock<std::mutex> lock( mtx );
+    while( (queueBytes > queueMB*1024.0*1024.0) && !queue.empty() )
+        cvSpace.wait( lock );
+    queueBytes += npix*sizeof(float);
+    queue.push_back( c );
+    lock.unlock();
+    cvWork.notify_one();
+
+}  // end cbed4d::put()
+
+//------------------ run() ---------------------------------
+//
+//  the writer thread - write each pattern in the queue to the
+//  file until close()
+//
+void cbed4d::run()
+{
+    int npix;
+    size_t n;
+    chunk c;
+
+    while( 1 ) {
+        std::unique_lock<std::mutex> lock( mtx );
+        while( queue.empty() && (0 == done) ) cvWork.wait( lock );
+        if( queue.empty() ) break;      //  done and nothing left
+        c.offset = queue.front().offset;
+        c.data.swap( queue.front().data );
+        queue.pop_front();
+        lock.unlock();
+
+        npix = (int) c.data.size();
+        n = 0;
+        if( 0 == fseek64( fp, c.offset ) ) n = fwrite( &c.data[0], sizeof(float), npix, fp );
+
+        lock.lock();
+        if( n != (size_t) npix ) status = -1;
+        queueBytes -= npix*sizeof(float);
+        lock.unlock();
+        cvSpace.notify_all();
+    }
+
+}  // end cbed4d::run()
+
+//------------------ close() ---------------------------------
+//
+//  wait for the writer thread to finish and close the file
+//
+//  return +1 if all patterns were written and <0 if not
+//
+int cbed4d::close()
+{
+    if( NULL == fp ) return( status );
+
+    {
+        std::lock_guard<std::mutex> lock( mtx );
+        done = 1;
+    }
+    cvWork.notify_one();
+    if( writer.joinable() ) writer.join();
+
+    if( 0 != fclose( fp ) ) status = -2;
+    fp = NULL;
+
+    if( status < 0 ) {
+        sbuff = "cbed4d: error writing " + fileName;
+        messageCB( sbuff, 2 );
+    }
+
+    return( status );
+
+}  // end cbed4d::close()
+
+//------------------ map() ---------------------------------
+//
+//  file = name of an existing file written by open(), put(), close()
+//
+//  read the header (sets nThick, nxout, nyout, nkx, nky, nbin, dkx,
+//  dky, wavlen, xi, xf, yi, yf, thick[]) and memory map the data so
+//  it is read from disk only as pattern() is used
+//
+//  return +1 for success and <0 for failure
+//
+int cbed4d::map( std::string file )
+{
+    char magic[8];
+    int32_t ih[8];
+    double dh[8];
+    int64_t nbytes, n;
+    FILE *fr;
+
+    unmap();
+
+    fr = fopen( file.c_str(), "rb" );
+    if( NULL == fr ) {
+        sbuff = "cbed4d: cannot open " + file;
+        messageCB( sbuff, 2 );
+        return( -1 );
+    }
+    n = fread( magic, 1, 8, fr );
+    n += fread( ih, sizeof(int32_t), 8, fr );
+    n += fread( dh, sizeof(double), 8, fr );
+    if( (n != (8+8+8)) || (0 != memcmp( magic, AST4D_MAGIC, 8 ))
+        || (ih[0] < 1) || (ih[1] < 1) || (ih[2] < 1) || (ih[3] < 1) || (ih[4] < 1) ) {
+        sbuff = "cbed4d: " + file + " is not a 4D-STEM file";
+        messageCB( sbuff, 2 );
+        fclose( fr );
+        return( -2 );
+    }
+    nThick = ih[0];
+    nxout  = ih[1];
+    nyout  = ih[2];
+    nkx    = ih[3];
+    nky    = ih[4];
+    nbin   = ih[5];
+    headerBytes = ih[6];
+    dkx    = dh[0];
+    dky    = dh[1];
+    wavlen = dh[2];
+    xi     = dh[3];
+    xf     = dh[4];
+    yi     = dh[5];
+    yf     = dh[6];
+    thick.resize( nThick );
+    n = fread( &thick[0], sizeof(double), nThick, fr );
+
+    nbytes = ((int64_t)sizeof(float)) * nThick
+        * ((int64_t)nxout) * ((int64_t)nyout) * ((int64_t)nkx) * ((int64_t)nky);
+    if( n != nThick ) nbytes = -1;
+
+#if !defined(_WIN32)
+    //  the header is a multiple of the page size so map from the start
+    if( nbytes > 0 ) {
+        mbytes = headerBytes + nbytes;
+        mbase = mmap( NULL, (size_t) mbytes, PROT_READ, MAP_SHARED, fileno( fr ), 0 );
+        if( MAP_FAILED == mbase ) {
+            mbase = NULL;
+            mbytes = 0;
+        } else {
+            mdata = (const float*) ( ((const char*) mbase) + headerBytes );
+        }
+    }
+#endif
+
+    //  read all of the data if it cannot be mapped
+    if( (NULL == mdata) && (nbytes > 0) ) {
+        mcopy.resize( (size_t) (nbytes/sizeof(float)) );
+        n = 0;
+        if( 0 == fseek64( fr, headerBytes ) )
+            n = fread( &mcopy[0], sizeof(float), mcopy.size(), fr );
+        if( n == (int64_t) mcopy.size() ) mdata = &mcopy[0];
+        else mcopy.clear();
+    }
+    fclose( fr );
+
+    if( NULL == mdata ) {
+        sbuff = "cbed4d: cannot read " + file;
+        messageCB( sbuff, 2 );
+        return( -3 );
+    }
+    fileName = file;
+
+    return( +1 );
+
+}  // end cbed4d::map()
+
+//------------------ unmap() ---------------------------------
+void cbed4d::unmap()
+{
+#if !defined(_WIN32)
+    if( NULL != mbase ) munmap( mbase, (size_t) mbytes );
+#endif
+    mbase = NULL;
+    mbytes = 0;
+    mdata = NULL;
+    mcopy.clear();
+
+}  // end cbed4d::unmap()
+
+/*------------------------- messageCB() ----------------------*/
+/*
+    common message output
+    redirect all print message to here so this can be redirected
+        to a dialog box in a GUI or cmd line
+
+   level = level of seriousness
+            0 = simple status message
+        1 = significant warning
+        2 = possibly fatal error
+*/
+void cbed4d::messageCB( std::string &smsg,  int level )
+{
+    messageSL( smsg.c_str(), level );  //  just call slicelib version for now
+}
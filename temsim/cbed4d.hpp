@@ -0,0 +1,168 @@
+/*              *** cbed4d.hpp ***
+
+------------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+---------------------- NO WARRANTY ------------------
+THIS PROGRAM IS PROVIDED AS-IS WITH ABSOLUTELY NO WARRANTY
+OR GUARANTEE OF ANY KIND, EITHER EXPRESSED OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE
+FOR DAMAGES RESULTING FROM THE USE OR INABILITY TO USE THIS
+PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU OR
+THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH
+ANY OTHER PROGRAM).
+------------------------------------------------------------------------
+
+   C++ class to save the diffraction pattern (CBED) of every probe
+   position and thickness of an autostem calculation (4D-STEM data)
+
+   the patterns are written to a binary file by a separate thread
+   so the disk IO runs at the same time as the calculation - put()
+   only copies the pattern into a queue (and waits if the queue
+   is full) - the caller averages the phonon configurations so
+   each pattern is written once and the file is never read back
+
+   the file is raw binary in the native byte order (not portable
+   between different types of computers) and holds:
+
+      char[8]   = "AST4DCB1"
+      int32[8]  = nThick, nxout, nyout, nkx, nky, nbin, header size, spare
+      double[8] = dkx, dky (1/Ang. per output pixel), wavelength (Ang.),
+                     scan range xi, xf, yi, yf (Ang.), spare
+      double    thick[nThick]
+      zeros up to the header size (a multiple of 4096 bytes)
+      float     cbed[nThick][nxout][nyout][nkx][nky]
+
+   each pattern is nkx x nky pixels with zero frequency at pixel
+   (nkx/2,nky/2) so the data part can be memory mapped as one
+   5D array (nxout=1 for a 1D line scan)
+
+   a finished file can be read back with map() (memory mapped on
+   systems that have mmap(), read into memory otherwise) to apply
+   other detectors later without repeating the calculation
+
+The source code is formatted for a tab size of 4.
+
+----------------------------------------------------------
+The public member functions are:
+
+open()     : create the file (all zero) and start the writer thread
+put()      : write one pattern to the file (in the background)
+close()    : wait for all patterns to be written and close the file
+map()      : open an existing file for reading (sets the sizes)
+pattern()  : one pattern of a mapped file
+unmap()    : close a mapped file
+
+----------------------------------------------------------
+
+   started 16-oct-2026
+   add scan range to header and map() to read the file 16-oct-2026
+   replace add() with put() so each pattern is written once without
+      reading it back 16-oct-2026
+*/
+
+#ifndef CBED4D_HPP   // only include this file if its not already
+
+#define CBED4D_HPP   // remember that this has been included
+
+#include <cstdio>
+#include <cstdint>
+#include <string>   // STD string class
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "slicelib.hpp"    // misc. routines for multislice
+
+//------------------------------------------------------------------
+class cbed4d{
+
+public:
+
+    cbed4d();         // constructor functions
+
+    ~cbed4d();        //  destructor function
+
+    //  size of data (set before open())
+    int nThick, nxout, nyout, nkx, nky, nbin;
+    double dkx, dky, wavlen;
+    double xi, xf, yi, yf;  //  scan range
+    vectord thick;
+
+    //  max. memory in MBytes of patterns waiting to be written
+    double queueMB;
+
+    //  return +1 for success and <0 for failure
+    int open( std::string file );
+
+    //  write weight*pat[] (nkx*nky values) as the pattern of
+    //    thickness it and position (ix,iy) in the file
+    void put( int it, int ix, int iy, const float *pat, float weight );
+
+    //  return +1 if all patterns were written and <0 if not
+    int close();
+
+    inline int isOpen() const { return( NULL != fp ); }
+
+    //  read the header of an existing file and map its data
+    //  return +1 for success and <0 for failure
+    int map( std::string file );
+
+    //  pattern of thickness it and position (ix,iy) after map()
+    //    (nkx*nky values, zero freq. at the center)
+    inline const float *pattern( int it, int ix, int iy ) const {
+        return( mdata + ((int64_t)nkx) * nky * ( ( ((int64_t)it)*nxout + ix )*nyout + iy ) );
+    }
+
+    void unmap();
+
+private:
+
+    struct chunk {
+        int64_t offset;     //  in bytes from start of file
+        vectorf data;
+    };
+
+    FILE *fp;
+    std::string fileName;
+    int64_t headerBytes;
+    int status;             //  <0 after a write error
+
+    std::thread writer;
+    std::mutex mtx;
+    std::condition_variable cvWork, cvSpace;
+    std::deque<chunk> queue;
+    double queueBytes;
+    int done;
+
+    void run();             //  the writer thread
+
+    //  read side (map())
+    const float *mdata;     //  start of data
+    void *mbase;            //  start of mapping (NULL if read into mcopy)
+    int64_t mbytes;         //  size of mapping
+    vectorf mcopy;          //  data if not mapped
+
+    std::string sbuff;
+    void messageCB( std::string &smsg, int level = 0 );
+
+};  // end cbed4d::
+
+#endif  // CBED4D_HPP
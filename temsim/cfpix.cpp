@@ -62,6 +62,8 @@ findRange()     : find range of values in complex image
 
 invert2D( )     : rearrange pix with corners moved to center (for FFT's)
 
+mulWindow()     : multiply by a (periodic) window of a larger image
+
 operator*=() 
 operator+=()
 operator=()
@@ -77,6 +79,7 @@ operator=()
    small change in operator+=() 25-oct-2015 ejk
    fix bug in invert2D() for unequal nx,ny 30-jul-2016 ejk
    last modified 30-jul-2016 ejk
+   add mulWindow() 16-oct-2026
 */
 
 #include "cfpix.hpp"    // class definition + inline functions here
@@ -85,6 +88,14 @@ operator=()
 
 #include "slicelib.hpp"    // misc. routines for multislice
 
+//  compile several versions of the inner loop of mulWindow() for
+//    different instruction sets and pick one at run time (gcc on x86 only)
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define CF_TARGET_CLONES __attribute__((target_clones("avx512f","avx2","default")))
+#else
+#define CF_TARGET_CLONES
+#endif
+
 //------------------ constructor --------------------------------
 
 cfpix::cfpix( int nx, int ny )
@@ -355,6 +366,67 @@ cfpix& cfpix::operator*=( const cfpix& m  )
     return *this;
 }  //  end cfpix::operator*=()
 
+//--------------------- cmulRow() ----------------------------------
+//  complex multiply p[i] = p[i]*t[i] for n contiguous complex values
+//   (re,im interleaved) - simple enough for the compiler to vectorize
+CF_TARGET_CLONES
+static void cmulRow( float * __restrict p, const float * __restrict t, int n )
+{
+    int i;
+    float wr, wi, tr, ti;
+    for( i=0; i<2*n; i+=2) {
+        wr = p[i];
+        wi = p[i+1];
+        tr = t[i];
+        ti = t[i+1];
+        p[i]   = wr*tr - wi*ti;
+        p[i+1] = wr*ti + wi*tr;
+    }
+}  //  end cmulRow()
+
+//--------------------- mulWindow() ----------------------------------
+//  multiply by the nxl x nyl window of the (bigger) image t
+//    starting at pixel (ixoff,iyoff) of t and wrapping around
+//    periodically (i.e. the transmission function of a shifted probe)
+//
+//  the window is at most 4 rectangles that do not wrap so each row
+//    of each rectangle is one contiguous complex multiply
+//   real data not implemented yet
+void cfpix::mulWindow( const cfpix &t, int ixoff, int iyoff )
+{
+    int ix, ixt, ny1;
+    float *p;
+    const float *pt;
+
+    if( (nxl > t.nxl) || (nyl > t.nyl) ){
+        sbuff= "cfpix mulWindow() invoked with a window bigger than the image:\n"
+                +toString(nxl)+" x "+ toString(nyl) +" and "
+                + toString(t.nxl)+" x "+ toString( t.nyl );
+        messageCF( sbuff, 2 );
+        exit( EXIT_FAILURE );
+    }
+    if( (nxl < 1) || (nyl < 1) ) return;
+
+    ixoff = ixoff % t.nxl;
+    if( ixoff < 0 ) ixoff += t.nxl;
+    iyoff = iyoff % t.nyl;
+    if( iyoff < 0 ) iyoff += t.nyl;
+
+    ny1 = t.nyl - iyoff;    //  length of the part of each row before wrapping
+    if( ny1 > nyl ) ny1 = nyl;
+
+    for( ix=0; ix<nxl; ix++) {
+        ixt = ix + ixoff;
+        if( ixt >= t.nxl ) ixt -= t.nxl;
+        p = &data[ix*nyl][0];
+        pt = &t.data[iyoff + ixt*t.nyl][0];
+        cmulRow( p, pt, ny1 );
+        if( ny1 < nyl )
+            cmulRow( p + 2*ny1, &t.data[ixt*t.nyl][0], nyl-ny1 );
+    }  /* end for(ix...) */
+
+}  //  end cfpix::mulWindow()
+
 //--------------------- operator*=() ----------------------------------
 //  multiply all elements by a constant
 //   real data not implemented yet
@@ -59,6 +59,8 @@ findRange()     : find range of values in complex image
 
 invert2D( )     : rearrange pix with corners moved to center (for FFT's)
 
+mulWindow()     : multiply by a (periodic) window of a larger image
+
 operator*=() 
 operator+=()
 operator=()
@@ -75,6 +77,7 @@ operator=()
    small change in operator+=() 25-oct-2015 ejk
    fix bug in invert2D() for unequal nx,ny 30-jul-2016 ejk
    last modified 30-jul-2016 ejk
+   add mulWindow() 16-oct-2026
 */
 
 #ifndef CFPIX_HPP   // only include this file if its not already
@@ -160,6 +163,10 @@ public:
     void copyInit( cfpix &xx );
     void invert2D( );
 
+    //  multiply by the nx() x ny() window of the bigger image t starting
+    //    at pixel (ixoff,iyoff) of t with periodic wrap around
+    void mulWindow( const cfpix &t, int ixoff, int iyoff );
+
     void fft();     //  perform forward FFT
     void ifft();    //  perform inverse FFT
 
@@ -0,0 +1,124 @@
+/*              *** convstat.cpp ***
+
+------------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+---------------------- NO WARRANTY ------------------
+THIS PROGRAM IS PROVIDED AS-IS WITH ABSOLUTELY NO WARRANTY
+OR GUARANTEE OF ANY KIND, EITHER EXPRESSED OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE
+FOR DAMAGES RESULTING FROM THE USE OR INABILITY TO USE THIS
+PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU OR
+THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH
+ANY OTHER PROGRAM).
+------------------------------------------------------------------------
+
+   C++ class to keep the running mean and variance of a set of images
+   over frozen phonon configurations (see convstat.hpp)
+
+The source code is formatted for a tab size of 4.
+
+   started 16-oct-2026
+*/
+
+#include "convstat.hpp"   // class definition + inline functions here
+
+#include <cmath>
+
+//------------------ constructor --------------------------------
+convstat::convstat()
+{
+    n = nimage = 0;
+    npix = 0;
+
+}  // end convstat::convstat()
+
+//------------------ destructor ---------------------------------
+convstat::~convstat()
+{
+}  // end convstat::~convstat()
+
+//------------------ resize() ---------------------------------
+void convstat::resize( int nimagein, size_t npixin )
+{
+    n = 0;
+    nimage = nimagein;
+    npix = npixin;
+    mean.assign( nimage*npix, 0.0 );
+    m2.assign( nimage*npix, 0.0 );
+
+}  // end convstat::resize()
+
+//------------------ add() ---------------------------------
+//
+//  Welford's method: stable for many configurations even if the
+//  variance is small compared to the mean
+//
+void convstat::add( const float *x, double scale )
+{
+    size_t i, ntot;
+    double d, xs, rn;
+
+    n += 1;
+    rn = 1.0/((double) n);
+    ntot = mean.size();
+    for( i=0; i<ntot; i++) {
+        xs = scale * x[i];
+        d = xs - mean[i];
+        mean[i] += d * rn;
+        m2[i] += d * ( xs - mean[i] );
+    }
+
+}  // end convstat::add()
+
+//------------------ relErr() ---------------------------------
+double convstat::relErr( int i ) const
+{
+    size_t ip, i0;
+    double sm, sv;
+
+    if( (n < 2) || (i < 0) || (i >= nimage) ) return( 0.0 );
+
+    //  variance of the mean = m2/(n-1)/n
+    sm = sv = 0.0;
+    i0 = i*npix;
+    for( ip=0; ip<npix; ip++) {
+        sm += mean[i0+ip] * mean[i0+ip];
+        sv += m2[i0+ip];
+    }
+    if( sm <= 0.0 ) return( 0.0 );
+    sv = sv / ( ((double)(n-1)) * ((double)n) );
+
+    return( sqrt( sv/sm ) );
+
+}  // end convstat::relErr()
+
+//------------------ maxRelErr() ---------------------------------
+double convstat::maxRelErr() const
+{
+    int i;
+    double e, emax = 0.0;
+
+    for( i=0; i<nimage; i++) {
+        e = relErr( i );
+        if( e > emax ) emax = e;
+    }
+
+    return( emax );
+
+}  // end convstat::maxRelErr()
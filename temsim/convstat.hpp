@@ -0,0 +1,99 @@
+/*              *** convstat.hpp ***
+
+------------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+---------------------- NO WARRANTY ------------------
+THIS PROGRAM IS PROVIDED AS-IS WITH ABSOLUTELY NO WARRANTY
+OR GUARANTEE OF ANY KIND, EITHER EXPRESSED OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE
+FOR DAMAGES RESULTING FROM THE USE OR INABILITY TO USE THIS
+PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU OR
+THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH
+ANY OTHER PROGRAM).
+------------------------------------------------------------------------
+
+   C++ class to decide when enough frozen phonon configurations have
+   been averaged
+
+   keep the running mean and variance (Welford's method) of every
+   pixel of a set of images over the configurations added so far and
+   estimate the relative standard error of the mean of each image as
+
+      sqrt( sum( variance/n ) / sum( mean^2 ) )   (sum over its pixels)
+
+   (an image that is all zero so far has zero error)
+
+The source code is formatted for a tab size of 4.
+
+----------------------------------------------------------
+The public member functions are:
+
+resize()   : set the number and size of images (and clear)
+add()      : add the images of one more configuration
+nconfig()  : number of configurations added
+relErr()   : relative standard error of one image
+maxRelErr(): largest relative standard error of all images
+
+----------------------------------------------------------
+
+   started 16-oct-2026
+*/
+
+#ifndef CONVSTAT_HPP   // only include this file if its not already
+
+#define CONVSTAT_HPP   // remember that this has been included
+
+#include <cstddef>
+#include <vector>
+
+#include "slicelib.hpp"    // misc. routines for multislice
+
+//------------------------------------------------------------------
+class convstat{
+
+public:
+
+    convstat();         // constructor functions
+
+    ~convstat();        //  destructor function
+
+    //  nimage images of npix pixels each (all zero and no configurations)
+    void resize( int nimage, size_t npix );
+
+    //  add one configuration: x[ ip + i*npix ] = pixel ip of image i
+    //    multiplied by scale
+    void add( const float *x, double scale = 1.0 );
+
+    inline int nconfig() const { return( n ); }
+
+    //  return the relative standard error of image i (0 if n < 2)
+    double relErr( int i ) const;
+
+    //  return the largest relErr() of all images
+    double maxRelErr() const;
+
+private:
+
+    int n, nimage;
+    size_t npix;
+    vectord mean, m2;     //  running mean and sum of squared deviations
+
+};  // end convstat::
+
+#endif  // CONVSTAT_HPP
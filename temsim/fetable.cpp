@@ -0,0 +1,131 @@
+/*              *** fetable.cpp ***
+
+------------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+---------------------- NO WARRANTY ------------------
+THIS PROGRAM IS PROVIDED AS-IS WITH ABSOLUTELY NO WARRANTY
+OR GUARANTEE OF ANY KIND, EITHER EXPRESSED OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE
+FOR DAMAGES RESULTING FROM THE USE OR INABILITY TO USE THIS
+PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU OR
+THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH
+ANY OTHER PROGRAM).
+------------------------------------------------------------------------
+
+   C++ class to keep a table of the electron scattering factors of
+   each atomic species on the simulation grid (see fetable.hpp)
+
+The source code is formatted for a tab size of 4.
+
+   started 16-oct-2026
+*/
+
+#include "fetable.hpp"   // class definition + inline functions here
+
+//------------------ constructor --------------------------------
+fetable::fetable()
+{
+    nxt = nyt = nzt = 0;
+
+}  // end fetable::fetable()
+
+//------------------ destructor ---------------------------------
+fetable::~fetable()
+{
+}  // end fetable::~fetable()
+
+//------------------ init() ---------------------------------
+//
+//  Znum[]  = atomic numbers (first natom)
+//  kx2[],ky2[] = kx^2 and ky^2 of the grid
+//  nyt     = number of ky to use
+//
+//  return +1 for success and <0 for failure
+//
+int fetable::init( const vectori &Znum, int natom,
+        const vectorf &kx2, const vectorf &ky2, int nyi )
+{
+    int ix, iy, iZ, Z;
+    float k2;
+
+    if( (int)ky2.size() < nyi ) nyi = -1;
+    if( species( Znum, natom, (int) kx2.size(), nyi ) < 0 ) return( -1 );
+
+    for( Z=0; Z<(int)slot.size(); Z++) if( (iZ = slot[Z]) >= 0 )
+    for( ix=0; ix<nxt; ix++) for( iy=0; iy<nyt; iy++) {
+        k2 = kx2[ix] + ky2[iy];    //  same as trlayer()
+        tab[ ((long)iZ*nxt + ix)*nyt + iy ] = featom( Z, k2 );
+    }
+
+    return( +1 );
+
+}  // end fetable::init()
+
+//------------------ species() ---------------------------------
+//
+//  find the atomic species and allocate the table
+//
+//  return +1 for success and <0 for failure
+//
+int fetable::species( const vectori &Znum, int natom, int nx, int nyi )
+{
+    int i, Z;
+
+    const int NZMIN = 1;   // min Z 
+    const int NZMAX = 103; // max Z 
+
+    nxt = nyt = nzt = 0;
+    slot.assign( NZMAX+1, -1 );
+    tab.clear();
+
+    if( (nx < 1) || (nyi < 1) || (natom > (int)Znum.size()) ) {
+        sbuff = "fetable: bad size";
+        messageFE( sbuff, 2 );
+        return( -1 );
+    }
+
+    for( i=0; i<natom; i++) {
+        Z = Znum[i];
+        if( (Z < NZMIN) || (Z > NZMAX) ) continue;
+        if( slot[Z] < 0 ) slot[Z] = nzt++;
+    }
+
+    nxt = nx;
+    nyt = nyi;
+    tab.resize( ((long)nzt)*nxt*nyt );
+
+    return( +1 );
+
+}  // end fetable::species()
+
+/*------------------------ messageFE() ---------------------*/
+/*
+    common message output
+    redirect all print message to here so this can be redirected
+        to a dialog box in a GUI or cmd line
+
+   level = level of seriousness
+            0 = simple status message
+        1 = significant warning
+        2 = possibly fatal error
+*/
+void fetable::messageFE( std::string &smsg,  int level )
+{
+    messageSL( smsg.c_str(), level );  //  just call slicelib version for now
+}
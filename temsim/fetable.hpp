@@ -0,0 +1,120 @@
+/*              *** fetable.hpp ***
+
+------------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+---------------------- NO WARRANTY ------------------
+THIS PROGRAM IS PROVIDED AS-IS WITH ABSOLUTELY NO WARRANTY
+OR GUARANTEE OF ANY KIND, EITHER EXPRESSED OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE
+FOR DAMAGES RESULTING FROM THE USE OR INABILITY TO USE THIS
+PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU OR
+THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH
+ANY OTHER PROGRAM).
+------------------------------------------------------------------------
+
+   C++ class to keep a table of the electron scattering factor
+   fe(Z,k) (from featom()) of each atomic species in the specimen at
+   every k of the simulation grid (k^2 = kx2[ix] + ky2[iy])
+
+   featom() calls exp() for each Gaussian term and reads its parameters
+   the first time it is called (which is NOT thread safe), so make this
+   table once per run (before the threads start) and then share it
+   between threads, slices and phonon configurations (read only)
+
+   the table is nZ * nx * ny doubles (usually only the half plane
+   iy < ny/2+1 is needed for a real potential)
+
+The source code is formatted for a tab size of 4.
+
+----------------------------------------------------------
+The public member functions are:
+
+init()      : make the table for the atomic species in a list
+fe()        : return fe(Z,k) at one k of the grid
+has()       : does the table include this atomic species
+row()       : return the start of one row of the table (fixed kx)
+
+----------------------------------------------------------
+
+   started 16-oct-2026
+*/
+
+#ifndef FETABLE_HPP   // only include this file if its not already
+
+#define FETABLE_HPP   // remember that this has been included
+
+#include <string>   // STD string class
+#include <vector>
+
+#include "slicelib.hpp"     // misc. routines for multislice
+
+//------------------------------------------------------------------
+class fetable{
+
+public:
+
+    fetable();         // constructor functions
+
+    ~fetable();        //  destructor function
+
+    //  Znum[]  = atomic numbers (only the first natom, may repeat)
+    //  kx2[],ky2[] = kx^2 and ky^2 of the grid (from freqn())
+    //  nyt     = number of ky to use (ky2[0] to ky2[nyt-1])
+    //  - k^2 is the sum kx2[ix]+ky2[iy] in the same precision as
+    //    kx2[] and ky2[] so the table gives exactly the same values
+    //    as featom() called with that sum
+    //  - calls featom() so it is NOT thread safe (call once before
+    //    the threads start)
+    //  return +1 for success and <0 for failure
+    int init( const vectori &Znum, int natom,
+        const vectorf &kx2, const vectorf &ky2, int nyt );
+
+    //  fe(Z,k) at kx2[ix]+ky2[iy] - Z must be in the table
+    inline double fe( int Z, int ix, int iy ) const {
+        return( tab[ ((long)slot[Z]*nxt + ix)*nyt + iy ] ); }
+
+    //  does the table include atomic number Z for a grid this size
+    inline int has( int Z, int nx, int ny ) const {
+        return( ( (Z >= 0) && (Z < (int)slot.size()) && (nx == nxt)
+            && (ny <= nyt) && (slot[Z] >= 0) ) ? 1 : 0 ); }
+
+    //  fe(Z,k) at kx2[ix]+ky2[iy] for iy=0,1,2...ny()-1 - Z must be in the table
+    inline const double *row( int Z, int ix ) const {
+        return( &tab[ ((long)slot[Z]*nxt + ix)*nyt ] ); }
+
+    inline int nx() const { return( nxt ); }
+    inline int ny() const { return( nyt ); }
+
+    //  number of atomic species in the table
+    inline int nZ() const { return( nzt ); }
+
+private:
+
+    int nxt, nyt, nzt;
+    vectori slot;       //  index of each Z in tab[] or -1 if not there
+    vectord tab;        //  fe for each Z, kx, ky
+
+    int species( const vectori &Znum, int natom, int nx, int ny );
+
+    std::string sbuff;
+    void messageFE( std::string &smsg, int level = 0 );
+
+};  // end fetable::
+
+#endif  // FETABLE_HPP
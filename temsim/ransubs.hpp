@@ -36,6 +36,7 @@ ANY OTHER PROGRAM).
     ranPoisson()  : return a random number with Poisson distribution
 
     getInitSeed() : diagnostic
+    getState()    : current state (to save and continue later with resetSeed())
     resetSeed()   : diagnostic - should not normally use this
 
     move RNG from slicelib to here
@@ -46,6 +47,7 @@ ANY OTHER PROGRAM).
     update resetSeed() to return void  11-jun-2024 ejk
     update to better low level RNG xorshift* 14-jul-2024 ejk
     last modified 14-jul-2024 ejk
+    add getState() for checkpoint/resume 16-oct-2026
 */
 
 
@@ -67,6 +69,9 @@ public:
 
     uint64_t getInitSeed() { return initseed;  }
 
+    //  to continue the same sequence later with resetSeed()
+    uint64_t getState() { return iseed;  }
+
     // <0 indicates a bad init
     int getStatus() { return initOK;  }
 
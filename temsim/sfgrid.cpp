@@ -0,0 +1,546 @@
+/*              *** sfgrid.cpp ***
+
+------------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+---------------------- NO WARRANTY ------------------
+THIS PROGRAM IS PROVIDED AS-IS WITH ABSOLUTELY NO WARRANTY
+OR GUARANTEE OF ANY KIND, EITHER EXPRESSED OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE
+FOR DAMAGES RESULTING FROM THE USE OR INABILITY TO USE THIS
+PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU OR
+THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH
+ANY OTHER PROGRAM).
+------------------------------------------------------------------------
+
+   C++ class to calculate the projected atomic potential of a slice
+   by gridding each atomic species (see sfgrid.hpp)
+
+The source code is formatted for a tab size of 4.
+
+   started 16-oct-2026
+*/
+
+#include "sfgrid.hpp"   // class definition + inline functions here
+
+#include <cmath>
+#include <algorithm>   // sort(), min(), max()
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+//------------------ constructor --------------------------------
+sfgrid::sfgrid()
+{
+    nx = ny = mx = my = nsp = 0;
+    ax = by = taux = tauy = 0.0;
+
+}  // end sfgrid::sfgrid()
+
+//------------------ destructor ---------------------------------
+sfgrid::~sfgrid()
+{
+}  // end sfgrid::~sfgrid()
+
+//------------------ init() ---------------------------------
+//
+//  nxi,nyi = size of potential in pixels
+//  axi,byi = size of potential in Ang.
+//  tol     = relative accuracy of the structure factors (> 0)
+//
+//  return +1 for success and <0 for failure
+//
+int sfgrid::init( int nxi, int nyi, double axi, double byi, double tol )
+{
+    const double pi = 4.0*atan( 1.0 );
+    const double R = 2.0;       //  oversampling
+
+    mx = my = 0;
+    if( (nxi < 8) || (nyi < 8) || (axi <= 0.0) || (byi <= 0.0) || (tol <= 0.0) ) {
+        sbuff = "sfgrid: bad size or accuracy";
+        messageSF( sbuff, 2 );
+        return( -1 );
+    }
+
+    nx = nxi;
+    ny = nyi;
+    ax = axi;
+    by = byi;
+
+    //  about nsp-2 digits (Greengard and Lee) but single precision
+    //    limits this to about 1e-5
+    nsp = (int) ceil( -log10( tol ) ) + 2;
+    if( nsp < 2 ) nsp = 2;
+    if( nsp > 16 ) nsp = 16;
+
+    mx = (int) ( R*nx );
+    my = (int) ( R*ny );
+    taux = pi*nsp/( ((double)mx)*mx*R*(R-0.5) );
+    tauy = pi*nsp/( ((double)my)*my*R*(R-0.5) );
+
+    grid0.resize( mx, my );
+    grid0.init( 1 );        //  estimate is enough for a few FFTs per slice
+
+    return( +1 );
+
+}  // end sfgrid::init()
+
+//------------------ direct() ---------------------------------
+//
+//  x[],y[],occ[],Znum[] = atoms (same as trlayer())
+//  istart, natom        = use atoms istart to istart+natom-1
+//  kx[],ky[],kx2[],ky2[] = spatial frequencies (from freqn())
+//  k2max                = max. k^2 to calculate
+//  scale                = multiply the potential by this
+//  fet                  = table of scattering factors (see table())
+//  poten                = image to get the result (half plane)
+//
+//  return the number of atoms summed
+//
+int sfgrid::direct( const vectorf &x, const vectorf &y, const vectorf &occ,
+        const vectori &Znum, int istart, int natom,
+        const vectorf &kx, const vectorf &ky,
+        const vectorf &kx2, const vectorf &ky2,
+        float k2max, float scale, const fetable &fet, rfpix &poten ) const
+{
+    return( sumk( x, y, occ, Znum, istart, natom, kx, ky, kx2, ky2,
+        k2max, scale, fet, poten, 1, 1, 1.0, 1.0 ) );
+
+}  // end sfgrid::direct()
+
+//------------------ lattice() ---------------------------------
+//
+//  x[],y[],occ[],Znum[] = atoms (same as trlayer())
+//  istart, natom        = use atoms istart to istart+natom-1
+//  ncx, ncy             = number of unit cells in x,y
+//  ax, by               = size of the whole specimen in Ang.
+//  kx[],ky[],kx2[],ky2[] = spatial frequencies (from freqn())
+//  k2max                = max. k^2 to calculate
+//  scale                = multiply the potential by this
+//  fet                  = table of scattering factors (see table())
+//  poten                = image to get the result (half plane)
+//
+//  return +1 if done and 0 if not (poten not changed)
+//
+int sfgrid::lattice( const vectorf &x, const vectorf &y, const vectorf &occ,
+        const vectori &Znum, int istart, int natom, int ncx, int ncy,
+        double ax, double by,
+        const vectorf &kx, const vectorf &ky,
+        const vectorf &kx2, const vectorf &ky2,
+        float k2max, float scale, const fetable &fet, rfpix &poten ) const
+{
+    int i, j, k, l, m, ncell, cx, cy;
+    double ac, bc, u, xmin, xmax, ymin, ymax;
+    vectori idx, cell;
+    vectord xr, yr;
+    vectorf xb, yb, occb;
+    vectori Zb;
+    std::vector<char> used;
+
+    const int NZMIN = 1;   // min Z 
+    const int NZMAX = 103; // max Z 
+    const double tol = 1.0e-3;   //  Ang., >> float roundoff and << bond length
+
+    ncell = ncx * ncy;
+    if( (ncx < 1) || (ncy < 1) || (ncell < 2) || (natom < ncell)
+        || (0 != (natom % ncell)) ) return( 0 );
+
+    //  position in the unit cell and which cell (an atom within tol
+    //    of the far edge is at the near edge of the next cell)
+    ac = ax / ncx;
+    bc = by / ncy;
+    idx.resize( natom );
+    cell.resize( natom );
+    xr.resize( natom );
+    yr.resize( natom );
+    for( i=0; i<natom; i++) {
+        j = Znum[istart+i];
+        if( (j < NZMIN) || (j > NZMAX) ) return( 0 );
+        u = x[istart+i];
+        cx = (int) floor( u/ac );
+        xr[i] = u - cx*ac;
+        if( xr[i] > ac - tol ) { xr[i] -= ac; cx += 1; }
+        u = y[istart+i];
+        cy = (int) floor( u/bc );
+        yr[i] = u - cy*bc;
+        if( yr[i] > bc - tol ) { yr[i] -= bc; cy += 1; }
+        cell[i] = ( (cx % ncx) + ncx ) % ncx + ncx * ( ( (cy % ncy) + ncy ) % ncy );
+        idx[i] = i;
+    }
+
+    //  each atom of the unit cell must be in every cell exactly once
+    //    (same Z and occ) - sort by x then y in columns of the same x
+    std::sort( idx.begin(), idx.end(), [&]( int a, int b ) {
+        if( Znum[istart+a] != Znum[istart+b] ) return( Znum[istart+a] < Znum[istart+b] );
+        if( occ[istart+a] != occ[istart+b] ) return( occ[istart+a] < occ[istart+b] );
+        return( xr[a] < xr[b] ); } );
+
+    used.resize( ncell );
+    i = 0;
+    while( i < natom ) {
+        for( j=i+1; j<natom; j++) {
+            if( (Znum[istart+idx[j]] != Znum[istart+idx[i]])
+                || (occ[istart+idx[j]] != occ[istart+idx[i]])
+                || (xr[idx[j]] - xr[idx[j-1]] >= tol) ) break;
+        }
+        std::sort( idx.begin()+i, idx.begin()+j,
+            [&]( int a, int b ) { return( yr[a] < yr[b] ); } );
+        for( k=i; k<j; k=l) {
+            for( l=k+1; l<j; l++) if( yr[idx[l]] - yr[idx[l-1]] >= tol ) break;
+            if( (l-k) != ncell ) return( 0 );
+            std::fill( used.begin(), used.end(), 0 );
+            xmin = xmax = xr[idx[k]];
+            ymin = ymax = yr[idx[k]];
+            for( m=k; m<l; m++) {
+                if( used[ cell[idx[m]] ] ) return( 0 );
+                used[ cell[idx[m]] ] = 1;
+                xmin = std::min( xmin, xr[idx[m]] );
+                xmax = std::max( xmax, xr[idx[m]] );
+                ymin = std::min( ymin, yr[idx[m]] );
+                ymax = std::max( ymax, yr[idx[m]] );
+            }
+            if( (xmax - xmin >= tol) || (ymax - ymin >= tol) ) return( 0 );
+            xb.push_back( x[istart+idx[k]] );
+            yb.push_back( y[istart+idx[k]] );
+            occb.push_back( occ[istart+idx[k]] );
+            Zb.push_back( Znum[istart+idx[k]] );
+        }
+        i = j;
+    }
+
+    //  the other cells only add the same terms at the reciprocal
+    //    lattice points of the unit cell and cancel everywhere else
+    sumk( xb, yb, occb, Zb, 0, (int) xb.size(), kx, ky, kx2, ky2,
+        k2max, scale*ncell, fet, poten, ncx, ncy, ax, by );
+
+    return( +1 );
+
+}  // end sfgrid::lattice()
+
+//------------------ sumk() ---------------------------------
+//
+//  direct sum over atoms at the k with frequency index m (kx = m/ax)
+//    a multiple of ncx in x and ncy in y (every k if ncx=ncy=1)
+//
+//  x[],y[],occ[],Znum[] = atoms (same as trlayer())
+//  istart, natom        = use atoms istart to istart+natom-1
+//  kx[],ky[],kx2[],ky2[] = spatial frequencies (from freqn())
+//  k2max                = max. k^2 to calculate
+//  scale                = multiply the potential by this
+//  fet                  = table of scattering factors (see table())
+//  poten                = image to get the result (half plane, zero
+//                         at the other k)
+//  ncx, ncy             = lattice of k to calculate
+//  ax, by               = size of poten in Ang. (not used if ncx=ncy=1)
+//
+//  return the number of atoms summed
+//
+int sfgrid::sumk( const vectorf &x, const vectorf &y, const vectorf &occ,
+        const vectori &Znum, int istart, int natom,
+        const vectorf &kx, const vectorf &ky,
+        const vectorf &kx2, const vectorf &ky2,
+        float k2max, float scale, const fetable &fet, rfpix &poten,
+        int ncx, int ncy, double ax, double by ) const
+{
+    int i, j, ix, iy, ir, it, iZ, nZ, nsum, nyh, nxl, nr, nc, i0, nb, ib, iyk;
+    long nk, ik;
+    double w, xr, xi, tr, ti;
+    double *ar, *ai;
+    const double *f, *qr, *qi;
+    vectori zlist, nyk, irow, icol;
+    std::vector<long> offk;
+
+    const int NZMIN = 1;   // min Z 
+    const int NZMAX = 103; // max Z 
+    const int NBLOCK = 32; // atoms per block
+    const double twopi = 8.0*atan( 1.0 );
+
+    nxl = poten.nx();
+    nyh = poten.ny()/2 + 1;
+
+    //  atomic species in this slice - stop at the first bad Z
+    vectori isp( natom );
+    for( i=0; i<natom; i++) {
+        j = Znum[istart+i];
+        if( (j < NZMIN) || (j > NZMAX) ) break;
+        for( iZ=0; iZ<(int)zlist.size(); iZ++) if( zlist[iZ] == j ) break;
+        if( iZ == (int)zlist.size() ) zlist.push_back( j );
+        isp[i] = iZ;
+    }
+    nsum = i;
+    nZ = (int) zlist.size();
+
+    //  rows and columns of the half plane to calculate
+    for( ix=0; ix<nxl; ix++)
+        if( (1 == ncx) || (0 == ((int) floor( kx[ix]*ax + 0.5 )) % ncx) ) irow.push_back( ix );
+    for( iy=0; iy<nyh; iy++)
+        if( (1 == ncy) || (0 == ((int) floor( ky[iy]*by + 0.5 )) % ncy) ) icol.push_back( iy );
+    nr = (int) irow.size();
+    nc = (int) icol.size();
+
+    //  k inside the bandwidth limit is it < nyk[ir] in each row
+    //    (ky2[] increases with iy in the half plane) and the sum
+    //    is stored together starting at offk[ir]
+    nyk.resize( nr );
+    offk.resize( nr+1 );
+    nk = 0;
+    for( ir=0; ir<nr; ir++) {
+        offk[ir] = nk;
+        nyk[ir] = 0;
+        while( (nyk[ir] < nc) && (kx2[irow[ir]] + ky2[icol[nyk[ir]]] < k2max) ) nyk[ir] += 1;
+        nk += nyk[ir];
+    }
+    offk[nr] = nk;
+    vectord acr( nk, 0.0 ), aci( nk, 0.0 );
+
+    //  scattering factor of each species at each k (a copy of
+    //    the rows of the table if not every column)
+    fetable fel;
+    const fetable *pfe = table( fet, zlist, kx2, ky2, nyh, fel );
+    vectord fek;
+    if( nc < nyh ) {
+        fek.resize( nZ*nk );
+        for( iZ=0; iZ<nZ; iZ++) for( ir=0; ir<nr; ir++)
+            for( it=0; it<nyk[ir]; it++)
+                fek[ iZ*nk + offk[ir] + it ] = pfe->fe( zlist[iZ], irow[ir], icol[it] );
+    }
+
+    //  phasors of a block of atoms, occ is in the x row
+    vectord pxr( NBLOCK*nr ), pxi( NBLOCK*nr ), pyr( NBLOCK*nc ), pyi( NBLOCK*nc );
+
+#pragma omp parallel private(ir,it,i0,nb,ib,w,xr,xi,tr,ti,ar,ai,f,qr,qi,iyk)
+    {
+    for( i0=0; i0<nsum; i0+=NBLOCK) {
+        nb = nsum - i0;
+        if( nb > NBLOCK ) nb = NBLOCK;
+
+        //  remember: fftw uses the opposite sign convention, 
+        //     but this still needs to be - to get atoms in right side (as trlayer())
+#pragma omp for schedule(static)
+        for( ib=0; ib<nb; ib++) {
+            for( ir=0; ir<nr; ir++) {
+                w = twopi * kx[irow[ir]] * x[istart+i0+ib];
+                pxr[ib*nr+ir] = cos( -w ) * occ[istart+i0+ib];
+                pxi[ib*nr+ir] = sin( -w ) * occ[istart+i0+ib];
+            }
+            for( it=0; it<nc; it++) {
+                w = twopi * ky[icol[it]] * y[istart+i0+ib];
+                pyr[ib*nc+it] = cos( -w );
+                pyi[ib*nc+it] = sin( -w );
+            }
+        }  /* end for( ib... ) */
+
+        //  add this block to every k (rows of the half plane)
+#pragma omp for schedule(dynamic,8)
+        for( ir=0; ir<nr; ir++) {
+            ar = acr.data() + offk[ir];
+            ai = aci.data() + offk[ir];
+            iyk = nyk[ir];
+            for( ib=0; ib<nb; ib++) {
+                xr = pxr[ib*nr+ir];
+                xi = pxi[ib*nr+ir];
+                qr = pyr.data() + ib*nc;
+                qi = pyi.data() + ib*nc;
+                if( nc < nyh ) f = fek.data() + isp[i0+ib]*nk + offk[ir];
+                else f = pfe->row( Znum[istart+i0+ib], irow[ir] );
+#pragma omp simd private(tr,ti)
+                for( it=0; it<iyk; it++) {
+                    tr = xr*qr[it] - xi*qi[it];
+                    ti = xr*qi[it] + xi*qr[it];
+                    ar[it] += f[it] * tr;
+                    ai[it] += f[it] * ti;
+                }
+            }  /* end for( ib... ) */
+        }  /* end for( ir... ) */
+
+    }  /* end for( i0... ) */
+    }  /* end omp parallel */
+
+    for( ix=0; ix<nxl; ix++) for( iy=0; iy<nyh; iy++)
+        poten.re(ix,iy) = poten.im(ix,iy) = 0.0F;
+    for( ir=0; ir<nr; ir++) for( it=0; it<nyk[ir]; it++) {
+        ik = offk[ir] + it;
+        poten.re(irow[ir],icol[it]) = scale * ((float)acr[ik]);
+        poten.im(irow[ir],icol[it]) = scale * ((float)aci[ik]);
+    }
+
+    return( nsum );
+
+}  // end sfgrid::sumk()
+
+//------------------ potential() ---------------------------------
+//
+//  x[],y[],occ[],Znum[] = atoms (same as trlayer())
+//  istart, natom        = use atoms istart to istart+natom-1
+//  kx[],ky[],kx2[],ky2[] = spatial frequencies (from freqn())
+//  k2max                = max. k^2 to calculate
+//  scale                = multiply the potential by this
+//  fet                  = table of scattering factors (see table())
+//  poten                = nx x ny r2c image to get the result
+//
+//  return +1 if done and 0 if not
+//
+int sfgrid::potential( const vectorf &x, const vectorf &y, const vectorf &occ,
+        const vectori &Znum, int istart, int natom,
+        const vectorf &kx, const vectorf &ky,
+        const vectorf &kx2, const vectorf &ky2,
+        float k2max, float scale, const fetable &fet, rfpix &poten )
+{
+    int i, j, ix, iy, ixg, iyg, iZ, nZ, m, n, nyh, l0x, l0y;
+    long nk;
+    double u, d, c, costDirect, costGrid, gr, gi, fe, k2;
+    vectori zlist;
+    vectord wx( 2*nsp ), wy( 2*nsp ), dx( nx ), dy( ny/2+1 );
+    vectori mix( nx ), miy( ny/2+1 );
+
+    const int NZMIN = 1;   // min Z 
+    const int NZMAX = 103; // max Z 
+    const double pi = 4.0*atan( 1.0 );
+
+    if( (mx < 1) || (poten.nx() != nx) || (poten.ny() != ny)
+        || ((int)kx.size() < nx) || ((int)ky.size() < ny) ) return( 0 );
+    nyh = ny/2 + 1;
+
+    //  atomic species in this slice (usually sorted by Z)
+    for( i=istart; i<(istart+natom); i++) {
+        if( (Znum[i] < NZMIN) || (Znum[i] > NZMAX) ) return( 0 );
+        for( j=0; j<(int)zlist.size(); j++) if( zlist[j] == Znum[i] ) break;
+        if( j == (int)zlist.size() ) zlist.push_back( Znum[i] );
+    }
+    nZ = (int) zlist.size();
+
+    //  do the direct sum if it is faster (few atoms)
+    nk = 0;
+    for( ix=0; ix<nx; ix++) for( iy=0; iy<nyh; iy++)
+        if( kx2[ix] + ky2[iy] < k2max ) nk += 1;
+    costDirect = 20.0 * ((double)nk) * natom;
+    costGrid = nZ * ( 2.5*((double)mx)*my*log( ((double)mx)*my )/log(2.0) + 4.0*nk )
+        + 3.0 * natom * (2.0*nsp)*(2.0*nsp);
+    if( costGrid >= costDirect ) return( 0 );
+
+    //  frequency index of each pixel and the Fourier transform of the
+    //    Gaussian to divide out (and FFT normalization)
+    for( ix=0; ix<nx; ix++) {
+        mix[ix] = m = (int) floor( kx[ix]*ax + 0.5 );
+        dx[ix] = sqrt( pi/taux ) * exp( taux*m*m ) / mx;
+    }
+    for( iy=0; iy<nyh; iy++) {
+        miy[iy] = n = (int) floor( ky[iy]*by + 0.5 );
+        dy[iy] = sqrt( pi/tauy ) * exp( tauy*n*n ) / my;
+    }
+
+    for( ix=0; ix<nx; ix++) for( iy=0; iy<nyh; iy++)
+        poten.re(ix,iy) = poten.im(ix,iy) = 0.0F;
+
+    cfpix grid( mx, my );
+    grid.copyInit( grid0 );
+
+    fetable fel;
+    const fetable *pfe = table( fet, zlist, kx2, ky2, nyh, fel );
+
+    for( iZ=0; iZ<nZ; iZ++) {
+
+        //  spread the atoms of this Z onto the grid (periodic)
+        grid = 0.0F;
+        for( i=istart; i<(istart+natom); i++) {
+            if( Znum[i] != zlist[iZ] ) continue;
+            u = x[i] * mx / ax;
+            l0x = (int) floor( u ) - nsp + 1;
+            for( j=0; j<2*nsp; j++) {
+                d = (l0x + j - u) * 2.0*pi/mx;
+                wx[j] = exp( -d*d/(4.0*taux) );
+            }
+            u = y[i] * my / by;
+            l0y = (int) floor( u ) - nsp + 1;
+            for( j=0; j<2*nsp; j++) {
+                d = (l0y + j - u) * 2.0*pi/my;
+                wy[j] = exp( -d*d/(4.0*tauy) );
+            }
+            c = occ[i];
+            for( ix=0; ix<2*nsp; ix++) {
+                ixg = ( (l0x + ix) % mx + mx ) % mx;
+                for( iy=0; iy<2*nsp; iy++) {
+                    iyg = ( (l0y + iy) % my + my ) % my;
+                    grid.re( ixg, iyg ) += (float) ( c * wx[ix] * wy[iy] );
+                }
+            }
+        }  /* end for( i... ) */
+
+        grid.fft();
+
+        //  divide out the Gaussian and add fe(Z,k)*S(Z,k)
+        //    cfpix::fft() has the exp(+i...) sign so take the complex conjugate
+        //    to get the same sign as the direct sum in trlayer()
+#pragma omp parallel for private(iy,ixg,iyg,k2,fe,gr,gi,c)
+        for( ix=0; ix<nx; ix++) {
+            ixg = ( mix[ix] % mx + mx ) % mx;
+            for( iy=0; iy<nyh; iy++) {
+                k2 = kx2[ix] + ky2[iy];
+                if( k2 < k2max ) {
+                    iyg = ( miy[iy] % my + my ) % my;
+                    fe = pfe->fe( zlist[iZ], ix, iy );
+                    c = scale * fe * dx[ix] * dy[iy];
+                    gr = grid.re( ixg, iyg );
+                    gi = grid.im( ixg, iyg );
+                    poten.re(ix,iy) += (float) ( c * gr );
+                    poten.im(ix,iy) -= (float) ( c * gi );
+                }
+            }
+        }  /* end for( ix... ) */
+
+    }  /* end for( iZ... ) */
+
+    return( +1 );
+
+}  // end sfgrid::potential()
+
+//------------------ table() ---------------------------------
+//
+//  return fet if it has every Z in zlist[] for this size or else
+//    make the table in fel (not thread safe) and return that
+//
+const fetable *sfgrid::table( const fetable &fet, const vectori &zlist,
+        const vectorf &kx2, const vectorf &ky2, int nyh, fetable &fel ) const
+{
+    int iZ;
+
+    for( iZ=0; iZ<(int)zlist.size(); iZ++)
+        if( 0 == fet.has( zlist[iZ], (int)kx2.size(), nyh ) ) break;
+    if( iZ == (int)zlist.size() ) return( &fet );
+
+    fel.init( zlist, (int)zlist.size(), kx2, ky2, nyh );
+    return( &fel );
+
+}  // end sfgrid::table()
+
+/*------------------------ messageSF() ---------------------*/
+/*
+    common message output
+    redirect all print message to here so this can be redirected
+        to a dialog box in a GUI or cmd line
+
+   level = level of seriousness
+            0 = simple status message
+        1 = significant warning
+        2 = possibly fatal error
+*/
+void sfgrid::messageSF( std::string &smsg,  int level )
+{
+    messageSL( smsg.c_str(), level );  //  just call slicelib version for now
+}
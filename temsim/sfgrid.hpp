@@ -0,0 +1,166 @@
+/*              *** sfgrid.hpp ***
+
+------------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+---------------------- NO WARRANTY ------------------
+THIS PROGRAM IS PROVIDED AS-IS WITH ABSOLUTELY NO WARRANTY
+OR GUARANTEE OF ANY KIND, EITHER EXPRESSED OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE
+FOR DAMAGES RESULTING FROM THE USE OR INABILITY TO USE THIS
+PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU OR
+THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH
+ANY OTHER PROGRAM).
+------------------------------------------------------------------------
+
+   C++ class to calculate the Fourier transform of the projected atomic
+   potential of a slice (as in trlayer()) from the structure factor of
+   each atomic species found by gridding (a type 1 non-uniform FFT)
+   instead of a direct sum over every atom at every k
+
+      V(k) = sum over Z of fe(Z,k) * S(Z,k)
+      S(Z,k) = sum over atoms of type Z of occ * exp(-2*pi*i*k.r)
+
+   the atoms of each Z are spread onto a grid oversampled by 2 in each
+   direction with a truncated Gaussian (Greengard and Lee, SIAM Review
+   46 (2004) p.443), the grid is Fourier transformed once and the
+   Gaussian is divided out at each k - the cost is about
+   natom*(2*nsp)^2 + nZ*4*nx*ny*log(nx*ny) instead of natom*nk
+
+   the half width of the Gaussian nsp (in grid pixels) is set by the
+   relative accuracy tol (about 10^-(nsp-2))
+
+   direct() does the same sum over every atom at every k (for small
+   slices) but exp(-2*pi*i*k.r) = exp(-2*pi*i*kx*x) * exp(-2*pi*i*ky*y)
+   so it only needs one row of phasors in x and one in y for each atom
+   (no sin()/cos() at each k) and the atoms are done in blocks so their
+   phasors stay in cache while the inner loop over ky is vectorized
+
+   lattice() is for a perfect crystal with ncx x ncy unit cells: the
+   structure factor of the whole slice is ncx*ncy times that of one
+   unit cell at the reciprocal lattice points of the unit cell and zero
+   everywhere else, so it finds the atoms of one cell (checking that
+   every other cell has the same atoms) and only sums them at those k
+
+The source code is formatted for a tab size of 4.
+
+----------------------------------------------------------
+The public member functions are:
+
+init()      : set the size and accuracy (and make the FFTW plan)
+direct()    : calculate the potential of one slice by the direct sum
+lattice()   : same as direct() for a slice of identical unit cells
+potential() : calculate the potential of one slice in Fourier space
+
+----------------------------------------------------------
+
+   started 16-oct-2026
+*/
+
+#ifndef SFGRID_HPP   // only include this file if its not already
+
+#define SFGRID_HPP   // remember that this has been included
+
+#include <string>   // STD string class
+#include <vector>
+
+#include "cfpix.hpp"        // complex image handler with FFT
+#include "fetable.hpp"      // table of scattering factors
+#include "rfpix.hpp"        // real image handler with r2c FFT
+#include "slicelib.hpp"     // misc. routines for multislice
+
+//------------------------------------------------------------------
+class sfgrid{
+
+public:
+
+    sfgrid();         // constructor functions
+
+    ~sfgrid();        //  destructor function
+
+    //  nx,ny = size of potential in pixels and ax,by = its size in Ang.
+    //  tol   = relative accuracy of the structure factors
+    //  - makes the FFTW plan so it is NOT thread safe (call once
+    //    before potential())
+    //  return +1 for success and <0 for failure
+    int init( int nx, int ny, double ax, double by, double tol );
+
+    inline int isInit() const { return( (mx > 0) ? 1 : 0 ); }
+
+    //  Fourier transform of the potential by the direct sum over atoms
+    //    with the same arguments and result as potential() - the
+    //    scattering factors come from fet (made once per run) if it has
+    //    every Z in this slice or else are calculated here - does
+    //    not need init() and is thread safe (multithreaded with openMP
+    //    if not called from inside another parallel region)
+    //  return the number of atoms summed (stops at the first Z out of
+    //    range as trlayer() did)
+    int direct( const vectorf &x, const vectorf &y, const vectorf &occ,
+        const vectori &Znum, int istart, int natom,
+        const vectorf &kx, const vectorf &ky,
+        const vectorf &kx2, const vectorf &ky2,
+        float k2max, float scale, const fetable &fet, rfpix &poten ) const;
+
+    //  same as direct() (thread safe) if the atoms are ncx x ncy copies
+    //    of a unit cell of size ax/ncx x by/ncy (no thermal vibrations)
+    //  return +1 if done, 0 if the atoms are not (poten is not changed)
+    int lattice( const vectorf &x, const vectorf &y, const vectorf &occ,
+        const vectori &Znum, int istart, int natom, int ncx, int ncy,
+        double ax, double by,
+        const vectorf &kx, const vectorf &ky,
+        const vectorf &kx2, const vectorf &ky2,
+        float k2max, float scale, const fetable &fet, rfpix &poten ) const;
+
+    //  Fourier transform of the potential (same as the direct sum in
+    //    trlayer()) of atoms istart to istart+natom-1 in the half plane
+    //    of poten (k2 = kx2[ix] + ky2[iy] < k2max, zero outside) times
+    //    scale - thread safe
+    //  return +1 if done, 0 if the direct sum is faster (or this was
+    //    not set up for this size) and poten is not changed
+    int potential( const vectorf &x, const vectorf &y, const vectorf &occ,
+        const vectori &Znum, int istart, int natom,
+        const vectorf &kx, const vectorf &ky,
+        const vectorf &kx2, const vectorf &ky2,
+        float k2max, float scale, const fetable &fet, rfpix &poten );
+
+    //  half width of the Gaussian in grid pixels
+    inline int width() const { return( nsp ); }
+
+private:
+
+    int nx, ny, mx, my, nsp;    //  mx,my = oversampled grid
+    double ax, by, taux, tauy;
+
+    cfpix grid0;                //  to copy the FFTW plan from
+
+    const fetable *table( const fetable &fet, const vectori &zlist,
+        const vectorf &kx2, const vectorf &ky2, int nyh, fetable &fel ) const;
+
+    int sumk( const vectorf &x, const vectorf &y, const vectorf &occ,
+        const vectori &Znum, int istart, int natom,
+        const vectorf &kx, const vectorf &ky,
+        const vectorf &kx2, const vectorf &ky2,
+        float k2max, float scale, const fetable &fet, rfpix &poten,
+        int ncx, int ncy, double ax, double by ) const;
+
+    std::string sbuff;
+    void messageSF( std::string &smsg, int level = 0 );
+
+};  // end sfgrid::
+
+#endif  // SFGRID_HPP
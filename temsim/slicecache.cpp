@@ -0,0 +1,216 @@
+/*              *** slicecache.cpp ***
+
+------------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+---------------------- NO WARRANTY ------------------
+THIS PROGRAM IS PROVIDED AS-IS WITH ABSOLUTELY NO WARRANTY
+OR GUARANTEE OF ANY KIND, EITHER EXPRESSED OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE
+FOR DAMAGES RESULTING FROM THE USE OR INABILITY TO USE THIS
+PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU OR
+THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH
+ANY OTHER PROGRAM).
+------------------------------------------------------------------------
+
+   C++ class to hold the specimen transmission functions of one
+   phonon configuration (see slicecache.hpp)
+
+   the scratch file is just the raw complex float data of each slice
+   (nx*ny*2 floats) in the order they were stored - it is removed
+   when the cache is destroyed
+
+The source code is formatted for a tab size of 4.
+
+   started 16-oct-2026
+   use 64 bit file positions for scratch files > 2 GBytes 16-oct-2026
+*/
+
+#include "slicecache.hpp"   // class definition + inline functions here
+
+#include "slicelib.hpp"     // misc. routines for multislice
+
+//  64 bit file position (same as cbed4d.cpp)
+#if defined(_WIN32)
+#define fseek64( fp, off ) _fseeki64( fp, off, SEEK_SET )
+#else
+#define fseek64( fp, off ) fseeko( fp, (off_t) (off), SEEK_SET )
+#endif
+
+//------------------ constructor --------------------------------
+slicecache::slicecache()
+{
+    nxl = nyl = nmem = ndisk = maxmem = 0;
+    bytesPerSlice = 0.0;
+    fp = NULL;
+
+}  // end slicecache::slicecache()
+
+//------------------ destructor ---------------------------------
+slicecache::~slicecache()
+{
+    freeMem();
+    if( NULL != fp ) {
+        fclose( fp );
+        remove( spillFile.c_str() );
+    }
+
+}  // end slicecache::~slicecache()
+
+//------------------ setup() ---------------------------------
+//
+//  nx,ny = size of transmission function in pixels
+//  maxMB = max memory to use in MBytes (<=0 for no limit)
+//  spill = scratch file name (empty to not use disk)
+//
+//  return +1 for success and <0 for failure
+//
+int slicecache::setup( int nx, int ny, double maxMB, std::string spill )
+{
+    freeMem();
+    if( NULL != fp ) {
+        fclose( fp );
+        remove( spillFile.c_str() );
+        fp = NULL;
+    }
+
+    nxl = nx;
+    nyl = ny;
+    bytesPerSlice = 2.0 * sizeof(float) * ((double)nx) * ((double)ny);
+
+    if( maxMB > 0.0 ) maxmem = (int) ( maxMB / sliceMB() );
+    else maxmem = -1;   //  no limit
+
+    spillFile = spill;
+    if( spillFile.length() > 0 ) {
+        fp = fopen( spillFile.c_str(), "w+b" );
+        if( NULL == fp ) {
+            sbuff = "slicecache cannot open scratch file " + spillFile;
+            messageSC( sbuff, 1 );
+            spillFile = "";
+            return( -1 );
+        }
+    }
+
+    return( +1 );
+
+}  // end slicecache::setup()
+
+//------------------ clear() ---------------------------------
+//  forget all stored slices (keep the memory limit and scratch file)
+void slicecache::clear()
+{
+    freeMem();
+    disk.clear();
+    ndisk = 0;
+
+}  // end slicecache::clear()
+
+//------------------ freeMem() ---------------------------------
+void slicecache::freeMem()
+{
+    size_t i;
+    for( i=0; i<mem.size(); i++) if( NULL != mem[i] ) delete mem[i];
+    mem.clear();
+    nmem = 0;
+
+}  // end slicecache::freeMem()
+
+//------------------ get() ---------------------------------
+//
+//  islice = slice index
+//  scratch = will get slice if stored on disk (must be nx x ny)
+//
+//  return pointer to slice or NULL if not stored
+//
+cfpix* slicecache::get( int islice, cfpix &scratch )
+{
+    if( islice < 0 ) return( NULL );
+
+    if( (islice < (int)mem.size()) && (NULL != mem[islice]) )
+        return( mem[islice] );
+
+    if( (islice < (int)disk.size()) && (disk[islice] >= 0) && (NULL != fp) ) {
+        size_t n = 2*((size_t)nxl)*((size_t)nyl);
+        if( (0 != fseek64( fp, ((long long) disk[islice]) * n * sizeof(float) ))
+            || (fread( &scratch.re(0,0), sizeof(float), n, fp ) != n) ) {
+            sbuff = "slicecache cannot read scratch file " + spillFile;
+            messageSC( sbuff, 1 );
+            return( NULL );
+        }
+        return( &scratch );
+    }
+
+    return( NULL );
+
+}  // end slicecache::get()
+
+//------------------ put() ---------------------------------
+//
+//  islice = slice index
+//  trans = transmission function to store (nx x ny)
+//
+//  return +1 if stored in memory, +2 if on disk and 0 if not stored
+//
+int slicecache::put( int islice, cfpix &trans )
+{
+    if( (islice < 0) || (trans.nx() != nxl) || (trans.ny() != nyl) ) return( 0 );
+
+    if( (maxmem < 0) || (nmem < maxmem) ) {
+        if( islice >= (int)mem.size() ) mem.resize( islice+1, NULL );
+        if( NULL == mem[islice] ) {
+            mem[islice] = new cfpix( nxl, nyl );
+            nmem += 1;
+        }
+        *mem[islice] = trans;
+        return( +1 );
+    }
+
+    if( NULL != fp ) {
+        size_t n = 2*((size_t)nxl)*((size_t)nyl);
+        if( islice >= (int)disk.size() ) disk.resize( islice+1, -1 );
+        if( disk[islice] < 0 ) disk[islice] = ndisk++;
+        if( (0 != fseek64( fp, ((long long) disk[islice]) * n * sizeof(float) ))
+            || (fwrite( &trans.re(0,0), sizeof(float), n, fp ) != n) ) {
+            sbuff = "slicecache cannot write scratch file " + spillFile;
+            messageSC( sbuff, 1 );
+            disk[islice] = -1;
+            return( 0 );
+        }
+        return( +2 );
+    }
+
+    return( 0 );
+
+}  // end slicecache::put()
+
+/*------------------------- messageSC() ----------------------*/
+/*
+    common message output
+    redirect all print message to here so this can be redirected
+        to a dialog box in a GUI or cmd line
+
+   level = level of seriousness
+            0 = simple status message
+        1 = significant warning
+        2 = possibly fatal error
+*/
+void slicecache::messageSC( std::string &smsg,  int level )
+{
+    messageSL( smsg.c_str(), level );  //  just call slicelib version for now
+}
@@ -0,0 +1,120 @@
+/*              *** slicecache.hpp ***
+
+------------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+---------------------- NO WARRANTY ------------------
+THIS PROGRAM IS PROVIDED AS-IS WITH ABSOLUTELY NO WARRANTY
+OR GUARANTEE OF ANY KIND, EITHER EXPRESSED OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE
+FOR DAMAGES RESULTING FROM THE USE OR INABILITY TO USE THIS
+PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU OR
+THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH
+ANY OTHER PROGRAM).
+------------------------------------------------------------------------
+
+   C++ class to hold the specimen transmission functions of one
+   phonon configuration so they only have to be calculated once
+   (for example by autostem in 2D image mode where the same slices
+   are needed for every scan line)
+
+   slices are kept in memory up to a given limit and the rest
+   can optionally be spilled to a scratch file on disk
+
+The source code is formatted for a tab size of 4.
+
+----------------------------------------------------------
+The public member functions are:
+
+setup()    : set the slice size, memory limit and scratch file
+clear()    : forget all slices (i.e. start a new configuration)
+get()      : retrieve a slice (if stored)
+put()      : store a slice (if there is room)
+
+memMB()    : memory currently used (in MBytes)
+diskMB()   : scratch file space currently used (in MBytes)
+sliceMB()  : size of one slice (in MBytes)
+
+----------------------------------------------------------
+
+   started 16-oct-2026
+   delete the copy constructor and operator=() 16-oct-2026
+*/
+
+#ifndef SLICECACHE_HPP   // only include this file if its not already
+
+#define SLICECACHE_HPP   // remember that this has been included
+
+#include <cstdio>
+#include <string>   // STD string class
+#include <vector>
+
+#include "cfpix.hpp"    // complex image handler with FFT
+
+//------------------------------------------------------------------
+class slicecache{
+
+public:
+
+    slicecache();         // constructor functions
+
+    ~slicecache();        //  destructor function
+
+    //  owns the slices in mem[] and the scratch file so do not copy
+    slicecache( const slicecache& ) = delete;
+    slicecache& operator=( const slicecache& ) = delete;
+
+    //  nx,ny = size of transmission function in pixels
+    //  maxMB = max memory to use in MBytes (<=0 for no limit)
+    //  spill = scratch file name (empty to not use disk)
+    int setup( int nx, int ny, double maxMB, std::string spill );
+
+    void clear();
+
+    //  returns pointer to slice in memory, or copy into scratch
+    //     and return &scratch if on disk, or NULL if not stored
+    cfpix* get( int islice, cfpix &scratch );
+
+    //  returns +1 if stored in memory, +2 if on disk, 0 if no room
+    int put( int islice, cfpix &trans );
+
+    inline double sliceMB() const { return( bytesPerSlice/(1024.0*1024.0) ); }
+    inline double memMB() const { return( nmem*sliceMB() ); }
+    inline double diskMB() const { return( ndisk*sliceMB() ); }
+    inline int nMem() const { return( nmem ); }
+    inline int nDisk() const { return( ndisk ); }
+
+private:
+
+    int nxl, nyl, nmem, ndisk, maxmem;
+    double bytesPerSlice;
+
+    std::vector<cfpix*> mem;    //  in-memory slices (NULL if not stored)
+    std::vector<long> disk;     //  slot number in scratch file (<0 if not stored)
+
+    std::string spillFile;
+    FILE *fp;
+
+    std::string sbuff;
+    void messageSC( std::string &smsg, int level = 0 );
+
+    void freeMem();
+
+};  // end slicecache::
+
+#endif  // SLICECACHE_HPP
@@ -44,9 +44,11 @@ ANY OTHER PROGRAM).
     freqn()       : calculate spatial frequencies
     messageSL()   : message handler
     parlay()      : parse the layer structure
+    physMemMB()   : return size of physical memory in MBytes
     readCnm()     : decypher aberr. of the form C34a etc.
     ReadfeTable() : read fe scattering factor table
     ReadXYZcoord(): read a set of (x,y,z) coordinates from a file
+    sameSlice()   : find slices with the same atoms (in projection)
     scaleW()       : scale a 2D FFTW
     seval()       : Interpolate from cubic spline coefficients
     sigma()       : return the interaction parameter
@@ -114,6 +116,9 @@ ANY OTHER PROGRAM).
    fix  freqn/xo small error 3-jul-2019 ejk
    remove propagate() so slicelib is not dependent on cfpix+fftw 29-jul-2019 ejk
    move random number generators from here to a ransubs class 25-dev-2023 ejk
+   add physMemMB() 16-oct-2026
+   make the first read of the fe table in featom() thread safe 16-oct-2026
+   add sameSlice() 16-oct-2026
 */
 
 
@@ -130,11 +135,19 @@ ANY OTHER PROGRAM).
 #include <sstream>  // string streams
 #include <fstream>  // STD file IO streams
 #include <vector>   // STD vector class
+#include <map>      // STD map for sameSlice()
+#include <algorithm>    // STD sort()
+#include <atomic>   // STD atomic for feTableRead
+#include <mutex>    // STD mutex for the first call to featom()
 
 using namespace std;
 
 /*#include <omp.h>   for openMP testing */
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>   /* for sysconf() in physMemMB() */
+#endif
+
 #include "slicelib.hpp"  /* verify consistency and use some routines */
 
 //#define wxGUI   //    set for wxWidgets graphical user interface
@@ -149,7 +162,8 @@ const int NPMAX=   12;  // number of parameters for each Z
 const int NZMIN=   1;   // min Z 
 const int NZMAX=   103; // max Z 
 
-int feTableRead=0;      // flag to remember if the param file has been read
+std::atomic<int> feTableRead(0);  // flag to remember if the param file has been read
+std::mutex feTableLock;           // only one thread reads it
 const int nl=3, ng=3;   // number of Lorenzians and Gaussians
 
 vector<double> tmp( NPMAX );       // to get fe(k) parameters
@@ -377,8 +391,11 @@ double featom( int Z, double k2 )
    if( (Z<NZMIN) || (Z>NZMAX) ) return( 0.0 );
 
     /* read in the table from a file if this is the
-        first time this is called */
-    if( feTableRead == 0 ) nfe = ReadfeTable();
+        first time this is called (maybe from several threads) */
+    if( feTableRead == 0 ) {
+        std::lock_guard<std::mutex> lock( feTableLock );
+        if( feTableRead == 0 ) nfe = ReadfeTable();
+    }
 
     sum = 0.0;
 
@@ -634,6 +651,24 @@ int parlay( const char c[], vectori &islice, int nsmax, int lmax,
 }  /* end parlay() */
 #endif
 
+/*--------------------- physMemMB() -----------------------*/
+/*
+    return the size of the physical memory in MBytes
+    (or 0 if it cannot be determined on this system)
+*/
+double physMemMB()
+{
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+    long np, ps;
+    np = sysconf( _SC_PHYS_PAGES );
+    ps = sysconf( _SC_PAGESIZE );
+    if( (np > 0) && (ps > 0) )
+        return( ((double)np) * ((double)ps) / (1024.0*1024.0) );
+#endif
+    return( 0.0 );
+
+}  /* end physMemMB() */
+
 /*--------------------- readCnm() -----------------------*/
 /*
     convert aberration line to a number 
@@ -2108,6 +2143,88 @@ int ReadXYZcoord( const char* infile, const int ncellx, const int ncelly,
 
 }  /* end ReadXYZcoord() */
 
+/*--------------------- sameSlice() -----------------------*/
+/*
+    find slices with the same atoms in projection (x,y,occ,Znum but
+    not z which trlayer() does not use)
+
+    x[],y[],occ[],Znum[] = atoms sorted by depth (with sortByZ())
+    sliceStart[i],sliceNa[i] = first atom and number of atoms in slice i
+    sliceRef[i] = (output) the first slice with the same atoms as
+                slice i (= i if there is no earlier one)
+
+    each slice is put in a standard order (sorted by Z,occ,x,y) so the
+    order of its atoms does not matter, and only slices with the same
+    hash of this list are compared atom by atom
+
+    return the number of distinct slices
+*/
+int sameSlice( const vectorf &x, const vectorf &y, const vectorf &occ,
+    const vectori &Znum, const vectori &sliceStart, const vectori &sliceNa,
+    vectori &sliceRef )
+{
+    int i, j, k, ia, iv, n, ns, nsame;
+    unsigned int u;
+    unsigned long long h;
+    float v[3];
+
+    std::vector< vectori > order;       //  atoms of each slice in standard order
+    std::map< unsigned long long, vectori > found;  //  distinct slices by hash
+
+    ns = (int) sliceNa.size();
+    sliceRef.resize( ns );
+    order.resize( ns );
+
+    nsame = 0;
+    for( i=0; i<ns; i++) {
+        n = sliceNa[i];
+        vectori &idx = order[i];
+        idx.resize( n );
+        for( j=0; j<n; j++) idx[j] = sliceStart[i] + j;
+        std::sort( idx.begin(), idx.end(), [&]( int a, int b ) {
+            if( Znum[a] != Znum[b] ) return( Znum[a] < Znum[b] );
+            if( occ[a] != occ[b] ) return( occ[a] < occ[b] );
+            if( x[a] != x[b] ) return( x[a] < x[b] );
+            return( y[a] < y[b] ); } );
+
+        //  FNV-1a hash of the exact values
+        h = 14695981039346656037ULL;
+        for( j=0; j<n; j++) {
+            ia = idx[j];
+            h = ( h ^ (unsigned int) Znum[ia] ) * 1099511628211ULL;
+            v[0] = occ[ia];
+            v[1] = x[ia];
+            v[2] = y[ia];
+            for( iv=0; iv<3; iv++) {
+                memcpy( &u, &v[iv], sizeof(u) );
+                h = ( h ^ u ) * 1099511628211ULL;
+            }
+        }
+
+        sliceRef[i] = i;
+        vectori &list = found[ h ];
+        for( k=0; k<(int)list.size(); k++) {
+            vectori &idx0 = order[ list[k] ];
+            if( (int)idx0.size() != n ) continue;
+            for( j=0; j<n; j++)
+                if( (Znum[idx[j]] != Znum[idx0[j]]) || (occ[idx[j]] != occ[idx0[j]])
+                    || (x[idx[j]] != x[idx0[j]]) || (y[idx[j]] != y[idx0[j]]) ) break;
+            if( j >= n ) {
+                sliceRef[i] = list[k];
+                break;
+            }
+        }
+        if( sliceRef[i] == i ) list.push_back( i );
+        else {
+            nsame++;
+            vectori().swap( idx );      //  not needed any more
+        }
+    }  /* end for( i... */
+
+    return( ns - nsame );
+
+}  /* end sameSlice() */
+
 /*----------------------- seval() ----------------------*/
 /*
     Interpolate from cubic spline coefficients
@@ -44,9 +44,11 @@ ANY OTHER PROGRAM).
     freqn()       : calculate spatial frequencies
     messageSL()   : message handler
     parlay()      : parse the layer structure
+    physMemMB()   : return size of physical memory in MBytes
     readCnm()     : decypher aberr. of the form C34a etc.
     ReadfeTable() : read fe scattering factor table
     ReadXYZcoord(): read a set of (x,y,z) coordinates from a file
+    sameSlice()   : find slices with the same atoms (in projection)
     seval()       : Interpolate from cubic spline coefficients
     sigma()       : return the interaction parameter
     sortByZ()     : sort atomic x,y,z coord. by z
@@ -122,6 +124,8 @@ ANY OTHER PROGRAM).
    fix definition of seval() 17-feb-2019 ejk
    remove propagate() so slicelib is not dependent on cfpix+fftw 29-jul-2019 ejk
    move random number generators from here to a ransubs class 25-dev-2023 ejk
+   add physMemMB() 16-oct-2026
+   add sameSlice() 16-oct-2026
 */
 
 #ifndef SLICELIB_HPP   // only include this file if its not already
@@ -448,6 +452,13 @@ int parlay( const char c[], vectori &islice, int nsmax, int lmax,
             int *nslice, int fperr );
 #endif
 
+/*--------------------- physMemMB() -----------------------*/
+/*
+    return the size of the physical memory in MBytes
+    (or 0 if it cannot be determined on this system)
+*/
+double physMemMB();
+
 /*--------------------- readCnm() -----------------------*/
 /*
     convert aberration line to a number 
@@ -516,6 +527,27 @@ int ReadXYZcoord( const char* infile, const int ncellx, const int ncelly,
     vectorf &x, vectorf &y, vectorf &z, vectorf &occ, vectorf &wobble,
     string &line1 );
 
+/*--------------------- sameSlice() -----------------------*/
+/*
+    find slices with the same atoms in projection (x,y,occ,Znum but
+    not z which trlayer() does not use) so the transmission function
+    of each distinct slice only has to be calculated once - for example
+    a crystal repeated in z (ncellz in ReadXYZcoord()) without thermal
+    vibrations when the slice thickness divides the unit cell
+
+    x[],y[],occ[],Znum[] = atoms sorted by depth (with sortByZ())
+    sliceStart[i],sliceNa[i] = first atom and number of atoms in slice i
+    sliceRef[i] = (output) the first slice with the same atoms as
+                slice i (= i if there is no earlier one)
+
+    atoms must match exactly (in any order) to be the same
+
+    return the number of distinct slices
+*/
+int sameSlice( const vectorf &x, const vectorf &y, const vectorf &occ,
+    const vectori &Znum, const vectori &sliceStart, const vectori &sliceNa,
+    vectori &sliceRef );
+
 /*----------------------- seval() ----------------------*/
 /*
     Interpolate from cubic spline coefficients
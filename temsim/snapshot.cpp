@@ -0,0 +1,198 @@
+/*              *** snapshot.cpp ***
+
+------------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+---------------------- NO WARRANTY ------------------
+THIS PROGRAM IS PROVIDED AS-IS WITH ABSOLUTELY NO WARRANTY
+OR GUARANTEE OF ANY KIND, EITHER EXPRESSED OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE
+FOR DAMAGES RESULTING FROM THE USE OR INABILITY TO USE THIS
+PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU OR
+THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH
+ANY OTHER PROGRAM).
+------------------------------------------------------------------------
+
+   C++ class to write snapshots of the running average of a long
+   calculation in the background (see snapshot.hpp)
+
+The source code is formatted for a tab size of 4.
+
+   started 16-oct-2026
+*/
+
+#include "snapshot.hpp"     // class definition + inline functions here
+#include "floatTIFF.hpp"    // file I/O routines in TIFF format
+
+#include <cstdio>           // rename(), remove()
+
+//------------------ constructor --------------------------------
+snapshot::snapshot()
+{
+    nwritten = nfailed = 0;
+    done = 0;
+
+}  // end snapshot::snapshot()
+
+//------------------ destructor ---------------------------------
+snapshot::~snapshot()
+{
+    stop();
+
+}  // end snapshot::~snapshot()
+
+//------------------ start() ---------------------------------
+//
+//  start the writer thread (if not already running)
+//
+void snapshot::start()
+{
+    if( writer.joinable() ) return;
+
+    nwritten = nfailed = 0;
+    done = 0;
+    writer = std::thread( &snapshot::run, this );
+
+}  // end snapshot::start()
+
+//------------------ add() ---------------------------------
+//
+//  file   = name of TIFF file to write (replaced if it exists)
+//  pix[]  = nx*ny image with pix[iy + ix*ny] = pixel (ix,iy)
+//  dx,dy  = pixel size in Ang.
+//  param  = floatTIFF parameters to write with the image
+//
+void snapshot::add( std::string file, const float *pix, int nx, int ny,
+        double dx, double dy, const vectorf &param )
+{
+    size_t i;
+    image im;
+
+    if( !writer.joinable() ) return;
+
+    im.file = file;
+    im.nx = nx;
+    im.ny = ny;
+    im.dx = dx;
+    im.dy = dy;
+    im.param = param;
+    im.pix.assign( pix, pix + ((size_t)nx)*ny );
+
+    //  replace an older snapshot of the same file that is still waiting
+    std::unique_lock<std::mutex> lock( mtx );
+    for( i=0; i<queue.size(); i++) if( queue[i].file == file ) break;
+    if( i < queue.size() ) queue[i] = im;
+    else queue.push_back( im );
+    lock.unlock();
+    cvWork.notify_one();
+
+}  // end snapshot::add()
+
+//------------------ run() ---------------------------------
+//
+//  the writer thread - write each image in the queue until stop()
+//
+void snapshot::run()
+{
+    int i, ix, iy, npix, status;
+    float rmin, rmax;
+    std::string tmpFile;
+    image im;
+    floatTIFF myFile;
+
+    while( 1 ) {
+        std::unique_lock<std::mutex> lock( mtx );
+        while( queue.empty() && (0 == done) ) cvWork.wait( lock );
+        if( queue.empty() ) break;      //  done and nothing left
+        im = queue.front();
+        queue.pop_front();
+        lock.unlock();
+
+        npix = im.nx * im.ny;
+        rmin = rmax = im.pix[0];
+        for( i=1; i<npix; i++) {
+            if( im.pix[i] < rmin ) rmin = im.pix[i];
+            if( im.pix[i] > rmax ) rmax = im.pix[i];
+        }
+
+        for( i=0; (i<(int)im.param.size()) && (i<myFile.maxParam()); i++)
+            myFile.setParam( i, im.param[i] );
+        myFile.setParam( pRMAX, rmax );
+        myFile.setParam( pRMIN, rmin );
+        myFile.setnpix( 1 );
+        myFile.resize( im.nx, im.ny );
+        for( ix=0; ix<im.nx; ix++) for( iy=0; iy<im.ny; iy++)
+            myFile( ix, iy ) = im.pix[ iy + ix*im.ny ];
+
+        tmpFile = im.file + ".tmp";
+        status = myFile.write( tmpFile.c_str(), rmin, rmax, 0.0F, 0.0F,
+            (float) im.dx, (float) im.dy );
+        if( 1 == status ) {
+            remove( im.file.c_str() );      //  rename() may not replace on Windows
+            if( 0 != rename( tmpFile.c_str(), im.file.c_str() ) ) status = -1;
+        }
+
+        lock.lock();
+        if( 1 == status ) nwritten += 1;
+        else nfailed += 1;
+        lock.unlock();
+
+        if( 1 != status ) {
+            sbuff = "snapshot: cannot write " + im.file;
+            messageSN( sbuff, 1 );
+        }
+    }
+
+}  // end snapshot::run()
+
+//------------------ stop() ---------------------------------
+//
+//  wait for the writer thread to write everything in the queue
+//
+//  return +1 if all images were written and <0 if not
+//
+int snapshot::stop()
+{
+    if( !writer.joinable() ) return( (nfailed > 0) ? -1 : +1 );
+
+    {
+        std::lock_guard<std::mutex> lock( mtx );
+        done = 1;
+    }
+    cvWork.notify_one();
+    writer.join();
+
+    return( (nfailed > 0) ? -1 : +1 );
+
+}  // end snapshot::stop()
+
+/*------------------------ messageSN() ---------------------*/
+/*
+    common message output
+    redirect all print message to here so this can be redirected
+        to a dialog box in a GUI or cmd line
+
+   level = level of seriousness
+            0 = simple status message
+        1 = significant warning
+        2 = possibly fatal error
+*/
+void snapshot::messageSN( std::string &smsg,  int level )
+{
+    messageSL( smsg.c_str(), level );  //  just call slicelib version for now
+}
@@ -0,0 +1,115 @@
+/*              *** snapshot.hpp ***
+
+------------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+---------------------- NO WARRANTY ------------------
+THIS PROGRAM IS PROVIDED AS-IS WITH ABSOLUTELY NO WARRANTY
+OR GUARANTEE OF ANY KIND, EITHER EXPRESSED OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE
+FOR DAMAGES RESULTING FROM THE USE OR INABILITY TO USE THIS
+PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF DATA OR DATA
+BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU OR
+THIRD PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH
+ANY OTHER PROGRAM).
+------------------------------------------------------------------------
+
+   C++ class to write snapshots of the running average of a long
+   calculation (autostem images or autoslic CBED) as floatTIFF files
+   while the calculation continues
+
+   the images are written by a separate thread - add() only copies the
+   image into a queue and never waits (an image that is still waiting
+   for the same file is replaced by the newer one) - each file is
+   written under a temporary name and then renamed so other programs
+   never see a partly written file
+
+The source code is formatted for a tab size of 4.
+
+----------------------------------------------------------
+The public member functions are:
+
+start()    : start the writer thread
+add()      : queue one image to be written (in the background)
+stop()     : wait for all images to be written and stop the thread
+
+----------------------------------------------------------
+
+   started 16-oct-2026
+*/
+
+#ifndef SNAPSHOT_HPP   // only include this file if its not already
+
+#define SNAPSHOT_HPP   // remember that this has been included
+
+#include <string>   // STD string class
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "slicelib.hpp"    // misc. routines for multislice
+
+//------------------------------------------------------------------
+class snapshot{
+
+public:
+
+    snapshot();         // constructor functions
+
+    ~snapshot();        //  destructor function
+
+    //  (output) number of files written and not written (write error)
+    int nwritten, nfailed;
+
+    void start();
+
+    //  write pix[] (nx*ny values with iy varying fastest) to file
+    //    with pixel size dx,dy (in Ang.) and the floatTIFF parameters
+    //    in param[] (min./max. are set here)
+    void add( std::string file, const float *pix, int nx, int ny,
+        double dx, double dy, const vectorf &param );
+
+    //  return +1 if all images were written and <0 if not
+    int stop();
+
+    inline int isRunning() const { return( writer.joinable() ? 1 : 0 ); }
+
+private:
+
+    struct image {
+        std::string file;
+        int nx, ny;
+        double dx, dy;
+        vectorf param, pix;
+    };
+
+    std::thread writer;
+    std::mutex mtx;
+    std::condition_variable cvWork;
+    std::deque<image> queue;
+    int done;
+
+    void run();             //  the writer thread
+
+    std::string sbuff;
+    void messageSN( std::string &smsg, int level = 0 );
+
+};  // end snapshot::
+
+#endif  // SNAPSHOT_HPP